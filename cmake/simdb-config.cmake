@@ -15,3 +15,10 @@ message (STATUS "Using zlib ${ZLIB_VERSION_STRING}")
 # Populate the SimDB_LIBS variable with the required libraries for
 # basic SimDB linking
 set (SimDB_LIBS sqlite3 ZLIB::ZLIB pthread)
+
+# Installed compiled library (SIMDB_BUILD_LIBRARY=ON). Linking against the
+# imported simdb target defines SIMDB_COMPILED_LIB, so the headers use the
+# library instead of compiling everything inline.
+if (EXISTS ${CMAKE_CURRENT_LIST_DIR}/simdbTargets.cmake AND NOT TARGET simdb)
+  include (${CMAKE_CURRENT_LIST_DIR}/simdbTargets.cmake)
+endif()
@@ -0,0 +1,40 @@
+// <LibraryMode.hpp> -*- C++ -*-
+
+#pragma once
+
+/// SimDB is header-only by default. Projects with many translation units
+/// can instead link against the "simdb" library target, which defines
+/// SIMDB_COMPILED_LIB for itself and everything that links to it. In that
+/// mode the non-template code in the *Impl.hpp headers is compiled once
+/// into the library instead of in every file that includes DatabaseManager.hpp,
+/// and the common template instantiations are declared extern.
+#ifdef SIMDB_COMPILED_LIB
+#    define SIMDB_INLINE
+#else
+#    define SIMDB_INLINE inline
+#endif
+
+/// Calls X(type) for each scalar type that the library instantiates the
+/// collection templates for (see SIMDB_EXTERN_COLLECTABLE).
+#define SIMDB_FOR_EACH_SCALAR_TYPE(X)                                                                                                      \
+    X(bool)                                                                                                                                \
+    X(int8_t)                                                                                                                              \
+    X(uint8_t)                                                                                                                             \
+    X(int16_t)                                                                                                                             \
+    X(uint16_t)                                                                                                                            \
+    X(int32_t)                                                                                                                             \
+    X(uint32_t)                                                                                                                            \
+    X(int64_t)                                                                                                                             \
+    X(uint64_t)                                                                                                                            \
+    X(float)                                                                                                                               \
+    X(double)
+
+/// StructSerializer and EnumMap are instantiated on user types, so the library
+/// cannot provide them. Put SIMDB_EXTERN_STRUCT_SERIALIZER(MyStruct) in the
+/// header that specializes defineStructSchema<MyStruct>(), and
+/// SIMDB_INSTANTIATE_STRUCT_SERIALIZER(MyStruct) in one of your .cpp files,
+/// to compile the serializer once. The same goes for enums.
+#define SIMDB_EXTERN_STRUCT_SERIALIZER(StructT) extern template class simdb::StructSerializer<StructT>;
+#define SIMDB_INSTANTIATE_STRUCT_SERIALIZER(StructT) template class simdb::StructSerializer<StructT>;
+#define SIMDB_EXTERN_ENUM_MAP(EnumT) extern template class simdb::EnumMap<EnumT>;
+#define SIMDB_INSTANTIATE_ENUM_MAP(EnumT) template class simdb::EnumMap<EnumT>;
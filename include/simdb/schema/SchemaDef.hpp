@@ -3,6 +3,7 @@
 #pragma once
 
 #include "simdb/Exceptions.hpp"
+#include "simdb/sqlite/CompressedBlob.hpp"
 #include "simdb/sqlite/SQLiteTable.hpp"
 
 #include <algorithm>
@@ -22,7 +23,11 @@ enum class SqlDataType
     int64_t,
     double_t,
     string_t,
-    blob_t
+    blob_t,
+
+    /// Blob that SimDB compresses on INSERT/setPropertyBlob() and
+    /// decompresses on getPropertyBlob()/SqlQuery::select().
+    compressed_blob_t
 };
 
 /// Stream operator used when creating various SQL commands.
@@ -56,6 +61,12 @@ inline std::ostream& operator<<(std::ostream& os, const SqlDataType dtype)
             os << "BLOB";
             break;
         }
+
+        case dt::compressed_blob_t:
+        {
+            os << COMPRESSED_BLOB_DECLTYPE;
+            break;
+        }
     }
 
     return os;
@@ -105,7 +116,7 @@ public:
     /// throw if you attempt to set a SqlBlob default value.
     template <typename T> void setDefaultValue(const T val)
     {
-        if (dt_ == SqlDataType::blob_t)
+        if (dt_ == SqlDataType::blob_t || dt_ == SqlDataType::compressed_blob_t)
         {
             throw DBException("Cannot set default value for a database "
                               "column with blob data type");
@@ -0,0 +1,1110 @@
+// <ArrowExporter.hpp> -*- C++ -*-
+
+#pragma once
+
+#include "simdb/serialize/RecordDecoder.hpp"
+#include "simdb/serialize/RegionReplayer.hpp"
+#include "simdb/sqlite/DatabaseManager.hpp"
+#include "simdb/utils/ArrowIpc.hpp"
+#include "simdb/utils/ColumnDecode.hpp"
+#include "simdb/utils/TaskExecutor.hpp"
+
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace simdb
+{
+
+/// The values of one collectable at every tick it was collected, after
+/// replaying its records (CARRY, ARRIVE/DEPART, region patches, ...).
+struct DecodedCollectable
+{
+    std::string location;
+    uint16_t elem_id = 0;
+    std::string data_type;
+
+    /// Iterables have one row per element per tick, with the element's
+    /// position (contig) or bin (sparse) in slots.
+    bool is_iterable = false;
+
+    /// Bytes per row in values: the serialized struct (see StructFields),
+    /// the scalar, or the whole region.
+    size_t value_num_bytes = 0;
+
+    std::vector<uint64_t> ticks;
+    std::vector<uint16_t> slots;
+    std::vector<char> values;
+
+    size_t getNumRows() const
+    {
+        return ticks.size();
+    }
+
+    const char* getValue(size_t row) const
+    {
+        return values.data() + row * value_num_bytes;
+    }
+};
+
+/*!
+ * \class ArrowExporter
+ *
+ * \brief Decodes the collection records of a database and writes each
+ *        collectable to its own Arrow IPC file (Feather v2), so the data
+ *        can be loaded by pandas, polars, DuckDB, etc. without going
+ *        through the Python record decoder. Every file has a Tick column,
+ *        a Slot column for iterables, and then one column per struct field
+ *        (or a Value column for scalars, or a Bytes column for regions):
+ *
+ *          - Integers and floats keep their type
+ *          - Bools (and struct fields formatted as bools) are Arrow bools
+ *          - Strings (StringMap IDs) and enums (EnumDefns) are dictionary-
+ *            encoded strings. String IDs missing from the StringMap table
+ *            are nulls.
+ *
+ *        The records are read one tick window at a time, so only one window
+ *        of records and rows is in memory. Each window's records are
+ *        decompressed and split on the TaskExecutor, and then the
+ *        collectables are replayed and appended to their files in parallel.
+ *        Records still in segment files must be imported first (see
+ *        DatabaseManager::importCollectionSegments()).
+ */
+class ArrowExporter
+{
+public:
+    /// Exported file of one collectable.
+    struct ExportedTable
+    {
+        std::string location;
+        std::string filename;
+        size_t num_rows = 0;
+    };
+
+    /// Reads the collection metadata (collectables, struct definitions,
+    /// enums, and strings) from the database.
+    explicit ArrowExporter(DatabaseManager* db_mgr)
+        : db_mgr_(db_mgr)
+    {
+        readStructFields_();
+        readEnumDefns_();
+        readStringMap_();
+        readCollectables_();
+    }
+
+    /// Write one <location>.arrow file per collectable into the directory,
+    /// which is created if needed. The files are appended to one tick
+    /// window at a time.
+    ///
+    /// \param max_rows_per_batch Rows per Arrow record batch
+    /// \param window_num_ticks Ticks of records decoded at a time
+    std::vector<ExportedTable> exportTables(const std::string& directory,
+                                            size_t max_rows_per_batch = 65536,
+                                            uint64_t window_num_ticks = DEFAULT_WINDOW_NUM_TICKS)
+    {
+        std::filesystem::create_directories(directory);
+
+        std::vector<ExportedTable> tables(collectables_.size());
+        std::vector<std::vector<ArrowColumn>> columns(collectables_.size());
+        std::vector<std::unique_ptr<ArrowFileWriter>> writers(collectables_.size());
+        for (size_t idx = 0; idx < collectables_.size(); ++idx)
+        {
+            auto& table = tables[idx];
+            table.location = collectables_[idx].location;
+            table.filename = (std::filesystem::path(directory) / (getFileStem_(table.location) + ".arrow")).string();
+            columns[idx] = makeEmptyColumns_(collectables_[idx]);
+            writers[idx] = std::make_unique<ArrowFileWriter>(table.filename, columns[idx]);
+        }
+
+        decodeTickWindows(window_num_ticks,
+                          [&](std::vector<DecodedCollectable>& decoded)
+                          {
+                              parallelFor_(decoded.size(),
+                                           [&](size_t idx)
+                                           {
+                                               tables[idx].num_rows += decoded[idx].getNumRows();
+                                               appendColumns_(decoded[idx], columns[idx]);
+                                               writers[idx]->writeRows(columns[idx], max_rows_per_batch);
+
+                                               // The dictionaries are kept for the next window
+                                               for (auto& column : columns[idx])
+                                               {
+                                                   column.clearRows();
+                                               }
+                                               decoded[idx] = DecodedCollectable();
+                                           });
+                          });
+
+        parallelFor_(writers.size(), [&](size_t idx) { writers[idx]->finish(columns[idx]); });
+        return tables;
+    }
+
+    /// Decode and replay the records one tick window at a time. The callback
+    /// gets the rows of every collectable (in the order the collectables
+    /// appear in CollectableTreeNodes) from the records that start in the
+    /// window. Coalesced records can have rows past the end of the window.
+    void decodeTickWindows(uint64_t window_num_ticks, const std::function<void(std::vector<DecodedCollectable>&)>& callback)
+    {
+        if (!window_num_ticks)
+        {
+            throw DBException("Tick windows need at least one tick");
+        }
+
+        if (db_mgr_->createQuery("CollectionSegments")->count())
+        {
+            throw DBException("Collection records are still in segment files. Call importCollectionSegments() first.");
+        }
+
+        const auto dictionaries = readDictionaries_();
+
+        // Replay state is carried from one window to the next
+        std::vector<ReplayState_> states(collectables_.size());
+        for (size_t idx = 0; idx < collectables_.size(); ++idx)
+        {
+            const auto& layout = collectables_[idx];
+            if (layout.kind == Kind_::REGION)
+            {
+                states[idx].region_replayer = std::make_unique<RegionReplayer>(layout.value_num_bytes, layout.block_size);
+            }
+        }
+
+        int64_t window_begin = std::numeric_limits<int64_t>::min();
+        while (findRecordTick_(window_begin, window_begin))
+        {
+            // The last window runs to the largest tick
+            const uint64_t num_ticks_left = (uint64_t)std::numeric_limits<int64_t>::max() - (uint64_t)window_begin;
+            const bool last_window = window_num_ticks > num_ticks_left;
+            const int64_t window_end = last_window ? 0 : (int64_t)((uint64_t)window_begin + window_num_ticks);
+            auto records = readRecords_(window_begin, window_end, last_window);
+
+            // Split the records into sweeps, and the sweeps into the bytes of
+            // each collectable (records are independent of each other)
+            std::vector<SplitRecord_> split_records(records.size());
+            parallelFor_(records.size(),
+                         [&](size_t idx)
+                         {
+                             const CompressionDictionary* dictionary = nullptr;
+                             auto iter = dictionaries.find(records[idx].dictionary_id);
+                             if (iter != dictionaries.end())
+                             {
+                                 dictionary = &iter->second;
+                             }
+
+                             splitRecord_(RecordDecoder::split(records[idx], dictionary), split_records[idx]);
+                             records[idx] = EncodedRecord();
+                         });
+
+            // Replay each collectable's segments in record order
+            std::vector<DecodedCollectable> decoded(collectables_.size());
+            parallelFor_(collectables_.size(),
+                         [&](size_t idx)
+                         {
+                             initDecoded_(collectables_[idx], decoded[idx]);
+                             replay_(collectables_[idx], split_records, states[idx], decoded[idx]);
+                         });
+
+            callback(decoded);
+            if (last_window)
+            {
+                break;
+            }
+            window_begin = window_end;
+        }
+    }
+
+    /// Decode and replay the records of every collectable, in the order
+    /// the collectables appear in CollectableTreeNodes. Every row is kept
+    /// in memory; see decodeTickWindows() or exportTables() for big runs.
+    std::vector<DecodedCollectable> decodeAll(uint64_t window_num_ticks = DEFAULT_WINDOW_NUM_TICKS)
+    {
+        std::vector<DecodedCollectable> decoded(collectables_.size());
+        for (size_t idx = 0; idx < collectables_.size(); ++idx)
+        {
+            initDecoded_(collectables_[idx], decoded[idx]);
+        }
+
+        decodeTickWindows(window_num_ticks,
+                          [&](std::vector<DecodedCollectable>& window)
+                          {
+                              for (size_t idx = 0; idx < window.size(); ++idx)
+                              {
+                                  auto& rows = decoded[idx];
+                                  rows.ticks.insert(rows.ticks.end(), window[idx].ticks.begin(), window[idx].ticks.end());
+                                  rows.slots.insert(rows.slots.end(), window[idx].slots.begin(), window[idx].slots.end());
+                                  rows.values.insert(rows.values.end(), window[idx].values.begin(), window[idx].values.end());
+                              }
+                          });
+        return decoded;
+    }
+
+    /// Get the Arrow columns for the decoded rows of a collectable.
+    std::vector<ArrowColumn> makeColumns(const DecodedCollectable& decoded) const
+    {
+        auto columns = makeEmptyColumns_(getLayout_(decoded.elem_id));
+        appendColumns_(decoded, columns);
+        return columns;
+    }
+
+    /// Ticks of records decoded at a time by default.
+    static constexpr uint64_t DEFAULT_WINDOW_NUM_TICKS = 1 << 20;
+
+private:
+    enum class Kind_
+    {
+        SCALAR,
+        CONTIG,
+        SPARSE,
+        REGION
+    };
+
+    /// One serialized field of a collected value.
+    struct FieldLayout_
+    {
+        std::string name;
+        std::string type;
+        size_t offset = 0;
+        size_t num_bytes = 0;
+        bool is_bool = false;
+    };
+
+    /// How one collectable's bytes are laid out in a sweep.
+    struct CollectableLayout_
+    {
+        std::string location;
+        uint16_t elem_id = 0;
+        std::string data_type;
+        Kind_ kind = Kind_::SCALAR;
+        bool auto_collected = false;
+        bool is_pod = false;
+        size_t value_num_bytes = 0;
+        size_t block_size = 0;
+        std::vector<FieldLayout_> fields;
+    };
+
+    /// The (empty) Tick, Slot, and value columns of a collectable.
+    std::vector<ArrowColumn> makeEmptyColumns_(const CollectableLayout_& layout) const
+    {
+        std::vector<ArrowColumn> columns;
+        columns.reserve(layout.fields.size() + 2);
+        columns.emplace_back(ArrowColumn::makeInt("Tick", 64, false));
+
+        if (layout.kind == Kind_::CONTIG || layout.kind == Kind_::SPARSE)
+        {
+            columns.emplace_back(ArrowColumn::makeInt("Slot", 16, false));
+        }
+
+        if (layout.kind == Kind_::REGION)
+        {
+            columns.emplace_back(ArrowColumn::makeFixedSizeBinary("Bytes", layout.value_num_bytes));
+            return columns;
+        }
+
+        for (const auto& field : layout.fields)
+        {
+            columns.emplace_back(makeFieldColumn_(field));
+        }
+        return columns;
+    }
+
+    /// Append the decoded rows of a collectable to its columns (see
+    /// makeEmptyColumns_()).
+    void appendColumns_(const DecodedCollectable& decoded, std::vector<ArrowColumn>& columns) const
+    {
+        const auto& layout = getLayout_(decoded.elem_id);
+        const size_t num_rows = decoded.getNumRows();
+
+        size_t column_idx = 0;
+        memcpy(columns[column_idx++].appendRows(num_rows), decoded.ticks.data(), num_rows * sizeof(uint64_t));
+
+        if (decoded.is_iterable)
+        {
+            memcpy(columns[column_idx++].appendRows(num_rows), decoded.slots.data(), num_rows * sizeof(uint16_t));
+        }
+
+        if (layout.kind == Kind_::REGION)
+        {
+            memcpy(columns[column_idx].appendRows(num_rows), decoded.values.data(), num_rows * layout.value_num_bytes);
+            return;
+        }
+
+        // The rows are fixed-stride structs, so all fields are transposed in
+        // one pass. Integers and floats are gathered straight into their
+        // columns; bools, strings, and enums go through a packed buffer and
+        // are converted afterwards.
+        const size_t first_field_column = column_idx;
+        std::vector<std::vector<char>> packed(layout.fields.size());
+        std::vector<ColumnSlice> slices(layout.fields.size());
+        for (size_t idx = 0; idx < layout.fields.size(); ++idx)
+        {
+            const auto& field = layout.fields[idx];
+            slices[idx].offset = field.offset;
+            slices[idx].num_bytes = field.num_bytes;
+            if (isPlainNumber_(field))
+            {
+                slices[idx].out = columns[first_field_column + idx].appendRows(num_rows);
+            }
+            else
+            {
+                packed[idx].resize(num_rows * field.num_bytes);
+                slices[idx].out = packed[idx].data();
+            }
+        }
+
+        transposeRows(decoded.values.data(), num_rows, layout.value_num_bytes, slices);
+
+        for (size_t idx = 0; idx < layout.fields.size(); ++idx)
+        {
+            if (!isPlainNumber_(layout.fields[idx]))
+            {
+                fillFieldColumn_(layout.fields[idx], packed[idx].data(), num_rows, columns[first_field_column + idx]);
+            }
+        }
+    }
+
+    /// A collectable's bytes in one sweep.
+    struct Segment_
+    {
+        uint64_t tick;
+        uint32_t offset;
+        uint32_t num_bytes;
+    };
+
+    /// The sweeps of one record, with their collectables' segments.
+    struct SplitRecord_
+    {
+        std::vector<char> bytes;
+        std::unordered_map<uint16_t, std::vector<Segment_>> segments_by_elem_id;
+    };
+
+    /// What a collectable's replay carries from one tick window to the
+    /// next: the last scalar value, the contig queue, or the region.
+    struct ReplayState_
+    {
+        std::vector<char> last_value;
+        std::vector<std::vector<char>> queue;
+        std::unique_ptr<RegionReplayer> region_replayer;
+    };
+
+    struct EnumDefn_
+    {
+        std::string int_type;
+        std::map<int64_t, std::string> names_by_value;
+    };
+
+    /// Run func(0) .. func(num_items - 1) on the TaskExecutor and wait for
+    /// them to finish. The first exception thrown is rethrown here.
+    static void parallelFor_(size_t num_items, const std::function<void(size_t)>& func)
+    {
+        if (!num_items)
+        {
+            return;
+        }
+
+        auto executor = TaskExecutor::getInstance();
+        const size_t num_tasks = std::min(num_items, executor->getNumWorkers() * 4);
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        size_t num_done = 0;
+        std::exception_ptr error;
+
+        for (size_t task_idx = 0; task_idx < num_tasks; ++task_idx)
+        {
+            executor->submit(
+                [&, task_idx]()
+                {
+                    try
+                    {
+                        for (size_t idx = task_idx; idx < num_items; idx += num_tasks)
+                        {
+                            func(idx);
+                        }
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (!error)
+                        {
+                            error = std::current_exception();
+                        }
+                    }
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    ++num_done;
+                    cv.notify_one();
+                });
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() { return num_done == num_tasks; });
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+
+    /// Size of the POD data types used in DataType and FieldType, or zero.
+    static size_t getPodNumBytes_(const std::string& type)
+    {
+        static const std::unordered_map<std::string, size_t> num_bytes_by_type = {
+            {"char_t", sizeof(char)},       {"int8_t", sizeof(int8_t)},     {"uint8_t", sizeof(uint8_t)},
+            {"int16_t", sizeof(int16_t)},   {"uint16_t", sizeof(uint16_t)}, {"int32_t", sizeof(int32_t)},
+            {"uint32_t", sizeof(uint32_t)}, {"int64_t", sizeof(int64_t)},   {"uint64_t", sizeof(uint64_t)},
+            {"float_t", sizeof(float)},     {"double_t", sizeof(double)},   {"string_t", sizeof(uint32_t)},
+            {"bool", sizeof(int32_t)}};
+
+        auto iter = num_bytes_by_type.find(type);
+        return iter != num_bytes_by_type.end() ? iter->second : 0;
+    }
+
+    /// Replace the characters that do not belong in file names.
+    static std::string getFileStem_(const std::string& location)
+    {
+        std::string stem = location;
+        for (auto& ch : stem)
+        {
+            if (!isalnum((unsigned char)ch) && ch != '.' && ch != '_' && ch != '-')
+            {
+                ch = '_';
+            }
+        }
+        return stem;
+    }
+
+    void readStructFields_()
+    {
+        std::string struct_name, field_name, field_type;
+        int32_t format_code = 0;
+        auto query = db_mgr_->createQuery("StructFields");
+        query->select("StructName", struct_name);
+        query->select("FieldName", field_name);
+        query->select("FieldType", field_type);
+        query->select("FormatCode", format_code);
+        query->orderBy("Id", QueryOrder::ASC);
+
+        auto results = query->getResultSet();
+        while (results.getNextRecord())
+        {
+            FieldLayout_ field;
+            field.name = field_name;
+            field.type = field_type;
+            field.is_bool = format_code == static_cast<int32_t>(Format::boolalpha);
+            struct_fields_[struct_name].emplace_back(std::move(field));
+        }
+    }
+
+    void readEnumDefns_()
+    {
+        std::string enum_name, enum_val_str, int_type;
+        std::vector<char> enum_val_blob;
+        auto query = db_mgr_->createQuery("EnumDefns");
+        query->select("EnumName", enum_name);
+        query->select("EnumValStr", enum_val_str);
+        query->select("EnumValBlob", enum_val_blob);
+        query->select("IntType", int_type);
+
+        auto results = query->getResultSet();
+        while (results.getNextRecord())
+        {
+            auto& defn = enum_defns_[enum_name];
+            defn.int_type = int_type;
+            defn.names_by_value[readInt_(enum_val_blob.data(), enum_val_blob.size(), int_type[0] != 'u')] = enum_val_str;
+        }
+    }
+
+    void readStringMap_()
+    {
+        int32_t int_val = 0;
+        std::string str;
+        auto query = db_mgr_->createQuery("StringMap");
+        query->select("IntVal", int_val);
+        query->select("String", str);
+
+        auto results = query->getResultSet();
+        while (results.getNextRecord())
+        {
+            strings_[int_val] = str;
+        }
+    }
+
+    void readCollectables_()
+    {
+        int32_t elem_id = 0, auto_collected = 0;
+        std::string data_type, location;
+        auto query = db_mgr_->createQuery("CollectableTreeNodes");
+        query->select("ElementTreeNodeID", elem_id);
+        query->select("DataType", data_type);
+        query->select("Location", location);
+        query->select("AutoCollected", auto_collected);
+        query->orderBy("Id", QueryOrder::ASC);
+
+        auto results = query->getResultSet();
+        while (results.getNextRecord())
+        {
+            CollectableLayout_ layout;
+            layout.location = location;
+            layout.elem_id = elem_id;
+            layout.data_type = data_type;
+            layout.auto_collected = auto_collected != 0;
+
+            size_t num_bytes = 0, block_size = 0;
+            if (sscanf(data_type.c_str(), "region_bytes%zu_block%zu", &num_bytes, &block_size) == 2)
+            {
+                layout.kind = Kind_::REGION;
+                layout.value_num_bytes = num_bytes;
+                layout.block_size = block_size;
+            }
+            else
+            {
+                std::string value_type = data_type;
+                for (auto kind : {Kind_::CONTIG, Kind_::SPARSE})
+                {
+                    const auto pos = data_type.rfind(kind == Kind_::CONTIG ? "_contig_capacity" : "_sparse_capacity");
+                    if (pos != std::string::npos)
+                    {
+                        layout.kind = kind;
+                        value_type = data_type.substr(0, pos);
+                    }
+                }
+                setValueFields_(value_type, layout);
+            }
+
+            elem_idxs_[layout.elem_id] = collectables_.size();
+            collectables_.emplace_back(std::move(layout));
+        }
+    }
+
+    /// Lay out the fields of the collected values (a struct or a POD).
+    void setValueFields_(const std::string& value_type, CollectableLayout_& layout) const
+    {
+        if (auto num_bytes = getPodNumBytes_(value_type))
+        {
+            FieldLayout_ field;
+            field.name = "Value";
+            field.type = value_type;
+            field.num_bytes = num_bytes;
+            field.is_bool = value_type == "bool";
+            layout.fields.push_back(field);
+            layout.is_pod = true;
+            layout.value_num_bytes = num_bytes;
+            return;
+        }
+
+        auto iter = struct_fields_.find(value_type);
+        if (iter == struct_fields_.end())
+        {
+            throw DBException("Unknown data type '") << value_type << "' for collectable " << layout.location;
+        }
+
+        for (auto field : iter->second)
+        {
+            field.offset = layout.value_num_bytes;
+            field.num_bytes = getPodNumBytes_(field.type);
+            if (!field.num_bytes)
+            {
+                auto enum_iter = enum_defns_.find(field.type);
+                if (enum_iter == enum_defns_.end())
+                {
+                    throw DBException("Unknown type '") << field.type << "' of field " << value_type << "::" << field.name;
+                }
+                field.num_bytes = getPodNumBytes_(enum_iter->second.int_type);
+            }
+
+            layout.value_num_bytes += field.num_bytes;
+            layout.fields.emplace_back(std::move(field));
+        }
+    }
+
+    const CollectableLayout_& getLayout_(uint16_t elem_id) const
+    {
+        auto iter = elem_idxs_.find(elem_id);
+        if (iter == elem_idxs_.end())
+        {
+            throw DBException("Unknown collectable ID ") << elem_id << " in the collection records";
+        }
+        return collectables_[iter->second];
+    }
+
+    /// Find the tick of the first record at or after min_tick.
+    bool findRecordTick_(int64_t min_tick, int64_t& tick) const
+    {
+        auto query = db_mgr_->createQuery("CollectionRecords");
+        query->select("Tick", tick);
+        query->addConstraintForInt("Tick", Constraints::GREATER_EQUAL, min_tick);
+        query->orderBy("Tick", QueryOrder::ASC);
+        query->setLimit(1);
+
+        auto results = query->getResultSet();
+        return results.getNextRecord();
+    }
+
+    /// Read the records that start in [begin_tick, end_tick), or at or after
+    /// begin_tick for the last window, in tick order.
+    std::vector<EncodedRecord> readRecords_(int64_t begin_tick, int64_t end_tick, bool last_window) const
+    {
+        int64_t tick = 0;
+        int32_t is_compressed = 0, format = 0, filters = 0, shuffle_stride = 0, dictionary_id = 0;
+        std::vector<char> data;
+
+        auto query = db_mgr_->createQuery("CollectionRecords");
+        query->select("Tick", tick);
+        query->select("Data", data);
+        query->select("IsCompressed", is_compressed);
+        query->select("RecordFormat", format);
+        query->select("Filters", filters);
+        query->select("ShuffleStride", shuffle_stride);
+        query->select("DictionaryID", dictionary_id);
+        query->addConstraintForInt("Tick", Constraints::GREATER_EQUAL, begin_tick);
+        if (!last_window)
+        {
+            query->addConstraintForInt("Tick", Constraints::LESS, end_tick);
+        }
+        query->orderBy("Tick", QueryOrder::ASC);
+        query->orderBy("Id", QueryOrder::ASC);
+
+        std::vector<EncodedRecord> records;
+        auto results = query->getResultSet();
+        while (results.getNextRecord())
+        {
+            EncodedRecord record;
+            record.tick = tick;
+            record.data = std::move(data);
+            record.compressed = is_compressed != 0;
+            record.format = static_cast<RecordFormat>(format);
+            record.filters = filters;
+            record.shuffle_stride = shuffle_stride;
+            record.dictionary_id = dictionary_id;
+            records.emplace_back(std::move(record));
+        }
+        return records;
+    }
+
+    std::unordered_map<int32_t, CompressionDictionary> readDictionaries_() const
+    {
+        int32_t dictionary_id = 0;
+        std::vector<char> bytes;
+        auto query = db_mgr_->createQuery("CompressionDictionaries");
+        query->select("DictionaryID", dictionary_id);
+        query->select("Dictionary", bytes);
+
+        std::unordered_map<int32_t, CompressionDictionary> dictionaries;
+        auto results = query->getResultSet();
+        while (results.getNextRecord())
+        {
+            auto& dictionary = dictionaries[dictionary_id];
+            dictionary.id = dictionary_id;
+            dictionary.bytes = bytes;
+        }
+        return dictionaries;
+    }
+
+    /// Find where each collectable's bytes begin and end in the sweeps.
+    /// Sweeps do not store their collectables' sizes, so they are worked
+    /// out from the collectables' layouts.
+    void splitRecord_(std::vector<DecodedSweep>&& sweeps, SplitRecord_& split) const
+    {
+        size_t num_bytes = 0;
+        for (const auto& sweep : sweeps)
+        {
+            num_bytes += sweep.bytes.size();
+        }
+        split.bytes.reserve(num_bytes);
+
+        for (const auto& sweep : sweeps)
+        {
+            const size_t sweep_offset = split.bytes.size();
+            split.bytes.insert(split.bytes.end(), sweep.bytes.begin(), sweep.bytes.end());
+
+            size_t offset = 0;
+            while (offset < sweep.bytes.size())
+            {
+                uint16_t elem_id = 0;
+                if (offset + sizeof(elem_id) > sweep.bytes.size())
+                {
+                    throw DBException("Truncated sweep at tick ") << sweep.tick;
+                }
+                memcpy(&elem_id, sweep.bytes.data() + offset, sizeof(elem_id));
+                offset += sizeof(elem_id);
+
+                const auto& layout = getLayout_(elem_id);
+                const auto payload_num_bytes = getPayloadNumBytes_(layout, sweep.bytes.data() + offset, sweep.bytes.size() - offset);
+                split.segments_by_elem_id[elem_id].push_back({sweep.tick, (uint32_t)(sweep_offset + offset), (uint32_t)payload_num_bytes});
+                offset += payload_num_bytes;
+            }
+        }
+    }
+
+    /// Number of bytes a collectable wrote into a sweep (after its element ID).
+    static size_t getPayloadNumBytes_(const CollectableLayout_& layout, const char* data, size_t max_num_bytes)
+    {
+        size_t offset = 0;
+        auto skip = [&](size_t num_bytes)
+        {
+            if (offset + num_bytes > max_num_bytes)
+            {
+                throw DBException("Truncated record of collectable ") << layout.location;
+            }
+            offset += num_bytes;
+            return data + offset - num_bytes;
+        };
+
+        auto read_u8 = [&]() { return (uint8_t)*skip(sizeof(uint8_t)); };
+        auto read_u16 = [&]()
+        {
+            uint16_t val;
+            memcpy(&val, skip(sizeof(val)), sizeof(val));
+            return val;
+        };
+        auto read_u32 = [&]()
+        {
+            uint32_t val;
+            memcpy(&val, skip(sizeof(val)), sizeof(val));
+            return val;
+        };
+
+        const size_t value_num_bytes = layout.value_num_bytes;
+        switch (layout.kind)
+        {
+            case Kind_::SCALAR:
+                // Manually collected values and small PODs are written directly
+                if (!layout.auto_collected || layout.is_pod)
+                {
+                    skip(value_num_bytes);
+                }
+                else if (read_u8() == static_cast<uint8_t>(CollectionPoint::Action::WRITE))
+                {
+                    skip(value_num_bytes);
+                }
+                break;
+
+            case Kind_::CONTIG:
+            {
+                using Action = ContigIterableCollectionPoint::Action;
+                switch (static_cast<Action>(read_u8()))
+                {
+                    case Action::FULL:
+                        skip(read_u16() * value_num_bytes);
+                        break;
+                    case Action::ARRIVE:
+                    case Action::BOOKENDS:
+                        skip(value_num_bytes);
+                        break;
+                    case Action::CHANGE:
+                        skip(sizeof(uint16_t) + value_num_bytes);
+                        break;
+                    case Action::DEPART:
+                    case Action::CARRY:
+                        break;
+                    default:
+                        throw DBException("Invalid action in the record of collectable ") << layout.location;
+                }
+                break;
+            }
+
+            case Kind_::SPARSE:
+                skip(read_u16() * (sizeof(uint16_t) + value_num_bytes));
+                break;
+
+            case Kind_::REGION:
+            {
+                using Action = RegionCollectionPoint::Action;
+                switch (static_cast<Action>(read_u8()))
+                {
+                    case Action::KEYFRAME:
+                        skip(value_num_bytes);
+                        break;
+                    case Action::PATCH:
+                    {
+                        const auto num_blocks = read_u32();
+                        for (uint32_t idx = 0; idx < num_blocks; ++idx)
+                        {
+                            const size_t block_offset = (size_t)read_u32() * layout.block_size;
+                            if (block_offset >= value_num_bytes)
+                            {
+                                throw DBException("Region patch out of range for collectable ") << layout.location;
+                            }
+                            skip(std::min(layout.block_size, value_num_bytes - block_offset));
+                        }
+                        break;
+                    }
+                    case Action::CARRY:
+                        break;
+                    default:
+                        throw DBException("Invalid action in the record of collectable ") << layout.location;
+                }
+                break;
+            }
+        }
+
+        return offset;
+    }
+
+    static void initDecoded_(const CollectableLayout_& layout, DecodedCollectable& decoded)
+    {
+        decoded.location = layout.location;
+        decoded.elem_id = layout.elem_id;
+        decoded.data_type = layout.data_type;
+        decoded.is_iterable = layout.kind == Kind_::CONTIG || layout.kind == Kind_::SPARSE;
+        decoded.value_num_bytes = layout.value_num_bytes;
+    }
+
+    /// Replay one collectable's segments (in record order) into rows.
+    static void replay_(const CollectableLayout_& layout,
+                        const std::vector<SplitRecord_>& split_records,
+                        ReplayState_& state,
+                        DecodedCollectable& decoded)
+    {
+        const size_t value_num_bytes = layout.value_num_bytes;
+        auto add_row = [&](uint64_t tick, uint16_t slot, const char* value)
+        {
+            decoded.ticks.push_back(tick);
+            if (decoded.is_iterable)
+            {
+                decoded.slots.push_back(slot);
+            }
+            decoded.values.insert(decoded.values.end(), value, value + value_num_bytes);
+        };
+
+        auto& last_value = state.last_value;
+        auto& queue = state.queue;
+        auto& region_replayer = state.region_replayer;
+
+        for (const auto& split : split_records)
+        {
+            auto iter = split.segments_by_elem_id.find(layout.elem_id);
+            if (iter == split.segments_by_elem_id.end())
+            {
+                continue;
+            }
+
+            for (const auto& segment : iter->second)
+            {
+                const char* data = split.bytes.data() + segment.offset;
+                switch (layout.kind)
+                {
+                    case Kind_::SCALAR:
+                        if (!layout.auto_collected || layout.is_pod)
+                        {
+                            add_row(segment.tick, 0, data);
+                        }
+                        else if (data[0] == static_cast<char>(CollectionPoint::Action::WRITE))
+                        {
+                            last_value.assign(data + 1, data + 1 + value_num_bytes);
+                            add_row(segment.tick, 0, last_value.data());
+                        }
+                        else if (!last_value.empty())
+                        {
+                            add_row(segment.tick, 0, last_value.data());
+                        }
+                        break;
+
+                    case Kind_::CONTIG:
+                    {
+                        using Action = ContigIterableCollectionPoint::Action;
+                        switch (static_cast<Action>(data[0]))
+                        {
+                            case Action::FULL:
+                            {
+                                uint16_t num_elems = 0;
+                                memcpy(&num_elems, data + 1, sizeof(num_elems));
+                                queue.resize(num_elems);
+                                for (uint16_t idx = 0; idx < num_elems; ++idx)
+                                {
+                                    const char* value = data + 1 + sizeof(num_elems) + idx * value_num_bytes;
+                                    queue[idx].assign(value, value + value_num_bytes);
+                                }
+                                break;
+                            }
+                            case Action::ARRIVE:
+                                queue.emplace_back(data + 1, data + 1 + value_num_bytes);
+                                break;
+                            case Action::DEPART:
+                                if (!queue.empty())
+                                {
+                                    queue.erase(queue.begin());
+                                }
+                                break;
+                            case Action::BOOKENDS:
+                                queue.emplace_back(data + 1, data + 1 + value_num_bytes);
+                                queue.erase(queue.begin());
+                                break;
+                            case Action::CHANGE:
+                            {
+                                uint16_t idx = 0;
+                                memcpy(&idx, data + 1, sizeof(idx));
+                                if (idx < queue.size())
+                                {
+                                    queue[idx].assign(data + 1 + sizeof(idx), data + 1 + sizeof(idx) + value_num_bytes);
+                                }
+                                break;
+                            }
+                            default:
+                                break;
+                        }
+
+                        for (size_t idx = 0; idx < queue.size(); ++idx)
+                        {
+                            add_row(segment.tick, idx, queue[idx].data());
+                        }
+                        break;
+                    }
+
+                    case Kind_::SPARSE:
+                    {
+                        uint16_t num_valid = 0;
+                        memcpy(&num_valid, data, sizeof(num_valid));
+                        const char* bin = data + sizeof(num_valid);
+                        for (uint16_t idx = 0; idx < num_valid; ++idx)
+                        {
+                            uint16_t bin_idx = 0;
+                            memcpy(&bin_idx, bin, sizeof(bin_idx));
+                            add_row(segment.tick, bin_idx, bin + sizeof(bin_idx));
+                            bin += sizeof(bin_idx) + value_num_bytes;
+                        }
+                        break;
+                    }
+
+                    case Kind_::REGION:
+                        region_replayer->replay(data, segment.num_bytes);
+                        if (region_replayer->hasKeyframe())
+                        {
+                            add_row(segment.tick, 0, region_replayer->getBytes().data());
+                        }
+                        break;
+                }
+            }
+        }
+    }
+
+    static int64_t readInt_(const char* data, size_t num_bytes, bool is_signed)
+    {
+        switch (num_bytes)
+        {
+            case 1:
+                return is_signed ? (int64_t)(*(const int8_t*)data) : (int64_t)(*(const uint8_t*)data);
+            case 2:
+            {
+                uint16_t val;
+                memcpy(&val, data, sizeof(val));
+                return is_signed ? (int64_t)(int16_t)val : (int64_t)val;
+            }
+            case 4:
+            {
+                uint32_t val;
+                memcpy(&val, data, sizeof(val));
+                return is_signed ? (int64_t)(int32_t)val : (int64_t)val;
+            }
+            case 8:
+            {
+                int64_t val;
+                memcpy(&val, data, sizeof(val));
+                return val;
+            }
+        }
+        throw DBException("Invalid integer size ") << num_bytes;
+    }
+
+    /// Integers and floats are copied into their column as they are. The
+    /// other fields need a conversion per row.
+    bool isPlainNumber_(const FieldLayout_& field) const
+    {
+        return !field.is_bool && field.type != "string_t" && field.type != "char_t" && !enum_defns_.count(field.type);
+    }
+
+    /// The (empty) column for one struct field, or the scalar value.
+    ArrowColumn makeFieldColumn_(const FieldLayout_& field) const
+    {
+        if (field.is_bool)
+        {
+            return ArrowColumn::makeBool(field.name);
+        }
+
+        if (field.type == "string_t" || field.type == "char_t")
+        {
+            return ArrowColumn::makeStringDictionary(field.name);
+        }
+
+        auto enum_iter = enum_defns_.find(field.type);
+        if (enum_iter != enum_defns_.end())
+        {
+            // Seed the dictionary with the names in value order. Values with
+            // no name are written as numbers.
+            std::vector<std::string> names;
+            for (const auto& kvp : enum_iter->second.names_by_value)
+            {
+                names.push_back(kvp.second);
+            }
+            return ArrowColumn::makeStringDictionary(field.name, names);
+        }
+
+        return field.type == "float_t" || field.type == "double_t" ? ArrowColumn::makeFloat(field.name, field.num_bytes * 8)
+                                                                   : ArrowColumn::makeInt(field.name, field.num_bytes * 8, field.type[0] != 'u');
+    }
+
+    /// Convert the packed values of a bool, string, or enum field (see
+    /// transposeRows()) into its column.
+    void fillFieldColumn_(const FieldLayout_& field, const char* packed, size_t num_rows, ArrowColumn& column) const
+    {
+        const size_t num_bytes = field.num_bytes;
+        column.reserve(num_rows);
+
+        if (field.is_bool)
+        {
+            for (size_t row = 0; row < num_rows; ++row)
+            {
+                column.appendBool(readInt_(packed + row * num_bytes, num_bytes, true) != 0);
+            }
+        }
+        else if (field.type == "string_t")
+        {
+            for (size_t row = 0; row < num_rows; ++row)
+            {
+                const auto string_id = (uint32_t)readInt_(packed + row * num_bytes, num_bytes, false);
+                auto iter = strings_.find(string_id);
+                if (iter != strings_.end())
+                {
+                    column.appendString(iter->second);
+                }
+                else
+                {
+                    column.appendNull();
+                }
+            }
+        }
+        else if (field.type == "char_t")
+        {
+            for (size_t row = 0; row < num_rows; ++row)
+            {
+                column.appendString(std::string(1, packed[row]));
+            }
+        }
+        else
+        {
+            const auto& defn = enum_defns_.at(field.type);
+            for (size_t row = 0; row < num_rows; ++row)
+            {
+                const auto val = readInt_(packed + row * num_bytes, num_bytes, defn.int_type[0] != 'u');
+                auto iter = defn.names_by_value.find(val);
+                column.appendString(iter != defn.names_by_value.end() ? iter->second : std::to_string(val));
+            }
+        }
+    }
+
+    DatabaseManager* db_mgr_;
+    std::vector<CollectableLayout_> collectables_;
+    std::unordered_map<uint16_t, size_t> elem_idxs_;
+    std::unordered_map<std::string, std::vector<FieldLayout_>> struct_fields_;
+    std::unordered_map<std::string, EnumDefn_> enum_defns_;
+    std::unordered_map<uint32_t, std::string> strings_;
+};
+
+} // namespace simdb
@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include "simdb/utils/MemoryResource.hpp"
 #include "simdb/utils/MetaStructs.hpp"
 
 #include <stdint.h>
@@ -24,14 +25,14 @@ namespace simdb
 class CollectionBuffer
 {
 public:
-    CollectionBuffer(std::vector<char>& buffer)
+    CollectionBuffer(CollectionBytes& buffer)
         : buffer_(buffer)
     {
         buffer_.clear();
         buffer_.reserve(buffer_.capacity());
     }
 
-    CollectionBuffer(std::vector<char>& buffer, uint16_t elem_id)
+    CollectionBuffer(CollectionBytes& buffer, uint16_t elem_id)
         : CollectionBuffer(buffer)
     {
         append(&elem_id, sizeof(elem_id));
@@ -44,7 +45,7 @@ public:
     }
 
 private:
-    std::vector<char>& buffer_;
+    CollectionBytes& buffer_;
 };
 
 template <typename T>
@@ -71,7 +72,7 @@ inline typename std::enable_if<std::is_enum<T>::value, CollectionBuffer&>::type
     return buffer << static_cast<dtype>(val);
 }
 
-template <typename T> inline CollectionBuffer& operator<<(CollectionBuffer& buffer, const std::vector<T>& bytes)
+template <typename T, typename Alloc> inline CollectionBuffer& operator<<(CollectionBuffer& buffer, const std::vector<T, Alloc>& bytes)
 {
     buffer.append(bytes.data(), bytes.size() * sizeof(T));
     return buffer;
@@ -0,0 +1,93 @@
+// <CollectionConfig.hpp> -*- C++ -*-
+
+#pragma once
+
+#include "simdb/serialize/SinkBackend.hpp"
+#include "simdb/utils/ThreadPlacement.hpp"
+#include "simdb/utils/TransformFilters.hpp"
+
+#include <stddef.h>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+namespace simdb
+{
+
+/// Options given to DatabaseManager::enableCollection(). The defaults
+/// match the behavior of enableCollection(heartbeat, num_compression_threads).
+struct CollectionConfig
+{
+    /// The maximum number of cycles' worth of repeating (unchanging) data
+    /// before we are forced to write the data to the database again.
+    /// Valid range is [1, 25].
+    size_t heartbeat = 10;
+
+    /// Number of dedicated compression threads (SinkThreads). May be zero.
+    /// Ignored when use_shared_executor is true.
+    size_t num_compression_threads = 1;
+
+    /// Run compression and database writes as tasks on the process-wide
+    /// TaskExecutor instead of creating dedicated threads for this manager.
+    /// Records are still written to the database in sweep() order.
+    bool use_shared_executor = false;
+
+    /// Coalesce consecutive sweeps into one compressed CollectionRecords row
+    /// until the batch would exceed this many uncompressed bytes. Small sweeps
+    /// compress much better together. Zero disables the byte budget.
+    size_t coalesce_max_bytes = 0;
+
+    /// Coalesce consecutive sweeps into one row until the batch would span
+    /// this many ticks. Zero disables the tick budget. Coalescing is off when
+    /// both budgets are zero. Requires compression threads or the shared executor.
+    size_t coalesce_max_ticks = 0;
+
+    /// Regroup each coalesced batch element-major before compression: all of
+    /// one collectable's bytes for the batch's ticks, then the next one's.
+    /// Each collectable's block is compressed on its own, so readers that
+    /// want one element only decompress that element's block. Requires one
+    /// of the coalescing budgets. XOR-delta does not apply to these records.
+    bool element_major = false;
+
+    /// Transforms to run on each record before compression. Ignored when
+    /// there are no compression threads (records are written uncompressed).
+    TransformFilters filters;
+
+    /// Build a zlib preset dictionary from this many sweeps at the start of
+    /// the run, and compress every later record with it. Small records
+    /// compress much better when the stream does not start out empty.
+    /// Zero disables training.
+    size_t dictionary_training_sweeps = 0;
+
+    /// Dictionary bytes to compress every record with, starting from the
+    /// first sweep. Takes precedence over training.
+    std::vector<char> preset_dictionary;
+
+    /// Load preset_dictionary from the CompressionDictionaries table of
+    /// another SimDB file (typically a previous run of the same simulator).
+    std::string dictionary_source_db;
+
+    /// Where the records go: CollectionRecords rows (default), or append-only
+    /// segment files indexed by the CollectionSegments table.
+    SinkBackendType sink_backend = SinkBackendType::SQLITE;
+
+    /// Start a new segment file once the current one reaches this many bytes.
+    /// Only used by the SEGMENT_FILES backend.
+    size_t segment_file_max_bytes = 1ull << 30;
+
+    /// Memory resource for the collectables' buffers (e.g. an arena or a
+    /// hugepage-backed resource). It must outlive the collectables. If null,
+    /// each CollectionMgr allocates them from a pool of its own.
+    std::pmr::memory_resource* memory_resource = nullptr;
+
+    /// Name, CPU set, and priority for the SinkThreads (all of them share
+    /// one cpu set). Names default to "simdb-sink<N>"; a custom name also
+    /// gets the thread index appended.
+    ThreadPlacement sink_thread_placement;
+
+    /// Name, CPU set, and priority for the DatabaseThread. The name
+    /// defaults to "simdb-db".
+    ThreadPlacement db_thread_placement;
+};
+
+} // namespace simdb
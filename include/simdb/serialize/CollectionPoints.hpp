@@ -2,10 +2,16 @@
 
 #pragma once
 
+#include "simdb/serialize/IterableTraits.hpp"
 #include "simdb/serialize/Serialize.hpp"
+#include "simdb/serialize/ValueSketches.hpp"
+#include "simdb/serialize/ZoneMap.hpp"
 
 #include <stdint.h>
+#include <algorithm>
 #include <cassert>
+#include <deque>
+#include <limits>
 #include <memory>
 #include <string>
 #include <vector>
@@ -26,10 +32,11 @@ struct ArgosRecord
     Status status = Status::DONT_READ;
 
     const uint16_t elem_id = 0;
-    std::vector<char> data;
+    CollectionBytes data;
 
-    ArgosRecord(uint16_t elem_id)
+    ArgosRecord(uint16_t elem_id, std::pmr::memory_resource* memory_resource)
         : elem_id(elem_id)
+        , data(memory_resource)
     {
     }
 
@@ -51,8 +58,16 @@ public:
 class CollectionPointBase
 {
 public:
-    CollectionPointBase(uint16_t elem_id, uint16_t clk_id, size_t heartbeat, const std::string& dtype)
-        : argos_record_(elem_id)
+    /// The collectable's buffers are allocated from the given memory resource
+    /// (or the default resource if null), which is kept alive for as long as
+    /// the collectable is.
+    CollectionPointBase(uint16_t elem_id,
+                        uint16_t clk_id,
+                        size_t heartbeat,
+                        const std::string& dtype,
+                        std::shared_ptr<std::pmr::memory_resource> memory_resource = nullptr)
+        : memory_resource_(std::move(memory_resource))
+        , argos_record_(elem_id, getMemoryResource())
         , elem_id_(elem_id)
         , clk_id_(clk_id)
         , heartbeat_(heartbeat)
@@ -100,6 +115,12 @@ public:
         return dtype_;
     }
 
+    /// Memory resource this collectable allocates its buffers from.
+    std::pmr::memory_resource* getMemoryResource() const
+    {
+        return memory_resource_ ? memory_resource_.get() : std::pmr::get_default_resource();
+    }
+
     void setTickReader(TickReader& reader)
     {
         tick_reader_ = &reader;
@@ -120,6 +141,7 @@ public:
     {
         if (argos_record_.status != ArgosRecord::Status::DONT_READ)
         {
+            onSweep_();
             swept_data.insert(swept_data.end(), argos_record_.data.begin(), argos_record_.data.end());
         }
 
@@ -129,6 +151,62 @@ public:
         }
     }
 
+    /// Set the fields of one collected value (or of one element, for
+    /// iterables) as they are serialized. Called by the CollectionMgr.
+    void setValueLayout(std::vector<ZoneMapField>&& layout)
+    {
+        value_layout_ = std::move(layout);
+        value_num_bytes_ = 0;
+        for (const auto& field : value_layout_)
+        {
+            value_num_bytes_ = std::max(value_num_bytes_, field.offset + field.num_bytes);
+        }
+    }
+
+    /// Get the field with the given name ("" for scalar collectables), or
+    /// nullptr if there is no such field.
+    const ZoneMapField* findValueField(const std::string& field_name) const
+    {
+        for (const auto& field : value_layout_)
+        {
+            if (field.name == field_name)
+            {
+                return &field;
+            }
+        }
+        return nullptr;
+    }
+
+    /// Keep the min/max of the given field in every record this
+    /// collectable is swept into (see CollectionMgr::addZoneMap()).
+    void addZoneMapField(const std::string& field_name, const int32_t field_id)
+    {
+        zone_map_fields_.push_back(getNumericField_(field_name));
+        zone_map_fields_.back().field_id = field_id;
+    }
+
+    /// Sketch the distribution of the given field over every value this
+    /// collectable is swept with (see CollectionMgr::addSketch()).
+    void addSketchField(const std::string& field_name, const uint32_t sketch_idx)
+    {
+        sketch_fields_.push_back(getNumericField_(field_name));
+        sketch_fields_.back().field_id = (int32_t)sketch_idx;
+    }
+
+    /// Add the zone map fields of the value in the black box to the given
+    /// zone map, and its sketched fields to the given samples. Call this
+    /// before sweep(), which may empty the black box.
+    void sweepFieldStats(ZoneMap& zone_map, std::vector<SketchSample>& sketch_samples) const
+    {
+        if ((zone_map_fields_.empty() && sketch_fields_.empty()) || argos_record_.status == ArgosRecord::Status::DONT_READ)
+        {
+            return;
+        }
+
+        FieldStatsVisitor visitor(zone_map_fields_, sketch_fields_, zone_map, sketch_samples);
+        visitValues_(visitor);
+    }
+
     /// Called at the end of simulation / when the pipeline collector is destroyed.
     /// Given the DatabaseManager in case the collectable needs to write any final
     /// metadata etc.
@@ -139,6 +217,9 @@ public:
     }
 
 protected:
+    /// Declared first so that it outlives every buffer allocated from it.
+    std::shared_ptr<std::pmr::memory_resource> memory_resource_;
+
     ArgosRecord argos_record_;
 
     static bool logMinification_(const bool* log = nullptr)
@@ -154,7 +235,78 @@ protected:
         return tick_reader_ ? tick_reader_->getTick() : 0;
     }
 
+    /// Receives the serialized bytes of each value in the black box.
+    class ValueVisitor
+    {
+    public:
+        virtual ~ValueVisitor() = default;
+        virtual void visit(const char* bytes, size_t num_bytes) = 0;
+    };
+
+    /// Visit the current value(s) of this collectable.
+    virtual void visitValues_(ValueVisitor&) const
+    {
+    }
+
+    /// Called by sweep() before the black box is read, unless the status
+    /// is DONT_READ. Collectables that watch live memory refresh their
+    /// black box here.
+    virtual void onSweep_()
+    {
+    }
+
+    /// Serialized fields of one value, and the ones kept in zone maps / sketches.
+    std::vector<ZoneMapField> value_layout_;
+    std::vector<ZoneMapField> zone_map_fields_;
+    std::vector<ZoneMapField> sketch_fields_;
+    size_t value_num_bytes_ = 0;
+
 private:
+    /// Updates the zone map and sketch samples from each visited value.
+    class FieldStatsVisitor : public ValueVisitor
+    {
+    public:
+        FieldStatsVisitor(const std::vector<ZoneMapField>& zone_map_fields, const std::vector<ZoneMapField>& sketch_fields,
+                          ZoneMap& zone_map, std::vector<SketchSample>& sketch_samples)
+            : zone_map_fields_(zone_map_fields)
+            , sketch_fields_(sketch_fields)
+            , zone_map_(zone_map)
+            , sketch_samples_(sketch_samples)
+        {
+        }
+
+        void visit(const char* bytes, size_t num_bytes) override
+        {
+            zone_map_.scan(zone_map_fields_, bytes, num_bytes);
+            for (const auto& field : sketch_fields_)
+            {
+                if (field.offset + field.num_bytes <= num_bytes)
+                {
+                    SketchSample sample;
+                    sample.sketch_idx = (uint32_t)field.field_id;
+                    memcpy(&sample.bits, bytes + field.offset, std::min(field.num_bytes, sizeof(sample.bits)));
+                    sketch_samples_.push_back(sample);
+                }
+            }
+        }
+
+    private:
+        const std::vector<ZoneMapField>& zone_map_fields_;
+        const std::vector<ZoneMapField>& sketch_fields_;
+        ZoneMap& zone_map_;
+        std::vector<SketchSample>& sketch_samples_;
+    };
+
+    const ZoneMapField& getNumericField_(const std::string& field_name) const
+    {
+        auto field = findValueField(field_name);
+        if (!field || field->dtype == StructFields::string_t)
+        {
+            throw DBException("No numeric field named '") << field_name << "' in collectable of type " << dtype_;
+        }
+        return *field;
+    }
+
     const uint16_t elem_id_;
     const uint16_t clk_id_;
     const size_t heartbeat_;
@@ -165,16 +317,6 @@ private:
 
 #define LOG_MINIFICATION simdb::CollectionPointBase::minificationLoggingEnabled()
 
-template <typename T> struct is_std_vector : std::false_type
-{
-};
-
-template <typename T> struct is_std_vector<std::vector<T>> : std::true_type
-{
-};
-
-template <typename T> static constexpr bool is_std_vector_v = is_std_vector<T>::value;
-
 /// Collectable for non-iterable data (not a queue/vector/deque/etc.)
 ///   - POD
 ///   - struct
@@ -192,6 +334,8 @@ public:
     template <typename... Args>
     CollectionPoint(Args&&... args)
         : CollectionPointBase(std::forward<Args>(args)...)
+        , curr_data_(getMemoryResource())
+        , prev_data_(getMemoryResource())
     {
     }
 
@@ -241,11 +385,13 @@ private:
             if constexpr (std::is_trivial<T>::value && std::is_standard_layout<T>::value)
             {
                 buffer << val;
+                value_in_record_ = true;
             }
             else
             {
                 StructSerializer<T>::getInstance()->extract(&val, curr_data_);
                 buffer << curr_data_;
+                value_in_record_ = false;
             }
             return;
         }
@@ -260,11 +406,13 @@ private:
                 if (LOG_MINIFICATION)
                     std::cout << "[simdb verbose] " << num_bytes << "<16, " << demangle(typeid(T).name()) << ": " << val << "\n";
                 buffer << val;
+                value_in_record_ = true;
                 return;
             }
         }
 
         StructSerializer<T>::getInstance()->extract(&val, curr_data_);
+        value_in_record_ = false;
         if (num_carry_overs_ < getHeartbeat() && curr_data_ == prev_data_)
         {
             if (LOG_MINIFICATION)
@@ -343,9 +491,28 @@ private:
         }
     }
 
-    std::vector<char> curr_data_;
-    std::vector<char> prev_data_;
+    /// The whole value is either written directly after the element ID in
+    /// the black box, or kept in curr_data_ (the record may only say CARRY).
+    void visitValues_(ValueVisitor& visitor) const override
+    {
+        if (value_in_record_)
+        {
+            const auto& data = argos_record_.data;
+            if (data.size() > sizeof(uint16_t))
+            {
+                visitor.visit(data.data() + sizeof(uint16_t), data.size() - sizeof(uint16_t));
+            }
+        }
+        else
+        {
+            visitor.visit(curr_data_.data(), curr_data_.size());
+        }
+    }
+
+    CollectionBytes curr_data_;
+    CollectionBytes prev_data_;
     size_t num_carry_overs_ = 0;
+    bool value_in_record_ = false;
 };
 
 /// Collectable for contiguous (non-sparse) iterable data e.g. queue/vector/deque/etc.
@@ -370,10 +537,15 @@ public:
         FULL
     };
 
-    ContigIterableCollectionPoint(uint16_t elem_id, uint16_t clk_id, size_t heartbeat, const std::string& dtype, size_t capacity)
-        : CollectionPointBase(elem_id, clk_id, heartbeat, dtype)
-        , curr_snapshot_(capacity)
-        , prev_snapshot_(capacity)
+    ContigIterableCollectionPoint(uint16_t elem_id,
+                                  uint16_t clk_id,
+                                  size_t heartbeat,
+                                  const std::string& dtype,
+                                  size_t capacity,
+                                  std::shared_ptr<std::pmr::memory_resource> memory_resource = nullptr)
+        : CollectionPointBase(elem_id, clk_id, heartbeat, dtype, std::move(memory_resource))
+        , curr_snapshot_(capacity, getMemoryResource())
+        , prev_snapshot_(capacity, getMemoryResource())
     {
     }
 
@@ -406,8 +578,8 @@ private:
     class IterableSnapshot
     {
     public:
-        IterableSnapshot(size_t expected_capacity)
-            : bytes_by_bin_(expected_capacity)
+        IterableSnapshot(size_t expected_capacity, std::pmr::memory_resource* memory_resource)
+            : bytes_by_bin_(expected_capacity, memory_resource)
         {
         }
 
@@ -429,12 +601,12 @@ private:
             return bytes_by_bin_.size();
         }
 
-        std::vector<char>& operator[](size_t idx)
+        CollectionBytes& operator[](size_t idx)
         {
             return bytes_by_bin_[idx];
         }
 
-        const std::vector<char>& operator[](size_t idx) const
+        const CollectionBytes& operator[](size_t idx) const
         {
             return bytes_by_bin_[idx];
         }
@@ -635,35 +807,32 @@ private:
             return Action::FULL;
         }
 
-        std::deque<std::vector<char>> bytes_by_bin_;
+        std::pmr::deque<CollectionBytes> bytes_by_bin_;
         size_t action_count_ = 0;
     };
 
     /// Write the collectable bytes in the smallest form possible.
     template <typename T> void minify_(const T& container)
     {
-        auto size = container.size();
-        if (size > prev_snapshot_.capacity())
-        {
-            size = prev_snapshot_.capacity();
-        }
+        using traits = iterable_traits<T>;
+        const auto size = std::min<size_t>(traits::size(container), prev_snapshot_.capacity());
 
         queue_max_size_ = std::max(queue_max_size_, (uint16_t)size);
         curr_snapshot_.clear();
 
-        auto itr = container.begin();
-        auto eitr = container.end();
+        // Elements are packed into the bins in order, up to the first null one
         uint16_t bin_idx = 0;
-
-        while (itr != eitr && bin_idx < size)
-        {
-            if (!writeStruct_(*itr, curr_snapshot_, bin_idx))
-            {
-                break;
-            }
-            ++itr;
-            ++bin_idx;
-        }
+        traits::forEachSlot(container,
+                            size,
+                            [&](size_t, const auto& el)
+                            {
+                                if (!writeStruct_(el, curr_snapshot_, bin_idx))
+                                {
+                                    return false;
+                                }
+                                ++bin_idx;
+                                return true;
+                            });
 
         // Let the current snapshot take into account the previous
         // snapshot, and figure out the most compact way to represent
@@ -695,6 +864,20 @@ private:
         return true;
     }
 
+    /// Scan every element in the container, not just the ones this
+    /// sweep's record says have changed.
+    void visitValues_(ValueVisitor& visitor) const override
+    {
+        for (uint16_t idx = 0; idx < curr_snapshot_.capacity(); ++idx)
+        {
+            const auto& bin = curr_snapshot_[idx];
+            if (!bin.empty())
+            {
+                visitor.visit(bin.data(), bin.size());
+            }
+        }
+    }
+
     /// Write the maximum size of this queue during simulation. This is used
     /// for Argos' SchedulingLines feature.
     ///
@@ -710,9 +893,15 @@ private:
 class SparseIterableCollectionPoint : public CollectionPointBase
 {
 public:
-    SparseIterableCollectionPoint(uint16_t elem_id, uint16_t clk_id, size_t heartbeat, const std::string& dtype, size_t capacity)
-        : CollectionPointBase(elem_id, clk_id, heartbeat, dtype)
+    SparseIterableCollectionPoint(uint16_t elem_id,
+                                  uint16_t clk_id,
+                                  size_t heartbeat,
+                                  const std::string& dtype,
+                                  size_t capacity,
+                                  std::shared_ptr<std::pmr::memory_resource> memory_resource = nullptr)
+        : CollectionPointBase(elem_id, clk_id, heartbeat, dtype, std::move(memory_resource))
         , expected_capacity_(capacity)
+        , prev_data_by_bin_(getMemoryResource())
     {
         prev_data_by_bin_.resize(capacity);
         num_carry_overs_by_bin_.resize(capacity, 0);
@@ -748,61 +937,28 @@ private:
     /// for sparse iterables types.
     template <typename T> void minify_(const T& container)
     {
-        uint16_t num_valid = 0;
-
-        {
-            auto itr = container.begin();
-            auto eitr = container.end();
-
-            while (itr != eitr)
-            {
-                if constexpr (is_std_vector_v<T>)
-                {
-                    if (*itr)
-                    {
-                        ++num_valid;
-                    }
-                }
-                else if (itr.isValid())
-                {
-                    ++num_valid;
-                }
-                ++itr;
-            }
-        }
-
-        queue_max_size_ = std::max(queue_max_size_, num_valid);
-
         CollectionBuffer buffer(argos_record_.data, getElemId());
         if (LOG_MINIFICATION)
             std::cout << "\n\n[simdb verbose] tick " << getTick_() << ", cid " << getElemId() << "\n";
 
+        // The number of valid elements is filled in once we have seen them all
+        const auto num_valid_offset = argos_record_.data.size();
+        uint16_t num_valid = 0;
         buffer << num_valid;
-        if (LOG_MINIFICATION)
-            std::cout << "[simdb verbose] num valid: " << num_valid << "\n";
 
-        uint16_t bin_idx = 0;
-        auto itr = container.begin();
-        auto eitr = container.end();
-        while (itr != eitr && bin_idx < expected_capacity_)
-        {
-            bool valid;
-            if constexpr (is_std_vector_v<T>)
-            {
-                valid = *itr != nullptr;
-            }
-            else
-            {
-                valid = itr.isValid();
-            }
+        iterable_traits<T>::forEachSlot(container,
+                                        expected_capacity_,
+                                        [&](size_t bin_idx, const auto& el)
+                                        {
+                                            num_valid += writeStruct_(el, buffer, (uint16_t)bin_idx);
+                                            return true;
+                                        });
 
-            if (valid)
-            {
-                writeStruct_(*itr, buffer, bin_idx);
-            }
-            ++itr;
-            ++bin_idx;
-        }
+        memcpy(argos_record_.data.data() + num_valid_offset, &num_valid, sizeof(num_valid));
+        queue_max_size_ = std::max(queue_max_size_, num_valid);
+
+        if (LOG_MINIFICATION)
+            std::cout << "[simdb verbose] num valid: " << num_valid << "\n";
     }
 
     template <typename T>
@@ -828,6 +984,28 @@ private:
         return true;
     }
 
+    /// The black box holds every valid element:
+    ///     uint16_t elem_id, uint16_t num_valid, num_valid x {uint16_t bin_idx, <element bytes>}
+    void visitValues_(ValueVisitor& visitor) const override
+    {
+        const auto& data = argos_record_.data;
+        if (data.size() < 2 * sizeof(uint16_t) || !value_num_bytes_)
+        {
+            return;
+        }
+
+        uint16_t num_valid = 0;
+        memcpy(&num_valid, data.data() + sizeof(uint16_t), sizeof(num_valid));
+
+        size_t offset = 2 * sizeof(uint16_t);
+        for (uint16_t idx = 0; idx < num_valid && offset + sizeof(uint16_t) + value_num_bytes_ <= data.size(); ++idx)
+        {
+            offset += sizeof(uint16_t);
+            visitor.visit(data.data() + offset, value_num_bytes_);
+            offset += value_num_bytes_;
+        }
+    }
+
     /// Write the maximum size of this queue during simulation. This is used
     /// for Argos' SchedulingLines feature.
     ///
@@ -835,9 +1013,166 @@ private:
     void postSim(DatabaseManager* db_mgr) override;
 
     const size_t expected_capacity_;
-    std::vector<std::vector<char>> prev_data_by_bin_;
+    std::pmr::vector<CollectionBytes> prev_data_by_bin_;
     std::vector<size_t> num_carry_overs_by_bin_;
     uint16_t queue_max_size_ = 0;
 };
 
+/// Collectable for a flat region of raw memory, e.g. a register file, a small
+/// cache, or a memory array. Only a few bytes of these typically change each
+/// cycle, so instead of serializing every entry we keep a shadow copy of the
+/// region and write the fixed-size blocks that differ from it:
+///
+///     KEYFRAME: <all region bytes>
+///     PATCH:    uint32_t num_blocks, num_blocks x {uint32_t block_idx, <block bytes>}
+///     CARRY:    nothing changed
+///
+/// The last block is shorter if the region size is not a multiple of the
+/// block size. A KEYFRAME is written on the first sweep, at least once
+/// every heartbeat sweeps, and whenever a patch would not be smaller.
+/// See RegionReplayer for the reader side.
+class RegionCollectionPoint : public CollectionPointBase
+{
+public:
+    enum class Action : uint8_t
+    {
+        KEYFRAME,
+        PATCH,
+        CARRY
+    };
+
+    RegionCollectionPoint(uint16_t elem_id,
+                          uint16_t clk_id,
+                          size_t heartbeat,
+                          const std::string& dtype,
+                          const void* base,
+                          size_t num_bytes,
+                          size_t block_size,
+                          std::shared_ptr<std::pmr::memory_resource> memory_resource = nullptr)
+        : CollectionPointBase(elem_id, clk_id, heartbeat, dtype, std::move(memory_resource))
+        , base_(static_cast<const char*>(base))
+        , num_bytes_(num_bytes)
+        , block_size_(block_size)
+        , shadow_(num_bytes, 0, getMemoryResource())
+    {
+        if (!base || !num_bytes || !block_size)
+        {
+            throw DBException("Region collectables need a base address, a size, and a block size");
+        }
+        if ((num_bytes + block_size - 1) / block_size > std::numeric_limits<uint32_t>::max())
+        {
+            throw DBException("Too many blocks in region collectable: ") << num_bytes << " bytes, " << block_size << "-byte blocks";
+        }
+    }
+
+    /// Get the data type string the CollectionMgr gives region collectables.
+    static std::string getRegionDataTypeStr(size_t num_bytes, size_t block_size)
+    {
+        return "region_bytes" + std::to_string(num_bytes) + "_block" + std::to_string(block_size);
+    }
+
+    size_t getNumBytes() const
+    {
+        return num_bytes_;
+    }
+
+    size_t getBlockSize() const
+    {
+        return block_size_;
+    }
+
+    /// Collect this region on every sweep until deactivate() is called. Each
+    /// sweep diffs the region against what was last collected.
+    /// NOTE: There is no reason to call deactivate() on your own if "bool once = true".
+    void activate(bool once = false)
+    {
+        argos_record_.status = once ? ArgosRecord::Status::READ_ONCE : ArgosRecord::Status::READ;
+    }
+
+    /// Remove this collectable from the black box (do not collect anymore until activate() is called again).
+    void deactivate()
+    {
+        argos_record_.status = ArgosRecord::Status::DONT_READ;
+    }
+
+private:
+    void onSweep_() override
+    {
+        minify_();
+    }
+
+    void minify_()
+    {
+        CollectionBuffer buffer(argos_record_.data, getElemId());
+        if (LOG_MINIFICATION)
+            std::cout << "\n\n[simdb verbose] tick " << getTick_() << ", cid " << getElemId() << "\n";
+
+        const bool keyframe_due = !has_keyframe_ || num_patches_ >= getHeartbeat();
+
+        // One full-region compare (memcmp is vectorized) before looking at
+        // the individual blocks.
+        if (!keyframe_due && memcmp(base_, shadow_.data(), num_bytes_) == 0)
+        {
+            if (LOG_MINIFICATION)
+                std::cout << "[simdb verbose] CARRY\n";
+            buffer << Action::CARRY;
+            ++num_patches_;
+            return;
+        }
+
+        dirty_blocks_.clear();
+        size_t patch_bytes = sizeof(uint32_t);
+        if (!keyframe_due)
+        {
+            const uint32_t num_blocks = (num_bytes_ + block_size_ - 1) / block_size_;
+            for (uint32_t block_idx = 0; block_idx < num_blocks; ++block_idx)
+            {
+                const auto offset = block_idx * block_size_;
+                const auto block_bytes = std::min(block_size_, num_bytes_ - offset);
+                if (memcmp(base_ + offset, shadow_.data() + offset, block_bytes) != 0)
+                {
+                    dirty_blocks_.push_back(block_idx);
+                    patch_bytes += sizeof(uint32_t) + block_bytes;
+                }
+            }
+        }
+
+        if (keyframe_due || patch_bytes >= num_bytes_)
+        {
+            if (LOG_MINIFICATION)
+                std::cout << "[simdb verbose] KEYFRAME " << num_bytes_ << " bytes\n";
+            buffer << Action::KEYFRAME;
+            buffer.append(base_, num_bytes_);
+            memcpy(shadow_.data(), base_, num_bytes_);
+            has_keyframe_ = true;
+            num_patches_ = 0;
+            return;
+        }
+
+        if (LOG_MINIFICATION)
+            std::cout << "[simdb verbose] PATCH " << dirty_blocks_.size() << " blocks, " << patch_bytes << " bytes\n";
+        buffer << Action::PATCH;
+        buffer << (uint32_t)dirty_blocks_.size();
+        for (auto block_idx : dirty_blocks_)
+        {
+            const auto offset = block_idx * block_size_;
+            const auto block_bytes = std::min(block_size_, num_bytes_ - offset);
+            buffer << block_idx;
+            buffer.append(base_ + offset, block_bytes);
+            memcpy(shadow_.data() + offset, base_ + offset, block_bytes);
+        }
+        ++num_patches_;
+    }
+
+    const char* const base_;
+    const size_t num_bytes_;
+    const size_t block_size_;
+
+    /// Region bytes as of the last record we wrote.
+    CollectionBytes shadow_;
+    std::vector<uint32_t> dirty_blocks_;
+    bool has_keyframe_ = false;
+    size_t num_patches_ = 0;
+};
+
 } // namespace simdb
@@ -1,16 +1,65 @@
 #pragma once
 
+#include "simdb/serialize/SinkBackend.hpp"
+#include "simdb/serialize/ValueSketches.hpp"
+#include "simdb/serialize/ZoneMap.hpp"
+#include "simdb/utils/Compress.hpp"
 #include "simdb/utils/ConcurrentQueue.hpp"
 #include "simdb/utils/Thread.hpp"
 
+#include <memory>
+#include <set>
+
 namespace simdb
 {
 
+/// Layout of the bytes in a CollectionRecords.Data blob.
+enum class RecordFormat : int32_t
+{
+    /// The bytes from a single call to CollectionMgr::sweep().
+    SWEEP = 0,
+
+    /// Several consecutive sweeps framed together (see EntryCoalescer).
+    COALESCED = 1,
+
+    /// Several consecutive sweeps regrouped element-major (see EntryCoalescer).
+    TRANSPOSED = 2
+};
+
 struct DatabaseEntry
 {
     std::vector<char> bytes;
     bool compressed = false;
     uint64_t tick = 0;
+
+    /// Last tick covered by this entry. Only differs from the
+    /// tick for COALESCED entries.
+    uint64_t end_tick = 0;
+
+    RecordFormat format = RecordFormat::SWEEP;
+
+    /// RecordFilters bitmask of the transforms applied before compression,
+    /// and the element size used by the byte shuffle (if any).
+    int32_t filters = 0;
+    uint32_t shuffle_stride = 0;
+
+    /// Database ID of the clock that was swept.
+    uint32_t clock_id = 0;
+
+    /// Number of bytes each collectable wrote to this sweep, in sweep order.
+    /// Only filled in when the element-major layout is enabled.
+    std::vector<uint32_t> segment_sizes;
+
+    /// Preset dictionary to compress this entry with (may be null).
+    std::shared_ptr<const CompressionDictionary> dictionary;
+
+    /// Min/max of the zone map fields over this entry's sweeps.
+    ZoneMap zone_map;
+
+    /// Values of the sketched fields in this entry's sweeps. These are fed
+    /// to the FieldSketches (and cleared) by the first sink thread to pick
+    /// up the entry.
+    std::vector<SketchSample> sketch_samples;
 };
 
 class DatabaseManager;
@@ -18,18 +67,28 @@ class DatabaseManager;
 class DatabaseThread : public Thread
 {
 public:
-    DatabaseThread(DatabaseManager* db_mgr)
-        : Thread(500)
+    /// Records are written to the given backend, or to the CollectionRecords
+    /// table if there is none.
+    DatabaseThread(DatabaseManager* db_mgr, std::unique_ptr<SinkBackend> backend = nullptr)
+        : Thread(500, "simdb-db")
         , db_mgr_(db_mgr)
+        , backend_(backend ? std::move(backend) : std::make_unique<SqliteSinkBackend>(db_mgr))
     {
     }
 
     void push(DatabaseEntry&& entry)
     {
-        queue_.emplace(std::move(entry));
+        enqueue(std::move(entry));
         startThreadLoop();
     }
 
+    /// Queue up an entry without starting the polling thread. Used when
+    /// flush() is driven externally (see TaskExecutor).
+    void enqueue(DatabaseEntry&& entry)
+    {
+        queue_.emplace(std::move(entry));
+    }
+
     void teardown()
     {
         flush();
@@ -48,7 +107,33 @@ public:
 
     void flush();
 
+    /// Feed the entry's sketch samples to the given shard of the field
+    /// sketches, or to any free shard if none is given.
+    void updateSketches(DatabaseEntry& entry, FieldSketches::Shard* shard = nullptr)
+    {
+        if (!entry.sketch_samples.empty())
+        {
+            if (shard)
+            {
+                shard->update(entry.sketch_samples);
+            }
+            else
+            {
+                field_sketches_.update(entry.sketch_samples);
+            }
+            entry.sketch_samples.clear();
+        }
+    }
+
+    FieldSketches& getFieldSketches()
+    {
+        return field_sketches_;
+    }
+
 private:
+    /// Write the entry's zone map to the CollectionZoneMaps table.
+    void writeZoneMap_(const DatabaseEntry& entry);
+
     void onInterval_() override
     {
         flush();
@@ -56,7 +141,19 @@ private:
 
     ConcurrentQueue<DatabaseEntry> queue_;
     DatabaseManager* db_mgr_;
+    std::unique_ptr<SinkBackend> backend_;
     uint64_t num_processed_ = 0;
+
+    /// IDs of the compression dictionaries already in the database.
+    std::set<int32_t> written_dictionary_ids_;
+
+    /// Number of StringMap strings already in the database. The StringMap
+    /// is shared by every database in the process, so each one writes the
+    /// strings it has not seen yet.
+    uint32_t num_strings_written_ = 0;
+
+    /// Distributions of the fields given to CollectionMgr::addSketch().
+    FieldSketches field_sketches_;
 };
 
 } // namespace simdb
@@ -0,0 +1,91 @@
+// <DictionaryTrainer.hpp> -*- C++ -*-
+
+#pragma once
+
+#include "simdb/serialize/DatabaseThread.hpp"
+#include "simdb/utils/Compress.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace simdb
+{
+
+/*!
+ * \class DictionaryTrainer
+ *
+ * \brief Builds the zlib preset dictionary for a run from its first N
+ *        sweeps, or hands out a preset dictionary given up front (e.g.
+ *        from a previous run's CompressionDictionaries table).
+ *
+ * Sweeps from one simulation repeat the same collectable IDs, struct
+ * layouts and slowly-changing values over and over, so the most recent
+ * sweeps make a good dictionary for the ones that follow. Entries seen
+ * before the dictionary is ready are compressed without one.
+ */
+class DictionaryTrainer
+{
+public:
+    /// \param num_training_sweeps Number of sweeps to build the dictionary from.
+    ///                            Zero disables training.
+    /// \param preset Dictionary bytes to use from the very first sweep. If not
+    ///               empty, no training is done.
+    DictionaryTrainer(size_t num_training_sweeps, const std::vector<char>& preset = std::vector<char>())
+        : num_training_sweeps_(num_training_sweeps)
+    {
+        if (!preset.empty())
+        {
+            dictionary_ = makeDictionary_(preset);
+        }
+    }
+
+    /// Check if entries will ever be given a dictionary.
+    bool enabled() const
+    {
+        return dictionary_ || num_training_sweeps_ > 0;
+    }
+
+    /// Get the dictionary to compress this entry with (null until trained).
+    /// The entry is used as a training sample if we still need more.
+    std::shared_ptr<const CompressionDictionary> observe(const DatabaseEntry& entry)
+    {
+        if (!dictionary_ && num_sweeps_seen_ < num_training_sweeps_)
+        {
+            samples_.insert(samples_.end(), entry.bytes.begin(), entry.bytes.end());
+
+            // Only the tail is used, so don't hold onto more than we need
+            if (samples_.size() > 2 * CompressionDictionary::MAX_BYTES)
+            {
+                samples_.erase(samples_.begin(), samples_.end() - CompressionDictionary::MAX_BYTES);
+            }
+
+            if (++num_sweeps_seen_ == num_training_sweeps_)
+            {
+                dictionary_ = makeDictionary_(samples_);
+                std::vector<char>().swap(samples_);
+            }
+        }
+
+        return dictionary_;
+    }
+
+private:
+    /// zlib looks back from the end of the dictionary, so keep the tail
+    /// (the most recent sweeps) if there is too much.
+    static std::shared_ptr<const CompressionDictionary> makeDictionary_(const std::vector<char>& bytes)
+    {
+        auto dictionary = std::make_shared<CompressionDictionary>();
+        dictionary->id = 1;
+
+        auto begin = bytes.size() > CompressionDictionary::MAX_BYTES ? bytes.end() - CompressionDictionary::MAX_BYTES : bytes.begin();
+        dictionary->bytes.assign(begin, bytes.end());
+        return dictionary;
+    }
+
+    const size_t num_training_sweeps_;
+    size_t num_sweeps_seen_ = 0;
+    std::vector<char> samples_;
+    std::shared_ptr<const CompressionDictionary> dictionary_;
+};
+
+} // namespace simdb
@@ -0,0 +1,495 @@
+// <EntryCoalescer.hpp> -*- C++ -*-
+
+#pragma once
+
+#include "simdb/serialize/DatabaseThread.hpp"
+#include "simdb/utils/Compress.hpp"
+#include "simdb/utils/TransformFilters.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace simdb
+{
+
+/// Compress the entry if it is not already compressed, after running the
+/// byte shuffle filter on it if requested. The entry's preset dictionary
+/// is used if it has one. The scratch buffer is swapped
+/// into the entry, so callers can reuse it across calls.
+inline void compressDatabaseEntry(DatabaseEntry& entry,
+                                  std::vector<char>& scratch,
+                                  int compression_level = 1,
+                                  const TransformFilters& filters = TransformFilters())
+{
+    if (entry.compressed)
+    {
+        return;
+    }
+
+    if (filters.byte_shuffle && filters.shuffle_stride > 1)
+    {
+        byteShuffle(entry.bytes, scratch, filters.shuffle_stride);
+        std::swap(entry.bytes, scratch);
+        entry.filters |= FILTER_BYTE_SHUFFLE;
+        entry.shuffle_stride = filters.shuffle_stride;
+    }
+
+    compressDataVec(entry.bytes, scratch, compression_level, entry.dictionary.get());
+    std::swap(entry.bytes, scratch);
+    entry.compressed = true;
+}
+
+/*!
+ * \class EntryCoalescer
+ *
+ * \brief Concatenates consecutive DatabaseEntry objects into a single
+ *        COALESCED entry. A sweep of a few hundred bytes compresses
+ *        poorly on its own and costs a whole CollectionRecords row, so
+ *        we batch sweeps up to a byte and/or tick budget first.
+ *
+ * A COALESCED blob starts with an uncompressed tick directory, so that
+ * readers can list the ticks in a record without decompressing it:
+ *
+ *     uint32_t num_ticks
+ *     num_ticks x { uint64_t tick, uint32_t num_bytes }
+ *     <sweep bytes for each tick, back to back>
+ *
+ * Only the sweep bytes after the directory are filtered (see the
+ * record's Filters bitmask) and compressed (if IsCompressed is set).
+ *
+ * In element-major mode the batch is written as a TRANSPOSED record
+ * instead, where each collectable's bytes for all the batch's ticks are
+ * grouped into their own block:
+ *
+ *     uint32_t num_ticks
+ *     num_ticks x uint64_t tick
+ *     uint32_t num_elems
+ *     num_elems x { uint16_t elem_id, uint32_t block_num_bytes }
+ *     <blocks, back to back>
+ *
+ * Each block is filtered and compressed on its own, and holds:
+ *
+ *     num_ticks x uint32_t num_bytes (zero if not collected that tick)
+ *     <the collectable's bytes for each tick, back to back>
+ *
+ * A sweep is rebuilt by concatenating the elements' bytes for that tick
+ * in directory order. The directory is therefore ordered so that it agrees
+ * with the element order of every sweep in the batch, even when some
+ * collectables are missing from some sweeps.
+ */
+class EntryCoalescer
+{
+public:
+    /// \param max_bytes Stop adding entries once the batch would exceed
+    ///                  this many (uncompressed) bytes. Zero means no limit.
+    /// \param max_ticks Stop adding entries once the batch would span this
+    ///                  many ticks. Zero means no limit.
+    /// \param filters   Transforms to run on the sweep bytes before compression.
+    /// \param element_major Write batches as TRANSPOSED records.
+    EntryCoalescer(size_t max_bytes,
+                   size_t max_ticks,
+                   const TransformFilters& filters = TransformFilters(),
+                   bool element_major = false)
+        : max_bytes_(max_bytes)
+        , max_ticks_(max_ticks)
+        , filters_(filters)
+        , element_major_(element_major)
+    {
+    }
+
+    const TransformFilters& getFilters() const
+    {
+        return filters_;
+    }
+
+    bool isElementMajor() const
+    {
+        return element_major_;
+    }
+
+    /// Coalescing is disabled if neither budget was given.
+    bool enabled() const
+    {
+        return max_bytes_ || max_ticks_;
+    }
+
+    bool empty() const
+    {
+        return batch_.empty();
+    }
+
+    /// Check if the entry can join the current batch without going over budget.
+    bool accepts(const DatabaseEntry& entry) const
+    {
+        if (batch_.empty())
+        {
+            return true;
+        }
+
+        if (entry.compressed || entry.format != RecordFormat::SWEEP)
+        {
+            return false;
+        }
+
+        if (max_bytes_ && num_bytes_ + entry.bytes.size() > max_bytes_)
+        {
+            return false;
+        }
+
+        if (max_ticks_ && entry.tick - batch_.front().tick >= max_ticks_)
+        {
+            return false;
+        }
+
+        // XOR-delta only pays off between sweeps of the same clock
+        if (filters_.xor_delta && entry.clock_id != batch_.front().clock_id)
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    /// Add an entry to the current batch. Call accepts() first.
+    void add(DatabaseEntry&& entry)
+    {
+        num_bytes_ += entry.bytes.size();
+        batch_.emplace_back(std::move(entry));
+    }
+
+    /// Take the current batch and start a new one.
+    std::vector<DatabaseEntry> takeBatch()
+    {
+        std::vector<DatabaseEntry> batch;
+        std::swap(batch, batch_);
+        num_bytes_ = 0;
+        return batch;
+    }
+
+    /// Frame the current batch into one entry (see frame()) and start a new batch.
+    DatabaseEntry release(bool compress, std::vector<char>& scratch)
+    {
+        return frame(takeBatch(), compress, scratch, filters_, element_major_);
+    }
+
+    /// Frame a batch of consecutive entries into one entry, filtering and
+    /// compressing the sweep bytes if requested. A batch of one is returned
+    /// as a regular SWEEP entry. Filters are only applied when compressing.
+    static DatabaseEntry frame(std::vector<DatabaseEntry>&& batch,
+                               bool compress,
+                               std::vector<char>& scratch,
+                               const TransformFilters& filters = TransformFilters(),
+                               bool element_major = false)
+    {
+        DatabaseEntry coalesced;
+        if (batch.size() == 1)
+        {
+            coalesced = std::move(batch.front());
+            if (compress)
+            {
+                compressDatabaseEntry(coalesced, scratch, 1, filters);
+            }
+            return coalesced;
+        }
+        else if (batch.empty())
+        {
+            return coalesced;
+        }
+
+        if (element_major && hasSegmentSizes_(batch))
+        {
+            auto transposed = frameElementMajor_(batch, compress, scratch, filters);
+            transposed.zone_map = mergeZoneMaps_(batch);
+            return transposed;
+        }
+
+        coalesced.tick = batch.front().tick;
+        coalesced.end_tick = batch.back().tick;
+        coalesced.format = RecordFormat::COALESCED;
+        coalesced.clock_id = batch.front().clock_id;
+        coalesced.zone_map = mergeZoneMaps_(batch);
+        if (compress)
+        {
+            coalesced.dictionary = batch.front().dictionary;
+        }
+
+        // Tick directory
+        auto& bytes = coalesced.bytes;
+        const uint32_t num_ticks = batch.size();
+        append_(bytes, &num_ticks, sizeof(num_ticks));
+
+        size_t payload_bytes = 0;
+        for (const auto& entry : batch)
+        {
+            const uint64_t tick = entry.tick;
+            const uint32_t num_bytes = entry.bytes.size();
+            append_(bytes, &tick, sizeof(tick));
+            append_(bytes, &num_bytes, sizeof(num_bytes));
+            payload_bytes += num_bytes;
+        }
+
+        // Sweep payloads
+        const bool xor_delta = compress && filters.xor_delta;
+        std::vector<char> payload;
+        payload.reserve(payload_bytes);
+        for (size_t idx = 0; idx < batch.size(); ++idx)
+        {
+            const auto& sweep = batch[idx].bytes;
+            const auto offset = payload.size();
+            payload.insert(payload.end(), sweep.begin(), sweep.end());
+
+            if (xor_delta && idx > 0)
+            {
+                const auto& prev = batch[idx - 1].bytes;
+                xorBytes(payload.data() + offset, sweep.size(), prev.data(), prev.size());
+            }
+        }
+
+        if (xor_delta)
+        {
+            coalesced.filters |= FILTER_XOR_DELTA;
+        }
+
+        if (compress && filters.byte_shuffle && filters.shuffle_stride > 1)
+        {
+            byteShuffle(payload, scratch, filters.shuffle_stride);
+            std::swap(payload, scratch);
+            coalesced.filters |= FILTER_BYTE_SHUFFLE;
+            coalesced.shuffle_stride = filters.shuffle_stride;
+        }
+
+        if (compress)
+        {
+            compressDataVec(payload, scratch, 1, coalesced.dictionary.get());
+            bytes.insert(bytes.end(), scratch.begin(), scratch.end());
+            coalesced.compressed = true;
+        }
+        else
+        {
+            bytes.insert(bytes.end(), payload.begin(), payload.end());
+        }
+
+        return coalesced;
+    }
+
+private:
+    /// Get the zone map covering every entry in the batch.
+    static ZoneMap mergeZoneMaps_(const std::vector<DatabaseEntry>& batch)
+    {
+        ZoneMap zone_map;
+        for (const auto& entry : batch)
+        {
+            zone_map.merge(entry.zone_map);
+        }
+        return zone_map;
+    }
+
+    /// Check that every entry knows where its collectables' bytes begin and end.
+    static bool hasSegmentSizes_(const std::vector<DatabaseEntry>& batch)
+    {
+        for (const auto& entry : batch)
+        {
+            size_t num_bytes = 0;
+            for (auto segment_size : entry.segment_sizes)
+            {
+                num_bytes += segment_size;
+            }
+
+            if (num_bytes != entry.bytes.size())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Write the batch as a TRANSPOSED record (see the class comments).
+    static DatabaseEntry frameElementMajor_(const std::vector<DatabaseEntry>& batch,
+                                            bool compress,
+                                            std::vector<char>& scratch,
+                                            const TransformFilters& filters)
+    {
+        struct ElementBlock
+        {
+            uint16_t elem_id;
+            std::vector<uint32_t> num_bytes_by_tick;
+            std::vector<char> bytes;
+        };
+
+        const auto num_ticks = batch.size();
+        std::vector<ElementBlock> blocks;
+
+        // Every collectable's bytes start with its element ID
+        for (size_t tick_idx = 0; tick_idx < num_ticks; ++tick_idx)
+        {
+            const auto& entry = batch[tick_idx];
+            size_t offset = 0;
+            for (auto segment_size : entry.segment_sizes)
+            {
+                uint16_t elem_id = 0;
+                memcpy(&elem_id, entry.bytes.data() + offset, sizeof(elem_id));
+
+                auto iter = std::find_if(
+                    blocks.begin(), blocks.end(), [elem_id](const ElementBlock& block) { return block.elem_id == elem_id; });
+                if (iter == blocks.end())
+                {
+                    blocks.push_back({elem_id, std::vector<uint32_t>(num_ticks, 0), {}});
+                    iter = blocks.end() - 1;
+                }
+
+                iter->num_bytes_by_tick[tick_idx] = segment_size;
+                iter->bytes.insert(iter->bytes.end(), entry.bytes.begin() + offset, entry.bytes.begin() + offset + segment_size);
+                offset += segment_size;
+            }
+        }
+
+        // The blocks are in first-appearance order. That only matches every
+        // sweep if no collectable first shows up in front of one that was
+        // already seen, so sort them by the "comes before" pairs of all the
+        // sweeps, keeping first-appearance order among unrelated elements.
+        const auto num_blocks = blocks.size();
+        auto get_block_idx = [&](uint16_t elem_id)
+        {
+            return std::find_if(blocks.begin(), blocks.end(), [elem_id](const ElementBlock& block) { return block.elem_id == elem_id; })
+                   - blocks.begin();
+        };
+
+        std::vector<std::vector<char>> successors(num_blocks, std::vector<char>(num_blocks, 0));
+        std::vector<size_t> num_predecessors(num_blocks, 0);
+        for (const auto& entry : batch)
+        {
+            size_t offset = 0;
+            size_t prev_idx = num_blocks;
+            for (auto segment_size : entry.segment_sizes)
+            {
+                uint16_t elem_id = 0;
+                memcpy(&elem_id, entry.bytes.data() + offset, sizeof(elem_id));
+                offset += segment_size;
+
+                const size_t block_idx = get_block_idx(elem_id);
+                if (prev_idx != num_blocks && !successors[prev_idx][block_idx])
+                {
+                    successors[prev_idx][block_idx] = 1;
+                    ++num_predecessors[block_idx];
+                }
+                prev_idx = block_idx;
+            }
+        }
+
+        std::vector<ElementBlock> sorted_blocks;
+        std::vector<char> placed(num_blocks, 0);
+        while (sorted_blocks.size() < num_blocks)
+        {
+            // The first unplaced block with no unplaced predecessors. Sweeps
+            // all follow the collectables' creation order, so there is
+            // always one; fall back to the first unplaced block regardless.
+            size_t next_idx = num_blocks;
+            for (size_t idx = 0; idx < num_blocks && next_idx == num_blocks; ++idx)
+            {
+                if (!placed[idx] && num_predecessors[idx] == 0)
+                {
+                    next_idx = idx;
+                }
+            }
+            if (next_idx == num_blocks)
+            {
+                next_idx = std::find(placed.begin(), placed.end(), 0) - placed.begin();
+            }
+
+            placed[next_idx] = 1;
+            for (size_t idx = 0; idx < num_blocks; ++idx)
+            {
+                if (successors[next_idx][idx] && num_predecessors[idx])
+                {
+                    --num_predecessors[idx];
+                }
+            }
+            sorted_blocks.emplace_back(std::move(blocks[next_idx]));
+        }
+        std::swap(blocks, sorted_blocks);
+
+        DatabaseEntry transposed;
+        transposed.tick = batch.front().tick;
+        transposed.end_tick = batch.back().tick;
+        transposed.format = RecordFormat::TRANSPOSED;
+        transposed.clock_id = batch.front().clock_id;
+        transposed.compressed = compress;
+        if (compress)
+        {
+            transposed.dictionary = batch.front().dictionary;
+        }
+
+        const bool shuffle = compress && filters.byte_shuffle && filters.shuffle_stride > 1;
+        if (shuffle)
+        {
+            transposed.filters |= FILTER_BYTE_SHUFFLE;
+            transposed.shuffle_stride = filters.shuffle_stride;
+        }
+
+        // Tick directory
+        auto& bytes = transposed.bytes;
+        const uint32_t num_ticks32 = num_ticks;
+        append_(bytes, &num_ticks32, sizeof(num_ticks32));
+        for (const auto& entry : batch)
+        {
+            const uint64_t tick = entry.tick;
+            append_(bytes, &tick, sizeof(tick));
+        }
+
+        // Element directory. The block sizes are filled in below.
+        const uint32_t num_elems = blocks.size();
+        append_(bytes, &num_elems, sizeof(num_elems));
+        const auto elem_directory_offset = bytes.size();
+        for (const auto& block : blocks)
+        {
+            const uint32_t block_num_bytes = 0;
+            append_(bytes, &block.elem_id, sizeof(block.elem_id));
+            append_(bytes, &block_num_bytes, sizeof(block_num_bytes));
+        }
+
+        // Element blocks
+        std::vector<char> block_bytes;
+        for (size_t elem_idx = 0; elem_idx < blocks.size(); ++elem_idx)
+        {
+            const auto& block = blocks[elem_idx];
+            block_bytes.clear();
+            append_(block_bytes, block.num_bytes_by_tick.data(), num_ticks * sizeof(uint32_t));
+            block_bytes.insert(block_bytes.end(), block.bytes.begin(), block.bytes.end());
+
+            if (shuffle)
+            {
+                byteShuffle(block_bytes, scratch, filters.shuffle_stride);
+                std::swap(block_bytes, scratch);
+            }
+
+            if (compress)
+            {
+                compressDataVec(block_bytes, scratch, 1, transposed.dictionary.get());
+                std::swap(block_bytes, scratch);
+            }
+
+            const uint32_t block_num_bytes = block_bytes.size();
+            const auto size_offset = elem_directory_offset + elem_idx * (sizeof(uint16_t) + sizeof(uint32_t)) + sizeof(uint16_t);
+            memcpy(bytes.data() + size_offset, &block_num_bytes, sizeof(block_num_bytes));
+            bytes.insert(bytes.end(), block_bytes.begin(), block_bytes.end());
+        }
+
+        return transposed;
+    }
+
+    static void append_(std::vector<char>& bytes, const void* data, size_t num_bytes)
+    {
+        auto src = static_cast<const char*>(data);
+        bytes.insert(bytes.end(), src, src + num_bytes);
+    }
+
+    const size_t max_bytes_;
+    const size_t max_ticks_;
+    const TransformFilters filters_;
+    const bool element_major_;
+    std::vector<DatabaseEntry> batch_;
+    size_t num_bytes_ = 0;
+};
+
+} // namespace simdb
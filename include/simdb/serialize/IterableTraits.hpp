@@ -0,0 +1,159 @@
+// <IterableTraits.hpp> -*- C++ -*-
+
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+namespace simdb
+{
+
+namespace iterable_detail
+{
+
+/// Iterators that can point at empty slots (e.g. sparta::Array) and say so
+/// with isValid().
+template <typename Container, typename = void> struct has_valid_iterators : std::false_type
+{
+};
+
+template <typename Container>
+struct has_valid_iterators<Container, std::void_t<decltype(std::begin(std::declval<const Container&>()).isValid())>> : std::true_type
+{
+};
+
+/// Contiguous storage: std::vector, std::array, C arrays, ...
+template <typename Container, typename = void> struct is_contiguous : std::false_type
+{
+};
+
+template <typename Container>
+struct is_contiguous<Container,
+                     std::void_t<decltype(std::data(std::declval<const Container&>())), decltype(std::size(std::declval<const Container&>()))>>
+    : std::true_type
+{
+};
+
+/// Indexed (but not contiguous) storage: std::deque, circular buffers, ...
+template <typename Container, typename = void> struct is_indexed : std::false_type
+{
+};
+
+template <typename Container>
+struct is_indexed<Container, std::void_t<decltype(std::declval<const Container&>()[size_t(0)]), decltype(std::declval<const Container&>().size())>>
+    : std::true_type
+{
+};
+
+template <typename Container, typename = void> struct has_size : std::false_type
+{
+};
+
+template <typename Container>
+struct has_size<Container, std::void_t<decltype(std::size(std::declval<const Container&>()))>> : std::true_type
+{
+};
+
+} // namespace iterable_detail
+
+/*!
+ * \struct iterable_traits
+ *
+ * \brief Tells the iterable collectables (see createIterableCollector())
+ *        how to walk a container. The default picks the fastest access the
+ *        container supports:
+ *
+ *          - Iterators with isValid(): forward iteration, skipping the
+ *            empty slots (e.g. sparta::Array / sparta::Buffer)
+ *          - Contiguous storage (std::vector, std::array, C arrays):
+ *            indexed loads from data()
+ *          - operator[] and size() (std::deque, circular buffers):
+ *            indexed loads
+ *          - Anything else with begin()/end() (std::list, intrusive
+ *            lists): forward iteration
+ *
+ *        Pointer elements that are null are treated as empty slots by the
+ *        collectables. Specialize this for containers that need something
+ *        else, e.g. an index-addressed sparse array with its own occupancy
+ *        bits:
+ *
+ *          template <> struct simdb::iterable_traits<MySparseArray>
+ *          {
+ *              using value_type = MyPacket;
+ *              static size_t size(const MySparseArray& arr);
+ *              template <typename Func>
+ *              static void forEachSlot(const MySparseArray& arr, size_t max_slots, Func&& func);
+ *          };
+ */
+template <typename Container, typename Enable = void> struct iterable_traits
+{
+    using value_type = std::remove_cv_t<std::remove_reference_t<decltype(*std::begin(std::declval<const Container&>()))>>;
+
+    /// Number of elements (or slots, for sparse containers).
+    static size_t size(const Container& container)
+    {
+        if constexpr (iterable_detail::has_size<Container>::value)
+        {
+            return std::size(container);
+        }
+        else
+        {
+            return std::distance(std::begin(container), std::end(container));
+        }
+    }
+
+    /// Call func(slot_idx, element) for the occupied slots among the first
+    /// max_slots, in order. Stops early if func returns false.
+    template <typename Func> static void forEachSlot(const Container& container, size_t max_slots, Func&& func)
+    {
+        if constexpr (iterable_detail::has_valid_iterators<Container>::value)
+        {
+            size_t slot_idx = 0;
+            for (auto itr = std::begin(container), eitr = std::end(container); itr != eitr && slot_idx < max_slots; ++itr, ++slot_idx)
+            {
+                if (itr.isValid() && !func(slot_idx, *itr))
+                {
+                    return;
+                }
+            }
+        }
+        else if constexpr (iterable_detail::is_contiguous<Container>::value)
+        {
+            const auto data = std::data(container);
+            const size_t num_slots = std::min<size_t>(std::size(container), max_slots);
+            for (size_t slot_idx = 0; slot_idx < num_slots; ++slot_idx)
+            {
+                if (!func(slot_idx, data[slot_idx]))
+                {
+                    return;
+                }
+            }
+        }
+        else if constexpr (iterable_detail::is_indexed<Container>::value)
+        {
+            const size_t num_slots = std::min<size_t>(container.size(), max_slots);
+            for (size_t slot_idx = 0; slot_idx < num_slots; ++slot_idx)
+            {
+                if (!func(slot_idx, container[slot_idx]))
+                {
+                    return;
+                }
+            }
+        }
+        else
+        {
+            size_t slot_idx = 0;
+            for (auto itr = std::begin(container), eitr = std::end(container); itr != eitr && slot_idx < max_slots; ++itr, ++slot_idx)
+            {
+                if (!func(slot_idx, *itr))
+                {
+                    return;
+                }
+            }
+        }
+    }
+};
+
+} // namespace simdb
@@ -0,0 +1,220 @@
+// <RecordDecoder.hpp> -*- C++ -*-
+
+#pragma once
+
+#include "simdb/Exceptions.hpp"
+#include "simdb/serialize/DatabaseThread.hpp"
+#include "simdb/utils/Compress.hpp"
+#include "simdb/utils/TransformFilters.hpp"
+
+#include <cstring>
+#include <vector>
+
+namespace simdb
+{
+
+/// One row of the CollectionRecords table, as written by the DatabaseThread.
+struct EncodedRecord
+{
+    uint64_t tick = 0;
+    std::vector<char> data;
+    bool compressed = false;
+    RecordFormat format = RecordFormat::SWEEP;
+    int32_t filters = FILTER_NONE;
+    size_t shuffle_stride = 0;
+    int32_t dictionary_id = 0;
+};
+
+/// The bytes of one CollectionMgr::sweep() call.
+struct DecodedSweep
+{
+    uint64_t tick = 0;
+    std::vector<char> bytes;
+};
+
+/*!
+ * \class RecordDecoder
+ *
+ * \brief Undoes what the sink threads did to the sweeps before they were
+ *        written: splits SWEEP, COALESCED, and TRANSPOSED records (see
+ *        EntryCoalescer) back into their sweeps, decompressing and inverting
+ *        the record's filters along the way. This is the C++ counterpart of
+ *        SplitRecord() in the Python viewer.
+ */
+class RecordDecoder
+{
+public:
+    /// \param dictionary Preset dictionary of the record (CompressionDictionaries
+    ///                   row with the record's DictionaryID), if it has one.
+    static std::vector<DecodedSweep> split(const EncodedRecord& record, const CompressionDictionary* dictionary = nullptr)
+    {
+        std::vector<DecodedSweep> sweeps;
+        switch (record.format)
+        {
+            case RecordFormat::SWEEP:
+                sweeps.emplace_back();
+                sweeps.back().tick = record.tick;
+                decodeBlock_(record, record.data.data(), record.data.size(), dictionary, sweeps.back().bytes);
+                break;
+
+            case RecordFormat::COALESCED:
+                splitCoalesced_(record, dictionary, sweeps);
+                break;
+
+            case RecordFormat::TRANSPOSED:
+                splitTransposed_(record, dictionary, sweeps);
+                break;
+
+            default:
+                throw DBException("Invalid record format ") << static_cast<int>(record.format);
+        }
+
+        return sweeps;
+    }
+
+private:
+    /// Decompress and unshuffle one block of a record.
+    static void decodeBlock_(const EncodedRecord& record,
+                             const char* data,
+                             size_t num_bytes,
+                             const CompressionDictionary* dictionary,
+                             std::vector<char>& out)
+    {
+        if (record.compressed)
+        {
+            decompressDataVec(data, num_bytes, out, dictionary);
+        }
+        else
+        {
+            out.assign(data, data + num_bytes);
+        }
+
+        if ((record.filters & FILTER_BYTE_SHUFFLE) && record.shuffle_stride > 1)
+        {
+            std::vector<char> unshuffled;
+            byteUnshuffle(out, unshuffled, record.shuffle_stride);
+            std::swap(out, unshuffled);
+        }
+    }
+
+    static void splitCoalesced_(const EncodedRecord& record, const CompressionDictionary* dictionary, std::vector<DecodedSweep>& sweeps)
+    {
+        Reader_ reader(record.data);
+        const auto num_ticks = reader.read<uint32_t>();
+
+        std::vector<uint32_t> num_bytes_by_tick(num_ticks);
+        sweeps.resize(num_ticks);
+        for (uint32_t idx = 0; idx < num_ticks; ++idx)
+        {
+            sweeps[idx].tick = reader.read<uint64_t>();
+            num_bytes_by_tick[idx] = reader.read<uint32_t>();
+        }
+
+        std::vector<char> payload;
+        decodeBlock_(record, reader.data(), reader.remaining(), dictionary, payload);
+
+        size_t offset = 0;
+        for (uint32_t idx = 0; idx < num_ticks; ++idx)
+        {
+            if (offset + num_bytes_by_tick[idx] > payload.size())
+            {
+                throw DBException("Truncated COALESCED record at tick ") << record.tick;
+            }
+
+            auto& bytes = sweeps[idx].bytes;
+            bytes.assign(payload.begin() + offset, payload.begin() + offset + num_bytes_by_tick[idx]);
+            offset += num_bytes_by_tick[idx];
+
+            if ((record.filters & FILTER_XOR_DELTA) && idx > 0)
+            {
+                const auto& prev = sweeps[idx - 1].bytes;
+                xorBytes(bytes.data(), bytes.size(), prev.data(), prev.size());
+            }
+        }
+    }
+
+    static void splitTransposed_(const EncodedRecord& record, const CompressionDictionary* dictionary, std::vector<DecodedSweep>& sweeps)
+    {
+        Reader_ reader(record.data);
+        const auto num_ticks = reader.read<uint32_t>();
+
+        sweeps.resize(num_ticks);
+        for (auto& sweep : sweeps)
+        {
+            sweep.tick = reader.read<uint64_t>();
+        }
+
+        const auto num_elems = reader.read<uint32_t>();
+        std::vector<uint32_t> block_num_bytes(num_elems);
+        for (auto& num_bytes : block_num_bytes)
+        {
+            reader.read<uint16_t>();
+            num_bytes = reader.read<uint32_t>();
+        }
+
+        // Each block holds one collectable's bytes for every tick (including
+        // its element ID), so the sweeps are rebuilt in directory order.
+        std::vector<char> block;
+        for (auto num_bytes : block_num_bytes)
+        {
+            decodeBlock_(record, reader.skip(num_bytes), num_bytes, dictionary, block);
+
+            Reader_ block_reader(block);
+            std::vector<uint32_t> num_bytes_by_tick(num_ticks);
+            for (auto& tick_num_bytes : num_bytes_by_tick)
+            {
+                tick_num_bytes = block_reader.read<uint32_t>();
+            }
+
+            for (uint32_t idx = 0; idx < num_ticks; ++idx)
+            {
+                auto src = block_reader.skip(num_bytes_by_tick[idx]);
+                sweeps[idx].bytes.insert(sweeps[idx].bytes.end(), src, src + num_bytes_by_tick[idx]);
+            }
+        }
+    }
+
+    /// Bounds-checked cursor over a record's bytes.
+    class Reader_
+    {
+    public:
+        explicit Reader_(const std::vector<char>& bytes)
+            : bytes_(bytes)
+        {
+        }
+
+        template <typename T> T read()
+        {
+            T val;
+            memcpy(&val, skip(sizeof(T)), sizeof(T));
+            return val;
+        }
+
+        const char* skip(size_t num_bytes)
+        {
+            if (offset_ + num_bytes > bytes_.size())
+            {
+                throw DBException("Truncated collection record");
+            }
+            auto ptr = bytes_.data() + offset_;
+            offset_ += num_bytes;
+            return ptr;
+        }
+
+        const char* data() const
+        {
+            return bytes_.data() + offset_;
+        }
+
+        size_t remaining() const
+        {
+            return bytes_.size() - offset_;
+        }
+
+    private:
+        const std::vector<char>& bytes_;
+        size_t offset_ = 0;
+    };
+};
+
+} // namespace simdb
@@ -0,0 +1,118 @@
+// <RegionReplayer.hpp> -*- C++ -*-
+
+#pragma once
+
+#include "simdb/Exceptions.hpp"
+#include "simdb/serialize/CollectionPoints.hpp"
+
+#include <cstring>
+#include <vector>
+
+namespace simdb
+{
+
+/*!
+ * \class RegionReplayer
+ *
+ * \brief Rebuilds the contents of a RegionCollectionPoint from its records.
+ *        Give it the collectable's bytes from each sweep in tick order
+ *        (starting at or before a KEYFRAME), and it applies the keyframes
+ *        and block patches to its copy of the region.
+ */
+class RegionReplayer
+{
+public:
+    using Action = RegionCollectionPoint::Action;
+
+    RegionReplayer(size_t num_bytes, size_t block_size)
+        : block_size_(block_size)
+        , bytes_(num_bytes, 0)
+    {
+        if (!num_bytes || !block_size)
+        {
+            throw DBException("Region replayers need a size and a block size");
+        }
+    }
+
+    /// Apply one record of the collectable (the bytes after its element ID).
+    ///
+    /// \return Returns the number of bytes read, so the caller can move on
+    ///         to the next collectable in the sweep.
+    ///
+    /// \throws Throws if the record is truncated, or if it is a PATCH and
+    ///         no KEYFRAME was replayed yet.
+    size_t replay(const char* data, size_t num_bytes)
+    {
+        size_t offset = 0;
+        auto read = [&](void* dst, size_t count)
+        {
+            if (offset + count > num_bytes)
+            {
+                throw DBException("Truncated region record");
+            }
+            memcpy(dst, data + offset, count);
+            offset += count;
+        };
+
+        uint8_t action = 0;
+        read(&action, sizeof(action));
+
+        switch (static_cast<Action>(action))
+        {
+            case Action::KEYFRAME:
+                read(bytes_.data(), bytes_.size());
+                has_keyframe_ = true;
+                break;
+
+            case Action::PATCH:
+            {
+                if (!has_keyframe_)
+                {
+                    throw DBException("Region patch replayed before any keyframe");
+                }
+
+                uint32_t num_blocks = 0;
+                read(&num_blocks, sizeof(num_blocks));
+                for (uint32_t idx = 0; idx < num_blocks; ++idx)
+                {
+                    uint32_t block_idx = 0;
+                    read(&block_idx, sizeof(block_idx));
+
+                    const size_t block_offset = (size_t)block_idx * block_size_;
+                    if (block_offset >= bytes_.size())
+                    {
+                        throw DBException("Region patch block ") << block_idx << " is out of range";
+                    }
+                    read(bytes_.data() + block_offset, std::min(block_size_, bytes_.size() - block_offset));
+                }
+                break;
+            }
+
+            case Action::CARRY:
+                break;
+
+            default:
+                throw DBException("Invalid region record action ") << (int)action;
+        }
+
+        return offset;
+    }
+
+    /// Whether a KEYFRAME has been replayed, i.e. whether getBytes() is valid.
+    bool hasKeyframe() const
+    {
+        return has_keyframe_;
+    }
+
+    const std::vector<char>& getBytes() const
+    {
+        return bytes_;
+    }
+
+private:
+    const size_t block_size_;
+    std::vector<char> bytes_;
+    bool has_keyframe_ = false;
+};
+
+} // namespace simdb
@@ -292,7 +292,6 @@ private:
 
     enum_map_t map_;
     std::string enum_name_;
-    mutable bool serialized_ = false;
 };
 
 /// \class FieldBase
@@ -626,17 +625,8 @@ public:
         throw DBException("Field not found: ") << name;
     }
 
-    void serializeDefn(DatabaseManager* db_mgr) const
-    {
-        static std::unordered_set<std::string> serialized_structs;
-        if (serialized_structs.insert(struct_name_).second)
-        {
-            for (auto& field : fields_)
-            {
-                field->serializeDefn(db_mgr, struct_name_);
-            }
-        }
-    }
+    /// Write the fields to the StructFields table (once per database).
+    void serializeDefn(DatabaseManager* db_mgr) const;
 
 private:
     const std::string struct_name_ = demangle(typeid(StructT).name());
@@ -688,6 +678,12 @@ public:
         return schema_.getStructNumBytes();
     }
 
+    /// Get the struct's fields, in the order they are serialized.
+    const std::vector<std::unique_ptr<FieldBase>>& getFields() const
+    {
+        return schema_.fields_;
+    }
+
     void serializeDefn(DatabaseManager* db_mgr) const
     {
         schema_.serializeDefn(db_mgr);
@@ -700,7 +696,7 @@ public:
         return field_serializer.numBytesWritten();
     }
 
-    void extract(const StructT* s, std::vector<char>& bytes) const
+    void extract(const StructT* s, CollectionBytes& bytes) const
     {
         CollectionBuffer buffer(bytes);
         writeStruct(s, buffer);
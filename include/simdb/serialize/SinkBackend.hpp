@@ -0,0 +1,131 @@
+// <SinkBackend.hpp> -*- C++ -*-
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace simdb
+{
+
+class DatabaseManager;
+struct DatabaseEntry;
+
+/// Where the DatabaseThread puts the collection records.
+enum class SinkBackendType
+{
+    /// One row per record in the CollectionRecords table.
+    SQLITE,
+
+    /// Raw record bytes appended to segment files next to the database,
+    /// with one CollectionSegments row per record saying where to find
+    /// them. DatabaseManager::importCollectionSegments() moves them into
+    /// CollectionRecords later on.
+    SEGMENT_FILES
+};
+
+/*!
+ * \class SinkBackend
+ *
+ * \brief Final stage of the collection pipeline. The DatabaseThread hands
+ *        every compressed (or raw) record to its backend from inside a
+ *        database transaction, so a backend may also write rows of its own.
+ */
+class SinkBackend
+{
+public:
+    virtual ~SinkBackend() = default;
+
+    /// Store one record.
+    virtual void writeRecord(const DatabaseEntry& entry) = 0;
+
+    /// Called at the end of every DatabaseThread::flush(), before its
+    /// transaction commits.
+    virtual void flush() {}
+};
+
+/// Writes each record as one CollectionRecords row (the default).
+class SqliteSinkBackend : public SinkBackend
+{
+public:
+    SqliteSinkBackend(DatabaseManager* db_mgr)
+        : db_mgr_(db_mgr)
+    {
+    }
+
+    void writeRecord(const DatabaseEntry& entry) override;
+
+private:
+    DatabaseManager* db_mgr_;
+};
+
+/*!
+ * \class SegmentFileSinkBackend
+ *
+ * \brief Appends the record bytes to "<database file>.seg<N>" files, and
+ *        indexes them in the CollectionSegments table by tick range,
+ *        segment ID, and byte offset. A new segment file is started once
+ *        the current one reaches the size limit.
+ *
+ *        Writes are plain buffered appends, so throughput is close to the
+ *        raw disk bandwidth. Each run starts a new segment after any that
+ *        are already indexed in the database or present on disk, so the
+ *        files kept by importCollectionSegments(false) are never reused.
+ */
+class SegmentFileSinkBackend : public SinkBackend
+{
+public:
+    SegmentFileSinkBackend(DatabaseManager* db_mgr, size_t max_segment_bytes)
+        : db_mgr_(db_mgr)
+        , max_segment_bytes_(max_segment_bytes)
+    {
+    }
+
+    ~SegmentFileSinkBackend() override
+    {
+        closeSegment_();
+    }
+
+    void writeRecord(const DatabaseEntry& entry) override;
+
+    /// Push the buffered bytes out to the file before the index rows
+    /// that point at them are committed.
+    void flush() override
+    {
+        if (segment_file_)
+        {
+            fflush(segment_file_);
+        }
+    }
+
+    /// Path of the given segment file for the given database file.
+    static std::string getSegmentFilePath(const std::string& db_filepath, int32_t segment_id)
+    {
+        return db_filepath + ".seg" + std::to_string(segment_id);
+    }
+
+    /// Highest N of the "<database file>.seg<N>" files that exist on disk,
+    /// or -1 if there are none.
+    static int32_t findMaxSegmentFileId(const std::string& db_filepath);
+
+private:
+    void openSegment_(int32_t segment_id);
+
+    void closeSegment_()
+    {
+        if (segment_file_)
+        {
+            fclose(segment_file_);
+            segment_file_ = nullptr;
+        }
+    }
+
+    DatabaseManager* db_mgr_;
+    const size_t max_segment_bytes_;
+    FILE* segment_file_ = nullptr;
+    int32_t segment_id_ = -1;
+    uint64_t segment_num_bytes_ = 0;
+};
+
+} // namespace simdb
@@ -0,0 +1,586 @@
+// <StatsReporter.hpp> -*- C++ -*-
+
+#pragma once
+
+#include "simdb/Exceptions.hpp"
+#include "simdb/sqlite/ValueContainer.hpp"
+#include "simdb/utils/ThreadPlacement.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace simdb
+{
+
+/// Output format of a StatsReporter.
+enum class StatsReportFormat
+{
+    /// One header row ("tick,<stat>,<stat>,...") followed by one row per sample.
+    CSV,
+
+    /// JSON Lines: one {"tick":N,"<stat>":value,...} object per sample.
+    JSON
+};
+
+/*!
+ * \class StatsReporter
+ *
+ * \brief Periodic CSV/JSON report of scalar statistics, written to disk
+ *        on a background thread.
+ *
+ * Statistics are registered up front with addStat() (backpointers or
+ * getters, see ScalarValueReader). The simulator then calls sample() every
+ * tick; every report_interval ticks the stats are read into a preallocated
+ * row of a bounded ring buffer and the call returns. Formatting and file I/O
+ * happen on the reporter's thread, which turns the rows into text with
+ * std::to_chars() and the header/key strings that were built once when
+ * the first row was sampled.
+ *
+ * Nothing is allocated per sample. If the writer falls max_buffered_rows
+ * behind, sample() waits for it to catch up (see getNumStalls()) instead of
+ * growing the buffer.
+ */
+class StatsReporter
+{
+public:
+    /// \param filename Report file. Overwritten if it exists.
+    /// \param format CSV or JSON Lines.
+    /// \param report_interval Write a row every this many ticks (on ticks
+    ///                        that are multiples of it).
+    /// \param max_buffered_rows Capacity of the ring buffer between sample()
+    ///                          and the writer thread.
+    /// \param placement Where the writer thread runs. Defaults to "simdb-stats".
+    StatsReporter(const std::string& filename,
+                  StatsReportFormat format,
+                  uint64_t report_interval = 1,
+                  size_t max_buffered_rows = 1024,
+                  const ThreadPlacement& placement = ThreadPlacement())
+        : filename_(filename)
+        , format_(format)
+        , report_interval_(report_interval)
+        , max_buffered_rows_(max_buffered_rows)
+        , placement_(placement)
+    {
+        if (report_interval_ == 0)
+        {
+            throw DBException("StatsReporter report interval must be nonzero");
+        }
+        if (max_buffered_rows_ == 0)
+        {
+            throw DBException("StatsReporter needs room for at least one buffered row");
+        }
+        validateThreadPlacement(placement_);
+    }
+
+    /// Flushes the remaining rows. Call close() instead to see write errors.
+    ~StatsReporter()
+    {
+        try
+        {
+            close();
+        }
+        catch (const std::exception& ex)
+        {
+            std::cerr << "[simdb] " << ex.what() << std::endl;
+        }
+    }
+
+    StatsReporter(const StatsReporter&) = delete;
+    StatsReporter& operator=(const StatsReporter&) = delete;
+
+    /// Report the value at the given address.
+    template <typename T> void addStat(const std::string& name, const T* backpointer)
+    {
+        addStat_(name, std::make_unique<Stat_<T>>(backpointer));
+    }
+
+    /// Report the value returned by the given getter.
+    template <typename T> void addStat(const std::string& name, std::function<T()> getter)
+    {
+        addStat_(name, std::make_unique<Stat_<T>>(getter));
+    }
+
+    size_t getNumStats() const
+    {
+        return stats_.size();
+    }
+
+    /// Call once per simulated tick. Samples the stats if the tick is due.
+    void sample(uint64_t tick)
+    {
+        if (tick < next_report_tick_)
+        {
+            return;
+        }
+        next_report_tick_ = (tick / report_interval_ + 1) * report_interval_;
+        sampleNow(tick);
+    }
+
+    /// Sample the stats now, regardless of the report interval.
+    void sampleNow(uint64_t tick)
+    {
+        if (closed_)
+        {
+            throw DBException("Cannot sample a closed StatsReporter");
+        }
+        start_();
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (tail_ - head_ == max_buffered_rows_)
+        {
+            ++num_stalls_;
+            writer_cv_.notify_one();
+            space_cv_.wait(lock, [this]() { return tail_ - head_ < max_buffered_rows_ || writer_exception_; });
+        }
+        rethrowWriterException_();
+        lock.unlock();
+
+        // Only the writer reads this row, and not until tail_ moves past it.
+        auto row = ring_.data() + (tail_ % max_buffered_rows_) * row_stride_;
+        row->u = tick;
+        for (size_t idx = 0; idx < stats_.size(); ++idx)
+        {
+            row[idx + 1] = stats_[idx]->read();
+        }
+
+        lock.lock();
+        if (++tail_ - head_ == wake_threshold_)
+        {
+            writer_cv_.notify_one();
+        }
+    }
+
+    /// Write out all buffered rows and close the file. No more samples
+    /// can be taken afterwards.
+    void close()
+    {
+        if (closed_)
+        {
+            return;
+        }
+        start_();
+        closed_ = true;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        writer_cv_.notify_one();
+        writer_.join();
+
+        if (fclose(file_) != 0 && !writer_exception_)
+        {
+            writer_exception_ = std::make_exception_ptr(DBException("Could not close stats report ") << filename_);
+        }
+        file_ = nullptr;
+        rethrowWriterException_();
+    }
+
+    /// Number of rows written to the file so far.
+    size_t getNumRowsWritten() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return head_;
+    }
+
+    /// Number of times sample() had to wait for the writer thread because
+    /// the ring buffer was full.
+    size_t getNumStalls() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return num_stalls_;
+    }
+
+private:
+    /// One sampled value. The stat's kind says which member is live.
+    union Word_
+    {
+        int64_t i;
+        uint64_t u;
+        double d;
+    };
+
+    enum class Kind_
+    {
+        SIGNED,
+        UNSIGNED,
+        FLOATING,
+        BOOL
+    };
+
+    class StatBase_
+    {
+    public:
+        StatBase_(Kind_ kind)
+            : kind(kind)
+        {
+        }
+
+        virtual ~StatBase_() = default;
+        virtual Word_ read() const = 0;
+
+        const Kind_ kind;
+    };
+
+    template <typename T> class Stat_ : public StatBase_
+    {
+    public:
+        template <typename Getter>
+        Stat_(Getter getter)
+            : StatBase_(getKind_())
+            , reader_(getter)
+        {
+        }
+
+        Word_ read() const override
+        {
+            Word_ word;
+            if constexpr (std::is_floating_point<T>::value)
+            {
+                word.d = static_cast<double>(reader_.getValue());
+            }
+            else if constexpr (std::is_signed<T>::value)
+            {
+                word.i = static_cast<int64_t>(reader_.getValue());
+            }
+            else
+            {
+                word.u = static_cast<uint64_t>(reader_.getValue());
+            }
+            return word;
+        }
+
+    private:
+        static constexpr Kind_ getKind_()
+        {
+            if constexpr (std::is_same<T, bool>::value)
+            {
+                return Kind_::BOOL;
+            }
+            else if constexpr (std::is_floating_point<T>::value)
+            {
+                return Kind_::FLOATING;
+            }
+            else if constexpr (std::is_signed<T>::value)
+            {
+                return Kind_::SIGNED;
+            }
+            else
+            {
+                return Kind_::UNSIGNED;
+            }
+        }
+
+        ScalarValueReader<T> reader_;
+    };
+
+    void addStat_(const std::string& name, std::unique_ptr<StatBase_> stat)
+    {
+        if (started_)
+        {
+            throw DBException("Cannot add stat ") << name << " after the StatsReporter has started";
+        }
+        if (name.empty() || name == "tick" || !stat_names_.insert(name).second)
+        {
+            throw DBException("Invalid or duplicate stat name '") << name << "'";
+        }
+        names_.push_back(name);
+        stats_.emplace_back(std::move(stat));
+    }
+
+    /// Build the header and keys, open the file, and launch the writer.
+    void start_()
+    {
+        if (started_)
+        {
+            return;
+        }
+
+        file_ = fopen(filename_.c_str(), "wb");
+        if (!file_)
+        {
+            throw DBException("Could not open stats report ") << filename_;
+        }
+        started_ = true;
+
+        if (format_ == StatsReportFormat::CSV)
+        {
+            header_ = "tick";
+            for (const auto& name : names_)
+            {
+                header_ += "," + csvField_(name);
+            }
+            header_ += "\n";
+        }
+        else
+        {
+            keys_.push_back("{\"tick\":");
+            for (const auto& name : names_)
+            {
+                keys_.push_back(",\"" + jsonEscape_(name) + "\":");
+            }
+        }
+
+        // Longest possible row: every key plus the longest number to_chars
+        // can produce (double is 24 chars) and the row terminator.
+        max_row_len_ = 3;
+        for (const auto& key : keys_)
+        {
+            max_row_len_ += key.size();
+        }
+        max_row_len_ += (stats_.size() + 1) * (kMaxNumberLen + 1);
+
+        row_stride_ = stats_.size() + 1;
+        ring_.resize(row_stride_ * max_buffered_rows_);
+        wake_threshold_ = std::max<size_t>(1, max_buffered_rows_ / 4);
+        out_.resize(std::max<size_t>(kOutputBufferLen, max_row_len_));
+
+        writer_ = std::thread([this]() { writerLoop_(); });
+    }
+
+    void writerLoop_()
+    {
+        applyThreadPlacement(placement_, "simdb-stats");
+
+        try
+        {
+            write_(header_.data(), header_.size());
+            while (true)
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                writer_cv_.wait_for(lock, std::chrono::milliseconds(100), [this]() { return stop_ || tail_ - head_ >= wake_threshold_; });
+                const size_t begin = head_;
+                const size_t end = tail_;
+                const bool stopping = stop_;
+                lock.unlock();
+
+                size_t num_bytes = 0;
+                for (size_t row_idx = begin; row_idx < end; ++row_idx)
+                {
+                    if (num_bytes + max_row_len_ > out_.size())
+                    {
+                        write_(out_.data(), num_bytes);
+                        num_bytes = 0;
+                    }
+                    num_bytes = formatRow_(ring_.data() + (row_idx % max_buffered_rows_) * row_stride_, num_bytes);
+                }
+                write_(out_.data(), num_bytes);
+
+                lock.lock();
+                head_ = end;
+                lock.unlock();
+                space_cv_.notify_one();
+
+                if (stopping && begin == end)
+                {
+                    break;
+                }
+            }
+
+            if (fflush(file_) != 0)
+            {
+                throw DBException("Could not write stats report ") << filename_;
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            writer_exception_ = std::current_exception();
+            space_cv_.notify_all();
+        }
+    }
+
+    /// Append one row to out_ at the given offset. Returns the new offset.
+    size_t formatRow_(const Word_* row, size_t offset)
+    {
+        char* dst = out_.data() + offset;
+        char* const last = out_.data() + out_.size();
+        const bool json = format_ == StatsReportFormat::JSON;
+
+        if (json)
+        {
+            dst = append_(dst, keys_[0]);
+        }
+        dst = std::to_chars(dst, last, row[0].u).ptr;
+
+        for (size_t idx = 0; idx < stats_.size(); ++idx)
+        {
+            if (json)
+            {
+                dst = append_(dst, keys_[idx + 1]);
+            }
+            else
+            {
+                *dst++ = ',';
+            }
+
+            const auto word = row[idx + 1];
+            switch (stats_[idx]->kind)
+            {
+                case Kind_::SIGNED:
+                    dst = std::to_chars(dst, last, word.i).ptr;
+                    break;
+                case Kind_::UNSIGNED:
+                    dst = std::to_chars(dst, last, word.u).ptr;
+                    break;
+                case Kind_::BOOL:
+                    if (json)
+                    {
+                        dst = word.u ? append_(dst, "true", 4) : append_(dst, "false", 5);
+                    }
+                    else
+                    {
+                        *dst++ = word.u ? '1' : '0';
+                    }
+                    break;
+                case Kind_::FLOATING:
+                    // JSON has no NaN/Inf literals
+                    if (json && !std::isfinite(word.d))
+                    {
+                        dst = append_(dst, "null", 4);
+                    }
+                    else
+                    {
+                        dst = std::to_chars(dst, last, word.d).ptr;
+                    }
+                    break;
+            }
+        }
+
+        if (json)
+        {
+            *dst++ = '}';
+        }
+        *dst++ = '\n';
+        return dst - out_.data();
+    }
+
+    static char* append_(char* dst, const std::string& str)
+    {
+        return append_(dst, str.data(), str.size());
+    }
+
+    static char* append_(char* dst, const char* str, size_t len)
+    {
+        memcpy(dst, str, len);
+        return dst + len;
+    }
+
+    void write_(const char* data, size_t num_bytes)
+    {
+        if (num_bytes && fwrite(data, 1, num_bytes, file_) != num_bytes)
+        {
+            throw DBException("Could not write stats report ") << filename_;
+        }
+    }
+
+    void rethrowWriterException_()
+    {
+        if (writer_exception_)
+        {
+            std::rethrow_exception(writer_exception_);
+        }
+    }
+
+    static std::string csvField_(const std::string& name)
+    {
+        if (name.find_first_of(",\"\r\n") == std::string::npos)
+        {
+            return name;
+        }
+
+        std::string quoted = "\"";
+        for (auto ch : name)
+        {
+            if (ch == '"')
+            {
+                quoted += '"';
+            }
+            quoted += ch;
+        }
+        return quoted + "\"";
+    }
+
+    static std::string jsonEscape_(const std::string& name)
+    {
+        std::string escaped;
+        for (auto ch : name)
+        {
+            if (ch == '"' || ch == '\\')
+            {
+                escaped += '\\';
+                escaped += ch;
+            }
+            else if (static_cast<unsigned char>(ch) < 0x20)
+            {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", ch);
+                escaped += buf;
+            }
+            else
+            {
+                escaped += ch;
+            }
+        }
+        return escaped;
+    }
+
+    /// Longest text std::to_chars() produces for an int64/uint64/double.
+    static constexpr size_t kMaxNumberLen = 24;
+
+    /// Rows are formatted into a buffer of this size and written in one call.
+    static constexpr size_t kOutputBufferLen = 1 << 16;
+
+    const std::string filename_;
+    const StatsReportFormat format_;
+    const uint64_t report_interval_;
+    const size_t max_buffered_rows_;
+    const ThreadPlacement placement_;
+
+    std::vector<std::string> names_;
+    std::unordered_set<std::string> stat_names_;
+    std::vector<std::unique_ptr<StatBase_>> stats_;
+    uint64_t next_report_tick_ = 0;
+
+    /// CSV header row / JSON keys ({"tick": and ,"<stat>":).
+    std::string header_;
+    std::vector<std::string> keys_;
+    size_t max_row_len_ = 0;
+
+    /// Ring of max_buffered_rows_ rows, each the tick followed by one word
+    /// per stat. head_/tail_ count rows and only ever grow.
+    std::vector<Word_> ring_;
+    size_t row_stride_ = 0;
+    size_t head_ = 0;
+    size_t tail_ = 0;
+    size_t wake_threshold_ = 1;
+    size_t num_stalls_ = 0;
+
+    /// Writer thread state. out_ is only touched by the writer.
+    std::vector<char> out_;
+    FILE* file_ = nullptr;
+    std::thread writer_;
+    mutable std::mutex mutex_;
+    std::condition_variable writer_cv_;
+    std::condition_variable space_cv_;
+    std::exception_ptr writer_exception_;
+    bool started_ = false;
+    bool stop_ = false;
+    bool closed_ = false;
+};
+
+} // namespace simdb
@@ -1,10 +1,17 @@
 #pragma once
 
+#include "simdb/serialize/CollectionConfig.hpp"
 #include "simdb/serialize/DatabaseThread.hpp"
+#include "simdb/serialize/DictionaryTrainer.hpp"
+#include "simdb/serialize/EntryCoalescer.hpp"
 #include "simdb/utils/Compress.hpp"
 #include "simdb/utils/ConcurrentQueue.hpp"
+#include "simdb/utils/TaskExecutor.hpp"
 #include "simdb/utils/Thread.hpp"
 
+#include <condition_variable>
+#include <map>
+
 namespace simdb
 {
 
@@ -12,14 +19,31 @@ namespace simdb
 /// DatabaseEntry objects. Each of these threads can have its own compression
 /// or no compression at all. They individually regulate their own internals
 /// in response to their % of the total work load (higher/lower/no compression).
+///
+/// If coalescing is enabled, consecutive entries are framed together into
+/// one compressed entry (see EntryCoalescer). Batches never outlive one
+/// onInterval_() call, which bounds the added latency to the interval.
 class SinkThread : public Thread
 {
 public:
-    SinkThread(ConcurrentQueue<DatabaseEntry>& queue, DatabaseThread& db_thread)
-        : Thread(500)
+    SinkThread(ConcurrentQueue<DatabaseEntry>& queue,
+               DatabaseThread& db_thread,
+               size_t sink_idx = 0,
+               const CollectionConfig& config = CollectionConfig())
+        : Thread(500, "simdb-sink" + std::to_string(sink_idx))
         , queue_(queue)
         , db_thread_(db_thread)
+        , coalescer_(config.coalesce_max_bytes, config.coalesce_max_ticks, config.filters, config.element_major)
+        , filters_(config.filters)
+        , sketch_shard_(db_thread.getFieldSketches().acquireShard())
+    {
+    }
+
+    /// Stop the thread before its sketch shard is handed back for merging.
+    ~SinkThread()
     {
+        stopThreadLoop();
+        db_thread_.getFieldSketches().releaseShard(sketch_shard_);
     }
 
 private:
@@ -28,9 +52,30 @@ private:
     /// reference across all SinkThread objects (and is owned by the ThreadedSink).
     void onInterval_() override
     {
+        if (coalescer_.enabled())
+        {
+            auto add_to_batch = [this](DatabaseEntry& entry)
+            {
+                if (!coalescer_.accepts(entry))
+                {
+                    return false;
+                }
+                db_thread_.updateSketches(entry, sketch_shard_);
+                coalescer_.add(std::move(entry));
+                return true;
+            };
+
+            while (queue_.consume_while(add_to_batch))
+            {
+                db_thread_.push(coalescer_.release(true, compressed_bytes_));
+            }
+            return;
+        }
+
         DatabaseEntry entry;
         while (queue_.try_pop(entry))
         {
+            db_thread_.updateSketches(entry, sketch_shard_);
             compress_(entry);
             db_thread_.push(std::move(entry));
         }
@@ -39,19 +84,17 @@ private:
     /// Compress the entry if we are able.
     void compress_(DatabaseEntry& entry)
     {
-        if (entry.compressed)
-        {
-            return;
-        }
-
-        compressDataVec(entry.bytes, compressed_bytes_, 1);
-        std::swap(entry.bytes, compressed_bytes_);
-        entry.compressed = true;
+        compressDatabaseEntry(entry, compressed_bytes_, 1, filters_);
     }
 
     ConcurrentQueue<DatabaseEntry>& queue_;
     DatabaseThread& db_thread_;
     std::vector<char> compressed_bytes_;
+    EntryCoalescer coalescer_;
+    const TransformFilters filters_;
+
+    /// This thread's own field sketches (see FieldSketches)
+    FieldSketches::Shard* const sketch_shard_;
 };
 
 /// This class holds onto a configurable number of threads that work on
@@ -67,28 +110,99 @@ private:
 ///
 /// All that to say that the total number of threads is the number of
 /// SinkThreads plus the DatabaseThread.
+///
+/// Alternatively, the sink can run on the process-wide TaskExecutor. In
+/// that mode it owns no threads at all: each entry is compressed by a task
+/// on any worker, and the database writes are funneled through a
+/// SerialTaskQueue so they still happen one at a time in push() order.
 class ThreadedSink
 {
 public:
     ThreadedSink(DatabaseManager* db_mgr, size_t num_compression_threads = 1)
-        : db_thread_(db_mgr)
+        : ThreadedSink(db_mgr, makeConfig_(num_compression_threads))
+    {
+    }
+
+    ThreadedSink(DatabaseManager* db_mgr, const CollectionConfig& config)
+        : db_thread_(db_mgr, makeBackend_(db_mgr, config))
+        , coalescer_(config.coalesce_max_bytes, config.coalesce_max_ticks, config.filters, config.element_major)
+        , dictionary_trainer_(config.dictionary_training_sweeps, config.preset_dictionary)
     {
-        for (size_t i = 0; i < num_compression_threads; ++i)
+        if (config.use_shared_executor)
+        {
+            executor_ = TaskExecutor::getInstance();
+            db_task_queue_ = std::make_unique<SerialTaskQueue>(executor_);
+        }
+        else
         {
-            auto thread = std::make_unique<SinkThread>(compression_queue_, db_thread_);
-            sink_threads_.emplace_back(std::move(thread));
+            for (size_t i = 0; i < config.num_compression_threads; ++i)
+            {
+                auto thread = std::make_unique<SinkThread>(compression_queue_, db_thread_, i, config);
+                auto placement = config.sink_thread_placement;
+                if (!placement.name.empty())
+                {
+                    placement.name = getIndexedThreadName(placement.name, i);
+                }
+                thread->setPlacement(placement);
+                sink_threads_.emplace_back(std::move(thread));
+            }
         }
+
+        db_thread_.setPlacement(config.db_thread_placement);
     }
 
     void push(DatabaseEntry&& entry)
     {
+        // Dictionaries only matter if someone is going to compress the entry
+        if (dictionary_trainer_.enabled() && (executor_ || !sink_threads_.empty()))
+        {
+            entry.dictionary = dictionary_trainer_.observe(entry);
+        }
+
+        if (executor_)
+        {
+            // Batches are formed here on the caller's thread (which only
+            // moves the entries), while framing and compression happen on
+            // the executor.
+            if (coalescer_.enabled())
+            {
+                if (!coalescer_.accepts(entry))
+                {
+                    submitTask_(coalescer_.takeBatch());
+                }
+                coalescer_.add(std::move(entry));
+            }
+            else
+            {
+                std::vector<DatabaseEntry> batch;
+                batch.emplace_back(std::move(entry));
+                submitTask_(std::move(batch));
+            }
+            return;
+        }
+
         compression_queue_.emplace(std::move(entry));
         startThreads_();
     }
 
     void flush()
     {
-        if (!sink_threads_.empty())
+        if (executor_)
+        {
+            if (!coalescer_.empty())
+            {
+                submitTask_(coalescer_.takeBatch());
+            }
+
+            // Allow the in-flight compression tasks and any scheduled
+            // database writes to finish. The last task to finish wakes us.
+            {
+                std::unique_lock<std::mutex> lock(in_flight_mutex_);
+                in_flight_cv_.wait(lock, [this]() { return num_tasks_in_flight_ == 0; });
+            }
+            db_task_queue_->waitUntilIdle();
+        }
+        else if (!sink_threads_.empty())
         {
             // Allow the threads to finish their work.
             while (!compression_queue_.empty())
@@ -115,11 +229,17 @@ public:
 
         // Stop the compression threads.
         sink_threads_.clear();
+        db_task_queue_.reset();
 
         // Flush and stop the database thread.
         db_thread_.teardown();
     }
 
+    FieldSketches& getFieldSketches()
+    {
+        return db_thread_.getFieldSketches();
+    }
+
 private:
     void startThreads_()
     {
@@ -133,10 +253,122 @@ private:
         }
     }
 
+    static CollectionConfig makeConfig_(size_t num_compression_threads)
+    {
+        CollectionConfig config;
+        config.num_compression_threads = num_compression_threads;
+        return config;
+    }
+
+    static std::unique_ptr<SinkBackend> makeBackend_(DatabaseManager* db_mgr, const CollectionConfig& config)
+    {
+        switch (config.sink_backend)
+        {
+            case SinkBackendType::SEGMENT_FILES:
+                return std::make_unique<SegmentFileSinkBackend>(db_mgr, config.segment_file_max_bytes);
+            case SinkBackendType::SQLITE:
+                break;
+        }
+        return std::make_unique<SqliteSinkBackend>(db_mgr);
+    }
+
+    /// Frame and compress a batch of entries on any executor worker, then
+    /// hand the result to the database in sequence order.
+    void submitTask_(std::vector<DatabaseEntry>&& batch)
+    {
+        const auto seq = next_seq_to_submit_++;
+        {
+            std::lock_guard<std::mutex> lock(in_flight_mutex_);
+            ++num_tasks_in_flight_;
+        }
+
+        auto pending = std::make_shared<std::vector<DatabaseEntry>>(std::move(batch));
+        executor_->submit(
+            [this, seq, pending]()
+            {
+                auto& field_sketches = db_thread_.getFieldSketches();
+                auto sketch_shard = field_sketches.acquireShard();
+                for (auto& pending_entry : *pending)
+                {
+                    db_thread_.updateSketches(pending_entry, sketch_shard);
+                }
+                field_sketches.releaseShard(sketch_shard);
+
+                thread_local std::vector<char> scratch;
+                auto entry = EntryCoalescer::frame(std::move(*pending), true, scratch, coalescer_.getFilters(), coalescer_.isElementMajor());
+
+                {
+                    // Compression tasks finish out of order. Only release the
+                    // entries whose predecessors have all been released.
+                    std::lock_guard<std::mutex> lock(reorder_mutex_);
+                    completed_entries_.emplace(seq, std::move(entry));
+
+                    auto iter = completed_entries_.begin();
+                    while (iter != completed_entries_.end() && iter->first == next_seq_to_write_)
+                    {
+                        db_thread_.enqueue(std::move(iter->second));
+                        iter = completed_entries_.erase(iter);
+                        ++next_seq_to_write_;
+                    }
+                }
+
+                scheduleDatabaseFlush_();
+
+                // Notify while holding the lock: flush() may return (and
+                // the sink be destroyed) as soon as the count hits zero.
+                std::lock_guard<std::mutex> lock(in_flight_mutex_);
+                if (--num_tasks_in_flight_ == 0)
+                {
+                    in_flight_cv_.notify_all();
+                }
+            });
+    }
+
+    /// Post a database flush unless one is already waiting to run. Entries
+    /// that arrive while a flush is waiting are picked up by that flush,
+    /// which batches many records into one transaction.
+    void scheduleDatabaseFlush_()
+    {
+        if (!db_flush_pending_.exchange(true))
+        {
+            db_task_queue_->post(
+                [this]()
+                {
+                    db_flush_pending_ = false;
+                    db_thread_.flush();
+                });
+        }
+    }
+
     ConcurrentQueue<DatabaseEntry> compression_queue_;
     DatabaseThread db_thread_;
     std::vector<std::unique_ptr<SinkThread>> sink_threads_;
     bool threads_running_ = false;
+
+    /// Batches entries for the shared executor when coalescing is enabled.
+    EntryCoalescer coalescer_;
+
+    /// Hands out the preset compression dictionary (once there is one).
+    DictionaryTrainer dictionary_trainer_;
+
+    /// Shared executor (nullptr when using dedicated threads).
+    TaskExecutor* executor_ = nullptr;
+
+    /// Serializes this sink's database writes on the shared executor.
+    std::unique_ptr<SerialTaskQueue> db_task_queue_;
+
+    /// Reorder buffer for compression tasks that finish out of order.
+    std::mutex reorder_mutex_;
+    std::map<uint64_t, DatabaseEntry> completed_entries_;
+    uint64_t next_seq_to_submit_ = 0;
+    uint64_t next_seq_to_write_ = 0;
+
+    /// Compression tasks submitted but not yet finished. flush() waits on
+    /// in_flight_cv_ for this to reach zero.
+    std::mutex in_flight_mutex_;
+    std::condition_variable in_flight_cv_;
+    uint64_t num_tasks_in_flight_ = 0;
+    std::atomic<bool> db_flush_pending_{false};
 };
 
 } // namespace simdb
@@ -0,0 +1,708 @@
+// <ValueSketches.hpp> -*- C++ -*-
+
+#pragma once
+
+#include "simdb/Exceptions.hpp"
+#include "simdb/serialize/Serialize.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace simdb
+{
+
+/// One value of a sketched field, as swept from a collectable. The value's
+/// serialized bytes are kept as-is in the low bytes of 'bits'.
+struct SketchSample
+{
+    uint32_t sketch_idx = 0;
+    uint64_t bits = 0;
+};
+
+/*!
+ * \class HyperLogLog
+ *
+ * \brief Distinct value count estimate in 2^precision bytes. The relative
+ *        error is about 1.04 / sqrt(2^precision), i.e. ~1.6% by default.
+ */
+class HyperLogLog
+{
+public:
+    explicit HyperLogLog(const uint8_t precision = 12)
+        : precision_(precision)
+        , registers_(size_t(1) << precision, 0)
+    {
+        if (precision < 4 || precision > 18)
+        {
+            throw DBException("HyperLogLog precision must be in [4,18], got ") << (int)precision;
+        }
+    }
+
+    /// Add a (well mixed) 64-bit hash of a value.
+    void add(const uint64_t hash)
+    {
+        const auto idx = hash >> (64 - precision_);
+
+        // The sentinel bit keeps the rank within [1, 64-precision+1]
+        const auto w = (hash << precision_) | (uint64_t(1) << (precision_ - 1));
+        const auto rank = uint8_t(countLeadingZeros_(w) + 1);
+        registers_[idx] = std::max(registers_[idx], rank);
+    }
+
+    /// Estimate the number of distinct values added so far.
+    double estimate() const
+    {
+        const double m = (double)registers_.size();
+        double sum = 0;
+        size_t num_zeros = 0;
+        for (auto reg : registers_)
+        {
+            sum += std::ldexp(1.0, -reg);
+            num_zeros += reg == 0;
+        }
+
+        const double alpha = 0.7213 / (1 + 1.079 / m);
+        const double raw = alpha * m * m / sum;
+
+        // Linear counting is more accurate for small cardinalities
+        if (raw <= 2.5 * m && num_zeros)
+        {
+            return m * std::log(m / (double)num_zeros);
+        }
+        return raw;
+    }
+
+    /// Combine with another sketch of the same precision.
+    void merge(const HyperLogLog& other)
+    {
+        if (other.precision_ != precision_)
+        {
+            throw DBException("Cannot merge HyperLogLog sketches of different precisions");
+        }
+        for (size_t idx = 0; idx < registers_.size(); ++idx)
+        {
+            registers_[idx] = std::max(registers_[idx], other.registers_[idx]);
+        }
+    }
+
+private:
+    static int countLeadingZeros_(uint64_t val)
+    {
+        int count = 0;
+        while (!(val & (uint64_t(1) << 63)))
+        {
+            val <<= 1;
+            ++count;
+        }
+        return count;
+    }
+
+    const uint8_t precision_;
+    std::vector<uint8_t> registers_;
+};
+
+/*!
+ * \class CountMinTopK
+ *
+ * \brief Heavy hitters: a count-min sketch for approximate per-value counts,
+ *        and the k values with the largest counts seen so far. Counts are
+ *        never underestimated, and overestimated by at most 2N/width with
+ *        probability 1 - 2^-depth (N being the number of values added).
+ */
+class CountMinTopK
+{
+public:
+    CountMinTopK(const size_t width = 2048, const size_t depth = 4, const size_t k = 16)
+        : width_(width)
+        , depth_(depth)
+        , k_(k)
+        , counts_(width * depth, 0)
+    {
+        if (!width || !depth || !k)
+        {
+            throw DBException("CountMinTopK dimensions must be nonzero");
+        }
+    }
+
+    /// Add one occurrence of the given value (hash is a well mixed hash of it).
+    void add(const uint64_t value, const uint64_t hash)
+    {
+        const auto h1 = hash & 0xffffffff;
+        const auto h2 = (hash >> 32) | 1;
+
+        uint64_t count = std::numeric_limits<uint64_t>::max();
+        for (size_t row = 0; row < depth_; ++row)
+        {
+            auto& counter = counts_[row * width_ + (h1 + row * h2) % width_];
+            count = std::min(count, ++counter);
+        }
+
+        offerTopK_(value, hash, count);
+    }
+
+    /// Combine with another sketch of the same dimensions. The counters
+    /// are summed, and the heavy hitters of both are re-ranked by their
+    /// merged counts.
+    void merge(const CountMinTopK& other)
+    {
+        if (other.width_ != width_ || other.depth_ != depth_ || other.k_ != k_)
+        {
+            throw DBException("Cannot merge CountMinTopK sketches of different dimensions");
+        }
+        for (size_t idx = 0; idx < counts_.size(); ++idx)
+        {
+            counts_[idx] += other.counts_[idx];
+        }
+
+        auto candidates = std::move(top_k_);
+        candidates.insert(other.top_k_.begin(), other.top_k_.end());
+        top_k_.clear();
+        for (const auto& kvp : candidates)
+        {
+            offerTopK_(kvp.first, kvp.second.hash, estimate_(kvp.second.hash));
+        }
+    }
+
+    /// Get the heavy hitters as {value, estimated count}, largest count first.
+    std::vector<std::pair<uint64_t, uint64_t>> getTopK() const
+    {
+        std::vector<std::pair<uint64_t, uint64_t>> top_k;
+        for (const auto& kvp : top_k_)
+        {
+            top_k.emplace_back(kvp.first, kvp.second.count);
+        }
+        std::sort(top_k.begin(), top_k.end(), [](const auto& a, const auto& b)
+                  { return a.second != b.second ? a.second > b.second : a.first < b.first; });
+        return top_k;
+    }
+
+private:
+    /// Estimated count of the value with the given hash.
+    uint64_t estimate_(const uint64_t hash) const
+    {
+        const auto h1 = hash & 0xffffffff;
+        const auto h2 = (hash >> 32) | 1;
+
+        uint64_t count = std::numeric_limits<uint64_t>::max();
+        for (size_t row = 0; row < depth_; ++row)
+        {
+            count = std::min(count, counts_[row * width_ + (h1 + row * h2) % width_]);
+        }
+        return count;
+    }
+
+    /// Keep the value in the top k if its count is large enough.
+    void offerTopK_(const uint64_t value, const uint64_t hash, const uint64_t count)
+    {
+        auto iter = top_k_.find(value);
+        if (iter != top_k_.end())
+        {
+            const bool was_min = iter->second.count == min_top_count_;
+            iter->second.count = count;
+            if (was_min)
+            {
+                recomputeMin_();
+            }
+        }
+        else if (top_k_.size() < k_)
+        {
+            top_k_[value] = {count, hash};
+            min_top_count_ = top_k_.size() == 1 ? count : std::min(min_top_count_, count);
+        }
+        else if (count > min_top_count_)
+        {
+            for (auto evict = top_k_.begin(); evict != top_k_.end(); ++evict)
+            {
+                if (evict->second.count == min_top_count_)
+                {
+                    top_k_.erase(evict);
+                    break;
+                }
+            }
+            top_k_[value] = {count, hash};
+            recomputeMin_();
+        }
+    }
+
+    void recomputeMin_()
+    {
+        min_top_count_ = std::numeric_limits<uint64_t>::max();
+        for (const auto& kvp : top_k_)
+        {
+            min_top_count_ = std::min(min_top_count_, kvp.second.count);
+        }
+    }
+
+    /// Estimated count of a heavy hitter, and its hash (to look up its
+    /// merged count)
+    struct TopKEntry
+    {
+        uint64_t count;
+        uint64_t hash;
+    };
+
+    const size_t width_;
+    const size_t depth_;
+    const size_t k_;
+    std::vector<uint64_t> counts_;
+    std::unordered_map<uint64_t, TopKEntry> top_k_;
+    uint64_t min_top_count_ = 0;
+};
+
+/*!
+ * \class KllQuantiles
+ *
+ * \brief KLL quantile sketch. Keeps O(k) values in a stack of compactors;
+ *        each value at level h stands in for 2^h of the values added. When
+ *        a level fills up, it is sorted and every other value is promoted
+ *        to the next level. The rank error is about 1.7 / k.
+ */
+class KllQuantiles
+{
+public:
+    explicit KllQuantiles(const uint32_t k = 200)
+        : k_(std::max(k, 8u))
+        , levels_(1)
+    {
+    }
+
+    void add(const double val)
+    {
+        if (std::isnan(val))
+        {
+            return;
+        }
+
+        min_val_ = num_values_ ? std::min(min_val_, val) : val;
+        max_val_ = num_values_ ? std::max(max_val_, val) : val;
+        ++num_values_;
+
+        levels_[0].push_back(val);
+        if (levels_[0].size() >= getCapacity_(0))
+        {
+            compress_();
+        }
+    }
+
+    /// Combine with another sketch. The other sketch's values are added to
+    /// the same levels (keeping their weights), and then compacted until
+    /// every level fits again.
+    void merge(const KllQuantiles& other)
+    {
+        if (!other.num_values_)
+        {
+            return;
+        }
+
+        min_val_ = num_values_ ? std::min(min_val_, other.min_val_) : other.min_val_;
+        max_val_ = num_values_ ? std::max(max_val_, other.max_val_) : other.max_val_;
+        num_values_ += other.num_values_;
+
+        if (levels_.size() < other.levels_.size())
+        {
+            levels_.resize(other.levels_.size());
+        }
+        for (size_t level = 0; level < other.levels_.size(); ++level)
+        {
+            levels_[level].insert(levels_[level].end(), other.levels_[level].begin(), other.levels_[level].end());
+        }
+
+        // Adding a level shrinks the capacities of the ones below it
+        while (isOverCapacity_())
+        {
+            compress_();
+        }
+    }
+
+    uint64_t getNumValues() const
+    {
+        return num_values_;
+    }
+
+    /// Get the approximate value at the given quantile in [0,1]. The
+    /// min (q=0) and max (q=1) are exact.
+    double getQuantile(const double q) const
+    {
+        if (!num_values_)
+        {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        if (q <= 0)
+        {
+            return min_val_;
+        }
+        if (q >= 1)
+        {
+            return max_val_;
+        }
+
+        std::vector<std::pair<double, uint64_t>> weighted;
+        for (size_t level = 0; level < levels_.size(); ++level)
+        {
+            for (auto val : levels_[level])
+            {
+                weighted.emplace_back(val, uint64_t(1) << level);
+            }
+        }
+        std::sort(weighted.begin(), weighted.end());
+
+        uint64_t total_weight = 0;
+        for (const auto& pair : weighted)
+        {
+            total_weight += pair.second;
+        }
+
+        const double target = q * (double)total_weight;
+        uint64_t cumulative = 0;
+        for (const auto& pair : weighted)
+        {
+            cumulative += pair.second;
+            if ((double)cumulative >= target)
+            {
+                return pair.first;
+            }
+        }
+        return max_val_;
+    }
+
+private:
+    /// Higher levels get larger capacities (by a factor of 3/2 per level).
+    size_t getCapacity_(const size_t level) const
+    {
+        const auto depth = levels_.size() - 1 - level;
+        return std::max<size_t>(2, (size_t)std::ceil(k_ * std::pow(2.0 / 3.0, (double)depth)));
+    }
+
+    bool isOverCapacity_() const
+    {
+        for (size_t level = 0; level < levels_.size(); ++level)
+        {
+            if (levels_[level].size() >= getCapacity_(level))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void compress_()
+    {
+        for (size_t level = 0; level < levels_.size(); ++level)
+        {
+            if (levels_[level].size() < getCapacity_(level))
+            {
+                continue;
+            }
+            if (level + 1 == levels_.size())
+            {
+                levels_.emplace_back();
+            }
+
+            auto& items = levels_[level];
+            std::sort(items.begin(), items.end());
+
+            // With an odd number of items, the smallest one stays behind
+            const size_t start = items.size() % 2;
+            coin_ = !coin_;
+            for (size_t idx = start + coin_; idx < items.size(); idx += 2)
+            {
+                levels_[level + 1].push_back(items[idx]);
+            }
+            items.resize(start);
+        }
+    }
+
+    const uint32_t k_;
+    std::vector<std::vector<double>> levels_;
+    uint64_t num_values_ = 0;
+    double min_val_ = 0;
+    double max_val_ = 0;
+    bool coin_ = false;
+};
+
+/// What FieldSketch::getSummary() reports (and what the CollectionMgr
+/// writes to the FieldSketches tables).
+struct FieldSketchSummary
+{
+    uint64_t num_values = 0;
+    double distinct_count = 0;
+    double min_val = 0;
+    double max_val = 0;
+
+    /// {value, estimated count}, largest count first
+    std::vector<std::pair<double, uint64_t>> heavy_hitters;
+
+    /// {quantile, value} at FieldSketch::getReportedQuantiles()
+    std::vector<std::pair<double, double>> quantiles;
+};
+
+/*!
+ * \class FieldSketch
+ *
+ * \brief Distinct count, heavy hitters, and quantiles of one numeric
+ *        field over all the values collected during the run.
+ */
+class FieldSketch
+{
+public:
+    explicit FieldSketch(const StructFields dtype)
+        : dtype_(dtype)
+    {
+        if (dtype == StructFields::string_t)
+        {
+            throw DBException("Cannot sketch string fields");
+        }
+    }
+
+    StructFields getDataType() const
+    {
+        return dtype_;
+    }
+
+    /// Add one value (its serialized bytes, see SketchSample).
+    void add(const uint64_t bits)
+    {
+        const auto hash = mix_(bits);
+        hll_.add(hash);
+        top_k_.add(bits, hash);
+        kll_.add(toDouble_(bits));
+    }
+
+    /// Combine with another sketch of the same field.
+    void merge(const FieldSketch& other)
+    {
+        if (other.dtype_ != dtype_)
+        {
+            throw DBException("Cannot merge sketches of different data types");
+        }
+        hll_.merge(other.hll_);
+        top_k_.merge(other.top_k_);
+        kll_.merge(other.kll_);
+    }
+
+    static const std::vector<double>& getReportedQuantiles()
+    {
+        static const std::vector<double> quantiles = {0, 0.01, 0.05, 0.1, 0.25, 0.5, 0.75, 0.9, 0.95, 0.99, 1};
+        return quantiles;
+    }
+
+    FieldSketchSummary getSummary() const
+    {
+        FieldSketchSummary summary;
+        summary.num_values = kll_.getNumValues();
+        if (!summary.num_values)
+        {
+            return summary;
+        }
+
+        summary.distinct_count = std::min(hll_.estimate(), (double)summary.num_values);
+        summary.min_val = kll_.getQuantile(0);
+        summary.max_val = kll_.getQuantile(1);
+
+        for (const auto& kvp : top_k_.getTopK())
+        {
+            summary.heavy_hitters.emplace_back(toDouble_(kvp.first), kvp.second);
+        }
+        for (auto q : getReportedQuantiles())
+        {
+            summary.quantiles.emplace_back(q, kll_.getQuantile(q));
+        }
+        return summary;
+    }
+
+private:
+    /// SplitMix64 finalizer
+    static uint64_t mix_(uint64_t val)
+    {
+        val += 0x9e3779b97f4a7c15ull;
+        val = (val ^ (val >> 30)) * 0xbf58476d1ce4e5b9ull;
+        val = (val ^ (val >> 27)) * 0x94d049bb133111ebull;
+        return val ^ (val >> 31);
+    }
+
+    double toDouble_(const uint64_t bits) const
+    {
+        switch (dtype_)
+        {
+            case StructFields::char_t: return toDouble_<char>(bits);
+            case StructFields::int8_t: return toDouble_<int8_t>(bits);
+            case StructFields::uint8_t: return toDouble_<uint8_t>(bits);
+            case StructFields::int16_t: return toDouble_<int16_t>(bits);
+            case StructFields::uint16_t: return toDouble_<uint16_t>(bits);
+            case StructFields::int32_t: return toDouble_<int32_t>(bits);
+            case StructFields::uint32_t: return toDouble_<uint32_t>(bits);
+            case StructFields::int64_t: return toDouble_<int64_t>(bits);
+            case StructFields::uint64_t: return toDouble_<uint64_t>(bits);
+            case StructFields::float_t: return toDouble_<float>(bits);
+            case StructFields::double_t: return toDouble_<double>(bits);
+            case StructFields::string_t: break;
+        }
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+
+    template <typename T> static double toDouble_(const uint64_t bits)
+    {
+        T val;
+        memcpy(&val, &bits, sizeof(T));
+        return static_cast<double>(val);
+    }
+
+    const StructFields dtype_;
+    HyperLogLog hll_;
+    CountMinTopK top_k_;
+    KllQuantiles kll_;
+};
+
+/*!
+ * \class FieldSketches
+ *
+ * \brief All the field sketches of one collection. Sketches are updated
+ *        by the sink threads (or the executor's compression tasks) as they
+ *        pick up each DatabaseEntry, so the simulation thread only pays for
+ *        copying the field values.
+ *
+ *        Every updating thread works on a Shard of its own (see
+ *        acquireShard()), so the threads never wait on each other. Shards
+ *        are merged into the totals once they are released; all of them
+ *        are by CollectionMgr::postSim(), after the sink threads stop.
+ */
+class FieldSketches
+{
+public:
+    /// Sketches of the samples fed in by one thread at a time.
+    class Shard
+    {
+    public:
+        void update(const std::vector<SketchSample>& samples)
+        {
+            for (const auto& sample : samples)
+            {
+                if (sample.sketch_idx >= sketches_.size())
+                {
+                    owner_->growShard_(*this);
+                }
+                if (sample.sketch_idx < sketches_.size())
+                {
+                    sketches_[sample.sketch_idx]->add(sample.bits);
+                }
+            }
+        }
+
+    private:
+        explicit Shard(FieldSketches* owner)
+            : owner_(owner)
+        {
+        }
+
+        FieldSketches* const owner_;
+        std::vector<std::unique_ptr<FieldSketch>> sketches_;
+
+        friend class FieldSketches;
+    };
+
+    /// Add a sketch and get its index (for SketchSample::sketch_idx).
+    uint32_t addSketch(const StructFields dtype)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sketches_.emplace_back(std::make_unique<FieldSketch>(dtype));
+        return uint32_t(sketches_.size() - 1);
+    }
+
+    size_t getNumSketches() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return sketches_.size();
+    }
+
+    /// Get a shard that only the calling thread updates until it gives it
+    /// back with releaseShard().
+    Shard* acquireShard()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_shards_.empty())
+        {
+            shards_.emplace_back(new Shard(this));
+            return shards_.back().get();
+        }
+
+        auto shard = free_shards_.back();
+        free_shards_.pop_back();
+        return shard;
+    }
+
+    void releaseShard(Shard* shard)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_shards_.push_back(shard);
+    }
+
+    /// Update a shard with the given samples. For callers that do not keep
+    /// a shard of their own.
+    void update(const std::vector<SketchSample>& samples)
+    {
+        if (samples.empty())
+        {
+            return;
+        }
+
+        auto shard = acquireShard();
+        shard->update(samples);
+        releaseShard(shard);
+    }
+
+    /// Get the summary of the given sketch over all the samples in the
+    /// released shards. Samples still held by a thread (e.g. a running
+    /// sink thread) are not included.
+    FieldSketchSummary getSummary(const uint32_t sketch_idx) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (sketch_idx >= sketches_.size())
+        {
+            throw DBException("Invalid sketch index ") << sketch_idx;
+        }
+
+        mergeFreeShards_();
+        return sketches_[sketch_idx]->getSummary();
+    }
+
+private:
+    /// Give the shard a sketch for every one added so far.
+    void growShard_(Shard& shard)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (shard.sketches_.size() < sketches_.size())
+        {
+            shard.sketches_.emplace_back(std::make_unique<FieldSketch>(sketches_[shard.sketches_.size()]->getDataType()));
+        }
+    }
+
+    /// Merge the released shards into the totals, and empty them.
+    void mergeFreeShards_() const
+    {
+        for (auto shard : free_shards_)
+        {
+            for (size_t idx = 0; idx < shard->sketches_.size(); ++idx)
+            {
+                sketches_[idx]->merge(*shard->sketches_[idx]);
+            }
+            shard->sketches_.clear();
+        }
+    }
+
+    /// Totals over the merged shards
+    std::vector<std::unique_ptr<FieldSketch>> sketches_;
+
+    /// Every shard handed out so far, and the ones not in use
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::vector<Shard*> free_shards_;
+
+    mutable std::mutex mutex_;
+};
+
+} // namespace simdb
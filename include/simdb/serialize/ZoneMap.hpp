@@ -0,0 +1,148 @@
+// <ZoneMap.hpp> -*- C++ -*-
+
+#pragma once
+
+#include "simdb/serialize/Serialize.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace simdb
+{
+
+/// One field of a collected value (a struct, or a scalar with an empty
+/// name): where it sits in the value's serialized bytes, and its
+/// ZoneMapFields ID once CollectionMgr::addZoneMap() was called for it.
+struct ZoneMapField
+{
+    std::string name;
+    StructFields dtype = StructFields::int32_t;
+    size_t offset = 0;
+    size_t num_bytes = 0;
+    int32_t field_id = 0;
+};
+
+/// Min/max of one zone map field over all the values in a record.
+struct ZoneMapRange
+{
+    int32_t field_id = 0;
+    double min_val = 0;
+    double max_val = 0;
+};
+
+/*!
+ * \class ZoneMap
+ *
+ * \brief Min/max of the zone map fields over the sweeps in one
+ *        DatabaseEntry. These are written to the CollectionZoneMaps table
+ *        along with the record's tick range, so readers looking for e.g.
+ *        "addresses in range X" can skip the records that cannot match
+ *        without decompressing them.
+ *
+ *        Values are kept as doubles. Integers that a double cannot hold
+ *        exactly are rounded outward, so the range always contains them.
+ */
+class ZoneMap
+{
+public:
+    bool empty() const
+    {
+        return ranges_.empty();
+    }
+
+    const std::vector<ZoneMapRange>& getRanges() const
+    {
+        return ranges_;
+    }
+
+    /// Widen the field's range to include [min_val, max_val].
+    void update(const int32_t field_id, const double min_val, const double max_val)
+    {
+        for (auto& range : ranges_)
+        {
+            if (range.field_id == field_id)
+            {
+                range.min_val = std::min(range.min_val, min_val);
+                range.max_val = std::max(range.max_val, max_val);
+                return;
+            }
+        }
+        ranges_.push_back({field_id, min_val, max_val});
+    }
+
+    /// Widen this zone map to include another one.
+    void merge(const ZoneMap& other)
+    {
+        for (const auto& range : other.ranges_)
+        {
+            update(range.field_id, range.min_val, range.max_val);
+        }
+    }
+
+    /// Update the ranges of the given fields from one serialized value.
+    /// Fields that do not fit in the given bytes are skipped.
+    void scan(const std::vector<ZoneMapField>& fields, const char* bytes, const size_t num_bytes)
+    {
+        for (const auto& field : fields)
+        {
+            double min_val, max_val;
+            if (field.offset + field.num_bytes <= num_bytes && readValue_(field.dtype, bytes + field.offset, min_val, max_val))
+            {
+                update(field.field_id, min_val, max_val);
+            }
+        }
+    }
+
+private:
+    static bool readValue_(const StructFields dtype, const char* bytes, double& min_val, double& max_val)
+    {
+        switch (dtype)
+        {
+            case StructFields::char_t: return readValue_<char>(bytes, min_val, max_val);
+            case StructFields::int8_t: return readValue_<int8_t>(bytes, min_val, max_val);
+            case StructFields::uint8_t: return readValue_<uint8_t>(bytes, min_val, max_val);
+            case StructFields::int16_t: return readValue_<int16_t>(bytes, min_val, max_val);
+            case StructFields::uint16_t: return readValue_<uint16_t>(bytes, min_val, max_val);
+            case StructFields::int32_t: return readValue_<int32_t>(bytes, min_val, max_val);
+            case StructFields::uint32_t: return readValue_<uint32_t>(bytes, min_val, max_val);
+            case StructFields::int64_t: return readValue_<int64_t>(bytes, min_val, max_val);
+            case StructFields::uint64_t: return readValue_<uint64_t>(bytes, min_val, max_val);
+            case StructFields::float_t: return readValue_<float>(bytes, min_val, max_val);
+            case StructFields::double_t: return readValue_<double>(bytes, min_val, max_val);
+            case StructFields::string_t: break;
+        }
+        return false;
+    }
+
+    template <typename T> static bool readValue_(const char* bytes, double& min_val, double& max_val)
+    {
+        T val;
+        memcpy(&val, bytes, sizeof(T));
+        min_val = max_val = static_cast<double>(val);
+
+        if constexpr (std::is_integral_v<T>)
+        {
+            // long double holds every 64-bit integer exactly
+            if ((long double)min_val > (long double)val)
+            {
+                min_val = std::nextafter(min_val, -std::numeric_limits<double>::infinity());
+            }
+            if ((long double)max_val < (long double)val)
+            {
+                max_val = std::nextafter(max_val, std::numeric_limits<double>::infinity());
+            }
+            return true;
+        }
+        else
+        {
+            return !std::isnan(min_val);
+        }
+    }
+
+    std::vector<ZoneMapRange> ranges_;
+};
+
+} // namespace simdb
@@ -0,0 +1,735 @@
+// <AsyncVfs.hpp> -*- C++ -*-
+
+#pragma once
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace simdb
+{
+
+/// Options for the asynchronous SQLite VFS (see AsyncVfs).
+struct AsyncVfsOptions
+{
+    /// Forward xSync() calls on the main database and the WAL to the OS
+    /// (fsync). Turn this off for scratch runs whose database does not need
+    /// to survive a crash or power loss. Journals are always synced.
+    bool durable = true;
+};
+
+namespace detail
+{
+
+/*!
+ * \class AsyncFileWriter
+ *
+ * \brief Queues up writes to one file and writes them on a background
+ *        thread, through the default VFS's own file object. Queued writes
+ *        are kept sorted by offset, and runs of adjacent pages are written
+ *        together with a single xWrite() call.
+ *
+ * No second file descriptor is ever opened: closing one would drop every
+ * POSIX advisory lock the process holds on the file, including those of
+ * other connections. Calls on the real file from this thread and from the
+ * connection are serialized with ioLock().
+ *
+ * Writes that have not reached the file yet are still visible to readers
+ * through overlay(), so SQLite never sees stale pages.
+ */
+class AsyncFileWriter
+{
+public:
+    /// Stop accepting writes once this many bytes are waiting to be written.
+    static constexpr size_t MAX_PENDING_BYTES = 64 * 1024 * 1024;
+
+    /// Largest single xWrite(). The unix VFS masks write sizes to 17 bits,
+    /// so larger runs are split.
+    static constexpr size_t MAX_RUN_BYTES = 64 * 1024;
+
+    /// \param real The default VFS's file object (owned by the AsyncFile).
+    AsyncFileWriter(sqlite3_file* real)
+        : real_(real)
+        , thread_([this]() { run_(); })
+    {
+    }
+
+    ~AsyncFileWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        work_cv_.notify_one();
+        thread_.join();
+    }
+
+    /// Queue a write. Blocks if too many bytes are already waiting.
+    void write(const void* data, int amt, sqlite3_int64 offset)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this]() { return num_pending_bytes_ < MAX_PENDING_BYTES || error_; });
+
+        // Merge with any queued writes that overlap this one. The new bytes win.
+        sqlite3_int64 start = offset;
+        sqlite3_int64 end = offset + amt;
+
+        auto iter = pending_.upper_bound(offset);
+        if (iter != pending_.begin())
+        {
+            --iter;
+        }
+
+        std::vector<std::pair<sqlite3_int64, std::vector<char>>> overlapping;
+        while (iter != pending_.end() && iter->first < end)
+        {
+            const auto iter_end = iter->first + static_cast<sqlite3_int64>(iter->second.size());
+            if (iter_end > offset)
+            {
+                start = std::min(start, iter->first);
+                end = std::max(end, iter_end);
+                num_pending_bytes_ -= iter->second.size();
+                overlapping.emplace_back(iter->first, std::move(iter->second));
+                iter = pending_.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+
+        std::vector<char> bytes(end - start);
+        for (const auto& old : overlapping)
+        {
+            memcpy(bytes.data() + (old.first - start), old.second.data(), old.second.size());
+        }
+        memcpy(bytes.data() + (offset - start), data, amt);
+
+        num_pending_bytes_ += bytes.size();
+        pending_.emplace(start, std::move(bytes));
+        work_cv_.notify_one();
+    }
+
+    /// Copy any queued bytes in [offset, offset+amt) over the buffer. The
+    /// caller must hold the lock from lock() across its own read of the
+    /// file and this call, so writes cannot land in between.
+    void overlay(void* buf, int amt, sqlite3_int64 offset) const
+    {
+        overlay_(in_flight_, buf, amt, offset);
+        overlay_(pending_, buf, amt, offset);
+    }
+
+    /// One past the last byte that will be in the file once all the queued
+    /// writes land. Requires the lock from lock().
+    sqlite3_int64 getEndOffset() const
+    {
+        sqlite3_int64 end = 0;
+        if (!in_flight_.empty())
+        {
+            end = std::max(end, in_flight_.rbegin()->first + static_cast<sqlite3_int64>(in_flight_.rbegin()->second.size()));
+        }
+        if (!pending_.empty())
+        {
+            end = std::max(end, pending_.rbegin()->first + static_cast<sqlite3_int64>(pending_.rbegin()->second.size()));
+        }
+        return end;
+    }
+
+    /// Lock on the queues.
+    std::unique_lock<std::mutex> lock() const
+    {
+        return std::unique_lock<std::mutex>(mutex_);
+    }
+
+    /// Lock on the real file. Hold it across every call into the real file
+    /// object (take lock() first when both are needed).
+    std::unique_lock<std::mutex> ioLock() const
+    {
+        return std::unique_lock<std::mutex>(io_mutex_);
+    }
+
+    /// Block until every queued write is in the file. Returns the SQLite
+    /// error code of the first failed write, or SQLITE_OK.
+    int drain()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this]() { return (pending_.empty() && in_flight_.empty()) || error_; });
+        return error_;
+    }
+
+    int getError() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return error_;
+    }
+
+private:
+    using WriteMap = std::map<sqlite3_int64, std::vector<char>>;
+
+    static void overlay_(const WriteMap& writes, void* buf, int amt, sqlite3_int64 offset)
+    {
+        const sqlite3_int64 end = offset + amt;
+        auto iter = writes.upper_bound(offset);
+        if (iter != writes.begin())
+        {
+            --iter;
+        }
+
+        for (; iter != writes.end() && iter->first < end; ++iter)
+        {
+            const auto write_start = iter->first;
+            const auto write_end = write_start + static_cast<sqlite3_int64>(iter->second.size());
+            const auto copy_start = std::max(offset, write_start);
+            const auto copy_end = std::min(end, write_end);
+            if (copy_start < copy_end)
+            {
+                memcpy(static_cast<char*>(buf) + (copy_start - offset), iter->second.data() + (copy_start - write_start), copy_end - copy_start);
+            }
+        }
+    }
+
+    void run_()
+    {
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                work_cv_.wait(lock, [this]() { return !pending_.empty() || stop_; });
+                if (pending_.empty())
+                {
+                    return;
+                }
+                std::swap(pending_, in_flight_);
+            }
+
+            const int error = writeInFlight_();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (const auto& write : in_flight_)
+                {
+                    num_pending_bytes_ -= write.second.size();
+                }
+                in_flight_.clear();
+                if (error != SQLITE_OK && !error_)
+                {
+                    error_ = error;
+                }
+            }
+            done_cv_.notify_all();
+        }
+    }
+
+    /// Write the in-flight batch, one xWrite() per run of adjacent writes.
+    int writeInFlight_()
+    {
+        auto iter = in_flight_.begin();
+        while (iter != in_flight_.end())
+        {
+            const auto run_start = iter->first;
+            auto next = std::next(iter);
+            auto run_end = run_start + static_cast<sqlite3_int64>(iter->second.size());
+            while (next != in_flight_.end() && next->first == run_end && run_end - run_start + next->second.size() <= MAX_RUN_BYTES)
+            {
+                run_end += next->second.size();
+                ++next;
+            }
+
+            const char* data = iter->second.data();
+            if (std::next(iter) != next)
+            {
+                run_buf_.clear();
+                for (auto run_iter = iter; run_iter != next; ++run_iter)
+                {
+                    run_buf_.insert(run_buf_.end(), run_iter->second.begin(), run_iter->second.end());
+                }
+                data = run_buf_.data();
+            }
+
+            for (auto offset = run_start; offset < run_end; offset += MAX_RUN_BYTES)
+            {
+                const auto amt = std::min<sqlite3_int64>(run_end - offset, MAX_RUN_BYTES);
+                auto io_lock = ioLock();
+                const int rc = real_->pMethods->xWrite(real_, data + (offset - run_start), static_cast<int>(amt), offset);
+                if (rc != SQLITE_OK)
+                {
+                    return rc;
+                }
+            }
+            iter = next;
+        }
+        return SQLITE_OK;
+    }
+
+    sqlite3_file* const real_;
+    WriteMap pending_;
+    WriteMap in_flight_;
+    std::vector<char> run_buf_;
+    size_t num_pending_bytes_ = 0;
+    int error_ = SQLITE_OK;
+    bool stop_ = false;
+
+    mutable std::mutex mutex_;
+    mutable std::mutex io_mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    std::thread thread_;
+};
+
+} // namespace detail
+
+/*!
+ * \class AsyncVfs
+ *
+ * \brief SQLite VFS that sits on top of the default (unix) VFS and takes
+ *        the page writes off the DatabaseThread.
+ *
+ * Writes to the main database file and the WAL are queued and written by
+ * a background thread per file (see detail::AsyncFileWriter), so an
+ * INSERT-heavy transaction no longer waits on one pwrite() per page.
+ * xSync() waits for the queue to drain and then calls fsync(), which
+ * keeps SQLite's ordering guarantees intact. In the non-durable mode
+ * xSync() on those two files only waits for the queue, so commits never
+ * block on the disk.
+ *
+ * Journals and temp files go straight to the default VFS, and are synced
+ * in both modes: a rollback journal that is not on disk cannot undo a
+ * torn write of the main database.
+ */
+class AsyncVfs
+{
+public:
+    /// Register the VFS for these options with SQLite (once) and return its
+    /// name, for use with sqlite3_open_v2(). Returns nullptr if it could not
+    /// be registered, in which case the default VFS should be used.
+    static const char* registerVfs(const AsyncVfsOptions& options = AsyncVfsOptions())
+    {
+        static std::mutex mutex;
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto& vfs = options.durable ? durableVfs_() : scratchVfs_();
+        if (!vfs.zName)
+        {
+            auto real_vfs = sqlite3_vfs_find(nullptr);
+            if (!real_vfs)
+            {
+                return nullptr;
+            }
+
+            vfs.iVersion = 2;
+            vfs.szOsFile = sizeof(AsyncFile) + real_vfs->szOsFile;
+            vfs.mxPathname = real_vfs->mxPathname;
+            vfs.zName = options.durable ? "simdb-async" : "simdb-async-nosync";
+            vfs.pAppData = real_vfs;
+            vfs.xOpen = options.durable ? &xOpen_<true> : &xOpen_<false>;
+            vfs.xDelete = &xDelete_;
+            vfs.xAccess = &xAccess_;
+            vfs.xFullPathname = &xFullPathname_;
+            vfs.xDlOpen = &xDlOpen_;
+            vfs.xDlError = &xDlError_;
+            vfs.xDlSym = &xDlSym_;
+            vfs.xDlClose = &xDlClose_;
+            vfs.xRandomness = &xRandomness_;
+            vfs.xSleep = &xSleep_;
+            vfs.xCurrentTime = &xCurrentTime_;
+            vfs.xGetLastError = &xGetLastError_;
+            vfs.xCurrentTimeInt64 = &xCurrentTimeInt64_;
+
+            if (sqlite3_vfs_register(&vfs, 0) != SQLITE_OK)
+            {
+                vfs.zName = nullptr;
+                return nullptr;
+            }
+        }
+
+        return vfs.zName;
+    }
+
+private:
+    /// Our sqlite3_file. The default VFS's file object lives right after it.
+    struct AsyncFile
+    {
+        sqlite3_file base;
+        sqlite3_file* real;
+        detail::AsyncFileWriter* writer;
+        /// Whether xSync() reaches the disk.
+        bool durable;
+    };
+
+    static sqlite3_vfs& durableVfs_()
+    {
+        static sqlite3_vfs vfs{};
+        return vfs;
+    }
+
+    static sqlite3_vfs& scratchVfs_()
+    {
+        static sqlite3_vfs vfs{};
+        return vfs;
+    }
+
+    static sqlite3_vfs* realVfs_(sqlite3_vfs* vfs)
+    {
+        return static_cast<sqlite3_vfs*>(vfs->pAppData);
+    }
+
+    static AsyncFile* cast_(sqlite3_file* file)
+    {
+        return reinterpret_cast<AsyncFile*>(file);
+    }
+
+    template <bool Durable> static int xOpen_(sqlite3_vfs* vfs, const char* name, sqlite3_file* file, int flags, int* out_flags)
+    {
+        auto async_file = cast_(file);
+        async_file->real = reinterpret_cast<sqlite3_file*>(async_file + 1);
+        async_file->writer = nullptr;
+        async_file->durable = true;
+
+        auto rc = realVfs_(vfs)->xOpen(realVfs_(vfs), name, async_file->real, flags, out_flags);
+        if (rc != SQLITE_OK)
+        {
+            async_file->base.pMethods = nullptr;
+            return rc;
+        }
+
+        // Only the main database and the WAL get the write-behind queue (and
+        // may skip fsync).
+        if (flags & (SQLITE_OPEN_MAIN_DB | SQLITE_OPEN_WAL))
+        {
+            async_file->writer = new detail::AsyncFileWriter(async_file->real);
+            async_file->durable = Durable;
+        }
+
+        async_file->base.pMethods = &ioMethods_();
+        return SQLITE_OK;
+    }
+
+    static const sqlite3_io_methods& ioMethods_()
+    {
+        static const sqlite3_io_methods methods = {
+            3,
+            &xClose_,
+            &xRead_,
+            &xWrite_,
+            &xTruncate_,
+            &xSync_,
+            &xFileSize_,
+            &xLock_,
+            &xUnlock_,
+            &xCheckReservedLock_,
+            &xFileControl_,
+            &xSectorSize_,
+            &xDeviceCharacteristics_,
+            &xShmMap_,
+            &xShmLock_,
+            &xShmBarrier_,
+            &xShmUnmap_,
+            &xFetch_,
+            &xUnfetch_};
+        return methods;
+    }
+
+    static int xClose_(sqlite3_file* file)
+    {
+        auto async_file = cast_(file);
+        int error = SQLITE_OK;
+        if (async_file->writer)
+        {
+            error = async_file->writer->drain();
+            delete async_file->writer;
+            async_file->writer = nullptr;
+        }
+
+        auto rc = async_file->real->pMethods->xClose(async_file->real);
+        return error != SQLITE_OK ? error : rc;
+    }
+
+    static int xRead_(sqlite3_file* file, void* buf, int amt, sqlite3_int64 offset)
+    {
+        auto async_file = cast_(file);
+        auto real = async_file->real;
+        if (!async_file->writer)
+        {
+            return real->pMethods->xRead(real, buf, amt, offset);
+        }
+
+        // Hold the writer's lock so that queued writes cannot land between
+        // our read and the overlay.
+        auto lock = async_file->writer->lock();
+        auto io_lock = async_file->writer->ioLock();
+        auto rc = real->pMethods->xRead(real, buf, amt, offset);
+        if (rc != SQLITE_OK && rc != SQLITE_IOERR_SHORT_READ)
+        {
+            return rc;
+        }
+
+        async_file->writer->overlay(buf, amt, offset);
+        if (rc == SQLITE_IOERR_SHORT_READ && offset + amt <= async_file->writer->getEndOffset())
+        {
+            rc = SQLITE_OK;
+        }
+        return rc;
+    }
+
+    static int xWrite_(sqlite3_file* file, const void* buf, int amt, sqlite3_int64 offset)
+    {
+        auto async_file = cast_(file);
+        if (!async_file->writer)
+        {
+            return async_file->real->pMethods->xWrite(async_file->real, buf, amt, offset);
+        }
+
+        if (const int error = async_file->writer->getError())
+        {
+            return error;
+        }
+
+        async_file->writer->write(buf, amt, offset);
+        return SQLITE_OK;
+    }
+
+    /// Lock the real file against the writer thread, if there is one.
+    static std::unique_lock<std::mutex> ioLock_(AsyncFile* async_file)
+    {
+        return async_file->writer ? async_file->writer->ioLock() : std::unique_lock<std::mutex>();
+    }
+
+    static int xTruncate_(sqlite3_file* file, sqlite3_int64 size)
+    {
+        auto async_file = cast_(file);
+        if (async_file->writer)
+        {
+            if (const int error = async_file->writer->drain())
+            {
+                return error;
+            }
+        }
+
+        auto io_lock = ioLock_(async_file);
+        return async_file->real->pMethods->xTruncate(async_file->real, size);
+    }
+
+    static int xSync_(sqlite3_file* file, int flags)
+    {
+        auto async_file = cast_(file);
+        if (async_file->writer)
+        {
+            if (const int error = async_file->writer->drain())
+            {
+                return error;
+            }
+        }
+
+        if (!async_file->durable)
+        {
+            return SQLITE_OK;
+        }
+
+        auto io_lock = ioLock_(async_file);
+        return async_file->real->pMethods->xSync(async_file->real, flags);
+    }
+
+    static int xFileSize_(sqlite3_file* file, sqlite3_int64* size)
+    {
+        auto async_file = cast_(file);
+        auto real = async_file->real;
+        if (!async_file->writer)
+        {
+            return real->pMethods->xFileSize(real, size);
+        }
+
+        auto lock = async_file->writer->lock();
+        auto io_lock = async_file->writer->ioLock();
+        auto rc = real->pMethods->xFileSize(real, size);
+        if (rc == SQLITE_OK)
+        {
+            *size = std::max(*size, async_file->writer->getEndOffset());
+        }
+        return rc;
+    }
+
+    static int xLock_(sqlite3_file* file, int lock)
+    {
+        auto io_lock = ioLock_(cast_(file));
+        auto real = cast_(file)->real;
+        return real->pMethods->xLock(real, lock);
+    }
+
+    static int xUnlock_(sqlite3_file* file, int lock)
+    {
+        auto io_lock = ioLock_(cast_(file));
+        auto real = cast_(file)->real;
+        return real->pMethods->xUnlock(real, lock);
+    }
+
+    static int xCheckReservedLock_(sqlite3_file* file, int* result)
+    {
+        auto io_lock = ioLock_(cast_(file));
+        auto real = cast_(file)->real;
+        return real->pMethods->xCheckReservedLock(real, result);
+    }
+
+    static int xFileControl_(sqlite3_file* file, int op, void* arg)
+    {
+        auto io_lock = ioLock_(cast_(file));
+        auto real = cast_(file)->real;
+        return real->pMethods->xFileControl(real, op, arg);
+    }
+
+    static int xSectorSize_(sqlite3_file* file)
+    {
+        auto real = cast_(file)->real;
+        return real->pMethods->xSectorSize(real);
+    }
+
+    static int xDeviceCharacteristics_(sqlite3_file* file)
+    {
+        auto real = cast_(file)->real;
+        return real->pMethods->xDeviceCharacteristics(real);
+    }
+
+    static int xShmMap_(sqlite3_file* file, int page, int page_size, int extend, void volatile** pp)
+    {
+        auto real = cast_(file)->real;
+        if (real->pMethods->iVersion < 2)
+        {
+            return SQLITE_IOERR;
+        }
+        return real->pMethods->xShmMap(real, page, page_size, extend, pp);
+    }
+
+    static int xShmLock_(sqlite3_file* file, int offset, int n, int flags)
+    {
+        auto real = cast_(file)->real;
+        if (real->pMethods->iVersion < 2)
+        {
+            return SQLITE_IOERR;
+        }
+        return real->pMethods->xShmLock(real, offset, n, flags);
+    }
+
+    static void xShmBarrier_(sqlite3_file* file)
+    {
+        auto real = cast_(file)->real;
+        if (real->pMethods->iVersion >= 2)
+        {
+            real->pMethods->xShmBarrier(real);
+        }
+    }
+
+    static int xShmUnmap_(sqlite3_file* file, int delete_flag)
+    {
+        auto real = cast_(file)->real;
+        if (real->pMethods->iVersion < 2)
+        {
+            return SQLITE_OK;
+        }
+        return real->pMethods->xShmUnmap(real, delete_flag);
+    }
+
+    /// Memory-mapped reads would bypass the queued writes, so never hand
+    /// out a mapping for files with a writer. SQLite falls back to xRead().
+    static int xFetch_(sqlite3_file* file, sqlite3_int64 offset, int amt, void** pp)
+    {
+        auto async_file = cast_(file);
+        auto real = async_file->real;
+        if (async_file->writer || real->pMethods->iVersion < 3)
+        {
+            *pp = nullptr;
+            return SQLITE_OK;
+        }
+        return real->pMethods->xFetch(real, offset, amt, pp);
+    }
+
+    static int xUnfetch_(sqlite3_file* file, sqlite3_int64 offset, void* p)
+    {
+        auto async_file = cast_(file);
+        auto real = async_file->real;
+        if (async_file->writer || real->pMethods->iVersion < 3)
+        {
+            return SQLITE_OK;
+        }
+        return real->pMethods->xUnfetch(real, offset, p);
+    }
+
+    // Everything that is not about file I/O goes straight to the default VFS.
+
+    static int xDelete_(sqlite3_vfs* vfs, const char* name, int sync_dir)
+    {
+        return realVfs_(vfs)->xDelete(realVfs_(vfs), name, sync_dir);
+    }
+
+    static int xAccess_(sqlite3_vfs* vfs, const char* name, int flags, int* result)
+    {
+        return realVfs_(vfs)->xAccess(realVfs_(vfs), name, flags, result);
+    }
+
+    static int xFullPathname_(sqlite3_vfs* vfs, const char* name, int num_out, char* out)
+    {
+        return realVfs_(vfs)->xFullPathname(realVfs_(vfs), name, num_out, out);
+    }
+
+    static void* xDlOpen_(sqlite3_vfs* vfs, const char* filename)
+    {
+        return realVfs_(vfs)->xDlOpen(realVfs_(vfs), filename);
+    }
+
+    static void xDlError_(sqlite3_vfs* vfs, int num_bytes, char* err_msg)
+    {
+        realVfs_(vfs)->xDlError(realVfs_(vfs), num_bytes, err_msg);
+    }
+
+    static void (*xDlSym_(sqlite3_vfs* vfs, void* handle, const char* symbol))(void)
+    {
+        return realVfs_(vfs)->xDlSym(realVfs_(vfs), handle, symbol);
+    }
+
+    static void xDlClose_(sqlite3_vfs* vfs, void* handle)
+    {
+        realVfs_(vfs)->xDlClose(realVfs_(vfs), handle);
+    }
+
+    static int xRandomness_(sqlite3_vfs* vfs, int num_bytes, char* out)
+    {
+        return realVfs_(vfs)->xRandomness(realVfs_(vfs), num_bytes, out);
+    }
+
+    static int xSleep_(sqlite3_vfs* vfs, int microseconds)
+    {
+        return realVfs_(vfs)->xSleep(realVfs_(vfs), microseconds);
+    }
+
+    static int xCurrentTime_(sqlite3_vfs* vfs, double* now)
+    {
+        return realVfs_(vfs)->xCurrentTime(realVfs_(vfs), now);
+    }
+
+    static int xGetLastError_(sqlite3_vfs* vfs, int num_bytes, char* err_msg)
+    {
+        return realVfs_(vfs)->xGetLastError(realVfs_(vfs), num_bytes, err_msg);
+    }
+
+    static int xCurrentTimeInt64_(sqlite3_vfs* vfs, sqlite3_int64* now)
+    {
+        auto real_vfs = realVfs_(vfs);
+        if (real_vfs->iVersion >= 2 && real_vfs->xCurrentTimeInt64)
+        {
+            return real_vfs->xCurrentTimeInt64(real_vfs, now);
+        }
+
+        double days = 0;
+        auto rc = real_vfs->xCurrentTime(real_vfs, &days);
+        *now = static_cast<sqlite3_int64>(days * 86400000.0);
+        return rc;
+    }
+};
+
+} // namespace simdb
@@ -0,0 +1,179 @@
+// <CompressedBlob.hpp> -*- C++ -*-
+
+#pragma once
+
+#include "simdb/Exceptions.hpp"
+
+#include <sqlite3.h>
+#include <zlib.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace simdb
+{
+
+/// Declared SQLite type of SqlDataType::compressed_blob_t columns. SQLite
+/// gives these columns BLOB affinity since the name contains "BLOB".
+static constexpr const char* COMPRESSED_BLOB_DECLTYPE = "COMPRESSED_BLOB";
+
+/// Codec used for one compressed_blob_t value. Written in the first byte
+/// of the value, followed by the uncompressed size (uint64_t) and the
+/// encoded bytes.
+enum class BlobCodec : uint8_t
+{
+    /// Stored as-is (small or incompressible values).
+    NONE = 0,
+
+    /// zlib (deflate) stream.
+    ZLIB = 1
+};
+
+/// Size of the per-value header in front of the encoded bytes.
+static constexpr size_t COMPRESSED_BLOB_HEADER_BYTES = 1 + sizeof(uint64_t);
+
+/// Is this the declared type of a compressed_blob_t column?
+inline bool isCompressedBlobDeclType(const char* decltype_str)
+{
+    return decltype_str && strcmp(decltype_str, COMPRESSED_BLOB_DECLTYPE) == 0;
+}
+
+/// Encode a value for a compressed_blob_t column: header followed by the
+/// zlib-compressed bytes, or by the raw bytes if compression does not help.
+inline void compressBlob(const void* data, const size_t num_bytes, std::vector<char>& out, const int compression_level = Z_DEFAULT_COMPRESSION)
+{
+    const uint64_t raw_bytes = num_bytes;
+    auto codec = BlobCodec::NONE;
+
+    uLongf encoded_bytes = compressBound((uLong)num_bytes);
+    out.resize(COMPRESSED_BLOB_HEADER_BYTES + encoded_bytes);
+
+    if (num_bytes &&
+        compress2((Bytef*)out.data() + COMPRESSED_BLOB_HEADER_BYTES, &encoded_bytes, (const Bytef*)data, (uLong)num_bytes, compression_level) ==
+            Z_OK &&
+        encoded_bytes < num_bytes)
+    {
+        codec = BlobCodec::ZLIB;
+        out.resize(COMPRESSED_BLOB_HEADER_BYTES + encoded_bytes);
+    }
+    else
+    {
+        out.resize(COMPRESSED_BLOB_HEADER_BYTES + num_bytes);
+        if (num_bytes)
+        {
+            memcpy(out.data() + COMPRESSED_BLOB_HEADER_BYTES, data, num_bytes);
+        }
+    }
+
+    out[0] = static_cast<char>(codec);
+    memcpy(out.data() + 1, &raw_bytes, sizeof(raw_bytes));
+}
+
+/// Decode a value read from a compressed_blob_t column. Values shorter than
+/// the header (e.g. written with raw SQL) are returned as-is.
+inline void decompressBlob(const void* data, const size_t num_bytes, std::vector<char>& out)
+{
+    if (num_bytes < COMPRESSED_BLOB_HEADER_BYTES)
+    {
+        out.assign((const char*)data, (const char*)data + num_bytes);
+        return;
+    }
+
+    const auto bytes = (const char*)data;
+    const auto codec = static_cast<BlobCodec>(bytes[0]);
+    uint64_t raw_bytes = 0;
+    memcpy(&raw_bytes, bytes + 1, sizeof(raw_bytes));
+
+    const auto encoded = bytes + COMPRESSED_BLOB_HEADER_BYTES;
+    const auto encoded_bytes = num_bytes - COMPRESSED_BLOB_HEADER_BYTES;
+
+    switch (codec)
+    {
+        case BlobCodec::NONE:
+        {
+            out.assign(encoded, encoded + encoded_bytes);
+            break;
+        }
+
+        case BlobCodec::ZLIB:
+        {
+            out.resize(raw_bytes);
+            uLongf out_bytes = (uLongf)raw_bytes;
+            if (uncompress((Bytef*)out.data(), &out_bytes, (const Bytef*)encoded, (uLong)encoded_bytes) != Z_OK || out_bytes != raw_bytes)
+            {
+                throw DBException("Corrupt compressed blob value");
+            }
+            break;
+        }
+
+        default:
+        {
+            throw DBException("Unknown compressed blob codec: ") << static_cast<int>(codec);
+        }
+    }
+}
+
+/// Get the names of the compressed_blob_t columns in the given table.
+inline std::unordered_set<std::string> getCompressedBlobColumns(sqlite3* db_conn, const std::string& table_name)
+{
+    std::unordered_set<std::string> col_names;
+
+    sqlite3_stmt* stmt = nullptr;
+    const std::string cmd = "PRAGMA table_info(" + table_name + ")";
+    if (sqlite3_prepare_v2(db_conn, cmd.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        sqlite3_finalize(stmt);
+        throw DBException(sqlite3_errmsg(db_conn));
+    }
+
+    // Columns: cid, name, type, notnull, dflt_value, pk
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        if (isCompressedBlobDeclType((const char*)sqlite3_column_text(stmt, 2)))
+        {
+            col_names.insert((const char*)sqlite3_column_text(stmt, 1));
+        }
+    }
+
+    sqlite3_finalize(stmt);
+    return col_names;
+}
+
+/*!
+ * \class CompressedBlobColumnCache
+ *
+ * \brief Compressed_blob_t column names by table, so that PRAGMA table_info
+ *        runs once per table instead of once per INSERT/UPDATE. Tables are
+ *        never altered once created. Owned by the DatabaseManager and shared
+ *        with its SqlRecords; only used from inside a safeTransaction(),
+ *        which serializes access.
+ */
+class CompressedBlobColumnCache
+{
+public:
+    /// Get the compressed_blob_t columns of the given (existing) table.
+    const std::unordered_set<std::string>& getColumns(sqlite3* db_conn, const std::string& table_name)
+    {
+        auto iter = cols_by_table_.find(table_name);
+        if (iter != cols_by_table_.end())
+        {
+            return iter->second;
+        }
+
+        return cols_by_table_.emplace(table_name, getCompressedBlobColumns(db_conn, table_name)).first->second;
+    }
+
+    /// Forget every table, e.g. when another database file is opened.
+    void clear()
+    {
+        cols_by_table_.clear();
+    }
+
+private:
+    std::unordered_map<std::string, std::unordered_set<std::string>> cols_by_table_;
+};
+
+} // namespace simdb
@@ -2,14 +2,18 @@
 
 #pragma once
 
+#include "simdb/LibraryMode.hpp"
 #include "simdb/schema/SchemaDef.hpp"
 #include "simdb/serialize/CollectionPoints.hpp"
 #include "simdb/serialize/Serialize.hpp"
 #include "simdb/serialize/ThreadedSink.hpp"
+#include "simdb/sqlite/AsyncVfs.hpp"
 #include "simdb/sqlite/SQLiteConnection.hpp"
 #include "simdb/sqlite/SQLiteQuery.hpp"
 #include "simdb/sqlite/SQLiteTable.hpp"
+#include "simdb/sqlite/WalCheckpointer.hpp"
 #include "simdb/utils/Compress.hpp"
+#include "simdb/utils/MemoryResource.hpp"
 #include "simdb/utils/TreeBuilder.hpp"
 
 namespace simdb
@@ -34,6 +38,9 @@ public:
     /// optimal performance.
     CollectionMgr(DatabaseManager* db_mgr, size_t heartbeat, size_t num_compression_threads = 1);
 
+    /// Construct with the DatabaseManager and the full set of collection options.
+    CollectionMgr(DatabaseManager* db_mgr, const CollectionConfig& config);
+
     /// Add a new clock domain for collection.
     void addClock(const std::string& name, const uint32_t period);
 
@@ -43,11 +50,49 @@ public:
     /// Create a collection point for a POD or struct-like type.
     template <typename T> std::shared_ptr<CollectionPoint> createCollectable(const std::string& path, const std::string& clock);
 
-    // Automatically collect iterable data (non-POD types).
+    // Automatically collect iterable data (non-POD types). The container is
+    // walked with simdb::iterable_traits<T>, which can be specialized.
     template <typename T, bool Sparse>
     std::shared_ptr<std::conditional_t<Sparse, SparseIterableCollectionPoint, ContigIterableCollectionPoint>>
     createIterableCollector(const std::string& path, const std::string& clock, const size_t capacity);
 
+    /// \brief  Collect a flat region of raw memory (register file, small cache,
+    ///         memory array, ...) by writing only the blocks that changed since
+    ///         the last sweep, with periodic keyframes (see RegionCollectionPoint).
+    ///
+    /// \param path Path of the collectable in the element tree
+    /// \param clock Name of the clock it is swept on
+    /// \param base Start of the region. It must stay valid for as long as
+    ///             the collectable is activated.
+    /// \param num_bytes Size of the region
+    /// \param block_size Granularity of the dirty-block patches
+    std::shared_ptr<RegionCollectionPoint> createRegionCollectable(
+        const std::string& path, const std::string& clock, const void* base, size_t num_bytes, size_t block_size = 64);
+
+    /// \brief  Keep the min/max of one numeric field of a collectable in the
+    ///         CollectionZoneMaps table, for every record the collectable is
+    ///         swept into. Readers can then skip records whose range cannot
+    ///         match (see DatabaseManager::findZoneMapTickRanges()).
+    ///
+    /// \param path Path given to createCollectable() or createIterableCollector()
+    /// \param field_name Struct field name, or "" for scalar collectables
+    ///
+    /// \return Returns the field's ID in the ZoneMapFields table.
+    int32_t addZoneMap(const std::string& path, const std::string& field_name = "");
+
+    /// \brief  Sketch the distribution of one numeric field of a collectable
+    ///         over the whole run: distinct count (HyperLogLog), heavy hitters
+    ///         (count-min + top-k), and quantiles (KLL). The sketches are
+    ///         updated on the sink threads and written to the FieldSketches,
+    ///         FieldHeavyHitters, and FieldQuantiles tables by postSim().
+    ///
+    /// \param path Path given to createCollectable() or createIterableCollector()
+    /// \param field_name Struct field name, or "" for scalar collectables
+    void addSketch(const std::string& path, const std::string& field_name = "");
+
+    /// Get the sketched distribution of a field so far (see addSketch()).
+    FieldSketchSummary getSketchSummary(const std::string& path, const std::string& field_name = "");
+
     // Sweep the collection system for all active collectables that exist on
     // the given clock, and send their data to the database.
     void sweep(const std::string& clk, uint64_t tick);
@@ -55,7 +100,17 @@ public:
     // One-time call to write post-simulation metadata to SimDB.
     void postSim();
 
+    /// Memory resource the collectables allocate their buffers from. Use it
+    /// to see how much memory the collection state is using.
+    const CountingMemoryResource& getMemoryResource() const
+    {
+        return *memory_resource_;
+    }
+
 private:
+    /// Get the serialized fields of one collected value of type T.
+    template <typename T> static std::vector<ZoneMapField> getValueLayout_();
+
     /// tree piecemeal as the simulator gets access to all the collection
     /// points it needs.
     ///
@@ -74,6 +129,10 @@ private:
     /// last known value.
     const size_t heartbeat_;
 
+    /// Shared with every collectable (which keeps it alive), and counts the
+    /// bytes allocated for their buffers.
+    std::shared_ptr<CountingMemoryResource> memory_resource_;
+
     /// All registered clocks (name->period).
     std::unordered_map<std::string, uint32_t> clocks_;
 
@@ -92,6 +151,20 @@ private:
     /// Data sink for high-performance processing (compression + SimDB writes)
     ThreadedSink sink_;
 
+    /// Fields given to addSketch(), and their FieldSketches indexes.
+    struct SketchedField
+    {
+        std::string path;
+        std::string field_name;
+        uint16_t elem_id = 0;
+        uint32_t sketch_idx = 0;
+    };
+    std::vector<SketchedField> sketched_fields_;
+
+    /// Whether to record each collectable's number of bytes in the sweeps
+    /// (needed for the element-major record layout).
+    const bool record_segment_sizes_ = false;
+
     /// The root of the serialized element tree.
     std::unique_ptr<TreeNode> root_;
 
@@ -101,6 +174,8 @@ private:
     friend class DatabaseManager;
 };
 
+template <typename Row, typename... Ts> class TypedTable;
+
 /*!
  * \class DatabaseManager
  *
@@ -118,29 +193,7 @@ public:
     ///                       then you will not be able to call createDatabaseFromSchema()
     ///                       or appendSchema(). The schema is considered read-only for
     ///                       previously existing database files.
-    DatabaseManager(const std::string& db_file = "sim.db", const bool force_new_file = false)
-        : db_file_(db_file)
-    {
-        std::ifstream fin(db_file);
-        if (fin.good())
-        {
-            if (force_new_file)
-            {
-                fin.close();
-                const auto cmd = "rm -f " + db_file;
-                auto rc = system(cmd.c_str());
-                (void)rc;
-            }
-            else
-            {
-                if (!connectToExistingDatabase_(db_file))
-                {
-                    throw DBException("Unable to connect to database file: ") << db_file;
-                }
-                append_schema_allowed_ = false;
-            }
-        }
-    }
+    DatabaseManager(const std::string& db_file = "sim.db", const bool force_new_file = false);
 
     /// You must explicitly call closeDatabase() prior to deleting
     /// the DatabaseManager to close the sqlite3 connection.
@@ -162,22 +215,17 @@ public:
     ///         existing file.
     ///
     /// \return Returns true if successful, false otherwise.
-    bool createDatabaseFromSchema(const Schema& schema)
-    {
-        if (!append_schema_allowed_)
-        {
-            throw DBException("Cannot alter schema if you created a DatabaseManager with an existing file.");
-        }
-
-        db_conn_.reset(new SQLiteConnection);
-        schema_ = schema;
-
-        assertNoDatabaseConnectionOpen_();
-        createDatabaseFile_();
+    bool createDatabaseFromSchema(const Schema& schema);
 
-        db_conn_->realizeSchema(schema_);
-        return db_conn_->isValid();
-    }
+    /// \brief   Write the database file through SimDB's asynchronous VFS,
+    ///          which moves page writes off the calling thread and batches
+    ///          adjacent pages together (see AsyncVfs). Pass durable=false
+    ///          for scratch runs to skip fsync of the database and WAL.
+    ///
+    /// \throws  This will throw an exception if the database file was
+    ///          already opened (call this before createDatabaseFromSchema()
+    ///          or enableCollection()).
+    void enableAsyncWrites(const AsyncVfsOptions& options = AsyncVfsOptions());
 
     /// \brief   After calling createDatabaseFromSchema(), you may
     ///          add additional tables with this method.
@@ -190,26 +238,7 @@ public:
     ///          existing file.
     ///
     /// \return  Returns true if successful, false otherwise.
-    bool appendSchema(const Schema& schema)
-    {
-        if (!db_conn_)
-        {
-            return false;
-        }
-        else if (!db_conn_->isValid())
-        {
-            throw DBException("Attempt to append schema tables to a DatabaseManager that does not have a valid database connection");
-        }
-
-        if (!append_schema_allowed_)
-        {
-            throw DBException("Cannot alter schema if you created a DatabaseManager with an existing file.");
-        }
-
-        db_conn_->realizeSchema(schema);
-        schema_.appendSchema(schema);
-        return true;
-    }
+    bool appendSchema(const Schema& schema);
 
     /// Get the full database file path.
     const std::string& getDatabaseFilePath() const
@@ -225,29 +254,37 @@ public:
     /// a slower Argos UI. The default is 10 cycles, with a valid range of 0 to 25.
     void enableCollection(size_t heartbeat = 10, size_t num_compression_threads = 1)
     {
-        if (heartbeat > 25 || heartbeat == 0)
-        {
-            throw DBException("Invalid heartbeat value. Must be in the range [1, 25]");
-        }
+        CollectionConfig config;
+        config.heartbeat = heartbeat;
+        config.num_compression_threads = num_compression_threads;
+        enableCollection(config);
+    }
 
-        if (!collection_mgr_)
-        {
-            if (!db_conn_)
-            {
-                Schema schema;
-                createDatabaseFromSchema(schema);
-            }
+    /// Initialize the collection manager prior to calling getCollectionMgr().
+    /// See CollectionConfig for the available options.
+    void enableCollection(const CollectionConfig& config);
 
-            collection_mgr_ = std::make_unique<CollectionMgr>(this, heartbeat, num_compression_threads);
+    /// Move the records written by the SEGMENT_FILES sink backend into the
+    /// CollectionRecords table, so the database can be read on its own.
+    /// Records keep the order they were written in.
+    ///
+    /// \param remove_segment_files Delete the segment files afterwards.
+    ///
+    /// \return Returns the number of records imported.
+    size_t importCollectionSegments(bool remove_segment_files = true);
 
-            Schema schema;
-            collection_mgr_->defineSchema(schema);
-            appendSchema(schema);
-        }
-    }
+    /// The reverse of importCollectionSegments(): move the CollectionRecords
+    /// rows into new segment files (after any existing ones) and index them
+    /// in the CollectionSegments table. Records keep their order.
+    ///
+    /// \param max_segment_bytes Start a new segment file once the current
+    ///        one reaches this many bytes.
+    ///
+    /// \return Returns the number of records exported.
+    size_t exportCollectionRecords(size_t max_segment_bytes = 1ull << 30);
 
-    /// Access the data collection system for e.g. pipeline collection
-    /// or stats collection (CSV/JSON).
+    /// Access the data collection system for e.g. pipeline collection.
+    /// Periodic CSV/JSON stats reports are written by a StatsReporter.
     CollectionMgr* getCollectionMgr()
     {
         return collection_mgr_.get();
@@ -275,61 +312,11 @@ public:
     /// \note   You may also provide ValueContainerBase subclasses in the SQL_VALUES.
     ///
     /// \return SqlRecord which wraps the table and the ID of its record.
-    std::unique_ptr<SqlRecord> INSERT(SqlTable&& table, SqlColumns&& cols, SqlValues&& vals)
-    {
-        std::unique_ptr<SqlRecord> record;
-
-        db_conn_->safeTransaction(
-            [&]()
-            {
-                std::ostringstream oss;
-                oss << "INSERT INTO " << table.getName();
-                cols.writeColsForINSERT(oss);
-                vals.writeValsForINSERT(oss);
-
-                std::string cmd = oss.str();
-                auto stmt = db_conn_->prepareStatement(cmd);
-                vals.bindValsForINSERT(stmt);
-
-                auto rc = SQLiteReturnCode(sqlite3_step(stmt));
-                if (rc != SQLITE_DONE)
-                {
-                    throw DBException("Could not perform INSERT. Error: ") << sqlite3_errmsg(db_conn_->getDatabase());
-                }
-
-                auto db_id = db_conn_->getLastInsertRowId();
-                record.reset(new SqlRecord(table.getName(), db_id, db_conn_->getDatabase(), db_conn_.get()));
-                return true;
-            });
-
-        return record;
-    }
+    std::unique_ptr<SqlRecord> INSERT(SqlTable&& table, SqlColumns&& cols, SqlValues&& vals);
 
     /// This INSERT() overload is to be used for tables that were defined with
     /// at least one default value for its column(s).
-    std::unique_ptr<SqlRecord> INSERT(SqlTable&& table)
-    {
-        std::unique_ptr<SqlRecord> record;
-
-        db_conn_->safeTransaction(
-            [&]()
-            {
-                const std::string cmd = "INSERT INTO " + table.getName() + " DEFAULT VALUES";
-                auto stmt = db_conn_->prepareStatement(cmd);
-
-                auto rc = SQLiteReturnCode(sqlite3_step(stmt));
-                if (rc != SQLITE_DONE)
-                {
-                    throw DBException("Could not perform INSERT. Error: ") << sqlite3_errmsg(db_conn_->getDatabase());
-                }
-
-                auto db_id = db_conn_->getLastInsertRowId();
-                record.reset(new SqlRecord(table.getName(), db_id, db_conn_->getDatabase(), db_conn_.get()));
-                return true;
-            });
-
-        return record;
-    }
+    std::unique_ptr<SqlRecord> INSERT(SqlTable&& table);
 
     /// \brief  Get a SqlRecord from a database ID for the given table.
     ///
@@ -347,111 +334,219 @@ public:
         return findRecord_(table_name, db_id, true);
     }
 
-    /// \brief  Delete one record from the given table with the given ID.
+    /// \brief  Get the SqlRecords for many database IDs in the given table,
+    ///         using a few "SELECT Id ... WHERE Id IN (...)" statements
+    ///         instead of one findRecord() call per ID.
     ///
-    /// \return Returns true if successful, false otherwise.
-    bool removeRecordFromTable(const char* table_name, const int db_id)
-    {
-        db_conn_->safeTransaction(
-            [&]()
-            {
-                std::ostringstream oss;
-                oss << "DELETE FROM " << table_name << " WHERE Id=" << db_id;
-                const auto cmd = oss.str();
+    /// \return Returns the record wrappers for the IDs that were found, in
+    ///         the order they were given. Missing IDs are skipped.
+    std::vector<std::unique_ptr<SqlRecord>> findRecords(const char* table_name, const std::vector<int>& db_ids) const;
 
-                auto rc = SQLiteReturnCode(sqlite3_exec(db_conn_->getDatabase(), cmd.c_str(), nullptr, nullptr, nullptr));
-                if (rc)
-                {
-                    throw DBException(sqlite3_errmsg(db_conn_->getDatabase()));
-                }
+    /// \brief  Read the given columns of many records in the given table
+    ///         with a few "SELECT Id,<cols> ... WHERE Id IN (...)" statements,
+    ///         instead of one getProperties() call per record:
+    ///
+    ///     auto rows = db_mgr.findRecords<std::string, int32_t>("Customers", SQL_COLUMNS("Name", "Age"), ids);
+    ///     for (const auto& [id, vals] : rows) { ... }
+    ///
+    /// \return Returns the (ID, column values) pairs for the IDs that were
+    ///         found, in the order they were given. Missing IDs are skipped.
+    template <typename... Ts>
+    std::vector<std::pair<int, std::tuple<Ts...>>> findRecords(const char* table_name,
+                                                               const SqlColumns& cols,
+                                                               const std::vector<int>& db_ids) const
+    {
+        const auto col_names = cols.getColNames();
+        if (col_names.size() != sizeof...(Ts))
+        {
+            throw DBException("Expected ") << sizeof...(Ts) << " columns in findRecords(), got " << col_names.size();
+        }
 
-                return true;
-            });
+        std::unordered_map<int, std::tuple<Ts...>> found;
+        forEachIdChunk_(db_ids,
+                        [&](const std::vector<int>& chunk)
+                        {
+                            SqlQuery query(table_name, db_conn_->getDatabase());
+
+                            int32_t id;
+                            std::tuple<Ts...> vals;
+                            query.select("Id", id);
+                            std::apply(
+                                [&](auto&... val)
+                                {
+                                    auto col_iter = col_names.begin();
+                                    (query.select((col_iter++)->c_str(), val), ...);
+                                },
+                                vals);
+                            query.addConstraintForInt("Id", SetConstraints::IN_SET, chunk);
+
+                            auto result_set = query.getResultSet();
+                            while (result_set.getNextRecord())
+                            {
+                                found[id] = vals;
+                            }
+                        });
+
+        std::vector<std::pair<int, std::tuple<Ts...>>> records;
+        records.reserve(found.size());
+        for (const auto db_id : db_ids)
+        {
+            auto iter = found.find(db_id);
+            if (iter != found.end())
+            {
+                records.emplace_back(db_id, iter->second);
+            }
+        }
 
-        return sqlite3_changes(db_conn_->getDatabase()) == 1;
+        return records;
     }
 
+    /// \brief  Delete one record from the given table with the given ID.
+    ///
+    /// \return Returns true if successful, false otherwise.
+    bool removeRecordFromTable(const char* table_name, const int db_id);
+
     /// \brief  Delete every record from the given table.
     ///
     /// \return Returns the total number of deleted records.
-    uint32_t removeAllRecordsFromTable(const char* table_name)
-    {
-        db_conn_->safeTransaction(
-            [&]()
-            {
-                std::ostringstream oss;
-                oss << "DELETE FROM " << table_name;
-                const auto cmd = oss.str();
+    uint32_t removeAllRecordsFromTable(const char* table_name);
 
-                auto rc = SQLiteReturnCode(sqlite3_exec(db_conn_->getDatabase(), cmd.c_str(), nullptr, nullptr, nullptr));
-                if (rc)
-                {
-                    throw DBException(sqlite3_errmsg(db_conn_->getDatabase()));
-                }
+    /// \brief  Issue "DELETE FROM TableName" to clear out the given table.
+    ///
+    /// \return Returns the total number of deleted records across all tables.
+    uint32_t removeAllRecordsFromAllTables();
 
-                return true;
-            });
+    /// Execute any SQL command.
+    void executeSQL(const std::string& sql_cmd);
 
-        return sqlite3_changes(db_conn_->getDatabase());
+    /// Get a query object to issue SELECT statements with constraints.
+    std::unique_ptr<SqlQuery> createQuery(const char* table_name)
+    {
+        std::unique_ptr<SqlQuery> query(new SqlQuery(table_name, db_conn_->getDatabase()));
+        if (index_advisor_)
+        {
+            query->setIndexAdvisor(index_advisor_);
+        }
+        if (query_cache_)
+        {
+            query->setQueryCache(query_cache_);
+        }
+        return query;
     }
 
-    /// \brief  Issue "DELETE FROM TableName" to clear out the given table.
+    /// \brief  Cache the results of queries made with createQuery(), so that
+    ///         running an identical query again (same columns, constraints,
+    ///         order, and limit) does not touch the database. Results are
+    ///         dropped once anything is written to the database, so this
+    ///         pays off for databases that are no longer changing, e.g. the
+    ///         metadata tables (StructFields, EnumDefns, ElementTreeNodes)
+    ///         after the simulation.
     ///
-    /// \return Returns the total number of deleted records across all tables.
-    uint32_t removeAllRecordsFromAllTables()
+    /// \param max_entries Maximum number of cached results
+    /// \param max_bytes Maximum total size of the cached results
+    void enableQueryCache(const size_t max_entries = 256, const size_t max_bytes = 64 * 1024 * 1024)
     {
-        uint32_t count = 0;
+        if (!db_conn_)
+        {
+            throw DBException("The query cache requires an open database connection");
+        }
+        query_cache_ = std::make_shared<QueryCache>(db_conn_->getDatabase(), max_entries, max_bytes);
+    }
 
-        db_conn_->safeTransaction(
-            [&]()
-            {
-                const char* cmd = "SELECT name FROM sqlite_master WHERE type='table'";
-                auto stmt = db_conn_->prepareStatement(cmd);
+    /// Get the query cache hit/miss statistics (see enableQueryCache()).
+    QueryCacheStats getQueryCacheStats() const
+    {
+        return query_cache_ ? query_cache_->getStats() : QueryCacheStats();
+    }
 
-                while (true)
-                {
-                    auto rc = SQLiteReturnCode(sqlite3_step(stmt));
-                    if (rc != SQLITE_ROW)
-                    {
-                        break;
-                    }
+    /// \brief  Switch the database to WAL journaling and move checkpoints off
+    ///         of the committing thread. SQLite's inline auto-checkpoint is
+    ///         turned off, and a background thread with its own connection
+    ///         runs PASSIVE checkpoints as the WAL grows or once commits go
+    ///         idle, and RESTART checkpoints (which also truncate the WAL)
+    ///         if the WAL gets too large anyway.
+    void enableWalCheckpointing(const WalCheckpointOptions& options = WalCheckpointOptions())
+    {
+        if (!db_conn_)
+        {
+            throw DBException("WAL checkpointing requires an open database connection");
+        }
 
-                    auto table_name = sqlite3_column_text(stmt, 0);
-                    count += removeAllRecordsFromTable((const char*)table_name);
-                }
+        wal_checkpointer_.reset();
 
-                return true;
-            });
+        auto db = db_conn_->getDatabase();
+        sqlite3_stmt* stmt = nullptr;
+        std::string journal_mode;
+        if (sqlite3_prepare_v2(db, "PRAGMA journal_mode=WAL", -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            journal_mode = (const char*)sqlite3_column_text(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
 
-        return count;
+        if (journal_mode != "wal")
+        {
+            throw DBException("Unable to switch ") << db_filepath_ << " to WAL journaling: " << sqlite3_errmsg(db);
+        }
+
+        sqlite3_wal_autocheckpoint(db, 0);
+        wal_checkpointer_ = std::make_unique<WalCheckpointer>(db, options);
+        wal_checkpointer_->startThreadLoop();
     }
 
-    /// Execute any SQL command.
-    void executeSQL(const std::string& sql_cmd)
+    /// Get the WAL checkpoint metrics (see enableWalCheckpointing()).
+    WalCheckpointStats getWalCheckpointStats() const
     {
-        db_conn_->safeTransaction(
-            [&]()
-            {
-                auto rc = SQLiteReturnCode(sqlite3_exec(db_conn_->getDatabase(), sql_cmd.c_str(), nullptr, nullptr, nullptr));
-                if (rc)
-                {
-                    throw DBException(sqlite3_errmsg(db_conn_->getDatabase()));
-                }
+        return wal_checkpointer_ ? wal_checkpointer_->getStats() : WalCheckpointStats();
+    }
 
-                return true;
-            });
+    /// \brief  Debug mode which checks the query plan of every query made
+    ///         with createQuery() when it runs. Tables that had to be scanned
+    ///         in full are remembered along with the columns the query was
+    ///         constrained on, and closeDatabase() prints the suggested
+    ///         createIndexOn()/createCompoundIndexOn() calls.
+    ///
+    /// \note   This adds an EXPLAIN QUERY PLAN to every query. Do not leave
+    ///         it on outside of development.
+    void enableIndexAdvice()
+    {
+        if (!index_advisor_)
+        {
+            index_advisor_ = std::make_shared<IndexAdvisor>();
+        }
     }
 
-    /// Get a query object to issue SELECT statements with constraints.
-    std::unique_ptr<SqlQuery> createQuery(const char* table_name)
+    /// Get the suggested indexes so far (see enableIndexAdvice()).
+    std::vector<std::string> getIndexAdvice() const
     {
-        return std::unique_ptr<SqlQuery>(new SqlQuery(table_name, db_conn_->getDatabase()));
+        return index_advisor_ ? index_advisor_->getIndexAdvice() : std::vector<std::string>();
     }
 
+    /// \brief  Get the tick ranges [Tick, EndTick] of the collection records
+    ///         that may hold a value of the given zone map field (see
+    ///         CollectionMgr::addZoneMap()) within [min_val, max_val].
+    ///         Every other record can be skipped.
+    ///
+    /// \throws Throws an exception if there is no zone map for this field.
+    std::vector<std::pair<uint64_t, uint64_t>>
+    findZoneMapTickRanges(const std::string& path, const std::string& field_name, double min_val, double max_val);
+
+    /// \brief  Get the distribution of a field over the whole run, as written
+    ///         by CollectionMgr::postSim() (see CollectionMgr::addSketch()).
+    ///
+    /// \throws Throws an exception if this field was not sketched.
+    FieldSketchSummary getFieldSketch(const std::string& path, const std::string& field_name = "");
+
     /// Close the sqlite3 connection.
     void closeDatabase()
     {
+        for (const auto& advice : getIndexAdvice())
+        {
+            std::cout << "[simdb] Full table scan, consider adding an index: " << advice << std::endl;
+        }
+        query_cache_.reset();
+        wal_checkpointer_.reset();
         db_conn_.reset();
+        compressed_blob_cols_.clear();
     }
 
     // One-time call to write post-simulation metadata to SimDB.
@@ -470,41 +565,15 @@ private:
     ///         from a previous call to getDatabaseFilePath()
     ///
     /// \return Returns true if successful, false otherwise.
-    bool connectToExistingDatabase_(const std::string& db_fpath)
-    {
-        assertNoDatabaseConnectionOpen_();
-        db_conn_.reset(new SQLiteConnection);
+    bool connectToExistingDatabase_(const std::string& db_fpath);
 
-        if (db_conn_->openDbFile_(db_fpath).empty())
-        {
-            db_conn_.reset();
-            db_filepath_.clear();
-            return false;
-        }
-
-        db_filepath_ = db_conn_->getDatabaseFilePath();
-        append_schema_allowed_ = false;
-        return true;
-    }
+    /// Read the newest compression dictionary from another SimDB file.
+    /// Returns no bytes (and collection falls back to training, if enabled)
+    /// if that file does not have one.
+    static std::vector<char> loadCompressionDictionary_(const std::string& db_fpath);
 
     /// Open the given database file.
-    bool createDatabaseFile_()
-    {
-        if (!db_conn_)
-        {
-            return false;
-        }
-
-        auto db_filename = db_conn_->openDbFile_(db_file_);
-        if (!db_filename.empty())
-        {
-            //File opened without issues. Store the full DB filename.
-            db_filepath_ = db_filename;
-            return true;
-        }
-
-        return false;
-    }
+    bool createDatabaseFile_();
 
     /// This class does not currently allow one DatabaseManager
     /// to be simultaneously connected to multiple databases.
@@ -522,34 +591,32 @@ private:
         }
     }
 
-    /// Get a SqlRecord from a database ID for the given table.
-    std::unique_ptr<SqlRecord> findRecord_(const char* table_name, const int db_id, const bool must_exist) const
-    {
-        std::ostringstream oss;
-        oss << "SELECT * FROM " << table_name << " WHERE Id=" << db_id;
-        const auto cmd = oss.str();
+    /// Get the compressed_blob_t columns of the given (existing) table.
+    /// Only called from inside a transaction.
+    const std::unordered_set<std::string>& getCompressedBlobColumns_(const std::string& table_name) const;
 
-        auto stmt = SQLitePreparedStatement(db_conn_->getDatabase(), cmd);
-        auto rc = SQLiteReturnCode(sqlite3_step(stmt));
+    /// Get a SqlRecord from a database ID for the given table.
+    std::unique_ptr<SqlRecord> findRecord_(const char* table_name, const int db_id, const bool must_exist) const;
 
-        if (must_exist && rc == SQLITE_DONE)
-        {
-            throw DBException("Record not found with ID ") << db_id << " in table " << table_name;
-        }
-        else if (rc == SQLITE_DONE)
-        {
-            return nullptr;
-        }
-        else if (rc == SQLITE_ROW)
-        {
-            return std::unique_ptr<SqlRecord>(new SqlRecord(table_name, db_id, db_conn_->getDatabase(), db_conn_.get()));
-        }
-        else
+    /// Call the given function with the IDs split into chunks that keep each
+    /// "IN (...)" list well under SQLite's maximum statement length.
+    template <typename Func> static void forEachIdChunk_(const std::vector<int>& db_ids, Func&& func)
+    {
+        constexpr size_t max_ids_per_query = 10000;
+        for (size_t start = 0; start < db_ids.size(); start += max_ids_per_query)
         {
-            throw DBException("Internal error has occured: ") << sqlite3_errmsg(db_conn_->getDatabase());
+            const auto end = std::min(start + max_ids_per_query, db_ids.size());
+            func(std::vector<int>(db_ids.begin() + start, db_ids.begin() + end));
         }
     }
 
+    /// Remember that a struct or enum definition was written to this
+    /// database. Returns false if it already was.
+    bool markDefnSerialized_(const std::string& defn_name)
+    {
+        return serialized_defns_.insert(defn_name).second;
+    }
+
     /// Finalize the collection system.
     bool finalizeCollections_()
     {
@@ -564,7 +631,7 @@ private:
     /// Database connection.
     std::shared_ptr<SQLiteConnection> db_conn_;
 
-    /// Collection manager (CSV/JSON/Argos).
+    /// Collection manager (Argos).
     std::unique_ptr<CollectionMgr> collection_mgr_;
 
     /// Schema for this database as given to createDatabaseFromSchema()
@@ -582,27 +649,37 @@ private:
     /// We do not allow schemas to be altered for DatabaseManager's
     /// that were initialized with a previously existing file.
     bool append_schema_allowed_ = true;
-};
 
-/// Note that this method is defined here since we need the INSERT() method.
-inline void FieldBase::serializeDefn(DatabaseManager* db_mgr, const std::string& struct_name) const
-{
-    const auto field_dtype_str = getFieldDTypeStr(dtype_);
-    const auto fmt = static_cast<int>(format_);
-    const auto is_autocolorize_key = (int)isAutocolorizeKey();
-    const auto is_displayed_by_default = (int)isDisplayedByDefault();
+    /// SQLite VFS to open new database files with (nullptr for the default).
+    const char* vfs_name_ = nullptr;
 
-    db_mgr->INSERT(SQL_TABLE("StructFields"),
-                   SQL_COLUMNS("StructName", "FieldName", "FieldType", "FormatCode", "IsAutoColorizeKey", "IsDisplayedByDefault"),
-                   SQL_VALUES(struct_name, name_, field_dtype_str, fmt, is_autocolorize_key, is_displayed_by_default));
-}
+    /// Collects full table scans when enableIndexAdvice() was called.
+    std::shared_ptr<IndexAdvisor> index_advisor_;
+
+    /// Caches query results when enableQueryCache() was called.
+    std::shared_ptr<QueryCache> query_cache_;
+
+    /// Runs WAL checkpoints when enableWalCheckpointing() was called.
+    std::unique_ptr<WalCheckpointer> wal_checkpointer_;
+
+    /// Compressed_blob_t columns by table name (see getCompressedBlobColumns_()).
+    /// Shared with the SqlRecords we create.
+    mutable CompressedBlobColumnCache compressed_blob_cols_;
+
+    /// Struct and enum definitions written to this database (see markDefnSerialized_()).
+    std::unordered_set<std::string> serialized_defns_;
+
+    template <typename Row, typename... Ts> friend class TypedTable;
+    template <typename StructT> friend class StructSchema;
+    template <typename EnumT> friend class EnumMap;
+};
 
 /// Note that this method is defined here since we need the INSERT() method.
 template <typename EnumT> inline void EnumMap<EnumT>::serializeDefn(DatabaseManager* db_mgr) const
 {
     using enum_int_t = typename std::underlying_type<EnumT>::type;
 
-    if (!serialized_)
+    if (db_mgr->markDefnSerialized_("enum " + enum_name_))
     {
         auto dtype = getFieldDTypeEnum<enum_int_t>();
         auto int_type_str = getFieldDTypeStr(dtype);
@@ -620,8 +697,18 @@ template <typename EnumT> inline void EnumMap<EnumT>::serializeDefn(DatabaseMana
                            SQL_COLUMNS("EnumName", "EnumValStr", "EnumValBlob", "IntType"),
                            SQL_VALUES(enum_name_, enum_val_str, enum_val_blob, int_type_str));
         }
+    }
+}
 
-        serialized_ = true;
+/// Note that this method is defined here since we need the DatabaseManager.
+template <typename StructT> inline void StructSchema<StructT>::serializeDefn(DatabaseManager* db_mgr) const
+{
+    if (db_mgr->markDefnSerialized_("struct " + struct_name_))
+    {
+        for (auto& field : fields_)
+        {
+            field->serializeDefn(db_mgr, struct_name_);
+        }
     }
 }
 
@@ -639,63 +726,6 @@ template <typename EnumT> inline void EnumField<EnumT>::serializeDefn(DatabaseMa
     EnumMap<EnumT>::instance()->serializeDefn(db_mgr);
 }
 
-inline CollectionMgr::CollectionMgr(DatabaseManager* db_mgr, size_t heartbeat, size_t num_compression_threads)
-    : db_mgr_(db_mgr)
-    , heartbeat_(heartbeat)
-    , sink_(db_mgr, num_compression_threads)
-{
-}
-
-inline void CollectionMgr::addClock(const std::string& name, const uint32_t period)
-{
-    clocks_[name] = period;
-}
-
-inline void CollectionMgr::defineSchema(Schema& schema) const
-{
-    using dt = SqlDataType;
-
-    schema.addTable("CollectionGlobals").addColumn("Heartbeat", dt::int32_t).setColumnDefaultValue("Heartbeat", 10);
-
-    schema.addTable("Clocks").addColumn("Name", dt::string_t).addColumn("Period", dt::int32_t);
-
-    schema.addTable("ElementTreeNodes").addColumn("Name", dt::string_t).addColumn("ParentID", dt::int32_t);
-
-    schema.addTable("CollectableTreeNodes")
-        .addColumn("ElementTreeNodeID", dt::int32_t)
-        .addColumn("ClockID", dt::int32_t)
-        .addColumn("DataType", dt::string_t)
-        .addColumn("Location", dt::string_t)
-        .addColumn("AutoCollected", dt::int32_t)
-        .setColumnDefaultValue("AutoCollected", 0);
-
-    schema.addTable("StructFields")
-        .addColumn("StructName", dt::string_t)
-        .addColumn("FieldName", dt::string_t)
-        .addColumn("FieldType", dt::string_t)
-        .addColumn("FormatCode", dt::int32_t)
-        .addColumn("IsAutoColorizeKey", dt::int32_t)
-        .addColumn("IsDisplayedByDefault", dt::int32_t)
-        .setColumnDefaultValue("IsAutoColorizeKey", 0)
-        .setColumnDefaultValue("IsDisplayedByDefault", 1);
-
-    schema.addTable("EnumDefns")
-        .addColumn("EnumName", dt::string_t)
-        .addColumn("EnumValStr", dt::string_t)
-        .addColumn("EnumValBlob", dt::blob_t)
-        .addColumn("IntType", dt::string_t);
-
-    schema.addTable("StringMap").addColumn("IntVal", dt::int32_t).addColumn("String", dt::string_t);
-
-    schema.addTable("CollectionRecords")
-        .addColumn("Tick", dt::int64_t)
-        .addColumn("Data", dt::blob_t)
-        .addColumn("IsCompressed", dt::int32_t)
-        .createIndexOn("Tick");
-
-    schema.addTable("QueueMaxSizes").addColumn("CollectableTreeNodeID", dt::int32_t).addColumn("MaxSize", dt::int32_t);
-}
-
 template <typename T>
 inline std::shared_ptr<CollectionPoint> CollectionMgr::createCollectable(const std::string& path, const std::string& clock)
 {
@@ -719,7 +749,8 @@ inline std::shared_ptr<CollectionPoint> CollectionMgr::createCollectable(const s
         dtype = demangle(typeid(value_type).name());
     }
 
-    auto collectable = std::make_shared<CollectionPoint>(elem_id, clk_id, heartbeat_, dtype);
+    auto collectable = std::make_shared<CollectionPoint>(elem_id, clk_id, heartbeat_, dtype, memory_resource_);
+    collectable->setValueLayout(getValueLayout_<value_type>());
 
     if constexpr (!std::is_trivial<value_type>::value)
     {
@@ -740,7 +771,7 @@ CollectionMgr::createIterableCollector(const std::string& path, const std::strin
     auto elem_id = treenode->db_id;
     auto clk_id = treenode->clk_id;
 
-    using value_type = meta_utils::remove_any_pointer_t<typename T::value_type>;
+    using value_type = meta_utils::remove_any_pointer_t<typename iterable_traits<T>::value_type>;
 
     if constexpr (!std::is_trivial<value_type>::value)
     {
@@ -773,186 +804,47 @@ CollectionMgr::createIterableCollector(const std::string& path, const std::strin
     dtype += "_capacity" + std::to_string(capacity);
 
     using collection_point_type = std::conditional_t<Sparse, SparseIterableCollectionPoint, ContigIterableCollectionPoint>;
-    auto collectable = std::make_shared<collection_point_type>(elem_id, clk_id, heartbeat_, dtype, capacity);
+    auto collectable = std::make_shared<collection_point_type>(elem_id, clk_id, heartbeat_, dtype, capacity, memory_resource_);
+    collectable->setValueLayout(getValueLayout_<value_type>());
     collectables_.push_back(collectable);
     collectables_by_path_[path] = collectable.get();
     return collectable;
 }
 
-/// Sweep the collection system for all active collectables that exist on
-/// the given clock, and send their data to the database.
-inline void CollectionMgr::sweep(const std::string& clk, uint64_t tick)
-{
-    const auto clk_id = clock_db_ids_by_name_.at(clk);
-
-    swept_data_.clear();
-    for (auto& collectable : collectables_)
-    {
-        if (collectable->getClockId() == clk_id)
-        {
-            collectable->sweep(swept_data_);
-        }
-    }
-
-    if (swept_data_.empty())
-    {
-        return;
-    }
-
-    DatabaseEntry entry;
-    entry.bytes = std::move(swept_data_);
-    entry.compressed = false;
-    entry.tick = tick;
-
-    sink_.push(std::move(entry));
-}
-
-/// One-time call to write post-simulation metadata to SimDB.
-inline void CollectionMgr::postSim()
-{
-    db_mgr_->safeTransaction(
-        [&]()
-        {
-            for (auto& collectable : collectables_)
-            {
-                collectable->postSim(db_mgr_);
-            }
-            return true;
-        });
-
-    sink_.teardown();
-}
-
-/// Note that this method is defined here since we need the INSERT() method.
-inline void ContigIterableCollectionPoint::postSim(DatabaseManager* db_mgr)
-{
-    db_mgr->INSERT(SQL_TABLE("QueueMaxSizes"), SQL_COLUMNS("CollectableTreeNodeID", "MaxSize"), SQL_VALUES(getElemId(), queue_max_size_));
-}
-
-/// Note that this method is defined here since we need the INSERT() method.
-inline void SparseIterableCollectionPoint::postSim(DatabaseManager* db_mgr)
+template <typename T> inline std::vector<ZoneMapField> CollectionMgr::getValueLayout_()
 {
-    db_mgr->INSERT(SQL_TABLE("QueueMaxSizes"), SQL_COLUMNS("CollectableTreeNodeID", "MaxSize"), SQL_VALUES(getElemId(), queue_max_size_));
-}
-
-/// Note that this method is defined here since we need the INSERT() method.
-inline TreeNode* CollectionMgr::updateTree_(const std::string& path, const std::string& clk)
-{
-    if (!root_)
+    std::vector<ZoneMapField> layout;
+    if constexpr (std::is_same_v<T, bool>)
     {
-        root_ = std::make_unique<TreeNode>("root");
-        auto record = db_mgr_->INSERT(SQL_TABLE("ElementTreeNodes"), SQL_COLUMNS("Name", "ParentID"), SQL_VALUES("root", 0));
-        root_->db_id = record->getId();
+        layout.push_back({"", StructFields::int32_t, 0, sizeof(int32_t), 0});
     }
-
-    if (clock_db_ids_by_name_.find(clk) == clock_db_ids_by_name_.end())
-    {
-        auto period = clocks_.at(clk);
-        auto record = db_mgr_->INSERT(SQL_TABLE("Clocks"), SQL_COLUMNS("Name", "Period"), SQL_VALUES(clk, period));
-        clock_db_ids_by_name_[clk] = record->getId();
-    }
-
-    auto node = root_.get();
-    auto path_parts = split_string(path, '.');
-    for (size_t part_idx = 0; part_idx < path_parts.size(); ++part_idx)
+    else if constexpr (std::is_arithmetic_v<T> || std::is_enum_v<T>)
     {
-        auto part = path_parts[part_idx];
-        auto found = false;
-        for (const auto& child : node->children)
-        {
-            if (child->name == part)
-            {
-                node = child.get();
-                found = true;
-                break;
-            }
-        }
-
-        if (!found)
-        {
-            auto new_node = std::make_unique<TreeNode>(part, node);
-            node->children.push_back(std::move(new_node));
-            node = node->children.back().get();
-
-            auto record =
-                db_mgr_->INSERT(SQL_TABLE("ElementTreeNodes"), SQL_COLUMNS("Name", "ParentID"), SQL_VALUES(part, node->parent->db_id));
-
-            node->db_id = record->getId();
-            if (part_idx == path_parts.size() - 1)
-            {
-                node->clk_id = clock_db_ids_by_name_.at(clk);
-            }
-        }
+        const auto dtype = getFieldDTypeEnum<T>();
+        layout.push_back({"", dtype, 0, getDTypeNumBytes(dtype), 0});
     }
-
-    return node;
-}
-
-/// Note that this method is defined here since we need the INSERT() method.
-inline void CollectionMgr::finalizeCollections_()
-{
-    db_mgr_->INSERT(SQL_TABLE("CollectionGlobals"), SQL_COLUMNS("Heartbeat"), SQL_VALUES((int)heartbeat_));
-
-    std::vector<TreeNode*> leaf_nodes;
-
-    std::function<void(TreeNode*)> findLeafNodes = [&](TreeNode* node)
+    else if constexpr (!std::is_trivial_v<T>)
     {
-        if (node->children.empty())
-        {
-            leaf_nodes.push_back(node);
-        }
-        else
+        size_t offset = 0;
+        for (const auto& field : StructSerializer<T>::getInstance()->getFields())
         {
-            for (auto& child : node->children)
-            {
-                findLeafNodes(child.get());
-            }
+            layout.push_back({field->getName(), field->getType(), offset, field->getNumBytes(), 0});
+            offset += field->getNumBytes();
         }
-    };
-
-    findLeafNodes(root_.get());
-
-    for (auto leaf : leaf_nodes)
-    {
-        auto elem_id = leaf->db_id;
-        auto clk_id = leaf->clk_id;
-        auto loc = leaf->getLocation();
-        auto collectable = collectables_by_path_.at(loc);
-        auto dtype = collectable->getDataTypeStr();
-
-        db_mgr_->INSERT(SQL_TABLE("CollectableTreeNodes"),
-                        SQL_COLUMNS("ElementTreeNodeID", "ClockID", "DataType", "Location"),
-                        SQL_VALUES(elem_id, clk_id, dtype, loc));
     }
+    return layout;
 }
 
-/// Note that this method is defined here since we need the INSERT() method.
-inline void DatabaseThread::flush()
-{
-    db_mgr_->safeTransaction(
-        [&]()
-        {
-            DatabaseEntry entry;
-            while (queue_.try_pop(entry))
-            {
-                const auto& data = entry.bytes;
-                const auto tick = entry.tick;
-                const auto compressed = entry.compressed;
-
-                db_mgr_->INSERT(
-                    SQL_TABLE("CollectionRecords"), SQL_COLUMNS("Tick", "Data", "IsCompressed"), SQL_VALUES(tick, data, (int)compressed));
-
-                ++num_processed_;
-            }
-
-            for (const auto& kvp : StringMap::instance()->getUnserializedMap())
-            {
-                db_mgr_->INSERT(SQL_TABLE("StringMap"), SQL_COLUMNS("IntVal", "String"), SQL_VALUES(kvp.first, kvp.second));
-            }
-
-            StringMap::instance()->clearUnserializedMap();
-            return true;
-        });
-}
+#ifdef SIMDB_COMPILED_LIB
+#    define SIMDB_EXTERN_COLLECTABLE(T)                                                                                                    \
+        extern template std::shared_ptr<CollectionPoint> CollectionMgr::createCollectable<T>(const std::string&, const std::string&);    \
+        extern template void CollectionPoint::activate<T>(const T&, bool);
+SIMDB_FOR_EACH_SCALAR_TYPE(SIMDB_EXTERN_COLLECTABLE)
+#    undef SIMDB_EXTERN_COLLECTABLE
+#endif
 
 } // namespace simdb
+
+#ifndef SIMDB_COMPILED_LIB
+#    include "simdb/sqlite/DatabaseManagerImpl.hpp"
+#endif
@@ -0,0 +1,1228 @@
+// <DatabaseManagerImpl.hpp> -*- C++ -*-
+
+#pragma once
+
+/// Non-template definitions for DatabaseManager.hpp. Included from there in
+/// header-only mode, or compiled once into the simdb library (see LibraryMode.hpp).
+
+#include "simdb/sqlite/DatabaseManager.hpp"
+
+#include <filesystem>
+#include <unordered_set>
+
+namespace simdb
+{
+
+SIMDB_INLINE DatabaseManager::DatabaseManager(const std::string& db_file, const bool force_new_file)
+    : db_file_(db_file)
+{
+    std::ifstream fin(db_file);
+    if (fin.good())
+    {
+        if (force_new_file)
+        {
+            fin.close();
+            const auto cmd = "rm -f " + db_file;
+            auto rc = system(cmd.c_str());
+            (void)rc;
+        }
+        else
+        {
+            if (!connectToExistingDatabase_(db_file))
+            {
+                throw DBException("Unable to connect to database file: ") << db_file;
+            }
+            append_schema_allowed_ = false;
+        }
+    }
+}
+
+SIMDB_INLINE bool DatabaseManager::createDatabaseFromSchema(const Schema& schema)
+{
+    if (!append_schema_allowed_)
+    {
+        throw DBException("Cannot alter schema if you created a DatabaseManager with an existing file.");
+    }
+
+    db_conn_.reset(new SQLiteConnection);
+    schema_ = schema;
+
+    assertNoDatabaseConnectionOpen_();
+    createDatabaseFile_();
+
+    db_conn_->realizeSchema(schema_);
+    return db_conn_->isValid();
+}
+
+SIMDB_INLINE void DatabaseManager::enableAsyncWrites(const AsyncVfsOptions& options)
+{
+    if (db_conn_)
+    {
+        throw DBException("enableAsyncWrites() must be called before the database file is opened");
+    }
+
+    vfs_name_ = AsyncVfs::registerVfs(options);
+    if (!vfs_name_)
+    {
+        std::cout << "[simdb] Asynchronous writes are not supported on this platform" << std::endl;
+    }
+}
+
+SIMDB_INLINE bool DatabaseManager::appendSchema(const Schema& schema)
+{
+    if (!db_conn_)
+    {
+        return false;
+    }
+    else if (!db_conn_->isValid())
+    {
+        throw DBException("Attempt to append schema tables to a DatabaseManager that does not have a valid database connection");
+    }
+
+    if (!append_schema_allowed_)
+    {
+        throw DBException("Cannot alter schema if you created a DatabaseManager with an existing file.");
+    }
+
+    db_conn_->realizeSchema(schema);
+    schema_.appendSchema(schema);
+    return true;
+}
+
+SIMDB_INLINE void DatabaseManager::enableCollection(const CollectionConfig& config)
+{
+    if (config.heartbeat > 25 || config.heartbeat == 0)
+    {
+        throw DBException("Invalid heartbeat value. Must be in the range [1, 25]");
+    }
+
+    if (!collection_mgr_)
+    {
+        if (!db_conn_)
+        {
+            Schema schema;
+            createDatabaseFromSchema(schema);
+        }
+
+        if (config.preset_dictionary.empty() && !config.dictionary_source_db.empty())
+        {
+            auto resolved_config = config;
+            resolved_config.preset_dictionary = loadCompressionDictionary_(config.dictionary_source_db);
+            collection_mgr_ = std::make_unique<CollectionMgr>(this, resolved_config);
+        }
+        else
+        {
+            collection_mgr_ = std::make_unique<CollectionMgr>(this, config);
+        }
+
+        Schema schema;
+        collection_mgr_->defineSchema(schema);
+        appendSchema(schema);
+    }
+}
+
+SIMDB_INLINE std::unique_ptr<SqlRecord> DatabaseManager::INSERT(SqlTable&& table, SqlColumns&& cols, SqlValues&& vals)
+{
+    std::unique_ptr<SqlRecord> record;
+
+    db_conn_->safeTransaction(
+        [&]()
+        {
+            std::ostringstream oss;
+            oss << "INSERT INTO " << table.getName();
+            cols.writeColsForINSERT(oss);
+            vals.writeValsForINSERT(oss);
+
+            std::string cmd = oss.str();
+            auto stmt = db_conn_->prepareStatement(cmd);
+            vals.bindValsForINSERT(stmt, getCompressedBlobFlags(cols.getColNames(), getCompressedBlobColumns_(table.getName())));
+
+            auto rc = SQLiteReturnCode(sqlite3_step(stmt));
+            if (rc != SQLITE_DONE)
+            {
+                throw DBException("Could not perform INSERT. Error: ") << sqlite3_errmsg(db_conn_->getDatabase());
+            }
+
+            auto db_id = db_conn_->getLastInsertRowId();
+            record.reset(new SqlRecord(table.getName(), db_id, db_conn_->getDatabase(), db_conn_.get(), &compressed_blob_cols_));
+            return true;
+        });
+
+    return record;
+}
+
+SIMDB_INLINE const std::unordered_set<std::string>& DatabaseManager::getCompressedBlobColumns_(const std::string& table_name) const
+{
+    return compressed_blob_cols_.getColumns(db_conn_->getDatabase(), table_name);
+}
+
+SIMDB_INLINE std::unique_ptr<SqlRecord> DatabaseManager::INSERT(SqlTable&& table)
+{
+    std::unique_ptr<SqlRecord> record;
+
+    db_conn_->safeTransaction(
+        [&]()
+        {
+            const std::string cmd = "INSERT INTO " + table.getName() + " DEFAULT VALUES";
+            auto stmt = db_conn_->prepareStatement(cmd);
+
+            auto rc = SQLiteReturnCode(sqlite3_step(stmt));
+            if (rc != SQLITE_DONE)
+            {
+                throw DBException("Could not perform INSERT. Error: ") << sqlite3_errmsg(db_conn_->getDatabase());
+            }
+
+            auto db_id = db_conn_->getLastInsertRowId();
+            record.reset(new SqlRecord(table.getName(), db_id, db_conn_->getDatabase(), db_conn_.get(), &compressed_blob_cols_));
+            return true;
+        });
+
+    return record;
+}
+
+SIMDB_INLINE bool DatabaseManager::removeRecordFromTable(const char* table_name, const int db_id)
+{
+    db_conn_->safeTransaction(
+        [&]()
+        {
+            std::ostringstream oss;
+            oss << "DELETE FROM " << table_name << " WHERE Id=" << db_id;
+            const auto cmd = oss.str();
+
+            auto rc = SQLiteReturnCode(sqlite3_exec(db_conn_->getDatabase(), cmd.c_str(), nullptr, nullptr, nullptr));
+            if (rc)
+            {
+                throw DBException(sqlite3_errmsg(db_conn_->getDatabase()));
+            }
+
+            return true;
+        });
+
+    return sqlite3_changes(db_conn_->getDatabase()) == 1;
+}
+
+SIMDB_INLINE uint32_t DatabaseManager::removeAllRecordsFromTable(const char* table_name)
+{
+    db_conn_->safeTransaction(
+        [&]()
+        {
+            std::ostringstream oss;
+            oss << "DELETE FROM " << table_name;
+            const auto cmd = oss.str();
+
+            auto rc = SQLiteReturnCode(sqlite3_exec(db_conn_->getDatabase(), cmd.c_str(), nullptr, nullptr, nullptr));
+            if (rc)
+            {
+                throw DBException(sqlite3_errmsg(db_conn_->getDatabase()));
+            }
+
+            return true;
+        });
+
+    return sqlite3_changes(db_conn_->getDatabase());
+}
+
+SIMDB_INLINE uint32_t DatabaseManager::removeAllRecordsFromAllTables()
+{
+    uint32_t count = 0;
+
+    db_conn_->safeTransaction(
+        [&]()
+        {
+            const char* cmd = "SELECT name FROM sqlite_master WHERE type='table'";
+            auto stmt = db_conn_->prepareStatement(cmd);
+
+            while (true)
+            {
+                auto rc = SQLiteReturnCode(sqlite3_step(stmt));
+                if (rc != SQLITE_ROW)
+                {
+                    break;
+                }
+
+                auto table_name = sqlite3_column_text(stmt, 0);
+                count += removeAllRecordsFromTable((const char*)table_name);
+            }
+
+            return true;
+        });
+
+    return count;
+}
+
+SIMDB_INLINE void DatabaseManager::executeSQL(const std::string& sql_cmd)
+{
+    db_conn_->safeTransaction(
+        [&]()
+        {
+            auto rc = SQLiteReturnCode(sqlite3_exec(db_conn_->getDatabase(), sql_cmd.c_str(), nullptr, nullptr, nullptr));
+            if (rc)
+            {
+                throw DBException(sqlite3_errmsg(db_conn_->getDatabase()));
+            }
+
+            return true;
+        });
+}
+
+SIMDB_INLINE bool DatabaseManager::connectToExistingDatabase_(const std::string& db_fpath)
+{
+    assertNoDatabaseConnectionOpen_();
+    db_conn_.reset(new SQLiteConnection);
+
+    if (db_conn_->openDbFile_(db_fpath).empty())
+    {
+        db_conn_.reset();
+        db_filepath_.clear();
+        return false;
+    }
+
+    db_filepath_ = db_conn_->getDatabaseFilePath();
+    append_schema_allowed_ = false;
+    return true;
+}
+
+SIMDB_INLINE std::vector<char> DatabaseManager::loadCompressionDictionary_(const std::string& db_fpath)
+{
+    std::ifstream fin(db_fpath);
+    if (!fin.good())
+    {
+        throw DBException("Compression dictionary source does not exist: ") << db_fpath;
+    }
+    fin.close();
+
+    std::vector<char> dictionary;
+    DatabaseManager source_db_mgr(db_fpath);
+
+    try
+    {
+        auto query = source_db_mgr.createQuery("CompressionDictionaries");
+        query->select("Dictionary", dictionary);
+        query->orderBy("DictionaryID", QueryOrder::DESC);
+        query->setLimit(1);
+
+        auto results = query->getResultSet();
+        if (!results.getNextRecord())
+        {
+            dictionary.clear();
+        }
+    }
+    catch (const DBException&)
+    {
+        dictionary.clear();
+    }
+
+    source_db_mgr.closeDatabase();
+
+    if (dictionary.empty())
+    {
+        std::cout << "[simdb] No compression dictionary found in " << db_fpath << std::endl;
+    }
+    return dictionary;
+}
+
+SIMDB_INLINE bool DatabaseManager::createDatabaseFile_()
+{
+    if (!db_conn_)
+    {
+        return false;
+    }
+
+    auto db_filename = db_conn_->openDbFile_(db_file_, vfs_name_);
+    if (!db_filename.empty())
+    {
+        //File opened without issues. Store the full DB filename.
+        db_filepath_ = db_filename;
+        return true;
+    }
+
+    return false;
+}
+
+SIMDB_INLINE std::unique_ptr<SqlRecord> DatabaseManager::findRecord_(const char* table_name, const int db_id, const bool must_exist) const
+{
+    std::ostringstream oss;
+    oss << "SELECT * FROM " << table_name << " WHERE Id=" << db_id;
+    const auto cmd = oss.str();
+
+    auto stmt = SQLitePreparedStatement(db_conn_->getDatabase(), cmd);
+    auto rc = SQLiteReturnCode(sqlite3_step(stmt));
+
+    if (must_exist && rc == SQLITE_DONE)
+    {
+        throw DBException("Record not found with ID ") << db_id << " in table " << table_name;
+    }
+    else if (rc == SQLITE_DONE)
+    {
+        return nullptr;
+    }
+    else if (rc == SQLITE_ROW)
+    {
+        return std::unique_ptr<SqlRecord>(new SqlRecord(table_name, db_id, db_conn_->getDatabase(), db_conn_.get(), &compressed_blob_cols_));
+    }
+    else
+    {
+        throw DBException("Internal error has occured: ") << sqlite3_errmsg(db_conn_->getDatabase());
+    }
+}
+
+SIMDB_INLINE std::vector<std::unique_ptr<SqlRecord>> DatabaseManager::findRecords(const char* table_name,
+                                                                                  const std::vector<int>& db_ids) const
+{
+    std::unordered_set<int> found_ids;
+    forEachIdChunk_(db_ids,
+                    [&](const std::vector<int>& chunk)
+                    {
+                        SqlQuery query(table_name, db_conn_->getDatabase());
+
+                        int32_t id;
+                        query.select("Id", id);
+                        query.addConstraintForInt("Id", SetConstraints::IN_SET, chunk);
+
+                        auto result_set = query.getResultSet();
+                        while (result_set.getNextRecord())
+                        {
+                            found_ids.insert(id);
+                        }
+                    });
+
+    std::vector<std::unique_ptr<SqlRecord>> records;
+    records.reserve(found_ids.size());
+    for (const auto db_id : db_ids)
+    {
+        if (found_ids.count(db_id))
+        {
+            records.emplace_back(new SqlRecord(table_name, db_id, db_conn_->getDatabase(), db_conn_.get(), &compressed_blob_cols_));
+        }
+    }
+
+    return records;
+}
+
+/// Note that this method is defined here since we need the INSERT() method.
+SIMDB_INLINE void FieldBase::serializeDefn(DatabaseManager* db_mgr, const std::string& struct_name) const
+{
+    const auto field_dtype_str = getFieldDTypeStr(dtype_);
+    const auto fmt = static_cast<int>(format_);
+    const auto is_autocolorize_key = (int)isAutocolorizeKey();
+    const auto is_displayed_by_default = (int)isDisplayedByDefault();
+
+    db_mgr->INSERT(SQL_TABLE("StructFields"),
+                   SQL_COLUMNS("StructName", "FieldName", "FieldType", "FormatCode", "IsAutoColorizeKey", "IsDisplayedByDefault"),
+                   SQL_VALUES(struct_name, name_, field_dtype_str, fmt, is_autocolorize_key, is_displayed_by_default));
+}
+
+SIMDB_INLINE CollectionMgr::CollectionMgr(DatabaseManager* db_mgr, size_t heartbeat, size_t num_compression_threads)
+    : db_mgr_(db_mgr)
+    , heartbeat_(heartbeat)
+    , memory_resource_(std::make_shared<CountingMemoryResource>())
+    , sink_(db_mgr, num_compression_threads)
+{
+}
+
+SIMDB_INLINE CollectionMgr::CollectionMgr(DatabaseManager* db_mgr, const CollectionConfig& config)
+    : db_mgr_(db_mgr)
+    , heartbeat_(config.heartbeat)
+    , memory_resource_(std::make_shared<CountingMemoryResource>(config.memory_resource))
+    , sink_(db_mgr, config)
+    , record_segment_sizes_(config.element_major && (config.coalesce_max_bytes || config.coalesce_max_ticks))
+{
+}
+
+SIMDB_INLINE void CollectionMgr::addClock(const std::string& name, const uint32_t period)
+{
+    clocks_[name] = period;
+}
+
+SIMDB_INLINE void CollectionMgr::defineSchema(Schema& schema) const
+{
+    using dt = SqlDataType;
+
+    schema.addTable("CollectionGlobals").addColumn("Heartbeat", dt::int32_t).setColumnDefaultValue("Heartbeat", 10);
+
+    schema.addTable("Clocks").addColumn("Name", dt::string_t).addColumn("Period", dt::int32_t);
+
+    schema.addTable("ElementTreeNodes").addColumn("Name", dt::string_t).addColumn("ParentID", dt::int32_t);
+
+    schema.addTable("CollectableTreeNodes")
+        .addColumn("ElementTreeNodeID", dt::int32_t)
+        .addColumn("ClockID", dt::int32_t)
+        .addColumn("DataType", dt::string_t)
+        .addColumn("Location", dt::string_t)
+        .addColumn("AutoCollected", dt::int32_t)
+        .setColumnDefaultValue("AutoCollected", 0);
+
+    schema.addTable("StructFields")
+        .addColumn("StructName", dt::string_t)
+        .addColumn("FieldName", dt::string_t)
+        .addColumn("FieldType", dt::string_t)
+        .addColumn("FormatCode", dt::int32_t)
+        .addColumn("IsAutoColorizeKey", dt::int32_t)
+        .addColumn("IsDisplayedByDefault", dt::int32_t)
+        .setColumnDefaultValue("IsAutoColorizeKey", 0)
+        .setColumnDefaultValue("IsDisplayedByDefault", 1);
+
+    schema.addTable("EnumDefns")
+        .addColumn("EnumName", dt::string_t)
+        .addColumn("EnumValStr", dt::string_t)
+        .addColumn("EnumValBlob", dt::blob_t)
+        .addColumn("IntType", dt::string_t);
+
+    schema.addTable("StringMap").addColumn("IntVal", dt::int32_t).addColumn("String", dt::string_t);
+
+    schema.addTable("CollectionRecords")
+        .addColumn("Tick", dt::int64_t)
+        .addColumn("Data", dt::blob_t)
+        .addColumn("IsCompressed", dt::int32_t)
+        .addColumn("EndTick", dt::int64_t)
+        .addColumn("RecordFormat", dt::int32_t)
+        .addColumn("Filters", dt::int32_t)
+        .addColumn("ShuffleStride", dt::int32_t)
+        .addColumn("DictionaryID", dt::int32_t)
+        .setColumnDefaultValue("RecordFormat", 0)
+        .setColumnDefaultValue("Filters", 0)
+        .setColumnDefaultValue("ShuffleStride", 0)
+        .setColumnDefaultValue("DictionaryID", 0)
+        .createIndexOn("Tick");
+
+    schema.addTable("CollectionSegments")
+        .addColumn("Tick", dt::int64_t)
+        .addColumn("EndTick", dt::int64_t)
+        .addColumn("SegmentID", dt::int32_t)
+        .addColumn("Offset", dt::int64_t)
+        .addColumn("NumBytes", dt::int64_t)
+        .addColumn("IsCompressed", dt::int32_t)
+        .addColumn("RecordFormat", dt::int32_t)
+        .addColumn("Filters", dt::int32_t)
+        .addColumn("ShuffleStride", dt::int32_t)
+        .addColumn("DictionaryID", dt::int32_t)
+        .createIndexOn("Tick");
+
+    schema.addTable("CompressionDictionaries").addColumn("DictionaryID", dt::int32_t).addColumn("Dictionary", dt::blob_t);
+
+    schema.addTable("QueueMaxSizes").addColumn("CollectableTreeNodeID", dt::int32_t).addColumn("MaxSize", dt::int32_t);
+
+    schema.addTable("ZoneMapFields").addColumn("CollectableTreeNodeID", dt::int32_t).addColumn("FieldName", dt::string_t);
+
+    schema.addTable("CollectionZoneMaps")
+        .addColumn("Tick", dt::int64_t)
+        .addColumn("EndTick", dt::int64_t)
+        .addColumn("FieldID", dt::int32_t)
+        .addColumn("MinVal", dt::double_t)
+        .addColumn("MaxVal", dt::double_t)
+        .createCompoundIndexOn(SQL_COLUMNS("FieldID", "MinVal"));
+
+    schema.addTable("FieldSketches")
+        .addColumn("CollectableTreeNodeID", dt::int32_t)
+        .addColumn("FieldName", dt::string_t)
+        .addColumn("NumValues", dt::int64_t)
+        .addColumn("DistinctCount", dt::double_t)
+        .addColumn("MinVal", dt::double_t)
+        .addColumn("MaxVal", dt::double_t);
+
+    schema.addTable("FieldHeavyHitters")
+        .addColumn("FieldSketchID", dt::int32_t)
+        .addColumn("Value", dt::double_t)
+        .addColumn("Count", dt::int64_t)
+        .createIndexOn("FieldSketchID");
+
+    schema.addTable("FieldQuantiles")
+        .addColumn("FieldSketchID", dt::int32_t)
+        .addColumn("Quantile", dt::double_t)
+        .addColumn("Value", dt::double_t)
+        .createIndexOn("FieldSketchID");
+}
+
+SIMDB_INLINE std::shared_ptr<RegionCollectionPoint> CollectionMgr::createRegionCollectable(
+    const std::string& path, const std::string& clock, const void* base, size_t num_bytes, size_t block_size)
+{
+    // Check before adding the path to the element tree
+    if (!base || !num_bytes || !block_size)
+    {
+        throw DBException("Region collectables need a base address, a size, and a block size: ") << path;
+    }
+
+    auto treenode = updateTree_(path, clock);
+    auto dtype = RegionCollectionPoint::getRegionDataTypeStr(num_bytes, block_size);
+
+    auto collectable = std::make_shared<RegionCollectionPoint>(
+        treenode->db_id, treenode->clk_id, heartbeat_, dtype, base, num_bytes, block_size, memory_resource_);
+    collectables_.push_back(collectable);
+    collectables_by_path_[path] = collectable.get();
+    return collectable;
+}
+
+SIMDB_INLINE int32_t CollectionMgr::addZoneMap(const std::string& path, const std::string& field_name)
+{
+    auto iter = collectables_by_path_.find(path);
+    if (iter == collectables_by_path_.end())
+    {
+        throw DBException("No collectable at ") << path;
+    }
+
+    auto collectable = iter->second;
+    auto field = collectable->findValueField(field_name);
+    if (!field || field->dtype == StructFields::string_t)
+    {
+        throw DBException("No numeric field named '") << field_name << "' in " << path;
+    }
+
+    auto record = db_mgr_->INSERT(
+        SQL_TABLE("ZoneMapFields"), SQL_COLUMNS("CollectableTreeNodeID", "FieldName"), SQL_VALUES(collectable->getElemId(), field_name));
+
+    const auto field_id = record->getId();
+    collectable->addZoneMapField(field_name, field_id);
+    return field_id;
+}
+
+SIMDB_INLINE void CollectionMgr::addSketch(const std::string& path, const std::string& field_name)
+{
+    auto iter = collectables_by_path_.find(path);
+    if (iter == collectables_by_path_.end())
+    {
+        throw DBException("No collectable at ") << path;
+    }
+
+    auto collectable = iter->second;
+    auto field = collectable->findValueField(field_name);
+    if (!field || field->dtype == StructFields::string_t)
+    {
+        throw DBException("No numeric field named '") << field_name << "' in " << path;
+    }
+
+    for (const auto& sketched : sketched_fields_)
+    {
+        if (sketched.path == path && sketched.field_name == field_name)
+        {
+            return;
+        }
+    }
+
+    const auto sketch_idx = sink_.getFieldSketches().addSketch(field->dtype);
+    collectable->addSketchField(field_name, sketch_idx);
+    sketched_fields_.push_back({path, field_name, collectable->getElemId(), sketch_idx});
+}
+
+SIMDB_INLINE FieldSketchSummary CollectionMgr::getSketchSummary(const std::string& path, const std::string& field_name)
+{
+    for (const auto& sketched : sketched_fields_)
+    {
+        if (sketched.path == path && sketched.field_name == field_name)
+        {
+            return sink_.getFieldSketches().getSummary(sketched.sketch_idx);
+        }
+    }
+    throw DBException("No sketch for field '") << field_name << "' of " << path;
+}
+
+/// Sweep the collection system for all active collectables that exist on
+/// the given clock, and send their data to the database.
+SIMDB_INLINE void CollectionMgr::sweep(const std::string& clk, uint64_t tick)
+{
+    const auto clk_id = clock_db_ids_by_name_.at(clk);
+
+    DatabaseEntry entry;
+    swept_data_.clear();
+    for (auto& collectable : collectables_)
+    {
+        if (collectable->getClockId() == clk_id)
+        {
+            const auto num_bytes_before = swept_data_.size();
+            collectable->sweepFieldStats(entry.zone_map, entry.sketch_samples);
+            collectable->sweep(swept_data_);
+            if (record_segment_sizes_ && swept_data_.size() > num_bytes_before)
+            {
+                entry.segment_sizes.push_back(swept_data_.size() - num_bytes_before);
+            }
+        }
+    }
+
+    if (swept_data_.empty())
+    {
+        return;
+    }
+
+    entry.bytes = std::move(swept_data_);
+    entry.compressed = false;
+    entry.tick = tick;
+    entry.clock_id = clk_id;
+
+    sink_.push(std::move(entry));
+}
+
+/// One-time call to write post-simulation metadata to SimDB.
+SIMDB_INLINE void CollectionMgr::postSim()
+{
+    db_mgr_->safeTransaction(
+        [&]()
+        {
+            for (auto& collectable : collectables_)
+            {
+                collectable->postSim(db_mgr_);
+            }
+            return true;
+        });
+
+    sink_.teardown();
+
+    // Every sweep has been sketched by now
+    if (!sketched_fields_.empty())
+    {
+        db_mgr_->safeTransaction(
+            [&]()
+            {
+                for (const auto& sketched : sketched_fields_)
+                {
+                    const auto summary = sink_.getFieldSketches().getSummary(sketched.sketch_idx);
+                    auto record = db_mgr_->INSERT(
+                        SQL_TABLE("FieldSketches"),
+                        SQL_COLUMNS("CollectableTreeNodeID", "FieldName", "NumValues", "DistinctCount", "MinVal", "MaxVal"),
+                        SQL_VALUES((int)sketched.elem_id, sketched.field_name, summary.num_values, summary.distinct_count, summary.min_val,
+                                   summary.max_val));
+
+                    const auto sketch_id = record->getId();
+                    for (const auto& heavy_hitter : summary.heavy_hitters)
+                    {
+                        db_mgr_->INSERT(SQL_TABLE("FieldHeavyHitters"),
+                                        SQL_COLUMNS("FieldSketchID", "Value", "Count"),
+                                        SQL_VALUES(sketch_id, heavy_hitter.first, heavy_hitter.second));
+                    }
+                    for (const auto& quantile : summary.quantiles)
+                    {
+                        db_mgr_->INSERT(SQL_TABLE("FieldQuantiles"),
+                                        SQL_COLUMNS("FieldSketchID", "Quantile", "Value"),
+                                        SQL_VALUES(sketch_id, quantile.first, quantile.second));
+                    }
+                }
+                return true;
+            });
+    }
+}
+
+/// Note that this method is defined here since we need the INSERT() method.
+SIMDB_INLINE void ContigIterableCollectionPoint::postSim(DatabaseManager* db_mgr)
+{
+    db_mgr->INSERT(SQL_TABLE("QueueMaxSizes"), SQL_COLUMNS("CollectableTreeNodeID", "MaxSize"), SQL_VALUES(getElemId(), queue_max_size_));
+}
+
+/// Note that this method is defined here since we need the INSERT() method.
+SIMDB_INLINE void SparseIterableCollectionPoint::postSim(DatabaseManager* db_mgr)
+{
+    db_mgr->INSERT(SQL_TABLE("QueueMaxSizes"), SQL_COLUMNS("CollectableTreeNodeID", "MaxSize"), SQL_VALUES(getElemId(), queue_max_size_));
+}
+
+/// Note that this method is defined here since we need the INSERT() method.
+SIMDB_INLINE TreeNode* CollectionMgr::updateTree_(const std::string& path, const std::string& clk)
+{
+    if (!root_)
+    {
+        root_ = std::make_unique<TreeNode>("root");
+        auto record = db_mgr_->INSERT(SQL_TABLE("ElementTreeNodes"), SQL_COLUMNS("Name", "ParentID"), SQL_VALUES("root", 0));
+        root_->db_id = record->getId();
+    }
+
+    if (clock_db_ids_by_name_.find(clk) == clock_db_ids_by_name_.end())
+    {
+        auto period = clocks_.at(clk);
+        auto record = db_mgr_->INSERT(SQL_TABLE("Clocks"), SQL_COLUMNS("Name", "Period"), SQL_VALUES(clk, period));
+        clock_db_ids_by_name_[clk] = record->getId();
+    }
+
+    auto node = root_.get();
+    auto path_parts = split_string(path, '.');
+    for (size_t part_idx = 0; part_idx < path_parts.size(); ++part_idx)
+    {
+        auto part = path_parts[part_idx];
+        auto found = false;
+        for (const auto& child : node->children)
+        {
+            if (child->name == part)
+            {
+                node = child.get();
+                found = true;
+                break;
+            }
+        }
+
+        if (!found)
+        {
+            auto new_node = std::make_unique<TreeNode>(part, node);
+            node->children.push_back(std::move(new_node));
+            node = node->children.back().get();
+
+            auto record =
+                db_mgr_->INSERT(SQL_TABLE("ElementTreeNodes"), SQL_COLUMNS("Name", "ParentID"), SQL_VALUES(part, node->parent->db_id));
+
+            node->db_id = record->getId();
+            if (part_idx == path_parts.size() - 1)
+            {
+                node->clk_id = clock_db_ids_by_name_.at(clk);
+            }
+        }
+    }
+
+    return node;
+}
+
+/// Note that this method is defined here since we need the INSERT() method.
+SIMDB_INLINE void CollectionMgr::finalizeCollections_()
+{
+    db_mgr_->INSERT(SQL_TABLE("CollectionGlobals"), SQL_COLUMNS("Heartbeat"), SQL_VALUES((int)heartbeat_));
+
+    std::vector<TreeNode*> leaf_nodes;
+
+    std::function<void(TreeNode*)> findLeafNodes = [&](TreeNode* node)
+    {
+        if (node->children.empty())
+        {
+            leaf_nodes.push_back(node);
+        }
+        else
+        {
+            for (auto& child : node->children)
+            {
+                findLeafNodes(child.get());
+            }
+        }
+    };
+
+    findLeafNodes(root_.get());
+
+    for (auto leaf : leaf_nodes)
+    {
+        auto elem_id = leaf->db_id;
+        auto clk_id = leaf->clk_id;
+        auto loc = leaf->getLocation();
+        auto collectable = collectables_by_path_.at(loc);
+        auto dtype = collectable->getDataTypeStr();
+
+        db_mgr_->INSERT(SQL_TABLE("CollectableTreeNodes"),
+                        SQL_COLUMNS("ElementTreeNodeID", "ClockID", "DataType", "Location"),
+                        SQL_VALUES(elem_id, clk_id, dtype, loc));
+    }
+}
+
+/// Note that this method is defined here since we need the INSERT() method.
+SIMDB_INLINE void DatabaseThread::flush()
+{
+    db_mgr_->safeTransaction(
+        [&]()
+        {
+            DatabaseEntry entry;
+            while (queue_.try_pop(entry))
+            {
+                const auto dictionary_id = entry.compressed && entry.dictionary ? entry.dictionary->id : 0;
+                if (dictionary_id && written_dictionary_ids_.insert(dictionary_id).second)
+                {
+                    db_mgr_->INSERT(SQL_TABLE("CompressionDictionaries"),
+                                    SQL_COLUMNS("DictionaryID", "Dictionary"),
+                                    SQL_VALUES(dictionary_id, entry.dictionary->bytes));
+                }
+
+                // Without sink threads, entries come straight from the sweep
+                updateSketches(entry);
+
+                backend_->writeRecord(entry);
+                writeZoneMap_(entry);
+                ++num_processed_;
+            }
+
+            backend_->flush();
+
+            const auto strings = StringMap::instance()->getStrings(num_strings_written_);
+            for (size_t idx = 0; idx < strings.size(); ++idx)
+            {
+                const auto string_id = static_cast<int32_t>(num_strings_written_ + idx);
+                db_mgr_->INSERT(SQL_TABLE("StringMap"), SQL_COLUMNS("IntVal", "String"), SQL_VALUES(string_id, strings[idx]));
+            }
+
+            num_strings_written_ += strings.size();
+            return true;
+        });
+}
+
+SIMDB_INLINE void DatabaseThread::writeZoneMap_(const DatabaseEntry& entry)
+{
+    const auto end_tick = std::max(entry.tick, entry.end_tick);
+    for (const auto& range : entry.zone_map.getRanges())
+    {
+        db_mgr_->INSERT(SQL_TABLE("CollectionZoneMaps"),
+                        SQL_COLUMNS("Tick", "EndTick", "FieldID", "MinVal", "MaxVal"),
+                        SQL_VALUES(entry.tick, end_tick, range.field_id, range.min_val, range.max_val));
+    }
+}
+
+SIMDB_INLINE void SqliteSinkBackend::writeRecord(const DatabaseEntry& entry)
+{
+    const auto end_tick = std::max(entry.tick, entry.end_tick);
+    const auto format = static_cast<int>(entry.format);
+    const auto shuffle_stride = static_cast<int>(entry.shuffle_stride);
+    const auto dictionary_id = entry.compressed && entry.dictionary ? entry.dictionary->id : 0;
+
+    db_mgr_->INSERT(SQL_TABLE("CollectionRecords"),
+                    SQL_COLUMNS("Tick", "Data", "IsCompressed", "EndTick", "RecordFormat", "Filters", "ShuffleStride", "DictionaryID"),
+                    SQL_VALUES(entry.tick, entry.bytes, (int)entry.compressed, end_tick, format, entry.filters, shuffle_stride, dictionary_id));
+}
+
+SIMDB_INLINE void SegmentFileSinkBackend::writeRecord(const DatabaseEntry& entry)
+{
+    if (!segment_file_)
+    {
+        // Pick up after the segments written by earlier runs (if any). The
+        // index is empty again after importCollectionSegments(), but the
+        // segment files may have been kept, so look on disk too.
+        int32_t max_segment_id = -1;
+        auto query = db_mgr_->createQuery("CollectionSegments");
+        query->select("SegmentID", max_segment_id);
+        query->orderBy("SegmentID", QueryOrder::DESC);
+        query->setLimit(1);
+        auto results = query->getResultSet();
+        results.getNextRecord();
+
+        max_segment_id = std::max(max_segment_id, findMaxSegmentFileId(db_mgr_->getDatabaseFilePath()));
+        openSegment_(std::max(max_segment_id, segment_id_) + 1);
+    }
+    else if (segment_num_bytes_ && segment_num_bytes_ + entry.bytes.size() > max_segment_bytes_)
+    {
+        openSegment_(segment_id_ + 1);
+    }
+
+    const auto offset = static_cast<int64_t>(segment_num_bytes_);
+    const auto num_bytes = static_cast<int64_t>(entry.bytes.size());
+    if (num_bytes && fwrite(entry.bytes.data(), 1, entry.bytes.size(), segment_file_) != entry.bytes.size())
+    {
+        throw DBException("Could not write to segment file ")
+            << getSegmentFilePath(db_mgr_->getDatabaseFilePath(), segment_id_);
+    }
+    segment_num_bytes_ += entry.bytes.size();
+
+    const auto end_tick = std::max(entry.tick, entry.end_tick);
+    const auto format = static_cast<int>(entry.format);
+    const auto shuffle_stride = static_cast<int>(entry.shuffle_stride);
+    const auto dictionary_id = entry.compressed && entry.dictionary ? entry.dictionary->id : 0;
+
+    db_mgr_->INSERT(SQL_TABLE("CollectionSegments"),
+                    SQL_COLUMNS("Tick",
+                                "EndTick",
+                                "SegmentID",
+                                "Offset",
+                                "NumBytes",
+                                "IsCompressed",
+                                "RecordFormat",
+                                "Filters",
+                                "ShuffleStride",
+                                "DictionaryID"),
+                    SQL_VALUES(entry.tick,
+                               end_tick,
+                               segment_id_,
+                               offset,
+                               num_bytes,
+                               (int)entry.compressed,
+                               format,
+                               entry.filters,
+                               shuffle_stride,
+                               dictionary_id));
+}
+
+SIMDB_INLINE int32_t SegmentFileSinkBackend::findMaxSegmentFileId(const std::string& db_filepath)
+{
+    const std::filesystem::path path(db_filepath);
+    const std::string prefix = path.filename().string() + ".seg";
+    const auto directory = path.has_parent_path() ? path.parent_path() : std::filesystem::path(".");
+
+    int32_t max_segment_id = -1;
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec))
+    {
+        const auto filename = it->path().filename().string();
+        if (filename.size() <= prefix.size() || filename.compare(0, prefix.size(), prefix) != 0)
+        {
+            continue;
+        }
+
+        const auto suffix = filename.substr(prefix.size());
+        if (suffix.size() > 9 || suffix.find_first_not_of("0123456789") != std::string::npos)
+        {
+            continue;
+        }
+        max_segment_id = std::max(max_segment_id, (int32_t)std::stol(suffix));
+    }
+
+    return max_segment_id;
+}
+
+SIMDB_INLINE void SegmentFileSinkBackend::openSegment_(int32_t segment_id)
+{
+    closeSegment_();
+
+    const auto segment_path = getSegmentFilePath(db_mgr_->getDatabaseFilePath(), segment_id);
+    segment_file_ = fopen(segment_path.c_str(), "wb");
+    if (!segment_file_)
+    {
+        throw DBException("Could not open segment file ") << segment_path;
+    }
+
+    // Large buffer so that many small records become one write() call
+    setvbuf(segment_file_, nullptr, _IOFBF, 1 << 20);
+    segment_id_ = segment_id;
+    segment_num_bytes_ = 0;
+}
+
+SIMDB_INLINE size_t DatabaseManager::importCollectionSegments(bool remove_segment_files)
+{
+    struct SegmentRecord
+    {
+        int64_t tick;
+        int64_t end_tick;
+        int32_t segment_id;
+        int64_t offset;
+        int64_t num_bytes;
+        int32_t is_compressed;
+        int32_t format;
+        int32_t filters;
+        int32_t shuffle_stride;
+        int32_t dictionary_id;
+    };
+
+    // Read the whole index first, since its rows are deleted below
+    std::vector<SegmentRecord> index;
+    SegmentRecord row;
+    auto query = createQuery("CollectionSegments");
+    query->select("Tick", row.tick);
+    query->select("EndTick", row.end_tick);
+    query->select("SegmentID", row.segment_id);
+    query->select("Offset", row.offset);
+    query->select("NumBytes", row.num_bytes);
+    query->select("IsCompressed", row.is_compressed);
+    query->select("RecordFormat", row.format);
+    query->select("Filters", row.filters);
+    query->select("ShuffleStride", row.shuffle_stride);
+    query->select("DictionaryID", row.dictionary_id);
+    query->orderBy("Id", QueryOrder::ASC);
+
+    auto results = query->getResultSet();
+    while (results.getNextRecord())
+    {
+        index.emplace_back(row);
+    }
+
+    std::set<int32_t> segment_ids;
+    safeTransaction(
+        [&]()
+        {
+            std::ifstream fin;
+            int32_t open_segment_id = -1;
+            std::vector<char> data;
+
+            for (const auto& rec : index)
+            {
+                if (rec.segment_id != open_segment_id)
+                {
+                    const auto segment_path = SegmentFileSinkBackend::getSegmentFilePath(db_filepath_, rec.segment_id);
+                    fin.close();
+                    fin.clear();
+                    fin.open(segment_path, std::ios::binary);
+                    if (!fin.good())
+                    {
+                        throw DBException("Could not open segment file ") << segment_path;
+                    }
+                    open_segment_id = rec.segment_id;
+                    segment_ids.insert(rec.segment_id);
+                }
+
+                data.resize(rec.num_bytes);
+                fin.seekg(rec.offset);
+                if (!fin.read(data.data(), rec.num_bytes))
+                {
+                    throw DBException("Segment file is missing bytes for the record at tick ") << rec.tick;
+                }
+
+                INSERT(SQL_TABLE("CollectionRecords"),
+                       SQL_COLUMNS("Tick", "Data", "IsCompressed", "EndTick", "RecordFormat", "Filters", "ShuffleStride", "DictionaryID"),
+                       SQL_VALUES(rec.tick, data, rec.is_compressed, rec.end_tick, rec.format, rec.filters, rec.shuffle_stride, rec.dictionary_id));
+            }
+
+            removeAllRecordsFromTable("CollectionSegments");
+            return true;
+        });
+
+    if (remove_segment_files)
+    {
+        for (auto segment_id : segment_ids)
+        {
+            std::remove(SegmentFileSinkBackend::getSegmentFilePath(db_filepath_, segment_id).c_str());
+        }
+    }
+
+    return index.size();
+}
+
+SIMDB_INLINE size_t DatabaseManager::exportCollectionRecords(size_t max_segment_bytes)
+{
+    size_t num_exported = 0;
+    safeTransaction(
+        [&]()
+        {
+            num_exported = 0;
+            SegmentFileSinkBackend backend(this, max_segment_bytes);
+            std::map<int32_t, std::shared_ptr<CompressionDictionary>> dictionaries;
+
+            int64_t tick, end_tick;
+            std::vector<char> data;
+            int32_t is_compressed, format, filters, shuffle_stride, dictionary_id;
+
+            auto query = createQuery("CollectionRecords");
+            query->select("Tick", tick);
+            query->select("Data", data);
+            query->select("IsCompressed", is_compressed);
+            query->select("EndTick", end_tick);
+            query->select("RecordFormat", format);
+            query->select("Filters", filters);
+            query->select("ShuffleStride", shuffle_stride);
+            query->select("DictionaryID", dictionary_id);
+            query->orderBy("Id", QueryOrder::ASC);
+
+            DatabaseEntry entry;
+            auto results = query->getResultSet();
+            while (results.getNextRecord())
+            {
+                entry.bytes.swap(data);
+                entry.compressed = is_compressed != 0;
+                entry.tick = tick;
+                entry.end_tick = end_tick;
+                entry.format = static_cast<RecordFormat>(format);
+                entry.filters = filters;
+                entry.shuffle_stride = shuffle_stride;
+                entry.dictionary.reset();
+
+                // The backend only stores the dictionary ID
+                if (dictionary_id)
+                {
+                    auto& dictionary = dictionaries[dictionary_id];
+                    if (!dictionary)
+                    {
+                        dictionary = std::make_shared<CompressionDictionary>();
+                        dictionary->id = dictionary_id;
+                    }
+                    entry.dictionary = dictionary;
+                }
+
+                backend.writeRecord(entry);
+                ++num_exported;
+            }
+
+            backend.flush();
+            removeAllRecordsFromTable("CollectionRecords");
+            return true;
+        });
+
+    return num_exported;
+}
+
+SIMDB_INLINE std::vector<std::pair<uint64_t, uint64_t>>
+DatabaseManager::findZoneMapTickRanges(const std::string& path, const std::string& field_name, double min_val, double max_val)
+{
+    int32_t elem_id = 0;
+    auto elem_query = createQuery("CollectableTreeNodes");
+    elem_query->addConstraintForString("Location", Constraints::EQUAL, path);
+    elem_query->select("ElementTreeNodeID", elem_id);
+    auto elem_results = elem_query->getResultSet();
+
+    int32_t field_id = 0;
+    if (elem_results.getNextRecord())
+    {
+        auto field_query = createQuery("ZoneMapFields");
+        field_query->addConstraintForInt("CollectableTreeNodeID", Constraints::EQUAL, elem_id);
+        field_query->addConstraintForString("FieldName", Constraints::EQUAL, field_name);
+        field_query->select("Id", field_id);
+        auto field_results = field_query->getResultSet();
+        field_results.getNextRecord();
+    }
+
+    if (!field_id)
+    {
+        throw DBException("No zone map for field '") << field_name << "' of " << path;
+    }
+
+    // SQL has no literal for infinity
+    min_val = std::max(min_val, std::numeric_limits<double>::lowest());
+    max_val = std::min(max_val, std::numeric_limits<double>::max());
+
+    int64_t tick = 0, end_tick = 0;
+    auto query = createQuery("CollectionZoneMaps");
+    query->addConstraintForInt("FieldID", Constraints::EQUAL, field_id);
+    query->addConstraintForDouble("MinVal", Constraints::LESS_EQUAL, max_val);
+    query->addConstraintForDouble("MaxVal", Constraints::GREATER_EQUAL, min_val);
+    query->select("Tick", tick);
+    query->select("EndTick", end_tick);
+    query->orderBy("Tick", QueryOrder::ASC);
+
+    std::vector<std::pair<uint64_t, uint64_t>> tick_ranges;
+    auto results = query->getResultSet();
+    while (results.getNextRecord())
+    {
+        tick_ranges.emplace_back(tick, end_tick);
+    }
+    return tick_ranges;
+}
+
+SIMDB_INLINE FieldSketchSummary DatabaseManager::getFieldSketch(const std::string& path, const std::string& field_name)
+{
+    int32_t elem_id = 0;
+    auto elem_query = createQuery("CollectableTreeNodes");
+    elem_query->addConstraintForString("Location", Constraints::EQUAL, path);
+    elem_query->select("ElementTreeNodeID", elem_id);
+    auto elem_results = elem_query->getResultSet();
+
+    FieldSketchSummary summary;
+    int32_t sketch_id = 0;
+    if (elem_results.getNextRecord())
+    {
+        int64_t num_values = 0;
+        auto sketch_query = createQuery("FieldSketches");
+        sketch_query->addConstraintForInt("CollectableTreeNodeID", Constraints::EQUAL, elem_id);
+        sketch_query->addConstraintForString("FieldName", Constraints::EQUAL, field_name);
+        sketch_query->select("Id", sketch_id);
+        sketch_query->select("NumValues", num_values);
+        sketch_query->select("DistinctCount", summary.distinct_count);
+        sketch_query->select("MinVal", summary.min_val);
+        sketch_query->select("MaxVal", summary.max_val);
+        auto sketch_results = sketch_query->getResultSet();
+        sketch_results.getNextRecord();
+        summary.num_values = num_values;
+    }
+
+    if (!sketch_id)
+    {
+        throw DBException("No sketch for field '") << field_name << "' of " << path;
+    }
+
+    double value = 0;
+    int64_t count = 0;
+    auto heavy_hitter_query = createQuery("FieldHeavyHitters");
+    heavy_hitter_query->addConstraintForInt("FieldSketchID", Constraints::EQUAL, sketch_id);
+    heavy_hitter_query->select("Value", value);
+    heavy_hitter_query->select("Count", count);
+    heavy_hitter_query->orderBy("Count", QueryOrder::DESC);
+    auto heavy_hitter_results = heavy_hitter_query->getResultSet();
+    while (heavy_hitter_results.getNextRecord())
+    {
+        summary.heavy_hitters.emplace_back(value, count);
+    }
+
+    double quantile = 0;
+    auto quantile_query = createQuery("FieldQuantiles");
+    quantile_query->addConstraintForInt("FieldSketchID", Constraints::EQUAL, sketch_id);
+    quantile_query->select("Quantile", quantile);
+    quantile_query->select("Value", value);
+    quantile_query->orderBy("Quantile", QueryOrder::ASC);
+    auto quantile_results = quantile_query->getResultSet();
+    while (quantile_results.getNextRecord())
+    {
+        summary.quantiles.emplace_back(quantile, value);
+    }
+
+    return summary;
+}
+
+} // namespace simdb
@@ -0,0 +1,279 @@
+// <QueryCache.hpp> -*- C++ -*-
+
+#pragma once
+
+#include "simdb/sqlite/CompressedBlob.hpp"
+
+#include <sqlite3.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace simdb
+{
+
+/*!
+ * \class CachedResultRows
+ *
+ * \brief Copy of every row of a query result set (row-major), as kept by
+ *        the QueryCache.
+ */
+class CachedResultRows
+{
+public:
+    /// Construct with the query's statement (for the declared column types)
+    /// and the number of selected columns.
+    CachedResultRows(sqlite3_stmt* stmt, const size_t num_cols)
+        : num_cols_(num_cols)
+    {
+        for (size_t idx = 0; idx < num_cols; ++idx)
+        {
+            compressed_blob_cols_.push_back(isCompressedBlobDeclType(sqlite3_column_decltype(stmt, (int)idx)));
+        }
+    }
+
+    ~CachedResultRows()
+    {
+        for (auto val : values_)
+        {
+            sqlite3_value_free(val);
+        }
+    }
+
+    CachedResultRows(const CachedResultRows&) = delete;
+    CachedResultRows& operator=(const CachedResultRows&) = delete;
+
+    /// Copy the current row of the given statement. Returns false if
+    /// SQLite ran out of memory.
+    bool appendRow(sqlite3_stmt* stmt)
+    {
+        for (size_t idx = 0; idx < num_cols_; ++idx)
+        {
+            auto val = sqlite3_value_dup(sqlite3_column_value(stmt, (int)idx));
+            if (!val)
+            {
+                return false;
+            }
+
+            values_.push_back(val);
+            num_bytes_ += sizeof(val) + sizeof(sqlite3_int64);
+
+            // Asking for the byte count of a numeric value would convert
+            // it to text, so only do that for strings and blobs.
+            const auto dtype = sqlite3_value_type(val);
+            if (dtype == SQLITE_TEXT || dtype == SQLITE_BLOB)
+            {
+                num_bytes_ += sqlite3_value_bytes(val);
+            }
+        }
+        ++num_rows_;
+        return true;
+    }
+
+    /// Number of rows.
+    size_t getNumRows() const
+    {
+        return num_rows_;
+    }
+
+    /// Column values of the given row.
+    sqlite3_value* const* getRow(const size_t row_idx) const
+    {
+        return values_.data() + row_idx * num_cols_;
+    }
+
+    /// Is the given column a compressed_blob_t column? Its values are
+    /// kept compressed.
+    bool isCompressedBlob(const size_t col_idx) const
+    {
+        return compressed_blob_cols_[col_idx];
+    }
+
+    /// Approximate memory used by the copied values.
+    size_t getNumBytes() const
+    {
+        return num_bytes_;
+    }
+
+private:
+    const size_t num_cols_;
+    std::vector<bool> compressed_blob_cols_;
+    std::vector<sqlite3_value*> values_;
+    size_t num_rows_ = 0;
+    size_t num_bytes_ = 0;
+};
+
+/// Hit/miss statistics for DatabaseManager::getQueryCacheStats().
+struct QueryCacheStats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t num_entries = 0;
+    size_t num_bytes = 0;
+};
+
+/*!
+ * \class QueryCache
+ *
+ * \brief LRU cache of query results keyed by their SQL command (SqlQuery
+ *        writes the constraint values into the command, so two queries
+ *        share an entry only if they select the same columns with the same
+ *        constraints). Enabled with DatabaseManager::enableQueryCache().
+ *
+ *        Every entry remembers the "data version" of the database when it
+ *        was made: the rows changed through this connection, plus SQLite's
+ *        own data_version and schema_version counters, which also move when
+ *        another connection or process commits. Any write makes every older
+ *        entry stale, while reads never do. This makes the cache most useful
+ *        for databases that are no longer being written to.
+ */
+class QueryCache
+{
+public:
+    QueryCache(sqlite3* db_conn, const size_t max_entries, const size_t max_bytes)
+        : db_conn_(db_conn)
+        , max_entries_(max_entries)
+        , max_bytes_(max_bytes)
+    {
+    }
+
+    /// Current data version of the database. Results cached at an older
+    /// version are not returned.
+    uint64_t getDataVersion() const
+    {
+        // PRAGMA data_version only changes for commits made by other
+        // connections, and neither it nor sqlite3_total_changes64() see
+        // schema changes, so all three are needed. The statement is not
+        // kept around since the cache may outlive the connection.
+        static const char* cmd = "SELECT (SELECT data_version FROM pragma_data_version),"
+                                 " (SELECT schema_version FROM pragma_schema_version)";
+
+        sqlite3_stmt* stmt = nullptr;
+        uint64_t version = 0;
+        if (sqlite3_prepare_v2(db_conn_, cmd, -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            version = (uint64_t)sqlite3_column_int64(stmt, 0) + (uint64_t)sqlite3_column_int64(stmt, 1);
+        }
+        else
+        {
+            // Unknown version (e.g. the database is locked): make sure it
+            // matches neither the cached entries nor the next lookup.
+            version = ++num_unknown_versions_ << 48;
+        }
+        sqlite3_finalize(stmt);
+
+        return version + (uint64_t)sqlite3_total_changes64(db_conn_);
+    }
+
+    /// Largest result (in bytes) that will be cached.
+    size_t getMaxBytes() const
+    {
+        return max_bytes_;
+    }
+
+    /// Get the cached result rows for this command, or nullptr (a miss).
+    std::shared_ptr<const CachedResultRows> find(const std::string& cmd)
+    {
+        const auto data_version = getDataVersion();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto iter = entries_.find(cmd);
+        if (iter == entries_.end())
+        {
+            ++stats_.misses;
+            return nullptr;
+        }
+
+        if (iter->second->data_version != data_version)
+        {
+            erase_(iter);
+            ++stats_.misses;
+            return nullptr;
+        }
+
+        // Move to the front of the LRU list.
+        lru_.splice(lru_.begin(), lru_, iter->second);
+        ++stats_.hits;
+        return iter->second->rows;
+    }
+
+    /// Add the result rows for this command, as read at the given data
+    /// version. Ignored if the database has changed since then.
+    void insert(const std::string& cmd, const std::shared_ptr<const CachedResultRows>& rows, const uint64_t data_version)
+    {
+        if (data_version != getDataVersion() || rows->getNumBytes() > max_bytes_ || !max_entries_)
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto iter = entries_.find(cmd);
+        if (iter != entries_.end())
+        {
+            erase_(iter);
+        }
+
+        lru_.push_front(Entry{cmd, rows, data_version});
+        entries_[cmd] = lru_.begin();
+        stats_.num_bytes += rows->getNumBytes();
+
+        while (lru_.size() > max_entries_ || stats_.num_bytes > max_bytes_)
+        {
+            erase_(entries_.find(lru_.back().cmd));
+            ++stats_.evictions;
+        }
+    }
+
+    /// Drop every entry.
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.clear();
+        lru_.clear();
+        stats_.num_bytes = 0;
+    }
+
+    /// Get the hit/miss statistics and the current cache size.
+    QueryCacheStats getStats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto stats = stats_;
+        stats.num_entries = lru_.size();
+        return stats;
+    }
+
+private:
+    struct Entry
+    {
+        std::string cmd;
+        std::shared_ptr<const CachedResultRows> rows;
+        uint64_t data_version;
+    };
+
+    using EntryIter = std::list<Entry>::iterator;
+
+    void erase_(std::unordered_map<std::string, EntryIter>::iterator iter)
+    {
+        stats_.num_bytes -= iter->second->rows->getNumBytes();
+        lru_.erase(iter->second);
+        entries_.erase(iter);
+    }
+
+    sqlite3* const db_conn_;
+    const size_t max_entries_;
+    const size_t max_bytes_;
+
+    /// Most recently used entries first
+    std::list<Entry> lru_;
+    std::unordered_map<std::string, EntryIter> entries_;
+    QueryCacheStats stats_;
+    mutable std::mutex mutex_;
+    mutable std::atomic<uint64_t> num_unknown_versions_{0};
+};
+
+} // namespace simdb
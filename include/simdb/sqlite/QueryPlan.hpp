@@ -0,0 +1,109 @@
+// <QueryPlan.hpp> -*- C++ -*-
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace simdb
+{
+
+/// One row of "EXPLAIN QUERY PLAN" output.
+struct QueryPlanStep
+{
+    /// Node ID of this step.
+    int id = 0;
+
+    /// Node ID of the parent step (0 for top-level steps).
+    int parent = 0;
+
+    /// Human-readable description, e.g. "SCAN Foo" or
+    /// "SEARCH Foo USING INDEX Foo_idx (ColA=?)".
+    std::string detail;
+
+    /// True if this step reads every row of a table without an index.
+    bool isFullScan() const
+    {
+        return detail.compare(0, 5, "SCAN ") == 0 && detail.find(" INDEX ") == std::string::npos;
+    }
+
+    /// Name (or alias) of the table this step reads, or "" if unknown.
+    std::string getTableName() const
+    {
+        std::istringstream iss(detail);
+        std::string verb, table;
+        iss >> verb >> table;
+
+        // Older SQLite versions write "SCAN TABLE Foo"
+        if (table == "TABLE")
+        {
+            iss >> table;
+        }
+        return table;
+    }
+};
+
+/*!
+ * \class IndexAdvisor
+ *
+ * \brief Debug helper that collects the tables SqlQuery had to scan in
+ *        full, along with the columns those queries were constrained on.
+ *        Enabled with DatabaseManager::enableIndexAdvice(). The advice is
+ *        printed when the database is closed.
+ */
+class IndexAdvisor
+{
+public:
+    /// Record a full scan of the given table for a query constrained on
+    /// the given columns.
+    void recordFullScan(const std::string& table_name, const std::vector<std::string>& constraint_cols)
+    {
+        if (!constraint_cols.empty())
+        {
+            scanned_tables_[table_name].insert(constraint_cols);
+        }
+    }
+
+    /// Get the suggested Schema calls, e.g.
+    ///   Foo: createIndexOn("ColA")
+    ///   Bar: createCompoundIndexOn(SQL_COLUMNS("ColA", "ColB"))
+    std::vector<std::string> getIndexAdvice() const
+    {
+        std::vector<std::string> advice;
+        for (const auto& [table_name, col_lists] : scanned_tables_)
+        {
+            for (const auto& cols : col_lists)
+            {
+                std::ostringstream oss;
+                oss << table_name << ": ";
+                if (cols.size() == 1)
+                {
+                    oss << "createIndexOn(\"" << cols[0] << "\")";
+                }
+                else
+                {
+                    oss << "createCompoundIndexOn(SQL_COLUMNS(";
+                    for (size_t idx = 0; idx < cols.size(); ++idx)
+                    {
+                        oss << "\"" << cols[idx] << "\"";
+                        if (idx != cols.size() - 1)
+                        {
+                            oss << ", ";
+                        }
+                    }
+                    oss << "))";
+                }
+                advice.emplace_back(oss.str());
+            }
+        }
+        return advice;
+    }
+
+private:
+    std::map<std::string, std::set<std::vector<std::string>>> scanned_tables_;
+};
+
+} // namespace simdb
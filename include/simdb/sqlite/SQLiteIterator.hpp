@@ -2,17 +2,29 @@
 
 #pragma once
 
+#include "simdb/LibraryMode.hpp"
+#include "simdb/sqlite/CompressedBlob.hpp"
+#include "simdb/sqlite/QueryCache.hpp"
 #include "simdb/sqlite/SQLiteTransaction.hpp"
 
 #include <sqlite3.h>
 #include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 namespace simdb
 {
 
+/// Registered on the PrefetchingResultIterator read connections for queries
+/// with fuzzy floating-point constraints (defined in SQLiteConnection).
+SIMDB_INLINE void fuzzyMatch(sqlite3_context* context, int, sqlite3_value** argv);
+
 /*!
  * \class ResultWriterBase
  *
@@ -30,6 +42,10 @@ public:
     /// and copy it to the user's local variable.
     virtual void writeToUserVar(sqlite3_stmt* stmt, const int idx) const = 0;
 
+    /// Copy the given column value (from a PrefetchingResultIterator row)
+    /// to the user's local variable.
+    virtual void writeValueToUserVar(sqlite3_value* val) const = 0;
+
     /// Return a new copy of this writer.
     virtual ResultWriterBase* clone() const = 0;
 
@@ -42,14 +58,36 @@ public:
         return col_name_;
     }
 
+    /// Set from the column's declared type when the query runs. Values of
+    /// compressed_blob_t columns are decompressed before they are written.
+    void setIsCompressedBlob(const bool compressed)
+    {
+        is_compressed_blob_ = compressed;
+    }
+
+    /// Set the flag above for each writer, given the query's statement.
+    static void detectCompressedBlobs(const std::vector<std::shared_ptr<ResultWriterBase>>& writers, sqlite3_stmt* stmt)
+    {
+        for (size_t idx = 0; idx < writers.size(); ++idx)
+        {
+            writers[idx]->setIsCompressedBlob(isCompressedBlobDeclType(sqlite3_column_decltype(stmt, (int)idx)));
+        }
+    }
+
 protected:
     ResultWriterBase(const char* col_name)
         : col_name_(col_name)
     {
     }
 
+    bool isCompressedBlob_() const
+    {
+        return is_compressed_blob_;
+    }
+
 private:
     std::string col_name_;
+    bool is_compressed_blob_ = false;
 };
 
 /*!
@@ -77,6 +115,12 @@ public:
         *user_var_ = sqlite3_column_int(stmt, idx);
     }
 
+    /// Copy the given column value to the user's local variable.
+    void writeValueToUserVar(sqlite3_value* val) const override
+    {
+        *user_var_ = sqlite3_value_int(val);
+    }
+
     /// Return a new copy of this writer.
     ResultWriterBase* clone() const override
     {
@@ -112,6 +156,12 @@ public:
         *user_var_ = sqlite3_column_int64(stmt, idx);
     }
 
+    /// Copy the given column value to the user's local variable.
+    void writeValueToUserVar(sqlite3_value* val) const override
+    {
+        *user_var_ = sqlite3_value_int64(val);
+    }
+
     /// Return a new copy of this writer.
     ResultWriterBase* clone() const override
     {
@@ -147,6 +197,12 @@ public:
         *user_var_ = sqlite3_column_double(stmt, idx);
     }
 
+    /// Copy the given column value to the user's local variable.
+    void writeValueToUserVar(sqlite3_value* val) const override
+    {
+        *user_var_ = sqlite3_value_double(val);
+    }
+
     /// Return a new copy of this writer.
     ResultWriterBase* clone() const override
     {
@@ -179,7 +235,16 @@ public:
     /// and copy it to the user's local variable.
     void writeToUserVar(sqlite3_stmt* stmt, const int idx) const override
     {
-        *user_var_ = (const char*)sqlite3_column_text(stmt, idx);
+        // NULL values (e.g. from a LEFT JOIN with no match) are written as "".
+        auto text = (const char*)sqlite3_column_text(stmt, idx);
+        *user_var_ = text ? text : "";
+    }
+
+    /// Copy the given column value to the user's local variable.
+    void writeValueToUserVar(sqlite3_value* val) const override
+    {
+        auto text = (const char*)sqlite3_value_text(val);
+        *user_var_ = text ? text : "";
     }
 
     /// Return a new copy of this writer.
@@ -214,10 +279,13 @@ public:
     /// and copy it to the user's local variable.
     void writeToUserVar(sqlite3_stmt* stmt, const int idx) const override
     {
-        const void* data = sqlite3_column_blob(stmt, idx);
-        const int bytes = sqlite3_column_bytes(stmt, idx);
-        user_var_->resize(bytes / sizeof(T));
-        memcpy(user_var_->data(), data, bytes);
+        writeBytes_(sqlite3_column_blob(stmt, idx), sqlite3_column_bytes(stmt, idx));
+    }
+
+    /// Copy the given column value to the user's local variable.
+    void writeValueToUserVar(sqlite3_value* val) const override
+    {
+        writeBytes_(sqlite3_value_blob(val), sqlite3_value_bytes(val));
     }
 
     /// Return a new copy of this writer.
@@ -227,7 +295,26 @@ public:
     }
 
 private:
+    /// Copy the blob bytes to the user's local variable, decompressing
+    /// them first for compressed_blob_t columns.
+    void writeBytes_(const void* data, size_t bytes) const
+    {
+        if (isCompressedBlob_())
+        {
+            decompressBlob(data, bytes, decompressed_bytes_);
+            data = decompressed_bytes_.data();
+            bytes = decompressed_bytes_.size();
+        }
+
+        user_var_->resize(bytes / sizeof(T));
+        if (bytes)
+        {
+            memcpy(user_var_->data(), data, bytes);
+        }
+    }
+
     std::vector<T>* user_var_;
+    mutable std::vector<char> decompressed_bytes_;
 };
 
 /*!
@@ -235,6 +322,10 @@ private:
  *
  * \brief This class is returned by SqlQuery::getResultSet() and
  *        is used to iterate over a query result set.
+ *
+ *        When the query cache is enabled, the iterator either replays
+ *        cached rows, or copies the rows it steps over and hands them to
+ *        the cache once the whole result set has been read.
  */
 class SqlResultIterator
 {
@@ -245,6 +336,37 @@ public:
         : stmt_(stmt)
         , result_writers_(std::move(result_writers))
     {
+        ResultWriterBase::detectCompressedBlobs(result_writers_, stmt_);
+    }
+
+    /// Construct with a prepared statement whose rows are copied into the given
+    /// cache under the given key, once the whole result set has been read.
+    SqlResultIterator(sqlite3_stmt* stmt,
+                      std::vector<std::shared_ptr<ResultWriterBase>>&& result_writers,
+                      const std::shared_ptr<QueryCache>& cache,
+                      const std::string& cache_key,
+                      const uint64_t data_version)
+        : stmt_(stmt)
+        , result_writers_(std::move(result_writers))
+        , cache_(cache)
+        , cache_key_(cache_key)
+        , data_version_(data_version)
+        , recorded_rows_(std::make_shared<CachedResultRows>(stmt, result_writers_.size()))
+    {
+        ResultWriterBase::detectCompressedBlobs(result_writers_, stmt_);
+    }
+
+    /// Construct with rows from the query cache.
+    SqlResultIterator(const std::shared_ptr<const CachedResultRows>& cached_rows,
+                      std::vector<std::shared_ptr<ResultWriterBase>>&& result_writers)
+        : stmt_(nullptr)
+        , result_writers_(std::move(result_writers))
+        , cached_rows_(cached_rows)
+    {
+        for (size_t idx = 0; idx < result_writers_.size(); ++idx)
+        {
+            result_writers_[idx]->setIsCompressedBlob(cached_rows_->isCompressedBlob(idx));
+        }
     }
 
     /// Finalize the prepared statement on destruction.
@@ -261,6 +383,21 @@ public:
     /// when the entire result set has been iterated over.
     bool getNextRecord()
     {
+        if (cached_rows_)
+        {
+            if (cached_row_idx_ == cached_rows_->getNumRows())
+            {
+                return false;
+            }
+
+            auto row = cached_rows_->getRow(cached_row_idx_++);
+            for (size_t idx = 0; idx < result_writers_.size(); ++idx)
+            {
+                result_writers_[idx]->writeValueToUserVar(row[idx]);
+            }
+            return true;
+        }
+
         auto rc = SQLiteReturnCode(sqlite3_step(stmt_));
         if (rc == SQLITE_ROW)
         {
@@ -268,6 +405,12 @@ public:
             {
                 result_writers_[idx]->writeToUserVar(stmt_, (int)idx);
             }
+
+            if (recorded_rows_ && (!recorded_rows_->appendRow(stmt_) || recorded_rows_->getNumBytes() > cache_->getMaxBytes()))
+            {
+                // Too big (or out of memory). Do not cache this one.
+                recorded_rows_.reset();
+            }
             return true;
         }
         else if (rc != SQLITE_DONE)
@@ -275,6 +418,11 @@ public:
             throw DBException(sqlite3_errmsg(sqlite3_db_handle(stmt_)));
         }
 
+        if (recorded_rows_)
+        {
+            cache_->insert(cache_key_, recorded_rows_, data_version_);
+            recorded_rows_.reset();
+        }
         return false;
     }
 
@@ -282,10 +430,19 @@ public:
     /// to iterate over it again.
     void reset()
     {
+        if (cached_rows_)
+        {
+            cached_row_idx_ = 0;
+            return;
+        }
+
         if (SQLiteReturnCode(sqlite3_reset(stmt_)))
         {
             throw DBException(sqlite3_errmsg(sqlite3_db_handle(stmt_)));
         }
+
+        // Only a single uninterrupted pass is recorded for the cache.
+        recorded_rows_.reset();
     }
 
 private:
@@ -294,6 +451,251 @@ private:
 
     /// Writers that read column values and write them into the user's local variables
     std::vector<std::shared_ptr<ResultWriterBase>> result_writers_;
+
+    /// Rows from the query cache (instead of a prepared statement)
+    std::shared_ptr<const CachedResultRows> cached_rows_;
+    size_t cached_row_idx_ = 0;
+
+    /// Rows being copied for the query cache
+    std::shared_ptr<QueryCache> cache_;
+    std::string cache_key_;
+    uint64_t data_version_ = 0;
+    std::shared_ptr<CachedResultRows> recorded_rows_;
+};
+
+/*!
+ * \class PrefetchingResultIterator
+ *
+ * \brief Drop-in alternative to SqlResultIterator for large scans, returned
+ *        by SqlQuery::getPrefetchingResultSet(). A worker thread runs the
+ *        query on its own read-only connection to the same database file,
+ *        and copies the column values into batches of rows. Up to a fixed
+ *        number of batches are buffered ahead of the caller, so SQLite I/O
+ *        and decoding overlap with the caller's processing of each record.
+ *
+ *        The read connection only sees committed data.
+ */
+class PrefetchingResultIterator
+{
+public:
+    /// \brief Construction
+    /// \param db_conn Connection whose database file (and VFS) we read from
+    /// \param cmd SELECT command to run
+    /// \param result_writers Writers that copy column values into the user's local variables
+    /// \param rows_per_batch Number of rows the worker hands over at once
+    /// \param max_batches Number of batches the worker may get ahead of the caller
+    PrefetchingResultIterator(sqlite3* db_conn,
+                              const std::string& cmd,
+                              std::vector<std::shared_ptr<ResultWriterBase>>&& result_writers,
+                              const size_t rows_per_batch = 256,
+                              const size_t max_batches = 4)
+        : result_writers_(std::move(result_writers))
+        , rows_per_batch_(std::max<size_t>(rows_per_batch, 1))
+        , max_batches_(std::max<size_t>(max_batches, 1))
+    {
+        if (result_writers_.empty())
+        {
+            throw DBException("Prefetching queries must select at least one column");
+        }
+
+        const char* db_filepath = sqlite3_db_filename(db_conn, "main");
+        if (!db_filepath || !*db_filepath)
+        {
+            throw DBException("Prefetching queries require a database file");
+        }
+
+        // Read through the same VFS the database was written with.
+        sqlite3_vfs* vfs = nullptr;
+        sqlite3_file_control(db_conn, "main", SQLITE_FCNTL_VFS_POINTER, &vfs);
+
+        if (sqlite3_open_v2(db_filepath, &read_conn_, SQLITE_OPEN_READONLY, vfs ? vfs->zName : nullptr) != SQLITE_OK)
+        {
+            std::string err = read_conn_ ? sqlite3_errmsg(read_conn_) : "out of memory";
+            sqlite3_close(read_conn_);
+            throw DBException("Unable to open a read connection to ") << db_filepath << ": " << err;
+        }
+
+        sqlite3_busy_timeout(read_conn_, 5000);
+        sqlite3_create_function(read_conn_, "fuzzyMatch", 3, SQLITE_UTF8, nullptr, &fuzzyMatch, nullptr, nullptr);
+
+        // Check the return code by hand: SQLiteReturnCode throws on
+        // SQLITE_BUSY/SQLITE_LOCKED, which would leak the read connection.
+        if (sqlite3_prepare_v2(read_conn_, cmd.c_str(), -1, &stmt_, nullptr) != SQLITE_OK)
+        {
+            std::string err = sqlite3_errmsg(read_conn_);
+            sqlite3_finalize(stmt_);
+            sqlite3_close(read_conn_);
+            throw DBException("Could not prepare query: ") << cmd << " (" << err << ")";
+        }
+
+        ResultWriterBase::detectCompressedBlobs(result_writers_, stmt_);
+
+        worker_ = std::thread([this]() { prefetch_(); });
+    }
+
+    /// Stop the worker thread and close the read connection.
+    ~PrefetchingResultIterator()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        not_full_cv_.notify_all();
+        worker_.join();
+
+        freeValues_(current_batch_);
+        for (auto& batch : batches_)
+        {
+            freeValues_(batch);
+        }
+
+        sqlite3_finalize(stmt_);
+        sqlite3_close(read_conn_);
+    }
+
+    /// Get the next record, populate the user's local variables,
+    /// and return TRUE if the record was found. FALSE is returned
+    /// when the entire result set has been iterated over.
+    bool getNextRecord()
+    {
+        const auto num_cols = result_writers_.size();
+        while (row_idx_ * num_cols >= current_batch_.values.size())
+        {
+            if (current_batch_.last)
+            {
+                if (!current_batch_.error.empty())
+                {
+                    throw DBException(current_batch_.error);
+                }
+                return false;
+            }
+
+            freeValues_(current_batch_);
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                not_empty_cv_.wait(lock, [this]() { return !batches_.empty(); });
+                current_batch_ = std::move(batches_.front());
+                batches_.pop_front();
+            }
+            not_full_cv_.notify_one();
+            row_idx_ = 0;
+        }
+
+        auto row = current_batch_.values.data() + row_idx_ * num_cols;
+        for (size_t idx = 0; idx < num_cols; ++idx)
+        {
+            result_writers_[idx]->writeValueToUserVar(row[idx]);
+        }
+        ++row_idx_;
+        return true;
+    }
+
+private:
+    /// Rows of copied column values (row-major), handed from the worker
+    /// thread to the caller.
+    struct Batch
+    {
+        std::vector<sqlite3_value*> values;
+        size_t num_rows = 0;
+        bool last = false;
+        std::string error;
+    };
+
+    /// Worker thread: step the query and hand over the rows in batches.
+    void prefetch_()
+    {
+        const int num_cols = (int)result_writers_.size();
+        bool last = false;
+        while (!last)
+        {
+            Batch batch;
+            batch.values.reserve(rows_per_batch_ * num_cols);
+            while (batch.num_rows < rows_per_batch_)
+            {
+                // Not SQLiteReturnCode: its exception on SQLITE_BUSY/SQLITE_LOCKED
+                // would escape this thread. Every error goes to batch.error and
+                // is rethrown by getNextRecord() on the caller's thread.
+                const int rc = sqlite3_step(stmt_);
+                if (rc == SQLITE_ROW)
+                {
+                    for (int idx = 0; idx < num_cols; ++idx)
+                    {
+                        batch.values.push_back(sqlite3_value_dup(sqlite3_column_value(stmt_, idx)));
+                        if (!batch.values.back())
+                        {
+                            batch.values.pop_back();
+                            batch.error = "Out of memory copying query results";
+                            break;
+                        }
+                    }
+                    if (!batch.error.empty())
+                    {
+                        break;
+                    }
+                    ++batch.num_rows;
+                }
+                else
+                {
+                    if (rc != SQLITE_DONE)
+                    {
+                        batch.error = sqlite3_errmsg(read_conn_);
+                    }
+                    break;
+                }
+            }
+
+            // Drop the values of a partially copied row.
+            batch.values.resize(batch.num_rows * num_cols);
+            last = batch.last = batch.num_rows < rows_per_batch_ || !batch.error.empty();
+
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                not_full_cv_.wait(lock, [this]() { return stop_ || batches_.size() < max_batches_; });
+                if (stop_)
+                {
+                    freeValues_(batch);
+                    return;
+                }
+                batches_.emplace_back(std::move(batch));
+            }
+            not_empty_cv_.notify_one();
+        }
+    }
+
+    /// Free the copied values of the given batch.
+    static void freeValues_(Batch& batch)
+    {
+        for (auto val : batch.values)
+        {
+            sqlite3_value_free(val);
+        }
+        batch.values.clear();
+    }
+
+    /// Writers that copy column values into the user's local variables
+    std::vector<std::shared_ptr<ResultWriterBase>> result_writers_;
+
+    /// Rows per batch, and how many batches can be buffered
+    const size_t rows_per_batch_;
+    const size_t max_batches_;
+
+    /// Read-only connection and prepared statement used by the worker thread
+    sqlite3* read_conn_ = nullptr;
+    sqlite3_stmt* stmt_ = nullptr;
+
+    /// Batches the worker has filled and the caller has not yet taken
+    std::deque<Batch> batches_;
+    std::mutex mutex_;
+    std::condition_variable not_empty_cv_;
+    std::condition_variable not_full_cv_;
+    bool stop_ = false;
+
+    /// Batch the caller is iterating over, and the next row in it
+    Batch current_batch_;
+    size_t row_idx_ = 0;
+
+    /// Runs prefetch_()
+    std::thread worker_;
 };
 
 } // namespace simdb
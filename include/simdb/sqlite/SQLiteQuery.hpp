@@ -2,10 +2,13 @@
 
 #pragma once
 
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <limits>
+#include <utility>
 #include "simdb/sqlite/Constraints.hpp"
+#include "simdb/sqlite/QueryPlan.hpp"
 #include "simdb/sqlite/SQLiteIterator.hpp"
 
 namespace simdb
@@ -30,12 +33,37 @@ inline std::ostream& operator<<(std::ostream& os, const QueryOrder order)
     return os;
 }
 
+/// Used in query->join(JoinType::LEFT, ...)
+enum class JoinType
+{
+    INNER,
+    LEFT
+};
+
+/// Stringify JoinType enums for SELECT commands
+inline std::ostream& operator<<(std::ostream& os, const JoinType join_type)
+{
+    switch (join_type)
+    {
+        case JoinType::INNER: os << "INNER JOIN"; break;
+        case JoinType::LEFT: os << "LEFT JOIN"; break;
+    }
+
+    return os;
+}
+
 /*!
  * \class SqlQuery
  *
  * \brief This class issues SELECT statements with Constraints, and is used
  *        in order to iterate over the result set and automatically write
  *        record values into users' local variables.
+ *
+ *        Other tables can be joined to the query so SQLite does the lookups
+ *        instead of one query per record. Once tables are joined, use
+ *        table-qualified column names ("Alias.Col") in select(), the
+ *        addConstraint*() methods, and orderBy(). A select() column may
+ *        also be given its own alias ("c.Name AS ClockName").
  */
 class SqlQuery
 {
@@ -46,6 +74,61 @@ public:
     {
     }
 
+    /// Give the query's own table an alias to use in table-qualified
+    /// column names.
+    ///
+    ///     // SELECT ... FROM ElementTreeNodes AS e ...
+    ///     query->setTableAlias("e");
+    void setTableAlias(const char* alias)
+    {
+        table_alias_ = alias;
+    }
+
+    /// Join another table to this query. The ON clause requires every given
+    /// pair of columns to be equal.
+    ///
+    ///     // SELECT ... FROM ElementTreeNodes AS e
+    ///     //     INNER JOIN CollectableTreeNodes AS c ON e.Id=c.ElementTreeNodeID
+    ///     //     LEFT JOIN Clocks AS k ON c.ClockID=k.Id
+    ///     query->setTableAlias("e");
+    ///     query->join(JoinType::INNER, "CollectableTreeNodes", "c", {{"e.Id", "c.ElementTreeNodeID"}});
+    ///     query->join(JoinType::LEFT, "Clocks", "k", {{"c.ClockID", "k.Id"}});
+    void join(const JoinType join_type,
+              const char* table_name,
+              const char* alias,
+              const std::vector<std::pair<std::string, std::string>>& on_cols)
+    {
+        if (on_cols.empty())
+        {
+            throw DBException("At least one ON column pair is required to join table ") << table_name;
+        }
+
+        std::ostringstream oss;
+        oss << join_type << " " << table_name;
+        if (alias && *alias)
+        {
+            oss << " AS " << alias;
+        }
+
+        oss << " ON ";
+        for (size_t idx = 0; idx < on_cols.size(); ++idx)
+        {
+            oss << on_cols[idx].first << "=" << on_cols[idx].second;
+            if (idx != on_cols.size() - 1)
+            {
+                oss << " AND ";
+            }
+        }
+
+        join_clauses_.emplace_back(oss.str());
+    }
+
+    /// Remove the JOIN clauses.
+    void resetJoins()
+    {
+        join_clauses_.clear();
+    }
+
     /// Query for at most N matching records.
     void setLimit(uint32_t limit)
     {
@@ -91,6 +174,7 @@ public:
         std::ostringstream oss;
         oss << col_name << stringify(constraint) << target;
         constraint_clauses_.emplace_back(oss.str());
+        recordConstraintCol_(col_name);
     }
 
     /// Add a constraint to this query specific to floating-point types
@@ -119,6 +203,7 @@ public:
         }
 
         constraint_clauses_.emplace_back(oss.str());
+        recordConstraintCol_(col_name);
     }
 
     /// Add a constraint to this query specific to string types and
@@ -135,6 +220,7 @@ public:
         std::ostringstream oss;
         oss << col_name << stringify(constraint) << "'" << target << "'";
         constraint_clauses_.emplace_back(oss.str());
+        recordConstraintCol_(col_name);
     }
 
     /// Add a constraint to this query specific to integer types and
@@ -165,6 +251,7 @@ public:
 
         oss << ")";
         constraint_clauses_.emplace_back(oss.str());
+        recordConstraintCol_(col_name);
     }
 
     /// Add a constraint to this query specific to floating-point types
@@ -246,6 +333,7 @@ public:
         }
 
         constraint_clauses_.emplace_back(oss.str());
+        recordConstraintCol_(col_name);
     }
 
     /// Add a constraint to this query specific to string types and
@@ -273,6 +361,7 @@ public:
 
         oss << ")";
         constraint_clauses_.emplace_back(oss.str());
+        recordConstraintCol_(col_name);
     }
 
     /// After one or more calls to addConstraint*(), this function can be called to
@@ -334,6 +423,7 @@ public:
     void resetConstraints()
     {
         constraint_clauses_.clear();
+        constraint_cols_.clear();
     }
 
     /// SELECT column values and write to the local variable on each iteration (int32).
@@ -392,16 +482,38 @@ public:
     uint64_t count()
     {
         std::ostringstream oss;
-        oss << "SELECT COUNT(Id) FROM " << table_name_ << " ";
+        oss << "SELECT COUNT(*) ";
+        appendFromClause_(oss);
         appendConstraintClauses_(oss);
         appendLimitClause_(oss);
 
         const auto cmd = oss.str();
+
+        uint64_t data_version = 0;
+        if (query_cache_)
+        {
+            data_version = query_cache_->getDataVersion();
+            if (auto cached_rows = query_cache_->find(cmd))
+            {
+                return sqlite3_value_int64(cached_rows->getRow(0)[0]);
+            }
+        }
+
+        adviseIndexes_(cmd);
+
         auto stmt = SQLitePreparedStatement(db_conn_, cmd);
         auto rc = SQLiteReturnCode(sqlite3_step(stmt));
 
         if (rc == SQLITE_ROW)
         {
+            if (query_cache_)
+            {
+                auto rows = std::make_shared<CachedResultRows>(stmt, 1);
+                if (rows->appendRow(stmt))
+                {
+                    query_cache_->insert(cmd, rows, data_version);
+                }
+            }
             return sqlite3_column_int64(stmt, 0);
         }
 
@@ -415,6 +527,88 @@ public:
 
     /// Execute the query.
     SqlResultIterator getResultSet()
+    {
+        const auto cmd = getSelectCommand_();
+
+        std::vector<std::shared_ptr<ResultWriterBase>> result_writers;
+        for (const auto& writer : result_writers_)
+        {
+            result_writers.emplace_back(writer->clone());
+        }
+
+        if (query_cache_)
+        {
+            // Read the data version before running the query, so that rows
+            // written in the meantime make this result stale.
+            const auto data_version = query_cache_->getDataVersion();
+            if (auto cached_rows = query_cache_->find(cmd))
+            {
+                return SqlResultIterator(cached_rows, std::move(result_writers));
+            }
+
+            adviseIndexes_(cmd);
+            auto stmt = SQLitePreparedStatement(db_conn_, cmd);
+            return SqlResultIterator(stmt.release(), std::move(result_writers), query_cache_, cmd, data_version);
+        }
+
+        adviseIndexes_(cmd);
+        auto stmt = SQLitePreparedStatement(db_conn_, cmd);
+        return SqlResultIterator(stmt.release(), std::move(result_writers));
+    }
+
+    /// Execute the query on a background thread (see PrefetchingResultIterator).
+    /// Use this for large scans where processing each record takes a while:
+    ///
+    ///     auto result_set = query->getPrefetchingResultSet();
+    ///     while (result_set->getNextRecord())
+    ///     {
+    ///         ...
+    ///     }
+    std::unique_ptr<PrefetchingResultIterator> getPrefetchingResultSet(const size_t rows_per_batch = 256, const size_t max_batches = 4)
+    {
+        const auto cmd = getSelectCommand_();
+        adviseIndexes_(cmd);
+
+        std::vector<std::shared_ptr<ResultWriterBase>> result_writers;
+        for (const auto& writer : result_writers_)
+        {
+            result_writers.emplace_back(writer->clone());
+        }
+
+        return std::make_unique<PrefetchingResultIterator>(db_conn_, cmd, std::move(result_writers), rows_per_batch, max_batches);
+    }
+
+    /// Serve repeated getResultSet() and count() calls from the given cache.
+    /// DatabaseManager::createQuery() does this for you when
+    /// DatabaseManager::enableQueryCache() was called.
+    void setQueryCache(const std::shared_ptr<QueryCache>& cache)
+    {
+        query_cache_ = cache;
+    }
+
+    /// Get the "EXPLAIN QUERY PLAN" output for this query, e.g. to check
+    /// that it uses an index instead of a full table scan:
+    ///
+    ///     for (const auto& step : query->explain())
+    ///     {
+    ///         if (step.isFullScan()) { ... }
+    ///     }
+    std::vector<QueryPlanStep> explain() const
+    {
+        return explain_(getSelectCommand_());
+    }
+
+    /// Send this query's full table scans to the given advisor every time
+    /// the query is run. DatabaseManager::createQuery() does this for you
+    /// when DatabaseManager::enableIndexAdvice() was called.
+    void setIndexAdvisor(const std::shared_ptr<IndexAdvisor>& advisor)
+    {
+        index_advisor_ = advisor;
+    }
+
+private:
+    /// Build the SELECT command for getResultSet() and explain().
+    std::string getSelectCommand_() const
     {
         std::ostringstream oss;
         oss << "SELECT ";
@@ -427,25 +621,100 @@ public:
             }
         }
 
-        oss << " FROM " << table_name_ << " ";
+        oss << " ";
 
+        appendFromClause_(oss);
         appendConstraintClauses_(oss);
         appendOrderByClauses_(oss);
         appendLimitClause_(oss);
 
-        const auto cmd = oss.str();
-        auto stmt = SQLitePreparedStatement(db_conn_, cmd);
+        return oss.str();
+    }
 
-        std::vector<std::shared_ptr<ResultWriterBase>> result_writers;
-        for (const auto& writer : result_writers_)
+    /// Run "EXPLAIN QUERY PLAN <cmd>" and return its rows.
+    std::vector<QueryPlanStep> explain_(const std::string& cmd) const
+    {
+        auto stmt = SQLitePreparedStatement(db_conn_, "EXPLAIN QUERY PLAN " + cmd);
+
+        std::vector<QueryPlanStep> steps;
+        while (true)
         {
-            result_writers.emplace_back(writer->clone());
+            auto rc = SQLiteReturnCode(sqlite3_step(stmt));
+            if (rc == SQLITE_DONE)
+            {
+                break;
+            }
+            else if (rc != SQLITE_ROW)
+            {
+                throw DBException(sqlite3_errmsg(db_conn_));
+            }
+
+            QueryPlanStep step;
+            step.id = sqlite3_column_int(stmt, 0);
+            step.parent = sqlite3_column_int(stmt, 1);
+            step.detail = (const char*)sqlite3_column_text(stmt, 3);
+            steps.emplace_back(std::move(step));
         }
 
-        return SqlResultIterator(stmt.release(), std::move(result_writers));
+        return steps;
+    }
+
+    /// Tell the index advisor (if any) that the given command scans this
+    /// query's table in full.
+    void adviseIndexes_(const std::string& cmd) const
+    {
+        if (!index_advisor_ || constraint_cols_.empty())
+        {
+            return;
+        }
+
+        const auto& table_ref = table_alias_.empty() ? table_name_ : table_alias_;
+        for (const auto& step : explain_(cmd))
+        {
+            if (step.isFullScan() && step.getTableName() == table_ref)
+            {
+                index_advisor_->recordFullScan(table_name_, constraint_cols_);
+            }
+        }
+    }
+
+    /// Remember which of this table's columns the query is constrained on.
+    /// Columns qualified with another (joined) table's alias are ignored.
+    void recordConstraintCol_(const std::string& col_name)
+    {
+        std::string col = col_name;
+        const auto dot = col.find('.');
+        if (dot != std::string::npos)
+        {
+            const auto qualifier = col.substr(0, dot);
+            if (qualifier != table_name_ && qualifier != table_alias_)
+            {
+                return;
+            }
+            col = col.substr(dot + 1);
+        }
+
+        if (std::find(constraint_cols_.begin(), constraint_cols_.end(), col) == constraint_cols_.end())
+        {
+            constraint_cols_.emplace_back(col);
+        }
+    }
+
+    /// Append the FROM clause, including any JOIN clauses.
+    void appendFromClause_(std::ostringstream& oss) const
+    {
+        oss << "FROM " << table_name_ << " ";
+        if (!table_alias_.empty())
+        {
+            oss << "AS " << table_alias_ << " ";
+        }
+
+        for (const auto& join_clause : join_clauses_)
+        {
+            oss << join_clause << " ";
+        }
     }
 
-private:
     /// Append WHERE clause(s).
     void appendConstraintClauses_(std::ostringstream& oss) const
     {
@@ -508,6 +777,12 @@ private:
     /// SELECT ColA,ColB FROM <table_name_> WHERE ...
     const std::string table_name_;
 
+    /// SELECT ColA,ColB FROM <table_name_> AS <table_alias_> ...
+    std::string table_alias_;
+
+    /// SELECT ColA,ColB FROM Table <join_clauses_> WHERE ...
+    std::vector<std::string> join_clauses_;
+
     /// Underlying sqlite3 database
     sqlite3* const db_conn_;
 
@@ -517,6 +792,15 @@ private:
     /// SELECT ColA,ColB FROM Table WHERE ... ORDER BY <order_clauses_>
     std::vector<QueryOrderClause> order_clauses_;
 
+    /// Columns of this table that appear in the constraint clauses
+    std::vector<std::string> constraint_cols_;
+
+    /// Optional debug helper (see DatabaseManager::enableIndexAdvice())
+    std::shared_ptr<IndexAdvisor> index_advisor_;
+
+    /// Optional result cache (see DatabaseManager::enableQueryCache())
+    std::shared_ptr<QueryCache> query_cache_;
+
     /// SELECT ColA,ColB FROM Table WHERE <constraint_clauses_>
     std::vector<std::string> constraint_clauses_;
 
@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include "simdb/sqlite/CompressedBlob.hpp"
 #include "simdb/sqlite/SQLiteQuery.hpp"
 #include "simdb/sqlite/SQLiteTransaction.hpp"
 #include "simdb/sqlite/ValueContainer.hpp"
@@ -9,6 +10,8 @@
 #include <sqlite3.h>
 #include <algorithm>
 #include <list>
+#include <tuple>
+#include <unordered_set>
 
 namespace simdb
 {
@@ -130,12 +133,34 @@ public:
         oss << ") ";
     }
 
-    void bindValsForINSERT(sqlite3_stmt* stmt) const
+    size_t getNumValues() const
+    {
+        return col_vals_.size();
+    }
+
+    /// Bind the values in order. Blob values whose entry in 'compressed_cols'
+    /// is true are compressed first (see SqlDataType::compressed_blob_t).
+    void bindValsForINSERT(sqlite3_stmt* stmt, const std::vector<bool>& compressed_cols = {}) const
     {
         int32_t idx = 1;
+        std::vector<char> compressed_bytes;
         for (auto& val : col_vals_)
         {
-            auto rc = SQLiteReturnCode(val->bind(stmt, idx++));
+            const void* data = nullptr;
+            size_t num_bytes = 0;
+            int32_t bind_rc;
+            if ((size_t)idx <= compressed_cols.size() && compressed_cols[idx - 1] && val->getBlobBytes(data, num_bytes))
+            {
+                compressBlob(data, num_bytes, compressed_bytes);
+                bind_rc = sqlite3_bind_blob(stmt, idx, compressed_bytes.data(), (int)compressed_bytes.size(), SQLITE_TRANSIENT);
+            }
+            else
+            {
+                bind_rc = val->bind(stmt, idx);
+            }
+            ++idx;
+
+            auto rc = SQLiteReturnCode(bind_rc);
             if (rc)
             {
                 throw DBException(sqlite3_errmsg(sqlite3_db_handle(stmt)));
@@ -197,6 +222,22 @@ private:
     std::list<std::shared_ptr<ValueContainerBase>> col_vals_;
 };
 
+/// For each of the given columns, whether it is one of the given
+/// compressed_blob_t columns.
+inline std::vector<bool> getCompressedBlobFlags(const std::list<std::string>& col_names,
+                                                const std::unordered_set<std::string>& compressed_cols)
+{
+    std::vector<bool> flags;
+    if (!compressed_cols.empty())
+    {
+        for (const auto& col_name : col_names)
+        {
+            flags.push_back(compressed_cols.count(col_name) > 0);
+        }
+    }
+    return flags;
+}
+
 /*!
  * \class SqlRecord
  *
@@ -205,11 +246,16 @@ private:
 class SqlRecord
 {
 public:
-    SqlRecord(const std::string& table_name, const int32_t db_id, sqlite3* db_conn, SQLiteTransaction* transaction)
+    SqlRecord(const std::string& table_name,
+              const int32_t db_id,
+              sqlite3* db_conn,
+              SQLiteTransaction* transaction,
+              CompressedBlobColumnCache* compressed_blob_cols = nullptr)
         : table_name_(table_name)
         , db_id_(db_id)
         , db_conn_(db_conn)
         , transaction_(transaction)
+        , compressed_blob_cols_(compressed_blob_cols)
     {
     }
 
@@ -234,6 +280,14 @@ public:
     /// SELECT the given column value (blob)
     template <typename T> std::vector<T> getPropertyBlob(const char* col_name) const;
 
+    /// SELECT several column values with one statement. The value types
+    /// are given in the same order as the columns, and may be any type
+    /// supported by SqlQuery::select() (int32_t, int64_t, double,
+    /// std::string, std::vector<T>):
+    ///
+    ///     auto [name, age] = record->getProperties<std::string, int32_t>(SQL_COLUMNS("Name", "Age"));
+    template <typename... Ts> std::tuple<Ts...> getProperties(const SqlColumns& cols) const;
+
     /// UPDATE the given column value (int32)
     void setPropertyInt32(const char* col_name, const int32_t val) const;
 
@@ -258,6 +312,11 @@ public:
     /// UPDATE the given column value (blob)
     void setPropertyBlob(const char* col_name, const void* data, const size_t bytes) const;
 
+    /// UPDATE several column values with one statement:
+    ///
+    ///     record->setProperties(SQL_COLUMNS("Name", "Age"), SQL_VALUES("Bob", 42));
+    void setProperties(const SqlColumns& cols, const SqlValues& vals) const;
+
     /// DELETE this record from its table. Returns TRUE if successful,
     /// FALSE otherwise. Should return FALSE on subsequent calls to this method.
     bool removeFromTable();
@@ -304,6 +363,14 @@ private:
         }
     }
 
+    /// Get the compressed_blob_t columns of this record's table, from the
+    /// DatabaseManager's cache if we have one.
+    std::unordered_set<std::string> getCompressedBlobColumns_() const
+    {
+        return compressed_blob_cols_ ? compressed_blob_cols_->getColumns(db_conn_, table_name_)
+                                     : getCompressedBlobColumns(db_conn_, table_name_);
+    }
+
     // SELECT ColA FROM <table_name_> WHERE Id=<db_id_>
     const std::string table_name_;
 
@@ -315,6 +382,9 @@ private:
 
     // Used for safeTransaction()
     SQLiteTransaction* const transaction_;
+
+    // Compressed_blob_t columns by table (owned by the DatabaseManager)
+    CompressedBlobColumnCache* const compressed_blob_cols_;
 };
 
 /// Run a query on the given table, column, and database ID, and return the property value.
@@ -361,6 +431,35 @@ template <typename T> inline std::vector<T> SqlRecord::getPropertyBlob(const cha
     return queryPropertyValue<std::vector<T>>(table_name_.c_str(), col_name, db_id_, db_conn_);
 }
 
+template <typename... Ts> inline std::tuple<Ts...> SqlRecord::getProperties(const SqlColumns& cols) const
+{
+    const auto col_names = cols.getColNames();
+    if (col_names.size() != sizeof...(Ts))
+    {
+        throw DBException("Expected ") << sizeof...(Ts) << " columns in getProperties(), got " << col_names.size();
+    }
+
+    SqlQuery query(table_name_.c_str(), db_conn_);
+
+    std::tuple<Ts...> vals;
+    std::apply(
+        [&](auto&... val)
+        {
+            auto col_iter = col_names.begin();
+            (query.select((col_iter++)->c_str(), val), ...);
+        },
+        vals);
+    query.addConstraintForInt("Id", Constraints::EQUAL, db_id_);
+
+    auto result_set = query.getResultSet();
+    if (!result_set.getNextRecord())
+    {
+        throw DBException("Record not found");
+    }
+
+    return vals;
+}
+
 inline void SqlRecord::setPropertyInt32(const char* col_name, const int32_t val) const
 {
     transaction_->safeTransaction(
@@ -458,12 +557,29 @@ inline void SqlRecord::setPropertyString(const char* col_name, const std::string
 }
 
 template <typename T> inline void SqlRecord::setPropertyBlob(const char* col_name, const std::vector<T>& val) const
+{
+    setPropertyBlob(col_name, val.data(), val.size() * sizeof(T));
+}
+
+inline void SqlRecord::setPropertyBlob(const char* col_name, const void* data, const size_t bytes) const
 {
     transaction_->safeTransaction(
         [&]()
         {
             auto stmt = createSetPropertyStmt_(col_name);
-            if (SQLiteReturnCode(sqlite3_bind_blob(stmt, 1, val.data(), val.size() * sizeof(T), 0)))
+
+            const void* bind_data = data;
+            size_t bind_bytes = bytes;
+
+            std::vector<char> compressed_bytes;
+            if (getCompressedBlobColumns_().count(col_name))
+            {
+                compressBlob(data, bytes, compressed_bytes);
+                bind_data = compressed_bytes.data();
+                bind_bytes = compressed_bytes.size();
+            }
+
+            if (SQLiteReturnCode(sqlite3_bind_blob(stmt, 1, bind_data, bind_bytes, 0)))
             {
                 throw DBException(sqlite3_errmsg(db_conn_));
             }
@@ -473,16 +589,32 @@ template <typename T> inline void SqlRecord::setPropertyBlob(const char* col_nam
         });
 }
 
-inline void SqlRecord::setPropertyBlob(const char* col_name, const void* data, const size_t bytes) const
+inline void SqlRecord::setProperties(const SqlColumns& cols, const SqlValues& vals) const
 {
+    const auto col_names = cols.getColNames();
+    if (col_names.size() != vals.getNumValues())
+    {
+        throw DBException("Column/value count mismatch in setProperties(): ") << col_names.size() << " vs " << vals.getNumValues();
+    }
+
     transaction_->safeTransaction(
         [&]()
         {
-            auto stmt = createSetPropertyStmt_(col_name);
-            if (SQLiteReturnCode(sqlite3_bind_blob(stmt, 1, data, bytes, 0)))
+            std::ostringstream oss;
+            oss << "UPDATE " << table_name_ << " SET ";
+            size_t idx = 0;
+            for (const auto& col_name : col_names)
             {
-                throw DBException(sqlite3_errmsg(db_conn_));
+                oss << col_name << "=?";
+                if (++idx != col_names.size())
+                {
+                    oss << ",";
+                }
             }
+            oss << " WHERE Id=" << db_id_;
+
+            SQLitePreparedStatement stmt(db_conn_, oss.str());
+            vals.bindValsForINSERT(stmt, getCompressedBlobFlags(col_names, getCompressedBlobColumns_()));
             stepStatement_(stmt, {SQLITE_DONE});
 
             return true;
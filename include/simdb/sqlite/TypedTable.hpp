@@ -0,0 +1,458 @@
+// <TypedTable.hpp> -*- C++ -*-
+
+#pragma once
+
+#include "simdb/sqlite/DatabaseManager.hpp"
+
+#include <sqlite3.h>
+#include <array>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace simdb
+{
+
+namespace detail
+{
+
+template <typename T> struct is_blob_vector : std::false_type
+{
+};
+
+template <typename T, typename Alloc> struct is_blob_vector<std::vector<T, Alloc>> : std::is_trivially_copyable<T>
+{
+};
+
+/// SQL column type for a TypedTable member. Integers that fit in an int32
+/// are stored as int32, the rest as int64 (uint64 values keep their bits).
+template <typename T> constexpr SqlDataType getTypedColumnDType()
+{
+    if constexpr (std::is_enum_v<T>)
+    {
+        return getTypedColumnDType<std::underlying_type_t<T>>();
+    }
+    else if constexpr (std::is_integral_v<T>)
+    {
+        return (sizeof(T) < sizeof(int32_t) || (sizeof(T) == sizeof(int32_t) && std::is_signed_v<T>)) ? SqlDataType::int32_t
+                                                                                                        : SqlDataType::int64_t;
+    }
+    else if constexpr (std::is_floating_point_v<T>)
+    {
+        return SqlDataType::double_t;
+    }
+    else if constexpr (std::is_same_v<T, std::string>)
+    {
+        return SqlDataType::string_t;
+    }
+    else
+    {
+        static_assert(is_blob_vector<T>::value, "TypedTable columns must be arithmetic, enum, std::string, or std::vector<POD>");
+        return SqlDataType::blob_t;
+    }
+}
+
+/// Bind one member value to the given (1-based) parameter of an INSERT.
+/// Strings and blobs are not copied; the row must outlive sqlite3_step().
+/// Blobs bound to a compressed_blob_t column are compressed into the given
+/// scratch buffer, which must outlive sqlite3_step() too.
+template <typename T> inline int bindTypedColumn(sqlite3_stmt* stmt, int idx, const T& val, bool compressed, std::vector<char>& scratch)
+{
+    constexpr auto dtype = getTypedColumnDType<T>();
+    if constexpr (dtype == SqlDataType::int32_t)
+    {
+        return sqlite3_bind_int(stmt, idx, static_cast<int>(val));
+    }
+    else if constexpr (dtype == SqlDataType::int64_t)
+    {
+        return sqlite3_bind_int64(stmt, idx, static_cast<sqlite3_int64>(val));
+    }
+    else if constexpr (dtype == SqlDataType::double_t)
+    {
+        return sqlite3_bind_double(stmt, idx, static_cast<double>(val));
+    }
+    else if constexpr (dtype == SqlDataType::string_t)
+    {
+        return sqlite3_bind_text(stmt, idx, val.c_str(), static_cast<int>(val.size()), SQLITE_STATIC);
+    }
+    else
+    {
+        using value_type = typename T::value_type;
+        const auto num_bytes = val.size() * sizeof(value_type);
+        if (compressed)
+        {
+            compressBlob(val.data(), num_bytes, scratch);
+            return sqlite3_bind_blob(stmt, idx, scratch.data(), static_cast<int>(scratch.size()), SQLITE_STATIC);
+        }
+        return sqlite3_bind_blob(stmt, idx, val.data(), static_cast<int>(num_bytes), SQLITE_STATIC);
+    }
+}
+
+/// Read one member value from the given (0-based) column of a SELECT.
+/// Blobs read from a compressed_blob_t column are decompressed through the
+/// given scratch buffer.
+template <typename T> inline void readTypedColumn(sqlite3_stmt* stmt, int idx, T& val, bool compressed, std::vector<char>& scratch)
+{
+    constexpr auto dtype = getTypedColumnDType<T>();
+    if constexpr (dtype == SqlDataType::int32_t)
+    {
+        val = static_cast<T>(sqlite3_column_int(stmt, idx));
+    }
+    else if constexpr (dtype == SqlDataType::int64_t)
+    {
+        val = static_cast<T>(sqlite3_column_int64(stmt, idx));
+    }
+    else if constexpr (dtype == SqlDataType::double_t)
+    {
+        val = static_cast<T>(sqlite3_column_double(stmt, idx));
+    }
+    else if constexpr (dtype == SqlDataType::string_t)
+    {
+        auto text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, idx));
+        val.assign(text ? text : "", sqlite3_column_bytes(stmt, idx));
+    }
+    else
+    {
+        using value_type = typename T::value_type;
+        auto bytes = static_cast<const char*>(sqlite3_column_blob(stmt, idx));
+        auto num_bytes = static_cast<size_t>(sqlite3_column_bytes(stmt, idx));
+        if (compressed && num_bytes)
+        {
+            decompressBlob(bytes, num_bytes, scratch);
+            bytes = scratch.data();
+            num_bytes = scratch.size();
+        }
+        val.resize(num_bytes / sizeof(value_type));
+        if (num_bytes)
+        {
+            memcpy(val.data(), bytes, val.size() * sizeof(value_type));
+        }
+    }
+}
+
+} // namespace detail
+
+/// One column of a TypedTable: the column name and the Row member it maps to.
+/// Blob members may be stored as compressed_blob_t columns instead.
+///
+/// \code
+///     simdb::TypedColumn("Balance", &Customer::balance)
+///     simdb::TypedColumn("History", &Customer::history, true)
+/// \endcode
+template <typename Row, typename T> struct TypedColumn
+{
+    TypedColumn(const char* name, T Row::*member, bool compressed = false)
+        : name(name)
+        , member(member)
+        , compressed(compressed)
+    {
+        if (compressed && detail::getTypedColumnDType<T>() != SqlDataType::blob_t)
+        {
+            throw DBException("Only blob columns can be compressed: ") << name;
+        }
+    }
+
+    const char* name;
+    T Row::*member;
+    bool compressed;
+};
+
+template <typename Row, typename... Ts> class TypedTable;
+
+/*!
+ * \class TypedInserter
+ *
+ * \brief Inserts Row values into a TypedTable. The INSERT statement is
+ *        prepared once, and each insert() binds the members directly.
+ *        The database connection stays open until this object is destroyed.
+ */
+template <typename Row, typename... Ts> class TypedInserter
+{
+public:
+    /// Insert one row. Returns the database ID of the new record.
+    int insert(const Row& row)
+    {
+        int db_id = 0;
+        db_conn_->safeTransaction(
+            [&]()
+            {
+                db_id = insertRow_(row);
+                return true;
+            });
+
+        return db_id;
+    }
+
+    /// Insert all the rows in one transaction.
+    template <typename Container> void insertAll(const Container& rows)
+    {
+        db_conn_->safeTransaction(
+            [&]()
+            {
+                for (const auto& row : rows)
+                {
+                    insertRow_(row);
+                }
+                return true;
+            });
+    }
+
+private:
+    TypedInserter(std::shared_ptr<SQLiteConnection> db_conn,
+                  const std::string& cmd,
+                  const std::tuple<TypedColumn<Row, Ts>...>& columns,
+                  const std::array<bool, sizeof...(Ts)>& compressed)
+        : db_conn_(std::move(db_conn))
+        , stmt_(std::make_unique<SQLitePreparedStatement>(db_conn_->getDatabase(), cmd))
+        , columns_(columns)
+        , compressed_(compressed)
+    {
+        if (!*stmt_)
+        {
+            throw DBException("Could not prepare statement: ") << cmd << ". Error: " << sqlite3_errmsg(db_conn_->getDatabase());
+        }
+    }
+
+    /// Bind and step the INSERT. The caller provides the transaction.
+    int insertRow_(const Row& row)
+    {
+        bindRow_(row, std::index_sequence_for<Ts...>());
+
+        auto rc = SQLiteReturnCode(sqlite3_step(*stmt_));
+        sqlite3_reset(*stmt_);
+        if (rc != SQLITE_DONE)
+        {
+            throw DBException("Could not perform INSERT. Error: ") << sqlite3_errmsg(db_conn_->getDatabase());
+        }
+
+        return db_conn_->getLastInsertRowId();
+    }
+
+    template <size_t... Idx> void bindRow_(const Row& row, std::index_sequence<Idx...>)
+    {
+        (detail::bindTypedColumn(
+             *stmt_, static_cast<int>(Idx) + 1, row.*(std::get<Idx>(columns_).member), compressed_[Idx], scratch_[Idx]),
+         ...);
+    }
+
+    std::shared_ptr<SQLiteConnection> db_conn_;
+    std::unique_ptr<SQLitePreparedStatement> stmt_;
+    std::tuple<TypedColumn<Row, Ts>...> columns_;
+
+    /// Which columns are compressed_blob_t columns, and the buffers their
+    /// compressed values are bound from.
+    std::array<bool, sizeof...(Ts)> compressed_;
+    std::array<std::vector<char>, sizeof...(Ts)> scratch_;
+
+    friend class TypedTable<Row, Ts...>;
+};
+
+/*!
+ * \class TypedReader
+ *
+ * \brief Iterates over the records of a TypedTable, reading each one
+ *        straight into a Row. The database connection stays open until
+ *        this object is destroyed.
+ */
+template <typename Row, typename... Ts> class TypedReader
+{
+public:
+    /// Read the next record into the given row. Returns false when there
+    /// are no more records.
+    bool getNextRow(Row& row)
+    {
+        auto rc = SQLiteReturnCode(sqlite3_step(*stmt_));
+        if (rc == SQLITE_DONE)
+        {
+            return false;
+        }
+        else if (rc != SQLITE_ROW)
+        {
+            throw DBException("Could not read the next record. Error: ") << sqlite3_errmsg(db_conn_->getDatabase());
+        }
+
+        current_id_ = sqlite3_column_int(*stmt_, 0);
+        readRow_(row, std::index_sequence_for<Ts...>());
+        return true;
+    }
+
+    /// Database ID of the record last read by getNextRow().
+    int getCurrentId() const
+    {
+        return current_id_;
+    }
+
+    /// Start over from the first record.
+    void reset()
+    {
+        sqlite3_reset(*stmt_);
+        current_id_ = 0;
+    }
+
+private:
+    TypedReader(std::shared_ptr<SQLiteConnection> db_conn, const std::string& cmd, const std::tuple<TypedColumn<Row, Ts>...>& columns)
+        : db_conn_(std::move(db_conn))
+        , stmt_(std::make_unique<SQLitePreparedStatement>(db_conn_->getDatabase(), cmd))
+        , columns_(columns)
+    {
+        if (!*stmt_)
+        {
+            throw DBException("Could not prepare statement: ") << cmd << ". Error: " << sqlite3_errmsg(db_conn_->getDatabase());
+        }
+
+        // Column 0 is the record ID
+        for (size_t idx = 0; idx < sizeof...(Ts); ++idx)
+        {
+            compressed_[idx] = isCompressedBlobDeclType(sqlite3_column_decltype(*stmt_, static_cast<int>(idx) + 1));
+        }
+    }
+
+    template <size_t... Idx> void readRow_(Row& row, std::index_sequence<Idx...>)
+    {
+        // Column 0 is the record ID
+        (detail::readTypedColumn(
+             *stmt_, static_cast<int>(Idx) + 1, row.*(std::get<Idx>(columns_).member), compressed_[Idx], scratch_[Idx]),
+         ...);
+    }
+
+    std::shared_ptr<SQLiteConnection> db_conn_;
+    std::unique_ptr<SQLitePreparedStatement> stmt_;
+    std::tuple<TypedColumn<Row, Ts>...> columns_;
+    int current_id_ = 0;
+
+    /// Which columns are compressed_blob_t columns, and the buffers their
+    /// values are decompressed into.
+    std::array<bool, sizeof...(Ts)> compressed_ = {};
+    std::array<std::vector<char>, sizeof...(Ts)> scratch_;
+
+    friend class TypedTable<Row, Ts...>;
+};
+
+/*!
+ * \class TypedTable
+ *
+ * \brief Declares a table from a row struct and its column list at compile
+ *        time. The column types come from the member types, rows are
+ *        inserted with a cached prepared statement, and queries hand back
+ *        Row values directly, with no per-call column name lookups or
+ *        type-erased value containers.
+ *
+ * \code
+ *     struct Customer
+ *     {
+ *         std::string name;
+ *         int32_t age;
+ *         double balance;
+ *     };
+ *
+ *     simdb::TypedTable customers("Customers",
+ *                                 simdb::TypedColumn("Name", &Customer::name),
+ *                                 simdb::TypedColumn("Age", &Customer::age),
+ *                                 simdb::TypedColumn("Balance", &Customer::balance));
+ *
+ *     simdb::Schema schema;
+ *     customers.addToSchema(schema).createIndexOn("Name");
+ *     db_mgr.createDatabaseFromSchema(schema);
+ *
+ *     auto inserter = customers.createInserter(db_mgr);
+ *     inserter.insert({"Alice", 30, 100.0});
+ *
+ *     auto reader = customers.createReader(db_mgr, "Age > 21");
+ *     Customer customer;
+ *     while (reader.getNextRow(customer)) { ... }
+ * \endcode
+ */
+template <typename Row, typename... Ts> class TypedTable
+{
+public:
+    TypedTable(const char* table_name, TypedColumn<Row, Ts>... columns)
+        : table_name_(table_name)
+        , columns_(columns...)
+    {
+    }
+
+    const std::string& getName() const
+    {
+        return table_name_;
+    }
+
+    /// Add this table and its columns to the schema. Returns the table so
+    /// that indexes and default values can be added to it.
+    Table& addToSchema(Schema& schema) const
+    {
+        auto& table = schema.addTable(table_name_);
+        std::apply(
+            [&](const auto&... column)
+            { (table.addColumn(column.name, column.compressed ? SqlDataType::compressed_blob_t : getColumnDType_(column)), ...); },
+            columns_);
+        return table;
+    }
+
+    /// Prepare the INSERT statement for this table.
+    TypedInserter<Row, Ts...> createInserter(DatabaseManager& db_mgr) const
+    {
+        std::ostringstream oss;
+        oss << "INSERT INTO " << table_name_ << " (";
+        writeColumnNames_(oss);
+        oss << ") VALUES (";
+        for (size_t idx = 0; idx < sizeof...(Ts); ++idx)
+        {
+            oss << (idx ? ",?" : "?");
+        }
+        oss << ")";
+
+        // Blobs going into compressed_blob_t columns are compressed, whether
+        // this TypedTable or some other schema declared the table.
+        std::array<bool, sizeof...(Ts)> compressed = {};
+        db_mgr.safeTransaction(
+            [&]()
+            {
+                const auto& compressed_cols = db_mgr.getCompressedBlobColumns_(table_name_);
+                size_t idx = 0;
+                std::apply([&](const auto&... column) { ((compressed[idx++] = compressed_cols.count(column.name) > 0), ...); }, columns_);
+                return true;
+            });
+
+        return TypedInserter<Row, Ts...>(db_mgr.db_conn_, oss.str(), columns_, compressed);
+    }
+
+    /// Prepare a SELECT over this table's records, in insertion order.
+    ///
+    /// \param where_clause Optional SQL condition, e.g. "Age > 21"
+    TypedReader<Row, Ts...> createReader(DatabaseManager& db_mgr, const std::string& where_clause = "") const
+    {
+        std::ostringstream oss;
+        oss << "SELECT Id,";
+        writeColumnNames_(oss);
+        oss << " FROM " << table_name_;
+        if (!where_clause.empty())
+        {
+            oss << " WHERE " << where_clause;
+        }
+        oss << " ORDER BY Id";
+
+        return TypedReader<Row, Ts...>(db_mgr.db_conn_, oss.str(), columns_);
+    }
+
+private:
+    template <typename T> static constexpr SqlDataType getColumnDType_(const TypedColumn<Row, T>&)
+    {
+        return detail::getTypedColumnDType<T>();
+    }
+
+    void writeColumnNames_(std::ostream& os) const
+    {
+        const char* sep = "";
+        std::apply([&](const auto&... column) { ((os << sep << column.name, sep = ","), ...); }, columns_);
+    }
+
+    std::string table_name_;
+    std::tuple<TypedColumn<Row, Ts>...> columns_;
+};
+
+} // namespace simdb
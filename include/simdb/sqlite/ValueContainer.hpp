@@ -23,6 +23,13 @@ class ValueContainerBase
 public:
     virtual ~ValueContainerBase() = default;
     virtual int32_t bind(sqlite3_stmt* stmt, int32_t col_idx) const = 0;
+
+    /// Get the raw bytes of blob values (used to compress values for
+    /// compressed_blob_t columns). Returns false for non-blob values.
+    virtual bool getBlobBytes(const void*&, size_t&) const
+    {
+        return false;
+    }
 };
 
 /// Bind an int32_t to an INSERT prepared statement.
@@ -111,6 +118,13 @@ public:
         return sqlite3_bind_blob(stmt, col_idx, val_.data_ptr, (int)val_.num_bytes, 0);
     }
 
+    bool getBlobBytes(const void*& data, size_t& num_bytes) const override
+    {
+        data = val_.data_ptr;
+        num_bytes = val_.num_bytes;
+        return true;
+    }
+
 private:
     SqlBlob val_;
 };
@@ -129,6 +143,13 @@ public:
         return sqlite3_bind_blob(stmt, col_idx, val_.data(), (int)val_.size() * sizeof(T), 0);
     }
 
+    bool getBlobBytes(const void*& data, size_t& num_bytes) const override
+    {
+        data = val_.data();
+        num_bytes = val_.size() * sizeof(T);
+        return true;
+    }
+
 private:
     std::vector<T> val_;
 };
@@ -0,0 +1,277 @@
+// <WalCheckpointer.hpp> -*- C++ -*-
+
+#pragma once
+
+#include "simdb/Exceptions.hpp"
+#include "simdb/utils/Thread.hpp"
+
+#include <sqlite3.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <string>
+
+namespace simdb
+{
+
+/// Options for DatabaseManager::enableWalCheckpointing().
+struct WalCheckpointOptions
+{
+    /// Run a PASSIVE checkpoint (never waits on readers or writers) once
+    /// this many bytes of WAL frames were committed since the last one.
+    size_t passive_wal_bytes = 16 * 1024 * 1024;
+
+    /// Run a RESTART checkpoint once the WAL file reaches this many bytes.
+    /// It waits (up to busy_timeout_ms) for readers to let go of the WAL,
+    /// and then truncates the WAL file, which keeps it from growing without
+    /// limit while the database is being viewed live.
+    size_t restart_wal_bytes = 256 * 1024 * 1024;
+
+    /// Run a PASSIVE checkpoint when nothing was written for this long.
+    size_t idle_ms = 1000;
+
+    /// How often the background thread checks the WAL size.
+    size_t poll_interval_ms = 100;
+
+    /// How long RESTART checkpoints wait on other connections.
+    int busy_timeout_ms = 1000;
+};
+
+/// Metrics reported by DatabaseManager::getWalCheckpointStats().
+struct WalCheckpointStats
+{
+    /// Number of PASSIVE and RESTART (with WAL truncation) checkpoints run so far.
+    uint64_t num_passive = 0;
+    uint64_t num_restart = 0;
+
+    /// Number of checkpoints that could not finish because another
+    /// connection was busy. They are retried on the next poll.
+    uint64_t num_busy = 0;
+
+    /// WAL frames committed by the owning connection, and the number
+    /// copied back into the database file.
+    uint64_t num_frames_committed = 0;
+    uint64_t num_frames_checkpointed = 0;
+
+    /// Checkpoint durations in microseconds.
+    uint64_t total_checkpoint_us = 0;
+    uint64_t max_checkpoint_us = 0;
+    uint64_t last_checkpoint_us = 0;
+
+    /// WAL file size at the last poll, and the largest seen so far.
+    uint64_t wal_bytes = 0;
+    uint64_t max_wal_bytes = 0;
+};
+
+/*!
+ * \class WalCheckpointer
+ *
+ * \brief Runs WAL checkpoints on a background thread, using a connection of
+ *        its own, so that commits (e.g. from the DatabaseThread) never stall
+ *        on SQLite's inline auto-checkpoint. The owning connection must have
+ *        auto-checkpoint turned off (see DatabaseManager::enableWalCheckpointing()).
+ *
+ *        The commits are counted with a sqlite3_wal_hook() on the owning
+ *        connection, which replaces the auto-checkpoint hook. It reports
+ *        the WAL frame count after every commit that wrote something, so
+ *        read-only transactions do not count as activity, and frames are
+ *        still counted after a checkpoint resets the WAL to the start of
+ *        the (unchanged) file.
+ */
+class WalCheckpointer : public Thread
+{
+public:
+    /// \param db_conn Connection whose database file (and VFS) we checkpoint,
+    ///        and whose commits we watch
+    /// \param options Checkpoint triggers
+    WalCheckpointer(sqlite3* db_conn, const WalCheckpointOptions& options)
+        : Thread(options.poll_interval_ms, "simdb-wal")
+        , db_conn_(db_conn)
+        , options_(options)
+        , last_commit_time_(std::chrono::steady_clock::now())
+    {
+        const char* db_filepath = sqlite3_db_filename(db_conn, "main");
+        if (!db_filepath || !*db_filepath)
+        {
+            throw DBException("WAL checkpointing requires a database file");
+        }
+        wal_filepath_ = std::string(db_filepath) + "-wal";
+
+        sqlite3_vfs* vfs = nullptr;
+        sqlite3_file_control(db_conn, "main", SQLITE_FCNTL_VFS_POINTER, &vfs);
+
+        if (sqlite3_open_v2(db_filepath, &checkpoint_conn_, SQLITE_OPEN_READWRITE, vfs ? vfs->zName : nullptr) != SQLITE_OK)
+        {
+            std::string err = checkpoint_conn_ ? sqlite3_errmsg(checkpoint_conn_) : "out of memory";
+            sqlite3_close(checkpoint_conn_);
+            throw DBException("Unable to open a checkpoint connection to ") << db_filepath << ": " << err;
+        }
+
+        sqlite3_busy_timeout(checkpoint_conn_, options_.busy_timeout_ms);
+        sqlite3_wal_autocheckpoint(checkpoint_conn_, 0);
+
+        // A new connection does not know the database is in WAL mode until
+        // it reads from it. Until then, checkpoints would do nothing.
+        sqlite3_exec(checkpoint_conn_, "SELECT COUNT(*) FROM sqlite_master", nullptr, nullptr, nullptr);
+
+        // Every frame holds one page plus a 24-byte header
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(checkpoint_conn_, "PRAGMA page_size", -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            frame_num_bytes_ = (uint64_t)sqlite3_column_int64(stmt, 0) + 24;
+        }
+        sqlite3_finalize(stmt);
+
+        sqlite3_wal_hook(db_conn_, &WalCheckpointer::walHook_, this);
+    }
+
+    /// Stop the background thread, unhook from the owning connection, and
+    /// close our connection.
+    ~WalCheckpointer()
+    {
+        stopThreadLoop();
+        sqlite3_wal_hook(db_conn_, nullptr, nullptr);
+        sqlite3_close(checkpoint_conn_);
+    }
+
+    /// Get the checkpoint metrics so far.
+    WalCheckpointStats getStats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+private:
+    /// Called by SQLite on the committing thread after every commit that
+    /// wrote to the WAL, with the number of frames now in the WAL.
+    static int walHook_(void* arg, sqlite3*, const char*, int num_wal_frames)
+    {
+        auto checkpointer = static_cast<WalCheckpointer*>(arg);
+        const auto num_frames = (uint64_t)std::max(num_wal_frames, 0);
+        const auto prev_num_frames = checkpointer->num_wal_frames_.exchange(num_frames);
+
+        // A smaller frame count means this commit started over at the
+        // beginning of the WAL after a checkpoint (see checkpoint_()).
+        checkpointer->num_new_frames_ += num_frames >= prev_num_frames ? num_frames - prev_num_frames : num_frames;
+        ++checkpointer->num_commits_;
+        return SQLITE_OK;
+    }
+
+    /// Check the committed frames, WAL size, and idle time, and checkpoint
+    /// if needed.
+    void onInterval_() override
+    {
+        const auto now = std::chrono::steady_clock::now();
+        const auto commit_count = num_commits_.load();
+        if (commit_count != last_commit_count_)
+        {
+            last_commit_count_ = commit_count;
+            last_commit_time_ = now;
+            checkpointed_since_commit_ = false;
+        }
+
+        const auto new_frames = num_new_frames_.exchange(0);
+        frames_since_checkpoint_ += new_frames;
+
+        std::error_code ec;
+        const uint64_t wal_bytes = std::filesystem::exists(wal_filepath_, ec) ? std::filesystem::file_size(wal_filepath_, ec) : 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.wal_bytes = ec ? 0 : wal_bytes;
+            stats_.max_wal_bytes = std::max(stats_.max_wal_bytes, stats_.wal_bytes);
+            stats_.num_frames_committed += new_frames;
+        }
+
+        // Once a checkpoint has copied every frame, writers start over at the
+        // beginning of the WAL without shrinking the file, so the file size
+        // says nothing about new frames. Those are counted by walHook_().
+        const auto idle_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_commit_time_).count();
+        if (options_.restart_wal_bytes && wal_bytes >= options_.restart_wal_bytes)
+        {
+            checkpoint_(SQLITE_CHECKPOINT_TRUNCATE);
+        }
+        else if (options_.passive_wal_bytes && frames_since_checkpoint_ * frame_num_bytes_ >= options_.passive_wal_bytes)
+        {
+            checkpoint_(SQLITE_CHECKPOINT_PASSIVE);
+        }
+        else if (!checkpointed_since_commit_ && (size_t)idle_ms >= options_.idle_ms)
+        {
+            checkpoint_(SQLITE_CHECKPOINT_PASSIVE);
+        }
+    }
+
+    /// Run one checkpoint and record its metrics.
+    void checkpoint_(const int mode)
+    {
+        const auto start = std::chrono::steady_clock::now();
+
+        int num_log_frames = 0;
+        int num_checkpointed_frames = 0;
+        const auto rc = sqlite3_wal_checkpoint_v2(checkpoint_conn_, "main", mode, &num_log_frames, &num_checkpointed_frames);
+
+        const auto elapsed_us =
+            (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (rc != SQLITE_OK)
+        {
+            // Usually SQLITE_BUSY. The next poll tries again.
+            ++stats_.num_busy;
+            return;
+        }
+
+        // Frames committed while the checkpoint ran are picked up (again)
+        // on the next poll, which at worst checkpoints a little early.
+        frames_since_checkpoint_ = (uint64_t)std::max(num_log_frames - num_checkpointed_frames, 0);
+
+        // Once every frame was copied, the next commit starts over at the
+        // beginning of the WAL, and may well end up with as many frames as
+        // before. Count its frames from zero.
+        if (num_checkpointed_frames >= num_log_frames)
+        {
+            num_wal_frames_ = 0;
+        }
+
+        if (mode == SQLITE_CHECKPOINT_TRUNCATE)
+        {
+            ++stats_.num_restart;
+        }
+        else
+        {
+            ++stats_.num_passive;
+        }
+
+        stats_.num_frames_checkpointed += std::max(num_checkpointed_frames, 0);
+        stats_.total_checkpoint_us += elapsed_us;
+        stats_.max_checkpoint_us = std::max(stats_.max_checkpoint_us, elapsed_us);
+        stats_.last_checkpoint_us = elapsed_us;
+        checkpointed_since_commit_ = num_checkpointed_frames >= num_log_frames;
+    }
+
+    sqlite3* const db_conn_;
+    const WalCheckpointOptions options_;
+    std::string wal_filepath_;
+    sqlite3* checkpoint_conn_ = nullptr;
+
+    /// Updated by walHook_(): commits that wrote to the WAL, the WAL frame
+    /// count after the last one, and the frames added since the last poll
+    std::atomic<uint64_t> num_commits_{0};
+    std::atomic<uint64_t> num_wal_frames_{0};
+    std::atomic<uint64_t> num_new_frames_{0};
+
+    /// Used to tell how long the database has been idle
+    uint64_t last_commit_count_ = 0;
+    std::chrono::steady_clock::time_point last_commit_time_;
+    bool checkpointed_since_commit_ = false;
+
+    /// Frames not yet copied back by a checkpoint, and the size of each
+    uint64_t frames_since_checkpoint_ = 0;
+    uint64_t frame_num_bytes_ = 4096 + 24;
+
+    WalCheckpointStats stats_;
+    mutable std::mutex mutex_;
+};
+
+} // namespace simdb
@@ -0,0 +1,843 @@
+// <ArrowIpc.hpp> -*- C++ -*-
+
+#pragma once
+
+#include "simdb/Exceptions.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace simdb
+{
+
+namespace arrow_detail
+{
+
+class FlatObject;
+using FlatObjectPtr = std::shared_ptr<FlatObject>;
+
+/*!
+ * \class FlatObject
+ *
+ * \brief Just enough of a FlatBuffers encoder for the Arrow IPC metadata
+ *        (Schema, Message, and Footer tables). Objects are built up as a
+ *        tree and then written front to back: a table's children always
+ *        land after it, so their (unsigned, forward) offsets are patched in
+ *        once each child has been placed.
+ */
+class FlatObject
+{
+public:
+    static FlatObjectPtr table()
+    {
+        return FlatObjectPtr(new FlatObject(Kind::TABLE));
+    }
+
+    static FlatObjectPtr string(const std::string& str)
+    {
+        FlatObjectPtr obj(new FlatObject(Kind::STRING));
+        obj->bytes_.assign(str.begin(), str.end());
+        return obj;
+    }
+
+    /// Vector of scalars or structs, stored back to back. The elements are
+    /// 8-byte aligned, which covers every struct in the Arrow schema.
+    static FlatObjectPtr inlineVector(const void* data, size_t num_elems, size_t elem_num_bytes)
+    {
+        FlatObjectPtr obj(new FlatObject(Kind::INLINE_VECTOR));
+        obj->num_elems_ = num_elems;
+        obj->bytes_.assign((const char*)data, (const char*)data + num_elems * elem_num_bytes);
+        return obj;
+    }
+
+    /// Vector of tables.
+    static FlatObjectPtr tableVector(const std::vector<FlatObjectPtr>& elems)
+    {
+        FlatObjectPtr obj(new FlatObject(Kind::TABLE_VECTOR));
+        obj->num_elems_ = elems.size();
+        obj->elems_ = elems;
+        return obj;
+    }
+
+    /// Set a scalar field of a table. The slot is the field's index in the
+    /// .fbs file (unions take two slots: the type, then the value).
+    template <typename T> FlatObject& addScalar(uint16_t slot, T value)
+    {
+        Field field;
+        field.slot = slot;
+        field.scalar.resize(sizeof(T));
+        memcpy(field.scalar.data(), &value, sizeof(T));
+        fields_.emplace_back(std::move(field));
+        return *this;
+    }
+
+    /// Set a table, vector, or string field of a table.
+    FlatObject& addObject(uint16_t slot, const FlatObjectPtr& child)
+    {
+        Field field;
+        field.slot = slot;
+        field.child = child;
+        fields_.emplace_back(std::move(field));
+        return *this;
+    }
+
+    /// Serialize this object as the root of a buffer. The size is padded to
+    /// a multiple of 8 bytes.
+    std::vector<char> finish() const
+    {
+        std::vector<char> buf(sizeof(uint32_t), 0);
+        const uint32_t root_pos = write_(buf);
+        memcpy(buf.data(), &root_pos, sizeof(root_pos));
+        pad_(buf, 8);
+        return buf;
+    }
+
+private:
+    enum class Kind
+    {
+        TABLE,
+        STRING,
+        INLINE_VECTOR,
+        TABLE_VECTOR
+    };
+
+    struct Field
+    {
+        uint16_t slot = 0;
+        std::vector<char> scalar;
+        FlatObjectPtr child;
+
+        size_t numBytes() const
+        {
+            return child ? sizeof(uint32_t) : scalar.size();
+        }
+    };
+
+    explicit FlatObject(Kind kind)
+        : kind_(kind)
+    {
+    }
+
+    /// Write the object (and its children) and return where it starts.
+    uint32_t write_(std::vector<char>& buf) const
+    {
+        switch (kind_)
+        {
+            case Kind::TABLE:
+                return writeTable_(buf);
+
+            case Kind::STRING:
+            {
+                pad_(buf, 4);
+                const uint32_t pos = buf.size();
+                append_(buf, (uint32_t)bytes_.size());
+                buf.insert(buf.end(), bytes_.begin(), bytes_.end());
+                buf.push_back('\0');
+                return pos;
+            }
+
+            case Kind::INLINE_VECTOR:
+            {
+                while ((buf.size() + sizeof(uint32_t)) % 8)
+                {
+                    buf.push_back(0);
+                }
+                const uint32_t pos = buf.size();
+                append_(buf, (uint32_t)num_elems_);
+                buf.insert(buf.end(), bytes_.begin(), bytes_.end());
+                return pos;
+            }
+
+            case Kind::TABLE_VECTOR:
+            {
+                pad_(buf, 4);
+                const uint32_t pos = buf.size();
+                append_(buf, (uint32_t)num_elems_);
+                buf.resize(buf.size() + num_elems_ * sizeof(uint32_t), 0);
+                for (size_t idx = 0; idx < elems_.size(); ++idx)
+                {
+                    const uint32_t offset_pos = pos + sizeof(uint32_t) * (idx + 1);
+                    patchOffset_(buf, offset_pos, elems_[idx]->write_(buf));
+                }
+                return pos;
+            }
+        }
+
+        throw DBException("Invalid flatbuffer object");
+    }
+
+    /// The vtable goes right before the table. The table's fields are laid
+    /// out largest first after its vtable offset, so each one is aligned.
+    uint32_t writeTable_(std::vector<char>& buf) const
+    {
+        std::vector<const Field*> sorted;
+        uint16_t num_slots = 0;
+        for (const auto& field : fields_)
+        {
+            sorted.push_back(&field);
+            num_slots = std::max<uint16_t>(num_slots, field.slot + 1);
+        }
+        std::stable_sort(sorted.begin(), sorted.end(), [](const Field* a, const Field* b) { return a->numBytes() > b->numBytes(); });
+
+        std::vector<uint16_t> field_offsets(num_slots, 0);
+        size_t inline_num_bytes = sizeof(int32_t);
+        for (auto field : sorted)
+        {
+            const auto num_bytes = field->numBytes();
+            inline_num_bytes = (inline_num_bytes + num_bytes - 1) / num_bytes * num_bytes;
+            field_offsets[field->slot] = inline_num_bytes;
+            inline_num_bytes += num_bytes;
+        }
+
+        pad_(buf, 2);
+        const uint32_t vtable_pos = buf.size();
+        append_(buf, (uint16_t)(sizeof(uint16_t) * (2 + num_slots)));
+        append_(buf, (uint16_t)inline_num_bytes);
+        for (auto offset : field_offsets)
+        {
+            append_(buf, offset);
+        }
+
+        pad_(buf, 8);
+        const uint32_t table_pos = buf.size();
+        append_(buf, (int32_t)(table_pos - vtable_pos));
+        buf.resize(table_pos + inline_num_bytes, 0);
+
+        for (const auto& field : fields_)
+        {
+            if (!field.child)
+            {
+                memcpy(buf.data() + table_pos + field_offsets[field.slot], field.scalar.data(), field.scalar.size());
+            }
+        }
+
+        for (const auto& field : fields_)
+        {
+            if (field.child)
+            {
+                const uint32_t offset_pos = table_pos + field_offsets[field.slot];
+                patchOffset_(buf, offset_pos, field.child->write_(buf));
+            }
+        }
+
+        return table_pos;
+    }
+
+    template <typename T> static void append_(std::vector<char>& buf, T value)
+    {
+        const auto pos = buf.size();
+        buf.resize(pos + sizeof(T));
+        memcpy(buf.data() + pos, &value, sizeof(T));
+    }
+
+    static void pad_(std::vector<char>& buf, size_t alignment)
+    {
+        buf.resize((buf.size() + alignment - 1) / alignment * alignment, 0);
+    }
+
+    static void patchOffset_(std::vector<char>& buf, uint32_t offset_pos, uint32_t target_pos)
+    {
+        const uint32_t offset = target_pos - offset_pos;
+        memcpy(buf.data() + offset_pos, &offset, sizeof(offset));
+    }
+
+    const Kind kind_;
+    std::vector<Field> fields_;
+    std::vector<char> bytes_;
+    size_t num_elems_ = 0;
+    std::vector<FlatObjectPtr> elems_;
+};
+
+} // namespace arrow_detail
+
+/*!
+ * \class ArrowColumn
+ *
+ * \brief One column of a table written by ArrowFileWriter. Values are
+ *        appended in their native (little-endian) layout. A validity byte
+ *        per row is only kept once the first null is appended.
+ */
+class ArrowColumn
+{
+public:
+    enum class Type
+    {
+        INT,
+        FLOAT,
+        BOOL,
+        STRING_DICTIONARY,
+        FIXED_SIZE_BINARY
+    };
+
+    static ArrowColumn makeInt(const std::string& name, size_t bit_width, bool is_signed)
+    {
+        return ArrowColumn(name, Type::INT, bit_width / 8, bit_width, is_signed);
+    }
+
+    static ArrowColumn makeFloat(const std::string& name, size_t bit_width)
+    {
+        return ArrowColumn(name, Type::FLOAT, bit_width / 8, bit_width, true);
+    }
+
+    /// Stored one byte per value until the file is written (bit-packed).
+    static ArrowColumn makeBool(const std::string& name)
+    {
+        return ArrowColumn(name, Type::BOOL, 1, 1, false);
+    }
+
+    /// Dictionary-encoded strings with int32 indices. The dictionary can be
+    /// seeded (e.g. with an enum's names in value order) and grows as new
+    /// strings are appended.
+    static ArrowColumn makeStringDictionary(const std::string& name, const std::vector<std::string>& dictionary = {})
+    {
+        ArrowColumn column(name, Type::STRING_DICTIONARY, sizeof(int32_t), 32, true);
+        for (const auto& str : dictionary)
+        {
+            column.getDictionaryIndex_(str);
+        }
+        return column;
+    }
+
+    static ArrowColumn makeFixedSizeBinary(const std::string& name, size_t byte_width)
+    {
+        return ArrowColumn(name, Type::FIXED_SIZE_BINARY, byte_width, byte_width * 8, false);
+    }
+
+    /// Append one value of getByteWidth() bytes (INT, FLOAT, FIXED_SIZE_BINARY).
+    void append(const void* value)
+    {
+        const auto src = static_cast<const char*>(value);
+        values_.insert(values_.end(), src, src + byte_width_);
+        addValidRows_(1);
+    }
+
+    void appendBool(bool value)
+    {
+        values_.push_back(value ? 1 : 0);
+        addValidRows_(1);
+    }
+
+    /// Append a null. Its value bytes are zeroed.
+    void appendNull()
+    {
+        if (validity_.empty())
+        {
+            validity_.assign(num_rows_, 1);
+        }
+        values_.resize(values_.size() + byte_width_, 0);
+        validity_.push_back(0);
+        ++num_rows_;
+    }
+
+    void appendString(const std::string& str)
+    {
+        const int32_t idx = getDictionaryIndex_(str);
+        append(&idx);
+    }
+
+    /// Append num_rows zeroed values and return where they start, so they
+    /// can be filled in place (e.g. by gatherColumn()).
+    char* appendRows(size_t num_rows)
+    {
+        const size_t offset = values_.size();
+        values_.resize(offset + num_rows * byte_width_);
+        addValidRows_(num_rows);
+        return values_.data() + offset;
+    }
+
+    /// Remove every row (e.g. once they are written), but keep the
+    /// dictionary so later rows use the same indices.
+    void clearRows()
+    {
+        values_.clear();
+        validity_.clear();
+        num_rows_ = 0;
+    }
+
+    /// Make room for this many more rows.
+    void reserve(size_t num_rows)
+    {
+        values_.reserve(values_.size() + num_rows * byte_width_);
+    }
+
+    const std::string& getName() const
+    {
+        return name_;
+    }
+
+    Type getType() const
+    {
+        return type_;
+    }
+
+    size_t getBitWidth() const
+    {
+        return bit_width_;
+    }
+
+    bool isSigned() const
+    {
+        return is_signed_;
+    }
+
+    size_t getByteWidth() const
+    {
+        return byte_width_;
+    }
+
+    size_t getNumRows() const
+    {
+        return num_rows_;
+    }
+
+    const std::vector<char>& getValues() const
+    {
+        return values_;
+    }
+
+    /// One byte per row (0 for nulls), or empty if there are no nulls.
+    const std::vector<uint8_t>& getValidity() const
+    {
+        return validity_;
+    }
+
+    const std::vector<std::string>& getDictionary() const
+    {
+        return dictionary_;
+    }
+
+private:
+    ArrowColumn(const std::string& name, Type type, size_t byte_width, size_t bit_width, bool is_signed)
+        : name_(name)
+        , type_(type)
+        , byte_width_(byte_width)
+        , bit_width_(bit_width)
+        , is_signed_(is_signed)
+    {
+    }
+
+    void addValidRows_(size_t num_rows)
+    {
+        if (!validity_.empty())
+        {
+            validity_.resize(validity_.size() + num_rows, 1);
+        }
+        num_rows_ += num_rows;
+    }
+
+    int32_t getDictionaryIndex_(const std::string& str)
+    {
+        auto iter = dictionary_indices_.find(str);
+        if (iter == dictionary_indices_.end())
+        {
+            iter = dictionary_indices_.emplace(str, (int32_t)dictionary_.size()).first;
+            dictionary_.push_back(str);
+        }
+        return iter->second;
+    }
+
+    std::string name_;
+    Type type_;
+    size_t byte_width_;
+    size_t bit_width_;
+    bool is_signed_;
+    std::vector<char> values_;
+    std::vector<uint8_t> validity_;
+    size_t num_rows_ = 0;
+    std::vector<std::string> dictionary_;
+    std::unordered_map<std::string, int32_t> dictionary_indices_;
+};
+
+/*!
+ * \class ArrowFileWriter
+ *
+ * \brief Writes columns to an Arrow IPC file (a.k.a. Feather v2): the
+ *        schema, the record batches, one dictionary batch per dictionary-
+ *        encoded column, and the footer that readers use to find them.
+ *        Rows can be written a chunk at a time, and the dictionaries are
+ *        written last, once they are complete (the file format allows
+ *        this, since readers find the dictionaries through the footer).
+ *        Buffers are 8-byte aligned so readers can memory-map the file
+ *        and use the columns in place.
+ */
+class ArrowFileWriter
+{
+public:
+    /// Write all rows of the columns to a new file.
+    static void write(const std::string& filename, const std::vector<ArrowColumn>& columns, size_t max_rows_per_batch = 65536)
+    {
+        ArrowFileWriter writer(filename, columns);
+        writer.writeRows(columns, max_rows_per_batch);
+        writer.finish(columns);
+    }
+
+    /// Start a new file with the schema of the columns (but none of their
+    /// rows). The file is only kept open while it is written to, so there
+    /// can be a writer for every collectable at once.
+    ArrowFileWriter(const std::string& filename, const std::vector<ArrowColumn>& columns)
+        : filename_(filename)
+        , num_columns_(columns.size())
+        , schema_(makeSchema_(columns))
+    {
+        openFile_(std::ios::trunc);
+        writeBytes_(MAGIC, sizeof(MAGIC));
+        writeBytes_("\0\0", 2);
+        writeMessage_(MessageHeader::SCHEMA, schema_, 0, {});
+        closeFile_();
+    }
+
+    /// Append the rows of the columns (the ones given to the constructor)
+    /// as record batches.
+    ///
+    /// \param max_rows_per_batch Rows per record batch. Readers load (or
+    ///                           map) one batch at a time.
+    void writeRows(const std::vector<ArrowColumn>& columns, size_t max_rows_per_batch = 65536)
+    {
+        if (finished_)
+        {
+            throw DBException("Arrow file ") << filename_ << " is already finished";
+        }
+
+        if (columns.size() != num_columns_)
+        {
+            throw DBException("Arrow file ") << filename_ << " has " << num_columns_ << " columns, not " << columns.size();
+        }
+
+        const size_t num_rows = columns.empty() ? 0 : columns.front().getNumRows();
+        for (const auto& column : columns)
+        {
+            if (column.getNumRows() != num_rows)
+            {
+                throw DBException("Arrow column '") << column.getName() << "' has " << column.getNumRows() << " rows, expected " << num_rows;
+            }
+        }
+
+        if (!max_rows_per_batch)
+        {
+            throw DBException("Arrow record batches need at least one row");
+        }
+
+        if (!num_rows)
+        {
+            return;
+        }
+
+        openFile_(std::ios::app);
+        for (size_t first_row = 0; first_row < num_rows; first_row += max_rows_per_batch)
+        {
+            const size_t batch_num_rows = std::min(max_rows_per_batch, num_rows - first_row);
+            batch_blocks_.push_back(writeRecordBatch_(columns, first_row, batch_num_rows));
+        }
+        closeFile_();
+    }
+
+    /// Write the dictionaries of the columns (every row written so far must
+    /// use them) and the footer.
+    void finish(const std::vector<ArrowColumn>& columns)
+    {
+        if (finished_)
+        {
+            return;
+        }
+
+        openFile_(std::ios::app);
+        std::vector<Block> dictionary_blocks;
+        for (size_t idx = 0; idx < columns.size(); ++idx)
+        {
+            if (columns[idx].getType() == ArrowColumn::Type::STRING_DICTIONARY)
+            {
+                dictionary_blocks.push_back(writeDictionary_(idx, columns[idx].getDictionary()));
+            }
+        }
+
+        // End-of-stream marker, then the footer
+        const uint32_t eos[] = {CONTINUATION, 0};
+        writeBytes_(eos, sizeof(eos));
+
+        auto footer = arrow_detail::FlatObject::table();
+        footer->addScalar<int16_t>(0, METADATA_VERSION_V5);
+        footer->addObject(1, schema_);
+        footer->addObject(2, arrow_detail::FlatObject::inlineVector(dictionary_blocks.data(), dictionary_blocks.size(), sizeof(Block)));
+        footer->addObject(3, arrow_detail::FlatObject::inlineVector(batch_blocks_.data(), batch_blocks_.size(), sizeof(Block)));
+
+        const auto footer_bytes = footer->finish();
+        const int32_t footer_num_bytes = footer_bytes.size();
+        writeBytes_(footer_bytes.data(), footer_bytes.size());
+        writeBytes_(&footer_num_bytes, sizeof(footer_num_bytes));
+        writeBytes_(MAGIC, sizeof(MAGIC));
+        closeFile_();
+        finished_ = true;
+    }
+
+private:
+    static constexpr char MAGIC[6] = {'A', 'R', 'R', 'O', 'W', '1'};
+    static constexpr uint32_t CONTINUATION = 0xFFFFFFFF;
+    static constexpr int16_t METADATA_VERSION_V5 = 4;
+
+    /// MessageHeader union (Message.fbs)
+    enum MessageHeader : uint8_t
+    {
+        SCHEMA = 1,
+        DICTIONARY_BATCH = 2,
+        RECORD_BATCH = 3
+    };
+
+    /// Type union (Schema.fbs)
+    enum TypeId : uint8_t
+    {
+        TYPE_INT = 2,
+        TYPE_FLOATING_POINT = 3,
+        TYPE_UTF8 = 5,
+        TYPE_BOOL = 6,
+        TYPE_FIXED_SIZE_BINARY = 15
+    };
+
+    /// Block struct (File.fbs)
+    struct Block
+    {
+        int64_t offset;
+        int32_t metadata_num_bytes;
+        int32_t padding;
+        int64_t body_num_bytes;
+    };
+
+    /// FieldNode and Buffer structs (Message.fbs, Schema.fbs)
+    struct FieldNode
+    {
+        int64_t length;
+        int64_t null_count;
+    };
+
+    struct Buffer
+    {
+        int64_t offset;
+        int64_t length;
+    };
+
+    /// Record batch body under construction.
+    struct Body
+    {
+        std::vector<FieldNode> nodes;
+        std::vector<Buffer> buffers;
+        std::vector<char> bytes;
+
+        void addBuffer(const void* data, size_t num_bytes)
+        {
+            buffers.push_back({(int64_t)bytes.size(), (int64_t)num_bytes});
+            bytes.insert(bytes.end(), (const char*)data, (const char*)data + num_bytes);
+            bytes.resize((bytes.size() + 7) / 8 * 8, 0);
+        }
+
+        /// Columns without nulls leave their validity bitmaps empty.
+        void addValidity()
+        {
+            buffers.push_back({(int64_t)bytes.size(), 0});
+        }
+    };
+
+    void openFile_(std::ios::openmode mode)
+    {
+        fout_.open(filename_, std::ios::binary | std::ios::out | mode);
+        if (!fout_)
+        {
+            throw DBException("Could not open ") << filename_ << " for writing";
+        }
+    }
+
+    void closeFile_()
+    {
+        fout_.close();
+        if (!fout_)
+        {
+            throw DBException("Could not write ") << filename_;
+        }
+    }
+
+    static arrow_detail::FlatObjectPtr makeIntType_(size_t bit_width, bool is_signed)
+    {
+        auto type = arrow_detail::FlatObject::table();
+        type->addScalar<int32_t>(0, bit_width);
+        type->addScalar<uint8_t>(1, is_signed);
+        return type;
+    }
+
+    static arrow_detail::FlatObjectPtr makeSchema_(const std::vector<ArrowColumn>& columns)
+    {
+        std::vector<arrow_detail::FlatObjectPtr> fields;
+        for (size_t idx = 0; idx < columns.size(); ++idx)
+        {
+            const auto& column = columns[idx];
+            auto field = arrow_detail::FlatObject::table();
+            field->addObject(0, arrow_detail::FlatObject::string(column.getName()));
+            field->addScalar<uint8_t>(1, true);
+
+            auto type = arrow_detail::FlatObject::table();
+            switch (column.getType())
+            {
+                case ArrowColumn::Type::INT:
+                    field->addScalar<uint8_t>(2, TYPE_INT);
+                    type = makeIntType_(column.getBitWidth(), column.isSigned());
+                    break;
+
+                case ArrowColumn::Type::FLOAT:
+                    // Precision: HALF, SINGLE, DOUBLE
+                    field->addScalar<uint8_t>(2, TYPE_FLOATING_POINT);
+                    type->addScalar<int16_t>(0, column.getBitWidth() == 64 ? 2 : 1);
+                    break;
+
+                case ArrowColumn::Type::BOOL:
+                    field->addScalar<uint8_t>(2, TYPE_BOOL);
+                    break;
+
+                case ArrowColumn::Type::STRING_DICTIONARY:
+                {
+                    // The field's type is the dictionary's value type
+                    field->addScalar<uint8_t>(2, TYPE_UTF8);
+
+                    auto encoding = arrow_detail::FlatObject::table();
+                    encoding->addScalar<int64_t>(0, idx);
+                    encoding->addObject(1, makeIntType_(32, true));
+                    encoding->addScalar<uint8_t>(2, false);
+                    field->addObject(4, encoding);
+                    break;
+                }
+
+                case ArrowColumn::Type::FIXED_SIZE_BINARY:
+                    field->addScalar<uint8_t>(2, TYPE_FIXED_SIZE_BINARY);
+                    type->addScalar<int32_t>(0, column.getByteWidth());
+                    break;
+            }
+
+            field->addObject(3, type);
+            field->addObject(5, arrow_detail::FlatObject::tableVector({}));
+            fields.push_back(field);
+        }
+
+        auto schema = arrow_detail::FlatObject::table();
+        schema->addObject(1, arrow_detail::FlatObject::tableVector(fields));
+        return schema;
+    }
+
+    static arrow_detail::FlatObjectPtr makeRecordBatch_(size_t num_rows, const Body& body)
+    {
+        auto batch = arrow_detail::FlatObject::table();
+        batch->addScalar<int64_t>(0, num_rows);
+        batch->addObject(1, arrow_detail::FlatObject::inlineVector(body.nodes.data(), body.nodes.size(), sizeof(FieldNode)));
+        batch->addObject(2, arrow_detail::FlatObject::inlineVector(body.buffers.data(), body.buffers.size(), sizeof(Buffer)));
+        return batch;
+    }
+
+    Block writeDictionary_(size_t dictionary_id, const std::vector<std::string>& dictionary)
+    {
+        std::vector<int32_t> offsets(1, 0);
+        std::vector<char> chars;
+        for (const auto& str : dictionary)
+        {
+            chars.insert(chars.end(), str.begin(), str.end());
+            offsets.push_back(chars.size());
+        }
+
+        Body body;
+        body.nodes.push_back({(int64_t)dictionary.size(), 0});
+        body.addValidity();
+        body.addBuffer(offsets.data(), offsets.size() * sizeof(int32_t));
+        body.addBuffer(chars.data(), chars.size());
+
+        auto header = arrow_detail::FlatObject::table();
+        header->addScalar<int64_t>(0, dictionary_id);
+        header->addObject(1, makeRecordBatch_(dictionary.size(), body));
+        return writeMessage_(DICTIONARY_BATCH, header, body.bytes.size(), body.bytes);
+    }
+
+    Block writeRecordBatch_(const std::vector<ArrowColumn>& columns, size_t first_row, size_t num_rows)
+    {
+        Body body;
+        std::vector<uint8_t> bits;
+        for (const auto& column : columns)
+        {
+            const auto& validity = column.getValidity();
+            const auto null_count = validity.empty() ? 0 : std::count(validity.begin() + first_row, validity.begin() + first_row + num_rows, 0);
+            body.nodes.push_back({(int64_t)num_rows, (int64_t)null_count});
+            if (null_count)
+            {
+                bits.assign((num_rows + 7) / 8, 0);
+                for (size_t row = 0; row < num_rows; ++row)
+                {
+                    bits[row / 8] |= (validity[first_row + row] ? 1 : 0) << (row % 8);
+                }
+                body.addBuffer(bits.data(), bits.size());
+            }
+            else
+            {
+                body.addValidity();
+            }
+
+            const auto values = column.getValues().data() + first_row * column.getByteWidth();
+            if (column.getType() == ArrowColumn::Type::BOOL)
+            {
+                bits.assign((num_rows + 7) / 8, 0);
+                for (size_t row = 0; row < num_rows; ++row)
+                {
+                    bits[row / 8] |= (values[row] ? 1 : 0) << (row % 8);
+                }
+                body.addBuffer(bits.data(), bits.size());
+            }
+            else
+            {
+                body.addBuffer(values, num_rows * column.getByteWidth());
+            }
+        }
+
+        return writeMessage_(RECORD_BATCH, makeRecordBatch_(num_rows, body), body.bytes.size(), body.bytes);
+    }
+
+    /// Encapsulated message: continuation marker, metadata size, the Message
+    /// flatbuffer (padded to 8 bytes), then the body.
+    Block writeMessage_(MessageHeader header_type,
+                        const arrow_detail::FlatObjectPtr& header,
+                        size_t body_num_bytes,
+                        const std::vector<char>& body)
+    {
+        auto message = arrow_detail::FlatObject::table();
+        message->addScalar<int16_t>(0, METADATA_VERSION_V5);
+        message->addScalar<uint8_t>(1, header_type);
+        message->addObject(2, header);
+        message->addScalar<int64_t>(3, body_num_bytes);
+
+        const auto metadata = message->finish();
+        const uint32_t prefix[] = {CONTINUATION, (uint32_t)metadata.size()};
+
+        Block block;
+        block.offset = num_bytes_written_;
+        block.metadata_num_bytes = sizeof(prefix) + metadata.size();
+        block.padding = 0;
+        block.body_num_bytes = body_num_bytes;
+
+        writeBytes_(prefix, sizeof(prefix));
+        writeBytes_(metadata.data(), metadata.size());
+        writeBytes_(body.data(), body.size());
+        return block;
+    }
+
+    void writeBytes_(const void* data, size_t num_bytes)
+    {
+        fout_.write((const char*)data, num_bytes);
+        num_bytes_written_ += num_bytes;
+    }
+
+    const std::string filename_;
+    const size_t num_columns_;
+    const arrow_detail::FlatObjectPtr schema_;
+    std::ofstream fout_;
+    int64_t num_bytes_written_ = 0;
+    std::vector<Block> batch_blocks_;
+    bool finished_ = false;
+};
+
+} // namespace simdb
@@ -0,0 +1,157 @@
+// <ColumnDecode.hpp> -*- C++ -*-
+
+#pragma once
+
+#include "simdb/Exceptions.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stddef.h>
+#include <vector>
+
+#ifdef __AVX2__
+#    include <immintrin.h>
+#endif
+
+namespace simdb
+{
+
+/// One fixed-width field of a fixed-stride row (a StructFields entry, or
+/// the whole value of a scalar), and the packed column it is copied to.
+struct ColumnSlice
+{
+    /// Byte offset of the field in the row.
+    size_t offset = 0;
+
+    /// Field width. The column gets this many bytes per row.
+    size_t num_bytes = 0;
+
+    /// Column buffer with room for num_bytes * num_rows bytes.
+    char* out = nullptr;
+};
+
+namespace detail
+{
+
+/// Fixed-width gather kernels. A compile-time width turns the copy into
+/// a single load/store per row.
+template <size_t Width> inline void gatherColumn(const char* rows, size_t num_rows, size_t stride, char* out)
+{
+    for (size_t row = 0; row < num_rows; ++row)
+    {
+        memcpy(out + row * Width, rows + row * stride, Width);
+    }
+}
+
+#ifdef __AVX2__
+/// 4-byte fields, 8 rows per gather. Returns the number of rows copied;
+/// the caller finishes the rest.
+inline size_t gatherColumn32Avx2(const char* rows, size_t num_rows, size_t stride, char* out)
+{
+    if (stride * 8 > (size_t)std::numeric_limits<int32_t>::max())
+    {
+        return 0;
+    }
+
+    const __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int32_t)stride));
+    size_t row = 0;
+    for (; row + 8 <= num_rows; row += 8)
+    {
+        const __m256i vals = _mm256_i32gather_epi32(reinterpret_cast<const int*>(rows + row * stride), offsets, 1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + row * 4), vals);
+    }
+    return row;
+}
+
+/// 8-byte fields, 4 rows per gather.
+inline size_t gatherColumn64Avx2(const char* rows, size_t num_rows, size_t stride, char* out)
+{
+    const auto s = (int64_t)stride;
+    const __m256i offsets = _mm256_setr_epi64x(0, s, 2 * s, 3 * s);
+    size_t row = 0;
+    for (; row + 4 <= num_rows; row += 4)
+    {
+        const __m256i vals = _mm256_i64gather_epi64(reinterpret_cast<const long long*>(rows + row * stride), offsets, 1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + row * 8), vals);
+    }
+    return row;
+}
+#endif
+
+} // namespace detail
+
+/// Copy the num_bytes-wide field at the given offset of num_rows rows
+/// (stride bytes apart) into a packed column. 4- and 8-byte fields use
+/// AVX2 gathers when SimDB is built with AVX2 enabled (e.g. -mavx2 or
+/// -march=native); everything else uses the fixed-width kernels above.
+inline void gatherColumn(const char* rows, size_t num_rows, size_t stride, size_t offset, size_t num_bytes, char* out)
+{
+    rows += offset;
+    size_t done = 0;
+
+    switch (num_bytes)
+    {
+        case 1:
+            detail::gatherColumn<1>(rows, num_rows, stride, out);
+            return;
+        case 2:
+            detail::gatherColumn<2>(rows, num_rows, stride, out);
+            return;
+        case 4:
+#ifdef __AVX2__
+            done = detail::gatherColumn32Avx2(rows, num_rows, stride, out);
+#endif
+            detail::gatherColumn<4>(rows + done * stride, num_rows - done, stride, out + done * 4);
+            return;
+        case 8:
+#ifdef __AVX2__
+            done = detail::gatherColumn64Avx2(rows, num_rows, stride, out);
+#endif
+            detail::gatherColumn<8>(rows + done * stride, num_rows - done, stride, out + done * 8);
+            return;
+        default:
+            for (size_t row = 0; row < num_rows; ++row)
+            {
+                memcpy(out + row * num_bytes, rows + row * stride, num_bytes);
+            }
+            return;
+    }
+}
+
+/// Transpose num_rows fixed-stride rows (e.g. the FULL payload of a contig
+/// iterable, or the replayed values of a collectable) into one packed
+/// column per slice. The rows are walked in blocks of about 16KB so that
+/// every slice reads the block from L1 instead of streaming the whole
+/// array once per field.
+inline void transposeRows(const char* rows, size_t num_rows, size_t stride, const std::vector<ColumnSlice>& slices)
+{
+    for (const auto& slice : slices)
+    {
+        if (slice.offset + slice.num_bytes > stride)
+        {
+            throw DBException("Column at offset ") << slice.offset << " (" << slice.num_bytes << " bytes) does not fit in a "
+                                                   << stride << "-byte row";
+        }
+    }
+
+    if (!stride)
+    {
+        return;
+    }
+
+    constexpr size_t block_num_bytes = 16 * 1024;
+    const size_t block_num_rows = std::max<size_t>(8, block_num_bytes / stride / 8 * 8);
+
+    for (size_t begin = 0; begin < num_rows; begin += block_num_rows)
+    {
+        const size_t count = std::min(block_num_rows, num_rows - begin);
+        for (const auto& slice : slices)
+        {
+            gatherColumn(rows + begin * stride, count, stride, slice.offset, slice.num_bytes, slice.out + begin * slice.num_bytes);
+        }
+    }
+}
+
+} // namespace simdb
@@ -2,7 +2,11 @@
 
 #pragma once
 
+#include "simdb/Exceptions.hpp"
+
 #include <zlib.h>
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 
 namespace simdb
@@ -15,9 +19,27 @@ enum class CompressionModes
     UNCOMPRESSED
 };
 
-/// Perform zlib compression on the single data vector of stats values.
+/// Preset dictionary for zlib (see deflateSetDictionary). Streams start
+/// with this many bytes already "seen", so short records can refer back
+/// to them instead of spelling everything out.
+struct CompressionDictionary
+{
+    /// ID as stored in the CompressionDictionaries table (0 means "none").
+    int32_t id = 0;
+
+    /// zlib only uses the last 32KB of a dictionary.
+    static constexpr size_t MAX_BYTES = 32768;
+    std::vector<char> bytes;
+};
+
+/// Perform zlib compression on the single data vector of stats values,
+/// optionally with a preset dictionary. Readers must give the same
+/// dictionary to inflateSetDictionary().
 template <typename T>
-inline void compressDataVec(const std::vector<T>& in, std::vector<char>& out, int compression_level = Z_DEFAULT_COMPRESSION)
+inline void compressDataVec(const std::vector<T>& in,
+                            std::vector<char>& out,
+                            int compression_level = Z_DEFAULT_COMPRESSION,
+                            const CompressionDictionary* dictionary = nullptr)
 {
     if (in.empty())
     {
@@ -49,6 +71,10 @@ inline void compressDataVec(const std::vector<T>& in, std::vector<char>& out, in
     defstream.next_out = (Bytef*)(out.data());
 
     deflateInit(&defstream, compression_level);
+    if (dictionary && !dictionary->bytes.empty())
+    {
+        deflateSetDictionary(&defstream, (const Bytef*)(dictionary->bytes.data()), (uInt)(dictionary->bytes.size()));
+    }
     deflate(&defstream, Z_FINISH);
     deflateEnd(&defstream);
 
@@ -56,4 +82,56 @@ inline void compressDataVec(const std::vector<T>& in, std::vector<char>& out, in
     out.resize(num_bytes_after);
 }
 
+/// Undo compressDataVec(). The uncompressed size is not stored with the
+/// stream, so the output grows as needed. The preset dictionary (if the
+/// stream was written with one) must be the same one given to compressDataVec().
+inline void decompressDataVec(const char* in, size_t num_bytes, std::vector<char>& out, const CompressionDictionary* dictionary = nullptr)
+{
+    out.clear();
+    if (!num_bytes)
+    {
+        return;
+    }
+
+    z_stream infstream;
+    infstream.zalloc = Z_NULL;
+    infstream.zfree = Z_NULL;
+    infstream.opaque = Z_NULL;
+    infstream.avail_in = (uInt)(num_bytes);
+    infstream.next_in = (Bytef*)(in);
+
+    if (inflateInit(&infstream) != Z_OK)
+    {
+        throw DBException("Could not initialize zlib inflate");
+    }
+
+    out.resize(std::max<size_t>(num_bytes * 4, 1024));
+    int ret = Z_OK;
+    while (ret != Z_STREAM_END)
+    {
+        if (infstream.total_out == out.size())
+        {
+            out.resize(out.size() * 2);
+        }
+
+        infstream.avail_out = (uInt)(out.size() - infstream.total_out);
+        infstream.next_out = (Bytef*)(out.data() + infstream.total_out);
+        ret = inflate(&infstream, Z_NO_FLUSH);
+
+        if (ret == Z_NEED_DICT && dictionary && !dictionary->bytes.empty())
+        {
+            ret = inflateSetDictionary(&infstream, (const Bytef*)(dictionary->bytes.data()), (uInt)(dictionary->bytes.size()));
+        }
+
+        if (ret != Z_OK && ret != Z_STREAM_END && !(ret == Z_BUF_ERROR && infstream.avail_out == 0))
+        {
+            inflateEnd(&infstream);
+            throw DBException("Could not decompress record (zlib error ") << ret << ")";
+        }
+    }
+
+    out.resize(infstream.total_out);
+    inflateEnd(&infstream);
+}
+
 } // namespace simdb
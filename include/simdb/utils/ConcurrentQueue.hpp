@@ -50,6 +50,27 @@ public:
         return true;
     }
 
+    /// \brief Hand items at the front of the queue to the given function
+    /// for as long as it accepts them. The queue stays locked throughout,
+    /// so the consumed items are guaranteed to be consecutive even when
+    /// other threads are popping from this queue too.
+    ///
+    /// \param consume Called with the front item. Return true after taking
+    ///                the item (it is then popped), or false to stop.
+    ///
+    /// \return Returns the number of items consumed.
+    template <typename Func> size_t consume_while(Func consume)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        size_t num_consumed = 0;
+        while (!queue_.empty() && consume(queue_.front()))
+        {
+            queue_.pop();
+            ++num_consumed;
+        }
+        return num_consumed;
+    }
+
     /// Get the number of items in this queue.
     size_t size() const
     {
@@ -0,0 +1,92 @@
+// <MemoryResource.hpp> -*- C++ -*-
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+namespace simdb
+{
+
+/// Byte buffers for the collection state (black box records, minification
+/// snapshots). They allocate from the CollectionMgr's memory resource.
+using CollectionBytes = std::pmr::vector<char>;
+
+/*!
+ * \class CountingMemoryResource
+ *
+ * \brief Memory resource that forwards to an upstream resource and keeps
+ *        track of how much memory went through it.
+ *
+ *        If no upstream resource is given, allocations come from a pool
+ *        owned by this object. That keeps the many small, long-lived
+ *        collection buffers out of the global heap that the simulator uses.
+ *
+ *        Not thread-safe. The collection state is only touched by the
+ *        thread that calls sweep() and activate().
+ */
+class CountingMemoryResource : public std::pmr::memory_resource
+{
+public:
+    CountingMemoryResource(std::pmr::memory_resource* upstream = nullptr)
+        : owned_upstream_(upstream ? nullptr : std::make_unique<std::pmr::unsynchronized_pool_resource>())
+        , upstream_(upstream ? upstream : owned_upstream_.get())
+    {
+    }
+
+    /// The resource this one forwards to.
+    std::pmr::memory_resource* getUpstream() const
+    {
+        return upstream_;
+    }
+
+    /// Number of allocate() calls so far.
+    uint64_t getNumAllocations() const
+    {
+        return num_allocations_;
+    }
+
+    /// Bytes currently allocated (and not yet deallocated).
+    uint64_t getNumBytesInUse() const
+    {
+        return num_bytes_in_use_;
+    }
+
+    /// Highest getNumBytesInUse() so far.
+    uint64_t getPeakBytesInUse() const
+    {
+        return peak_bytes_in_use_;
+    }
+
+private:
+    void* do_allocate(size_t num_bytes, size_t alignment) override
+    {
+        auto ptr = upstream_->allocate(num_bytes, alignment);
+        ++num_allocations_;
+        num_bytes_in_use_ += num_bytes;
+        peak_bytes_in_use_ = std::max(peak_bytes_in_use_, num_bytes_in_use_);
+        return ptr;
+    }
+
+    void do_deallocate(void* ptr, size_t num_bytes, size_t alignment) override
+    {
+        upstream_->deallocate(ptr, num_bytes, alignment);
+        num_bytes_in_use_ -= num_bytes;
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    std::unique_ptr<std::pmr::memory_resource> owned_upstream_;
+    std::pmr::memory_resource* upstream_;
+    uint64_t num_allocations_ = 0;
+    uint64_t num_bytes_in_use_ = 0;
+    uint64_t peak_bytes_in_use_ = 0;
+};
+
+} // namespace simdb
@@ -2,9 +2,10 @@
 
 #pragma once
 
-#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace simdb
 {
@@ -13,12 +14,12 @@ namespace simdb
 /// not as actual strings, but as ints. This class is used to map strings to ints,
 /// while the SimDB compression/sqlite pipeline will serialize the map to the database
 /// throughout simulation.
+///
+/// The map is shared by every database in the process, so each database keeps
+/// track of the strings it has written itself (see DatabaseThread::flush()).
 class StringMap
 {
 public:
-    using string_map_t = std::shared_ptr<std::unordered_map<std::string, uint32_t>>;
-    using unserialized_string_map_t = std::unordered_map<uint32_t, std::string>;
-
     static StringMap* instance()
     {
         static StringMap map;
@@ -27,12 +28,13 @@ public:
 
     uint32_t getStringId(const std::string& s)
     {
-        auto iter = map_->find(s);
-        if (iter == map_->end())
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto iter = map_.find(s);
+        if (iter == map_.end())
         {
-            uint32_t id = map_->size();
-            map_->insert({s, id});
-            unserialized_map_.insert({id, s});
+            uint32_t id = strings_.size();
+            map_.insert({s, id});
+            strings_.push_back(s);
             return id;
         }
         else
@@ -41,20 +43,26 @@ public:
         }
     }
 
-    const unserialized_string_map_t& getUnserializedMap() const
-    {
-        return unserialized_map_;
-    }
-
-    void clearUnserializedMap()
+    /// Get the strings with IDs first_id, first_id + 1, ... (IDs are handed
+    /// out in order starting from zero).
+    std::vector<std::string> getStrings(uint32_t first_id) const
     {
-        unserialized_map_.clear();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (first_id >= strings_.size())
+        {
+            return {};
+        }
+        return std::vector<std::string>(strings_.begin() + first_id, strings_.end());
     }
 
 private:
     StringMap() = default;
-    string_map_t map_ = std::make_shared<std::unordered_map<std::string, uint32_t>>();
-    unserialized_string_map_t unserialized_map_;
+
+    /// Strings are looked up on the simulation thread and written out on
+    /// the database threads.
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, uint32_t> map_;
+    std::vector<std::string> strings_;
 };
 
 } // namespace simdb
@@ -0,0 +1,338 @@
+// <TaskExecutor.hpp> -*- C++ -*-
+
+#pragma once
+
+#include "simdb/Exceptions.hpp"
+#include "simdb/utils/ThreadPlacement.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace simdb
+{
+
+/*!
+ * \class TaskExecutor
+ *
+ * \brief Process-wide pool of worker threads that run compression and
+ *        database tasks for every DatabaseManager that opts into it.
+ *
+ * Each worker owns a deque of pending tasks. Workers pop from the back
+ * of their own deque and, when that runs dry, steal from the front of
+ * another worker's deque. Idle workers block on a condition variable
+ * instead of polling, so a process running many small simulations no
+ * longer pays for 1+N mostly-sleeping threads per DatabaseManager.
+ *
+ * The executor makes no ordering guarantees. Use a SerialTaskQueue on
+ * top of it for work that must run in submission order.
+ */
+class TaskExecutor
+{
+public:
+    using Task = std::function<void()>;
+
+    /// Set the number of worker threads in the process-wide executor, and
+    /// optionally where they run. Must be called before the first call to
+    /// getInstance(), or with the same size it was already created with.
+    /// Worker names default to "simdb-exec<N>"; a custom name also gets the
+    /// worker index appended.
+    static void configure(size_t num_workers, const ThreadPlacement& placement = ThreadPlacement())
+    {
+        if (num_workers == 0)
+        {
+            throw DBException("TaskExecutor requires at least one worker thread");
+        }
+        validateThreadPlacement(placement);
+
+        std::lock_guard<std::mutex> lock(singletonMutex_());
+        if (singleton_() && singleton_()->getNumWorkers() != num_workers)
+        {
+            throw DBException("TaskExecutor already running with ") << singleton_()->getNumWorkers() << " workers";
+        }
+        requestedNumWorkers_() = num_workers;
+        requestedPlacement_() = placement;
+    }
+
+    /// Access the process-wide executor, creating it on first use.
+    static TaskExecutor* getInstance()
+    {
+        std::lock_guard<std::mutex> lock(singletonMutex_());
+        if (!singleton_())
+        {
+            auto num_workers = requestedNumWorkers_();
+            if (num_workers == 0)
+            {
+                num_workers = std::max(2u, std::thread::hardware_concurrency() / 2);
+            }
+            singleton_().reset(new TaskExecutor(num_workers, requestedPlacement_()));
+        }
+        return singleton_().get();
+    }
+
+    /// Create a standalone executor. Most users want getInstance().
+    explicit TaskExecutor(size_t num_workers, const ThreadPlacement& placement = ThreadPlacement())
+        : placement_(placement)
+    {
+        validateThreadPlacement(placement_);
+        for (size_t idx = 0; idx < num_workers; ++idx)
+        {
+            queues_.emplace_back(new WorkerQueue);
+        }
+
+        for (size_t idx = 0; idx < num_workers; ++idx)
+        {
+            workers_.emplace_back([this, idx]() { workerLoop_(idx); });
+        }
+    }
+
+    /// Drain all pending tasks and join the worker threads.
+    ~TaskExecutor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+
+        for (auto& worker : workers_)
+        {
+            worker.join();
+        }
+    }
+
+    /// Get the number of worker threads.
+    size_t getNumWorkers() const
+    {
+        return workers_.size();
+    }
+
+    /// Schedule a task. Tasks submitted from one of our own workers go to
+    /// the back of that worker's deque (cache-friendly for follow-on work),
+    /// while external submissions are distributed round-robin.
+    void submit(Task task)
+    {
+        auto worker_idx = currentWorkerIdx_(this);
+        if (worker_idx == NOT_A_WORKER)
+        {
+            worker_idx = next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(queues_[worker_idx]->mutex);
+            queues_[worker_idx]->tasks.emplace_back(std::move(task));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++num_pending_;
+        }
+        cv_.notify_one();
+    }
+
+private:
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    static constexpr size_t NOT_A_WORKER = std::numeric_limits<size_t>::max();
+
+    static std::mutex& singletonMutex_()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::unique_ptr<TaskExecutor>& singleton_()
+    {
+        static std::unique_ptr<TaskExecutor> executor;
+        return executor;
+    }
+
+    static size_t& requestedNumWorkers_()
+    {
+        static size_t num_workers = 0;
+        return num_workers;
+    }
+
+    static ThreadPlacement& requestedPlacement_()
+    {
+        static ThreadPlacement placement;
+        return placement;
+    }
+
+    /// Return the calling thread's worker index if it belongs to the given
+    /// executor, or NOT_A_WORKER otherwise. Optionally set the thread's identity.
+    static size_t currentWorkerIdx_(const TaskExecutor* executor, const size_t* set_idx = nullptr)
+    {
+        thread_local const TaskExecutor* owner = nullptr;
+        thread_local size_t idx = NOT_A_WORKER;
+        if (set_idx)
+        {
+            owner = executor;
+            idx = *set_idx;
+        }
+        return owner == executor ? idx : NOT_A_WORKER;
+    }
+
+    /// Pop from the back of our own deque, or steal from the front of another.
+    bool tryGetTask_(size_t worker_idx, Task& task)
+    {
+        {
+            auto& own = *queues_[worker_idx];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty())
+            {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+
+        for (size_t offset = 1; offset < queues_.size(); ++offset)
+        {
+            auto& victim = *queues_[(worker_idx + offset) % queues_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty())
+            {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void workerLoop_(size_t worker_idx)
+    {
+        currentWorkerIdx_(this, &worker_idx);
+        auto placement = placement_;
+        if (!placement.name.empty())
+        {
+            placement.name = getIndexedThreadName(placement.name, worker_idx);
+        }
+        applyThreadPlacement(placement, "simdb-exec" + std::to_string(worker_idx));
+
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this]() { return num_pending_ > 0 || stopping_; });
+                if (num_pending_ == 0 && stopping_)
+                {
+                    return;
+                }
+            }
+
+            Task task;
+            if (tryGetTask_(worker_idx, task))
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    --num_pending_;
+                }
+                task();
+            }
+        }
+    }
+
+    const ThreadPlacement placement_;
+    std::vector<std::unique_ptr<WorkerQueue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> next_queue_{0};
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    size_t num_pending_ = 0;
+    bool stopping_ = false;
+};
+
+/*!
+ * \class SerialTaskQueue
+ *
+ * \brief Runs tasks on a TaskExecutor one at a time, in the order they
+ *        were posted. At most one of our tasks occupies a worker at any
+ *        moment, so a DatabaseManager can share the executor with other
+ *        managers and still see its own work happen in order.
+ */
+class SerialTaskQueue
+{
+public:
+    SerialTaskQueue(TaskExecutor* executor)
+        : executor_(executor)
+    {
+    }
+
+    /// Blocks until all posted tasks have run.
+    ~SerialTaskQueue()
+    {
+        waitUntilIdle();
+    }
+
+    /// Post a task to run after every previously posted task.
+    void post(TaskExecutor::Task task)
+    {
+        bool schedule = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.emplace_back(std::move(task));
+            if (!running_)
+            {
+                running_ = true;
+                schedule = true;
+            }
+        }
+
+        if (schedule)
+        {
+            executor_->submit([this]() { drain_(); });
+        }
+    }
+
+    /// Block the calling thread until there is nothing left to run.
+    void waitUntilIdle()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_cv_.wait(lock, [this]() { return !running_; });
+    }
+
+private:
+    void drain_()
+    {
+        while (true)
+        {
+            TaskExecutor::Task task;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (tasks_.empty())
+                {
+                    running_ = false;
+                    idle_cv_.notify_all();
+                    return;
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+    TaskExecutor* const executor_;
+    std::mutex mutex_;
+    std::condition_variable idle_cv_;
+    std::deque<TaskExecutor::Task> tasks_;
+    bool running_ = false;
+};
+
+} // namespace simdb
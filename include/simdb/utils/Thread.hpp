@@ -1,5 +1,7 @@
 #pragma once
 
+#include "simdb/utils/ThreadPlacement.hpp"
+
 #include <memory>
 #include <thread>
 
@@ -12,8 +14,9 @@ namespace simdb
 class Thread
 {
 public:
-    Thread(const size_t interval_milliseconds)
+    Thread(const size_t interval_milliseconds, const std::string& default_name = "simdb")
         : interval_ms_(interval_milliseconds)
+        , default_name_(default_name)
     {
     }
 
@@ -22,6 +25,14 @@ public:
         stopThreadLoop();
     }
 
+    /// Set the thread name, CPU affinity, and priority. Takes effect
+    /// the next time the thread loop is started.
+    void setPlacement(const ThreadPlacement& placement)
+    {
+        validateThreadPlacement(placement);
+        placement_ = placement;
+    }
+
     void startThreadLoop()
     {
         if (!is_running_)
@@ -30,6 +41,7 @@ public:
             thread_ = std::make_unique<std::thread>(
                 [this]()
                 {
+                    applyThreadPlacement(placement_, default_name_);
                     while (is_running_)
                     {
                         onInterval_();
@@ -52,6 +64,8 @@ private:
     virtual void onInterval_() = 0;
 
     const size_t interval_ms_;
+    const std::string default_name_;
+    ThreadPlacement placement_;
     std::unique_ptr<std::thread> thread_;
     bool is_running_ = false;
 };
@@ -0,0 +1,138 @@
+// <ThreadPlacement.hpp> -*- C++ -*-
+
+#pragma once
+
+#include "simdb/Exceptions.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#    include <pthread.h>
+#    include <sched.h>
+#    include <sys/resource.h>
+#    include <sys/syscall.h>
+#    include <unistd.h>
+#endif
+
+namespace simdb
+{
+
+/// Where and how a SimDB background thread should run. Keep the simulation
+/// core out of the cpu set to stop compression and database work from
+/// interrupting it.
+///
+/// All settings are applied by the thread itself when it starts. Settings
+/// the OS refuses (e.g. realtime priority without CAP_SYS_NICE) are reported
+/// on stderr and otherwise ignored.
+struct ThreadPlacement
+{
+    /// Name shown in top/perf/gdb. Linux truncates names to 15 characters.
+    /// Leave empty to use the SimDB default for the thread.
+    std::string name;
+
+    /// CPU cores this thread may run on. Empty means "anywhere".
+    std::vector<int> cpus;
+
+    /// Nice value for this thread (-20..19). Only applied if set_nice is true.
+    int nice = 0;
+    bool set_nice = false;
+
+    /// If nonzero, run under SCHED_FIFO with this priority (1..99).
+    int realtime_priority = 0;
+};
+
+/// Whether the given CPU index can go in a cpu set.
+inline bool isValidThreadCpu(int cpu)
+{
+#ifdef __linux__
+    return cpu >= 0 && cpu < CPU_SETSIZE;
+#else
+    return cpu >= 0;
+#endif
+}
+
+/// Throw if the placement cannot be applied as given (e.g. CPU indices
+/// outside 0..CPU_SETSIZE-1). Called when a placement is handed to a
+/// thread, so that mistakes surface on the caller's thread.
+inline void validateThreadPlacement(const ThreadPlacement& placement)
+{
+    for (auto cpu : placement.cpus)
+    {
+        if (!isValidThreadCpu(cpu))
+        {
+            throw DBException("Invalid CPU index ") << cpu << " in the placement of thread '" << placement.name << "'";
+        }
+    }
+}
+
+/// Name of the idx'th of several threads that share one name, e.g.
+/// "mysink" -> "mysink2". The name is shortened as needed so that the
+/// index survives Linux's 15-character limit.
+inline std::string getIndexedThreadName(const std::string& name, size_t idx)
+{
+    const auto suffix = std::to_string(idx);
+    return name.substr(0, suffix.size() < 15 ? 15 - suffix.size() : 0) + suffix;
+}
+
+/// Apply the given placement to the calling thread. The default_name is
+/// used when placement.name is empty. Invalid CPU indices are skipped (see
+/// validateThreadPlacement()).
+inline void applyThreadPlacement(const ThreadPlacement& placement, const std::string& default_name = "")
+{
+#ifdef __linux__
+    const auto& name = placement.name.empty() ? default_name : placement.name;
+    if (!name.empty())
+    {
+        pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+    }
+
+    if (!placement.cpus.empty())
+    {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        for (auto cpu : placement.cpus)
+        {
+            if (isValidThreadCpu(cpu))
+            {
+                CPU_SET(cpu, &cpuset);
+            }
+            else
+            {
+                std::cerr << "[simdb] Ignoring invalid CPU index " << cpu << " for thread " << name << std::endl;
+            }
+        }
+
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+        {
+            std::cerr << "[simdb] Unable to set CPU affinity for thread " << name << std::endl;
+        }
+    }
+
+    if (placement.set_nice)
+    {
+        const auto tid = static_cast<id_t>(syscall(SYS_gettid));
+        if (setpriority(PRIO_PROCESS, tid, placement.nice) != 0)
+        {
+            std::cerr << "[simdb] Unable to set nice value " << placement.nice << " for thread " << name << std::endl;
+        }
+    }
+
+    if (placement.realtime_priority > 0)
+    {
+        sched_param param;
+        param.sched_priority = placement.realtime_priority;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+        {
+            std::cerr << "[simdb] Unable to set realtime priority " << placement.realtime_priority << " for thread " << name
+                      << std::endl;
+        }
+    }
+#else
+    (void)placement;
+    (void)default_name;
+#endif
+}
+
+} // namespace simdb
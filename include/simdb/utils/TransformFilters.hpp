@@ -0,0 +1,166 @@
+// <TransformFilters.hpp> -*- C++ -*-
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stddef.h>
+#include <vector>
+
+namespace simdb
+{
+
+/// Reversible transforms applied to the record bytes before compression.
+/// These are stored as a bitmask in CollectionRecords.Filters so readers
+/// know which transforms to invert (in reverse order) after decompression.
+enum RecordFilters : int32_t
+{
+    FILTER_NONE = 0,
+
+    /// Each sweep in a COALESCED record is XOR'd with the sweep before it.
+    /// Applied first, inverted last.
+    FILTER_XOR_DELTA = 1 << 0,
+
+    /// Bytes are regrouped by their position within fixed-size elements
+    /// (see byteShuffle). The element size is CollectionRecords.ShuffleStride.
+    FILTER_BYTE_SHUFFLE = 1 << 1
+};
+
+/// Which filters to run before compression. Given to enableCollection()
+/// via CollectionConfig.
+struct TransformFilters
+{
+    /// Regroup the bytes of each record so that byte 0 of every element comes
+    /// first, then byte 1, etc. The high bytes of small integers are mostly
+    /// zeros, and grouping them together gives zlib long runs to work with.
+    bool byte_shuffle = false;
+
+    /// Element size in bytes for the shuffle. Most sweep data is made of
+    /// 4-byte values (int32/float fields, bools, string IDs).
+    size_t shuffle_stride = 4;
+
+    /// XOR each sweep with the previous sweep of the same clock, so that
+    /// unchanged bytes become zeros. Only applies to COALESCED records (the
+    /// previous sweep is always in the same record, so records can still be
+    /// decoded on their own).
+    bool xor_delta = false;
+};
+
+namespace detail
+{
+
+/// Fixed-stride shuffle kernels. A compile-time stride lets the compiler
+/// unroll and vectorize the gather.
+template <size_t Stride> inline void byteShuffle(const char* in, size_t num_elems, char* out)
+{
+    for (size_t elem = 0; elem < num_elems; ++elem)
+    {
+        for (size_t byte = 0; byte < Stride; ++byte)
+        {
+            out[byte * num_elems + elem] = in[elem * Stride + byte];
+        }
+    }
+}
+
+template <size_t Stride> inline void byteUnshuffle(const char* in, size_t num_elems, char* out)
+{
+    for (size_t elem = 0; elem < num_elems; ++elem)
+    {
+        for (size_t byte = 0; byte < Stride; ++byte)
+        {
+            out[elem * Stride + byte] = in[byte * num_elems + elem];
+        }
+    }
+}
+
+} // namespace detail
+
+/// Shuffle the bytes of the input (as in Blosc): byte 0 of every element,
+/// then byte 1 of every element, and so on. Trailing bytes that do not fill
+/// a whole element are copied to the end unchanged.
+inline void byteShuffle(const std::vector<char>& in, std::vector<char>& out, size_t stride)
+{
+    out.resize(in.size());
+    const size_t num_elems = stride ? in.size() / stride : 0;
+
+    switch (stride)
+    {
+        case 2:
+            detail::byteShuffle<2>(in.data(), num_elems, out.data());
+            break;
+        case 4:
+            detail::byteShuffle<4>(in.data(), num_elems, out.data());
+            break;
+        case 8:
+            detail::byteShuffle<8>(in.data(), num_elems, out.data());
+            break;
+        default:
+            for (size_t byte = 0; byte < stride; ++byte)
+            {
+                for (size_t elem = 0; elem < num_elems; ++elem)
+                {
+                    out[byte * num_elems + elem] = in[elem * stride + byte];
+                }
+            }
+            break;
+    }
+
+    std::copy(in.begin() + num_elems * stride, in.end(), out.begin() + num_elems * stride);
+}
+
+/// Invert byteShuffle().
+inline void byteUnshuffle(const std::vector<char>& in, std::vector<char>& out, size_t stride)
+{
+    out.resize(in.size());
+    const size_t num_elems = stride ? in.size() / stride : 0;
+
+    switch (stride)
+    {
+        case 2:
+            detail::byteUnshuffle<2>(in.data(), num_elems, out.data());
+            break;
+        case 4:
+            detail::byteUnshuffle<4>(in.data(), num_elems, out.data());
+            break;
+        case 8:
+            detail::byteUnshuffle<8>(in.data(), num_elems, out.data());
+            break;
+        default:
+            for (size_t byte = 0; byte < stride; ++byte)
+            {
+                for (size_t elem = 0; elem < num_elems; ++elem)
+                {
+                    out[elem * stride + byte] = in[byte * num_elems + elem];
+                }
+            }
+            break;
+    }
+
+    std::copy(in.begin() + num_elems * stride, in.end(), out.begin() + num_elems * stride);
+}
+
+/// XOR the given bytes in place with the reference bytes. If the two differ
+/// in length, only the common prefix is changed. This is its own inverse.
+inline void xorBytes(char* bytes, size_t num_bytes, const char* ref, size_t ref_num_bytes)
+{
+    const size_t n = std::min(num_bytes, ref_num_bytes);
+    size_t idx = 0;
+
+    // 8 bytes at a time, then the remainder
+    for (; idx + sizeof(uint64_t) <= n; idx += sizeof(uint64_t))
+    {
+        uint64_t lhs, rhs;
+        memcpy(&lhs, bytes + idx, sizeof(lhs));
+        memcpy(&rhs, ref + idx, sizeof(rhs));
+        lhs ^= rhs;
+        memcpy(bytes + idx, &lhs, sizeof(lhs));
+    }
+
+    for (; idx < n; ++idx)
+    {
+        bytes[idx] ^= ref[idx];
+    }
+}
+
+} // namespace simdb
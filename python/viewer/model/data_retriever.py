@@ -13,8 +13,36 @@ class DataRetriever:
         cursor.execute('SELECT Heartbeat FROM CollectionGlobals')
         self._heartbeat = cursor.fetchone()[0]
 
+        # Databases written before coalescing was added have no RecordFormat
+        # column, and every record holds exactly one tick.
+        cursor.execute('PRAGMA table_info(CollectionRecords)')
+        record_columns = [row[1] for row in cursor.fetchall()]
+        self._has_record_format = 'RecordFormat' in record_columns
+        self._has_filters = 'Filters' in record_columns
+        self._has_dictionaries = 'DictionaryID' in record_columns
+
+        self._dictionaries_by_id = {}
+        if self._has_dictionaries:
+            cursor.execute('SELECT DictionaryID,Dictionary FROM CompressionDictionaries')
+            for dictionary_id, dictionary in cursor.fetchall():
+                self._dictionaries_by_id[dictionary_id] = dictionary
+
         cursor.execute('SELECT DISTINCT(Tick) FROM CollectionRecords ORDER BY Tick ASC')
-        self._time_vals = [row[0] for row in cursor.fetchall()]
+        time_vals = set(row[0] for row in cursor.fetchall())
+
+        if self._has_record_format:
+            # Coalesced and transposed records list their ticks in an uncompressed
+            # directory at the front of the blob. It holds at most EndTick-Tick+1 ticks.
+            cursor.execute('SELECT substr(Data, 1, 4 + 12 * (EndTick - Tick + 1)), RecordFormat FROM CollectionRecords '
+                           'WHERE RecordFormat IN ({},{})'.format(RecordFormat.COALESCED, RecordFormat.TRANSPOSED))
+
+            for directory, record_format in cursor.fetchall():
+                if record_format == RecordFormat.COALESCED:
+                    time_vals.update(tick for tick, _ in ParseTickDirectory(directory)[0])
+                else:
+                    time_vals.update(ParseTransposedTicks(directory)[0])
+
+        self._time_vals = sorted(time_vals)
 
         self._displayed_columns_by_struct_name = {}
         self._auto_colorize_column_by_struct_name = {}
@@ -121,6 +149,13 @@ class DataRetriever:
                 capacity = int(match.group(2))
                 struct_num_bytes = struct_num_bytes_by_struct_name[struct_name]
                 self._replayers_by_elem_path[elem_path] = SparseIterableReplayer(struct_num_bytes, capacity)
+            elif dtype.startswith('region_bytes'):
+                pattern = re.compile(r'region_bytes(\d+)_block(\d+)')
+                match = pattern.match(dtype)
+                if match is None:
+                    raise ValueError('Invalid data type: ' + dtype)
+
+                self._replayers_by_elem_path[elem_path] = RegionReplayer(int(match.group(1)), int(match.group(2)))
             else:
                 struct_name = dtype
                 struct_num_bytes = struct_num_bytes_by_struct_name[struct_name]
@@ -245,7 +280,10 @@ class DataRetriever:
         return {id:0 for id in self.simhier.GetContainerIDs()}
 
     def Unpack(self, elem_path, time_range=None):
-        cmd = 'SELECT Tick,Data,IsCompressed FROM CollectionRecords '
+        cmd = 'SELECT Tick,Data,IsCompressed,{},{},{} FROM CollectionRecords '.format(
+            'RecordFormat' if self._has_record_format else RecordFormat.SWEEP,
+            'Filters,ShuffleStride' if self._has_filters else '0,0',
+            'DictionaryID' if self._has_dictionaries else '0')
         if time_range is not None:
             cmd += 'WHERE '
             if type(time_range) in (int, float):
@@ -272,7 +310,10 @@ class DataRetriever:
                         start_time = self._time_vals[start_idx]
                         break
 
-                where_clauses.append(' Tick>={} '.format(start_time))
+                if self._has_record_format:
+                    where_clauses.append(' EndTick>={} '.format(start_time))
+                else:
+                    where_clauses.append(' Tick>={} '.format(start_time))
 
             if time_range[1] >= 0:
                 where_clauses.append(' Tick<={} '.format(time_range[1]))
@@ -289,31 +330,13 @@ class DataRetriever:
         for replayer in self._replayers_by_elem_path.values():
             replayer.Reset()
 
+        # Transposed records let us decode only the requested element.
         requested_elem_path = elem_path
-        for tick, data_blob, is_compressed in self.cursor.fetchall():
-            if is_compressed:
-                data_blob = zlib.decompress(data_blob)
-
-            while True:
-                # The first 2 bytes of any blob is a collectable ID,
-                # followed by the raw bytes of that collectable, then
-                # another collectable ID, and so on.
-                cid = struct.unpack('H', data_blob[:2])[0]
-                if self.IsDevDebug():
-                    print ('[simdb verbose] tick {}, cid {}'.format(tick, cid))
-
-                data_blob = data_blob[2:]
-
-                replayer = self._replayers_by_elem_path[self.simhier.GetElemPath(cid)]
-                is_auto_collected = cid in self._auto_collected_cids
-                is_dev_debug = self.IsDevDebug()
-                num_bytes_read = replayer.Replay(tick, data_blob, is_auto_collected, is_dev_debug)
-                if num_bytes_read == 0:
-                    break
-
-                data_blob = data_blob[num_bytes_read:]
-                if len(data_blob) == 0:
-                    break
+        requested_elem_id = self.simhier.GetElemID(elem_path)
+        for record in self.cursor.fetchall():
+            zdict = self._dictionaries_by_id.get(record[-1])
+            for tick, data_blob in SplitRecord(*record[:-1], only_elem_id=requested_elem_id, zdict=zdict):
+                self.__ReplaySweep(tick, data_blob)
 
         time_vals = []
         data_vals = []
@@ -333,9 +356,74 @@ class DataRetriever:
 
         return {'TimeVals': time_vals, 'DataVals': data_vals}
 
+    # Returns the [Tick, EndTick] ranges of the records that may hold a value of
+    # the given field within [min_val, max_val], according to the zone maps the
+    # simulator kept (CollectionMgr::addZoneMap). Records outside of these ranges
+    # can be skipped. Returns None if there is no zone map for this field, in
+    # which case every record has to be searched. Use field_name='' for scalar
+    # collectables.
+    def GetZoneMapTickRanges(self, elem_path, field_name, min_val, max_val):
+        self.cursor.execute('SELECT name FROM sqlite_master WHERE type="table" AND name="ZoneMapFields"')
+        if self.cursor.fetchone() is None:
+            return None
+
+        elem_id = self.simhier.GetElemID(elem_path)
+        self.cursor.execute('SELECT Id FROM ZoneMapFields WHERE CollectableTreeNodeID=? AND FieldName=?', (elem_id, field_name))
+        row = self.cursor.fetchone()
+        if row is None:
+            return None
+
+        self.cursor.execute('SELECT Tick,EndTick FROM CollectionZoneMaps WHERE FieldID=? AND MinVal<=? AND MaxVal>=? '
+                            'ORDER BY Tick ASC', (row[0], max_val, min_val))
+        return self.cursor.fetchall()
+
+    # Returns the run-wide distribution of a sketched field as a dict with
+    # 'num_values', 'distinct_count', 'min', 'max', 'heavy_hitters' [(value, count)]
+    # and 'quantiles' [(quantile, value)], or None if it was not sketched.
+    def GetFieldSketch(self, elem_path, field_name):
+        self.cursor.execute('SELECT name FROM sqlite_master WHERE type="table" AND name="FieldSketches"')
+        if self.cursor.fetchone() is None:
+            return None
+
+        elem_id = self.simhier.GetElemID(elem_path)
+        self.cursor.execute('SELECT Id,NumValues,DistinctCount,MinVal,MaxVal FROM FieldSketches '
+                            'WHERE CollectableTreeNodeID=? AND FieldName=?', (elem_id, field_name))
+        row = self.cursor.fetchone()
+        if row is None:
+            return None
+
+        sketch = {'num_values': row[1], 'distinct_count': row[2], 'min': row[3], 'max': row[4]}
+        self.cursor.execute('SELECT Value,Count FROM FieldHeavyHitters WHERE FieldSketchID=? ORDER BY Count DESC', (row[0],))
+        sketch['heavy_hitters'] = self.cursor.fetchall()
+        self.cursor.execute('SELECT Quantile,Value FROM FieldQuantiles WHERE FieldSketchID=? ORDER BY Quantile ASC', (row[0],))
+        sketch['quantiles'] = self.cursor.fetchall()
+        return sketch
+
     def GetAllTimeVals(self):
         return copy.deepcopy(self._time_vals)
 
+    def __ReplaySweep(self, tick, data_blob):
+        while True:
+            # The first 2 bytes of any blob is a collectable ID,
+            # followed by the raw bytes of that collectable, then
+            # another collectable ID, and so on.
+            cid = struct.unpack('H', data_blob[:2])[0]
+            if self.IsDevDebug():
+                print ('[simdb verbose] tick {}, cid {}'.format(tick, cid))
+
+            data_blob = data_blob[2:]
+
+            replayer = self._replayers_by_elem_path[self.simhier.GetElemPath(cid)]
+            is_auto_collected = cid in self._auto_collected_cids
+            is_dev_debug = self.IsDevDebug()
+            num_bytes_read = replayer.Replay(tick, data_blob, is_auto_collected, is_dev_debug)
+            if num_bytes_read == 0:
+                break
+
+            data_blob = data_blob[num_bytes_read:]
+            if len(data_blob) == 0:
+                break
+
 class PODReplayer:
     NUM_BYTES_MAP = {
         'char': 1,
@@ -789,6 +877,57 @@ class SparseIterableReplayer:
         self.values_by_tick[tick] = copy.deepcopy(self.values)
         return 2 + size*2 + size*self.struct_num_bytes
 
+class RegionReplayer:
+    class Actions(IntEnum):
+        KEYFRAME = 0
+        PATCH = 1
+        CARRY = 2
+
+    def __init__(self, num_bytes, block_size):
+        self.num_bytes = num_bytes
+        self.block_size = block_size
+        self.Reset()
+
+    def Reset(self):
+        self.values = None
+        self.values_by_tick = {}
+
+    def Replay(self, tick, data_blob, is_auto_collected, is_dev_debug):
+        # Actions are at the top of the blob as a uint8_t.
+        action = self.Actions(struct.unpack('B', data_blob[:1])[0])
+
+        if action == self.Actions.KEYFRAME:
+            if is_dev_debug:
+                print ('[simdb verbose] KEYFRAME {} bytes'.format(self.num_bytes))
+            self.values = bytearray(data_blob[1:1+self.num_bytes])
+            self.values_by_tick[tick] = bytes(self.values)
+            return 1 + self.num_bytes
+
+        if action == self.Actions.PATCH:
+            # uint32_t number of blocks, then each block's uint32_t index
+            # followed by its bytes (the last block may be shorter).
+            num_blocks = struct.unpack('I', data_blob[1:5])[0]
+            offset = 5
+            for i in range(num_blocks):
+                block_idx = struct.unpack('I', data_blob[offset:offset+4])[0]
+                start = block_idx * self.block_size
+                block_bytes = min(self.block_size, self.num_bytes - start)
+                if self.values is not None:
+                    self.values[start:start+block_bytes] = data_blob[offset+4:offset+4+block_bytes]
+                offset += 4 + block_bytes
+
+            if is_dev_debug:
+                print ('[simdb verbose] PATCH {} blocks, {} bytes'.format(num_blocks, offset - 1))
+            if self.values is not None:
+                self.values_by_tick[tick] = bytes(self.values)
+            return offset
+
+        if is_dev_debug:
+            print ('[simdb verbose] CARRY')
+        if self.values is not None:
+            self.values_by_tick[tick] = bytes(self.values)
+        return 1
+
 class EnumDef:
     def __init__(self, name, int_type):
         self._name = name
@@ -851,3 +990,106 @@ def GetDataTypeStr(format_code):
         return 'double_t'
     else:
         raise ValueError('Invalid format code: ' + format_code)
+
+class RecordFormat(IntEnum):
+    SWEEP = 0
+    COALESCED = 1
+    TRANSPOSED = 2
+
+class RecordFilters(IntEnum):
+    XOR_DELTA = 1
+    BYTE_SHUFFLE = 2
+
+def ByteUnshuffle(data_blob, stride):
+    """Invert the byte shuffle filter (see TransformFilters.hpp)."""
+    num_elems = len(data_blob) // stride
+    out = bytearray(data_blob)
+    for byte in range(stride):
+        out[byte : num_elems*stride : stride] = data_blob[byte*num_elems : (byte+1)*num_elems]
+    return bytes(out)
+
+def XorBytes(data_blob, ref_blob):
+    """XOR the common prefix of the two blobs. This is its own inverse."""
+    n = min(len(data_blob), len(ref_blob))
+    xored = int.from_bytes(data_blob[:n], 'little') ^ int.from_bytes(ref_blob[:n], 'little')
+    return xored.to_bytes(n, 'little') + data_blob[n:]
+
+def ParseTickDirectory(data_blob):
+    """Parse the tick directory at the front of a COALESCED record.
+    Returns the list of (tick, num_bytes) and the number of directory bytes."""
+    num_ticks = struct.unpack('I', data_blob[:4])[0]
+    directory = [struct.unpack('QI', data_blob[4 + 12*i : 16 + 12*i]) for i in range(num_ticks)]
+    return directory, 4 + 12*num_ticks
+
+def ParseTransposedTicks(data_blob):
+    """Parse the tick list at the front of a TRANSPOSED record.
+    Returns the ticks and the number of bytes they took up."""
+    num_ticks = struct.unpack('I', data_blob[:4])[0]
+    ticks = list(struct.unpack('{}Q'.format(num_ticks), data_blob[4 : 4 + 8*num_ticks]))
+    return ticks, 4 + 8*num_ticks
+
+def DecodeBlock(data_blob, is_compressed, filters, shuffle_stride, zdict=None):
+    """Undo the compression and byte shuffle of one record/block. The zdict
+    is the record's preset dictionary (see CompressionDictionaries)."""
+    if is_compressed and zdict:
+        decompressor = zlib.decompressobj(zdict=zdict)
+        data_blob = decompressor.decompress(data_blob) + decompressor.flush()
+    elif is_compressed:
+        data_blob = zlib.decompress(data_blob)
+
+    if filters & RecordFilters.BYTE_SHUFFLE:
+        data_blob = ByteUnshuffle(data_blob, shuffle_stride)
+
+    return data_blob
+
+def SplitTransposedRecord(data_blob, is_compressed, filters, shuffle_stride, only_elem_id=None, zdict=None):
+    """Rebuild the (tick, sweep bytes) pairs of a TRANSPOSED record. If only_elem_id
+    is given, the other elements' blocks are skipped without being decompressed."""
+    ticks, offset = ParseTransposedTicks(data_blob)
+    num_ticks = len(ticks)
+    num_elems = struct.unpack('I', data_blob[offset : offset + 4])[0]
+    offset += 4
+
+    elem_directory = [struct.unpack('=HI', data_blob[offset + 6*i : offset + 6*(i+1)]) for i in range(num_elems)]
+    offset += 6 * num_elems
+
+    sweeps = [b''] * num_ticks
+    for elem_id, block_num_bytes in elem_directory:
+        if only_elem_id is None or elem_id == only_elem_id:
+            block = DecodeBlock(data_blob[offset : offset + block_num_bytes], is_compressed, filters, shuffle_stride, zdict)
+            num_bytes_by_tick = struct.unpack('{}I'.format(num_ticks), block[:4*num_ticks])
+            block_offset = 4 * num_ticks
+            for tick_idx, num_bytes in enumerate(num_bytes_by_tick):
+                sweeps[tick_idx] += block[block_offset : block_offset + num_bytes]
+                block_offset += num_bytes
+
+        offset += block_num_bytes
+
+    return [(tick, sweep) for tick, sweep in zip(ticks, sweeps) if sweep]
+
+def SplitRecord(tick, data_blob, is_compressed, record_format, filters=0, shuffle_stride=0, only_elem_id=None, zdict=None):
+    """Split one CollectionRecords row into its (tick, sweep bytes) pairs,
+    undoing the compression and any pre-compression filters."""
+    if record_format == RecordFormat.TRANSPOSED:
+        return SplitTransposedRecord(data_blob, is_compressed, filters, shuffle_stride, only_elem_id, zdict)
+
+    directory = None
+    if record_format == RecordFormat.COALESCED:
+        directory, directory_bytes = ParseTickDirectory(data_blob)
+        data_blob = data_blob[directory_bytes:]
+
+    data_blob = DecodeBlock(data_blob, is_compressed, filters, shuffle_stride, zdict)
+    if directory is None:
+        return [(tick, data_blob)]
+
+    sweeps = []
+    offset = 0
+    for tick, num_bytes in directory:
+        sweep = data_blob[offset : offset + num_bytes]
+        if filters & RecordFilters.XOR_DELTA and sweeps:
+            sweep = XorBytes(sweep, sweeps[-1][1])
+
+        sweeps.append((tick, sweep))
+        offset += num_bytes
+
+    return sweeps
@@ -0,0 +1,19 @@
+// <simdb.cpp> -*- C++ -*-
+
+/// The simdb library: builds the non-template SimDB code once, for projects
+/// that link against it instead of using the headers on their own. The
+/// library target defines SIMDB_COMPILED_LIB (see LibraryMode.hpp).
+
+#include "simdb/sqlite/DatabaseManagerImpl.hpp"
+#include "simdb/sqlite/SQLiteConnectionImpl.hpp"
+
+namespace simdb
+{
+
+#define SIMDB_INSTANTIATE_COLLECTABLE(T)                                                                                                   \
+    template std::shared_ptr<CollectionPoint> CollectionMgr::createCollectable<T>(const std::string&, const std::string&);                \
+    template void CollectionPoint::activate<T>(const T&, bool);
+SIMDB_FOR_EACH_SCALAR_TYPE(SIMDB_INSTANTIATE_COLLECTABLE)
+#undef SIMDB_INSTANTIATE_COLLECTABLE
+
+} // namespace simdb
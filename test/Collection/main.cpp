@@ -1,6 +1,15 @@
 /// Tests for SimDB collections feature.
 
+#include <array>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <list>
 #include <random>
+#include <set>
+#include "simdb/serialize/ArrowExporter.hpp"
+#include "simdb/serialize/RegionReplayer.hpp"
+#include "simdb/serialize/StatsReporter.hpp"
 #include "simdb/sqlite/DatabaseManager.hpp"
 #include "simdb/test/SimDBTester.hpp"
 
@@ -162,8 +171,9 @@ template <> void writeStructFields(const DummyPacket* all, StructFieldSerializer
 class Sim
 {
 public:
-    Sim(simdb::DatabaseManager* db_mgr)
+    Sim(simdb::DatabaseManager* db_mgr, const simdb::CollectionConfig& config = simdb::CollectionConfig())
         : db_mgr_(db_mgr)
+        , config_(config)
     {
     }
 
@@ -241,7 +251,7 @@ public:
 private:
     void configCollectables_()
     {
-        db_mgr_->enableCollection(10);
+        db_mgr_->enableCollection(config_);
         auto collection_mgr = db_mgr_->getCollectionMgr();
         collection_mgr->addClock("root", 10);
 
@@ -277,6 +287,7 @@ private:
     }
 
     simdb::DatabaseManager* db_mgr_;
+    const simdb::CollectionConfig config_;
 
     std::shared_ptr<simdb::CollectionPoint> uint64_collectable_;
     std::shared_ptr<simdb::CollectionPoint> bool_collectable_;
@@ -297,8 +308,970 @@ int main()
     simdb::DatabaseManager db_mgr("test.db");
     Sim sim(&db_mgr);
     sim.runSimulation();
+
+    // The collectables' buffers come from the collection manager's own pool
+    const auto& memory_resource = db_mgr.getCollectionMgr()->getMemoryResource();
+    EXPECT_TRUE(memory_resource.getNumBytesInUse() > 0);
+    EXPECT_TRUE(memory_resource.getPeakBytesInUse() >= memory_resource.getNumBytesInUse());
     db_mgr.closeDatabase();
 
+#ifdef __linux__
+    // Thread placement: names are applied (with the thread index appended
+    // for the sink threads) and bad CPU indices are rejected up front.
+    {
+        simdb::ThreadPlacement placement;
+        placement.name = "simdb-test";
+        std::string applied_name;
+        std::thread(
+            [&]()
+            {
+                simdb::applyThreadPlacement(placement);
+                char buf[16] = {};
+                pthread_getname_np(pthread_self(), buf, sizeof(buf));
+                applied_name = buf;
+            })
+            .join();
+        EXPECT_EQUAL(applied_name, "simdb-test");
+        EXPECT_EQUAL(simdb::getIndexedThreadName("simdb-long-thread", 12), "simdb-long-th12");
+
+        simdb::ThreadPlacement bad_placement;
+        bad_placement.cpus = {0, -1};
+        EXPECT_THROW(simdb::validateThreadPlacement(bad_placement));
+        EXPECT_THROW(simdb::TaskExecutor(1, bad_placement));
+        bad_placement.cpus = {CPU_SETSIZE};
+        EXPECT_THROW(simdb::TaskExecutor::configure(4, bad_placement));
+
+        simdb::CollectionConfig sink_config;
+        sink_config.num_compression_threads = 2;
+        sink_config.sink_thread_placement.name = "simdb-tsink";
+        simdb::DatabaseManager sink_db_mgr("test_thread_names.db");
+        sink_db_mgr.enableCollection(sink_config);
+        auto sink_collection_mgr = sink_db_mgr.getCollectionMgr();
+        sink_collection_mgr->addClock("root", 1);
+        auto sink_collectable = sink_collection_mgr->createCollectable<uint32_t>("top.val", "root");
+        sink_db_mgr.finalizeCollections();
+        sink_collectable->activate(1);
+        sink_collection_mgr->sweep("root", 1);
+
+        // The threads name themselves once they are running
+        auto has_sink_names = []()
+        {
+            std::set<std::string> thread_names;
+            for (const auto& task : std::filesystem::directory_iterator("/proc/self/task"))
+            {
+                std::ifstream fin(task.path() / "comm");
+                std::string name;
+                std::getline(fin, name);
+                thread_names.insert(name);
+            }
+            return thread_names.count("simdb-tsink0") && thread_names.count("simdb-tsink1");
+        };
+        bool sink_names_applied = false;
+        for (int attempt = 0; attempt < 100 && !sink_names_applied; ++attempt)
+        {
+            sink_names_applied = has_sink_names();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        EXPECT_TRUE(sink_names_applied);
+        sink_db_mgr.postSim();
+        sink_db_mgr.closeDatabase();
+    }
+#endif
+
+    // Run the same simulation on the shared TaskExecutor. Compression tasks
+    // can finish in any order, but the records must still be written in
+    // tick order.
+    simdb::TaskExecutor::configure(4);
+
+    simdb::CollectionConfig config;
+    config.use_shared_executor = true;
+    config.dictionary_training_sweeps = 100;
+
+    // Allocate the collection state from a user-supplied arena
+    std::pmr::monotonic_buffer_resource arena;
+    config.memory_resource = &arena;
+
+    simdb::DatabaseManager db_mgr2("test_executor.db");
+    Sim sim2(&db_mgr2, config);
+    sim2.runSimulation();
+
+    auto query = db_mgr2.createQuery("CollectionRecords");
+    int64_t tick;
+    query->select("Tick", tick);
+    query->orderBy("Id", simdb::QueryOrder::ASC);
+    EXPECT_EQUAL(query->count(), 9999);
+
+    int64_t prev_tick = 0;
+    bool ticks_in_order = true;
+    auto result_set = query->getResultSet();
+    while (result_set.getNextRecord())
+    {
+        ticks_in_order &= tick > prev_tick;
+        prev_tick = tick;
+    }
+    EXPECT_TRUE(ticks_in_order);
+
+    // The first 100 sweeps train the compression dictionary. Every record
+    // from the 100th sweep on is compressed with it.
+    auto dict_query = db_mgr2.createQuery("CollectionRecords");
+    dict_query->addConstraintForInt("DictionaryID", simdb::Constraints::EQUAL, 1);
+    EXPECT_EQUAL(dict_query->count(), 9999 - 99);
+    EXPECT_EQUAL(db_mgr2.createQuery("CompressionDictionaries")->count(), 1);
+    EXPECT_EQUAL(db_mgr2.getCollectionMgr()->getMemoryResource().getUpstream(), &arena);
+    EXPECT_TRUE(db_mgr2.getCollectionMgr()->getMemoryResource().getNumAllocations() > 0);
+    db_mgr2.closeDatabase();
+
+    // Coalesce up to 100 ticks' worth of sweeps into each record, with the
+    // XOR-delta and byte shuffle filters. Every tick must still be accounted
+    // for in the records' tick directories.
+    simdb::CollectionConfig coalesce_config;
+    coalesce_config.coalesce_max_ticks = 100;
+    coalesce_config.filters.byte_shuffle = true;
+    coalesce_config.filters.xor_delta = true;
+
+    simdb::DatabaseManager db_mgr3("test_coalesced.db");
+    Sim sim3(&db_mgr3, coalesce_config);
+    sim3.runSimulation();
+
+    auto coalesced_query = db_mgr3.createQuery("CollectionRecords");
+    int64_t end_tick;
+    int32_t format;
+    int32_t filters;
+    int32_t shuffle_stride;
+    std::vector<char> data;
+    coalesced_query->select("Tick", tick);
+    coalesced_query->select("EndTick", end_tick);
+    coalesced_query->select("RecordFormat", format);
+    coalesced_query->select("Filters", filters);
+    coalesced_query->select("ShuffleStride", shuffle_stride);
+    coalesced_query->select("Data", data);
+    EXPECT_TRUE(coalesced_query->count() < 9999);
+
+    size_t num_ticks_recorded = 0;
+    bool valid_tick_ranges = true;
+    bool valid_filters = true;
+    bool valid_sweeps = true;
+    auto coalesced_results = coalesced_query->getResultSet();
+    while (coalesced_results.getNextRecord())
+    {
+        valid_tick_ranges &= end_tick >= tick && end_tick - tick < 100;
+        if (format == static_cast<int32_t>(simdb::RecordFormat::COALESCED))
+        {
+            uint32_t num_ticks = 0;
+            memcpy(&num_ticks, data.data(), sizeof(num_ticks));
+            num_ticks_recorded += num_ticks;
+            valid_filters &= filters == (simdb::FILTER_XOR_DELTA | simdb::FILTER_BYTE_SHUFFLE) && shuffle_stride == 4;
+
+            // Invert the filters and make sure every sweep starts with a valid collectable ID
+            std::vector<uint32_t> sweep_sizes(num_ticks);
+            size_t num_bytes = 0;
+            for (uint32_t idx = 0; idx < num_ticks; ++idx)
+            {
+                memcpy(&sweep_sizes[idx], data.data() + sizeof(uint32_t) + idx * 12 + sizeof(uint64_t), sizeof(uint32_t));
+                num_bytes += sweep_sizes[idx];
+            }
+
+            const size_t directory_bytes = sizeof(uint32_t) + num_ticks * 12;
+            std::vector<char> shuffled(num_bytes), payload;
+            uLongf dest_len = num_bytes;
+            uncompress((Bytef*)shuffled.data(), &dest_len, (const Bytef*)data.data() + directory_bytes, data.size() - directory_bytes);
+            valid_sweeps &= dest_len == num_bytes;
+            simdb::byteUnshuffle(shuffled, payload, shuffle_stride);
+
+            size_t offset = 0, prev_offset = 0;
+            for (uint32_t idx = 0; idx < num_ticks; ++idx)
+            {
+                if (idx > 0)
+                {
+                    simdb::xorBytes(payload.data() + offset, sweep_sizes[idx], payload.data() + prev_offset, sweep_sizes[idx - 1]);
+                }
+
+                uint16_t cid = 0;
+                memcpy(&cid, payload.data() + offset, sizeof(cid));
+                valid_sweeps &= cid > 0 && cid < 100;
+                prev_offset = offset;
+                offset += sweep_sizes[idx];
+            }
+        }
+        else
+        {
+            ++num_ticks_recorded;
+        }
+    }
+    EXPECT_TRUE(valid_tick_ranges);
+    EXPECT_TRUE(valid_filters);
+    EXPECT_TRUE(valid_sweeps);
+    EXPECT_EQUAL(num_ticks_recorded, 9999);
+    db_mgr3.closeDatabase();
+
+    // Same thing with the batches regrouped element-major.
+    simdb::CollectionConfig transposed_config;
+    transposed_config.coalesce_max_ticks = 100;
+    transposed_config.element_major = true;
+    transposed_config.dictionary_source_db = "test_executor.db";
+
+    simdb::DatabaseManager db_mgr4("test_transposed.db");
+    Sim sim4(&db_mgr4, transposed_config);
+    sim4.runSimulation();
+
+    auto transposed_query = db_mgr4.createQuery("CollectionRecords");
+    int32_t dictionary_id;
+    transposed_query->select("RecordFormat", format);
+    transposed_query->select("DictionaryID", dictionary_id);
+    transposed_query->select("Data", data);
+    EXPECT_TRUE(transposed_query->count() < 9999);
+
+    num_ticks_recorded = 0;
+    bool valid_blocks = true;
+    auto transposed_results = transposed_query->getResultSet();
+    while (transposed_results.getNextRecord())
+    {
+        if (format != static_cast<int32_t>(simdb::RecordFormat::TRANSPOSED))
+        {
+            ++num_ticks_recorded;
+            continue;
+        }
+
+        uint32_t num_ticks = 0, num_elems = 0;
+        memcpy(&num_ticks, data.data(), sizeof(num_ticks));
+        num_ticks_recorded += num_ticks;
+
+        // The element blocks must account for the rest of the blob exactly
+        size_t offset = sizeof(uint32_t) + num_ticks * sizeof(uint64_t);
+        memcpy(&num_elems, data.data() + offset, sizeof(num_elems));
+        offset += sizeof(uint32_t);
+
+        size_t num_block_bytes = 0;
+        for (uint32_t idx = 0; idx < num_elems; ++idx)
+        {
+            uint32_t block_num_bytes = 0;
+            memcpy(&block_num_bytes, data.data() + offset + sizeof(uint16_t), sizeof(block_num_bytes));
+            num_block_bytes += block_num_bytes;
+            offset += sizeof(uint16_t) + sizeof(uint32_t);
+        }
+        valid_blocks &= num_elems > 0 && offset + num_block_bytes == data.size() && dictionary_id == 1;
+    }
+    EXPECT_TRUE(valid_blocks);
+    EXPECT_EQUAL(num_ticks_recorded, 9999);
+    db_mgr4.closeDatabase();
+
+    // TRANSPOSED records must rebuild the original sweeps byte for byte.
+    // Element 7 first shows up in front of element 9, and element 5 in
+    // front of both, so first-appearance order (9, 7, 5) would rebuild the
+    // later sweeps in the wrong order.
+    {
+        auto make_sweep = [](uint64_t tick, const std::vector<std::pair<uint16_t, size_t>>& elems)
+        {
+            simdb::DatabaseEntry entry;
+            entry.tick = tick;
+            for (const auto& elem : elems)
+            {
+                const auto offset = entry.bytes.size();
+                entry.bytes.resize(offset + sizeof(uint16_t) + elem.second);
+                memcpy(entry.bytes.data() + offset, &elem.first, sizeof(uint16_t));
+                for (size_t idx = 0; idx < elem.second; ++idx)
+                {
+                    entry.bytes[offset + sizeof(uint16_t) + idx] = (char)(tick * 31 + elem.first * 7 + idx);
+                }
+                entry.segment_sizes.push_back(sizeof(uint16_t) + elem.second);
+            }
+            return entry;
+        };
+
+        std::vector<simdb::DatabaseEntry> sweeps;
+        sweeps.push_back(make_sweep(10, {{9, 12}}));
+        sweeps.push_back(make_sweep(11, {{7, 5}, {9, 12}}));
+        sweeps.push_back(make_sweep(12, {{5, 33}, {7, 6}, {9, 12}}));
+        sweeps.push_back(make_sweep(13, {{5, 33}, {9, 13}}));
+        sweeps.push_back(make_sweep(14, {{7, 1}}));
+
+        std::vector<simdb::DatabaseEntry> batch = sweeps;
+        simdb::TransformFilters filters;
+        filters.byte_shuffle = true;
+        std::vector<char> scratch;
+        auto framed = simdb::EntryCoalescer::frame(std::move(batch), true, scratch, filters, true);
+        EXPECT_EQUAL(static_cast<int>(framed.format), static_cast<int>(simdb::RecordFormat::TRANSPOSED));
+
+        simdb::EncodedRecord record;
+        record.tick = framed.tick;
+        record.data = framed.bytes;
+        record.compressed = framed.compressed;
+        record.format = framed.format;
+        record.filters = framed.filters;
+        record.shuffle_stride = framed.shuffle_stride;
+
+        auto decoded_sweeps = simdb::RecordDecoder::split(record);
+        EXPECT_EQUAL(decoded_sweeps.size(), sweeps.size());
+        bool sweeps_match = decoded_sweeps.size() == sweeps.size();
+        for (size_t idx = 0; idx < sweeps.size() && sweeps_match; ++idx)
+        {
+            sweeps_match &= decoded_sweeps[idx].tick == sweeps[idx].tick && decoded_sweeps[idx].bytes == sweeps[idx].bytes;
+        }
+        EXPECT_TRUE(sweeps_match);
+    }
+
+    // Write the records to append-only segment files (small ones, so that
+    // several get used), then import them into CollectionRecords.
+    simdb::CollectionConfig segment_config;
+    segment_config.sink_backend = simdb::SinkBackendType::SEGMENT_FILES;
+    segment_config.segment_file_max_bytes = 64 * 1024;
+
+    simdb::DatabaseManager db_mgr5("test_segments.db");
+    Sim sim5(&db_mgr5, segment_config);
+    sim5.runSimulation();
+
+    EXPECT_EQUAL(db_mgr5.createQuery("CollectionRecords")->count(), 0);
+    EXPECT_EQUAL(db_mgr5.createQuery("CollectionSegments")->count(), 9999);
+
+    auto segment_query = db_mgr5.createQuery("CollectionSegments");
+    int32_t max_segment_id;
+    segment_query->select("SegmentID", max_segment_id);
+    segment_query->orderBy("SegmentID", simdb::QueryOrder::DESC);
+    segment_query->setLimit(1);
+    auto segment_results = segment_query->getResultSet();
+    EXPECT_TRUE(segment_results.getNextRecord());
+    EXPECT_TRUE(max_segment_id > 0);
+
+    EXPECT_EQUAL(db_mgr5.importCollectionSegments(), 9999);
+    EXPECT_EQUAL(db_mgr5.createQuery("CollectionSegments")->count(), 0);
+
+    auto imported_query = db_mgr5.createQuery("CollectionRecords");
+    imported_query->select("Tick", tick);
+    imported_query->select("Data", data);
+    imported_query->orderBy("Id", simdb::QueryOrder::ASC);
+    EXPECT_EQUAL(imported_query->count(), 9999);
+
+    // Every record must decompress back into a sweep
+    prev_tick = 0;
+    ticks_in_order = true;
+    bool valid_records = true;
+    std::vector<char> sweep;
+    auto imported_results = imported_query->getResultSet();
+    while (imported_results.getNextRecord())
+    {
+        ticks_in_order &= tick > prev_tick;
+        prev_tick = tick;
+
+        sweep.resize(1 << 20);
+        uLongf sweep_num_bytes = sweep.size();
+        valid_records &= uncompress((Bytef*)sweep.data(), &sweep_num_bytes, (const Bytef*)data.data(), data.size()) == Z_OK;
+    }
+    EXPECT_TRUE(ticks_in_order);
+    EXPECT_TRUE(valid_records);
+
+    std::ifstream removed_segment(simdb::SegmentFileSinkBackend::getSegmentFilePath(db_mgr5.getDatabaseFilePath(), 0));
+    EXPECT_FALSE(removed_segment.good());
+
+    // Round trip: export the records back to segment files, import them while
+    // keeping the files, and export again. The second export must not reuse
+    // (and overwrite) the segment files that were kept.
+    std::vector<std::vector<char>> original_records;
+    auto original_results = imported_query->getResultSet();
+    while (original_results.getNextRecord())
+    {
+        original_records.emplace_back(data);
+    }
+
+    const auto db_filepath5 = db_mgr5.getDatabaseFilePath();
+    EXPECT_EQUAL(db_mgr5.exportCollectionRecords(64 * 1024), 9999);
+    EXPECT_EQUAL(db_mgr5.createQuery("CollectionRecords")->count(), 0);
+    EXPECT_EQUAL(db_mgr5.createQuery("CollectionSegments")->count(), 9999);
+
+    EXPECT_EQUAL(db_mgr5.importCollectionSegments(false), 9999);
+    const auto kept_max_segment_id = simdb::SegmentFileSinkBackend::findMaxSegmentFileId(db_filepath5);
+    EXPECT_TRUE(kept_max_segment_id > 0);
+
+    EXPECT_EQUAL(db_mgr5.exportCollectionRecords(64 * 1024), 9999);
+    int32_t min_segment_id;
+    auto min_segment_query = db_mgr5.createQuery("CollectionSegments");
+    min_segment_query->select("SegmentID", min_segment_id);
+    min_segment_query->orderBy("SegmentID", simdb::QueryOrder::ASC);
+    min_segment_query->setLimit(1);
+    auto min_segment_results = min_segment_query->getResultSet();
+    EXPECT_TRUE(min_segment_results.getNextRecord());
+    EXPECT_TRUE(min_segment_id > kept_max_segment_id);
+
+    EXPECT_EQUAL(db_mgr5.importCollectionSegments(), 9999);
+    size_t record_idx = 0;
+    bool records_match = true;
+    auto round_trip_results = imported_query->getResultSet();
+    while (round_trip_results.getNextRecord())
+    {
+        records_match &= record_idx < original_records.size() && original_records[record_idx++] == data;
+    }
+    EXPECT_TRUE(records_match);
+    EXPECT_EQUAL(record_idx, original_records.size());
+
+    for (int32_t segment_id = 0; segment_id <= kept_max_segment_id; ++segment_id)
+    {
+        std::remove(simdb::SegmentFileSinkBackend::getSegmentFilePath(db_filepath5, segment_id).c_str());
+    }
+    EXPECT_EQUAL(simdb::SegmentFileSinkBackend::findMaxSegmentFileId(db_filepath5), -1);
+    db_mgr5.closeDatabase();
+
+    // Zone maps: a scalar and a struct field whose values follow the tick, so
+    // we know which records must be returned for a given value range.
+    simdb::CollectionConfig zone_map_config;
+    zone_map_config.coalesce_max_ticks = 100;
+
+    simdb::DatabaseManager db_mgr6("test_zone_maps.db", true);
+    db_mgr6.enableCollection(zone_map_config);
+    auto zone_map_mgr = db_mgr6.getCollectionMgr();
+    zone_map_mgr->addClock("root", 10);
+
+    auto tick_collectable = zone_map_mgr->createCollectable<uint32_t>("zone.tick", "root");
+    auto packet_collectable = zone_map_mgr->createCollectable<DummyPacket>("zone.packet", "root");
+    EXPECT_NOTEQUAL(zone_map_mgr->addZoneMap("zone.tick"), 0);
+    EXPECT_NOTEQUAL(zone_map_mgr->addZoneMap("zone.packet", "dbl"), 0);
+    EXPECT_THROW(zone_map_mgr->addZoneMap("zone.packet", "str"));
+    EXPECT_THROW(zone_map_mgr->addZoneMap("zone.missing"));
+    db_mgr6.finalizeCollections();
+
+    DummyPacket zone_packet = *generateRandomDummyPacket();
+    for (uint32_t zone_tick = 1; zone_tick < 10000; ++zone_tick)
+    {
+        zone_packet.dbl = zone_tick * 0.5;
+        tick_collectable->activate(zone_tick);
+        packet_collectable->activate(zone_packet);
+        zone_map_mgr->sweep("root", zone_tick);
+    }
+    db_mgr6.postSim();
+
+    // Every returned record must overlap the ticks we asked for, and
+    // together they must cover all of them.
+    auto covers_ticks = [](const std::vector<std::pair<uint64_t, uint64_t>>& tick_ranges, uint64_t first_tick, uint64_t last_tick)
+    {
+        uint64_t next_tick = first_tick;
+        for (const auto& [tick, end_tick] : tick_ranges)
+        {
+            if (end_tick < first_tick || tick > last_tick || tick > next_tick)
+            {
+                return false;
+            }
+            next_tick = std::max(next_tick, end_tick + 1);
+        }
+        return next_tick > last_tick;
+    };
+
+    auto tick_ranges = db_mgr6.findZoneMapTickRanges("zone.tick", "", 4200, 4250);
+    EXPECT_TRUE(!tick_ranges.empty() && tick_ranges.size() < 10);
+    EXPECT_TRUE(covers_ticks(tick_ranges, 4200, 4250));
+
+    tick_ranges = db_mgr6.findZoneMapTickRanges("zone.packet", "dbl", 100, 101);
+    EXPECT_TRUE(covers_ticks(tick_ranges, 200, 202));
+    EXPECT_TRUE(db_mgr6.findZoneMapTickRanges("zone.tick", "", 20000, 30000).empty());
+    EXPECT_THROW(db_mgr6.findZoneMapTickRanges("zone.packet", "int32", 0, 1));
+    db_mgr6.closeDatabase();
+
+    // Sketches: a uniform scalar (distinct count and quantiles are known),
+    // and a struct field where one "opcode" makes up 70% of the values.
+    simdb::DatabaseManager db_mgr7("test_sketches.db", true);
+    db_mgr7.enableCollection(zone_map_config);
+    auto sketch_mgr = db_mgr7.getCollectionMgr();
+    sketch_mgr->addClock("root", 10);
+
+    auto uniform_collectable = sketch_mgr->createCollectable<uint32_t>("sketch.uniform", "root");
+    auto opcode_collectable = sketch_mgr->createCollectable<DummyPacket>("sketch.packet", "root");
+    sketch_mgr->addSketch("sketch.uniform");
+    sketch_mgr->addSketch("sketch.packet", "int32");
+    EXPECT_THROW(sketch_mgr->addSketch("sketch.packet", "str"));
+    EXPECT_THROW(sketch_mgr->addSketch("sketch.missing"));
+    db_mgr7.finalizeCollections();
+
+    DummyPacket opcode_packet = *generateRandomDummyPacket();
+    for (uint32_t sketch_tick = 1; sketch_tick <= 10000; ++sketch_tick)
+    {
+        opcode_packet.int32 = sketch_tick % 10 < 7 ? 42 : (int32_t)(sketch_tick % 1000);
+        uniform_collectable->activate(sketch_tick);
+        opcode_collectable->activate(opcode_packet);
+        sketch_mgr->sweep("root", sketch_tick);
+    }
+    db_mgr7.postSim();
+
+    auto uniform_sketch = db_mgr7.getFieldSketch("sketch.uniform");
+    EXPECT_EQUAL(uniform_sketch.num_values, 10000);
+    EXPECT_EQUAL(uniform_sketch.min_val, 1);
+    EXPECT_EQUAL(uniform_sketch.max_val, 10000);
+    EXPECT_TRUE(std::abs(uniform_sketch.distinct_count - 10000) < 500);
+    EXPECT_EQUAL(uniform_sketch.quantiles.size(), simdb::FieldSketch::getReportedQuantiles().size());
+    for (const auto& [quantile, value] : uniform_sketch.quantiles)
+    {
+        EXPECT_TRUE(std::abs(value - quantile * 10000) < 200);
+    }
+
+    auto opcode_sketch = db_mgr7.getFieldSketch("sketch.packet", "int32");
+    EXPECT_EQUAL(opcode_sketch.num_values, 10000);
+    EXPECT_TRUE(!opcode_sketch.heavy_hitters.empty() && opcode_sketch.heavy_hitters[0].first == 42);
+    EXPECT_TRUE(!opcode_sketch.heavy_hitters.empty() && opcode_sketch.heavy_hitters[0].second >= 7000);
+    EXPECT_TRUE(sketch_mgr->getSketchSummary("sketch.packet", "int32").heavy_hitters == opcode_sketch.heavy_hitters);
+    EXPECT_THROW(db_mgr7.getFieldSketch("sketch.packet", "dbl"));
+    db_mgr7.closeDatabase();
+
+    // Sketches updated on separate shards (one per sink thread) merge into
+    // the same answer as one sketch of all the values.
+    simdb::FieldSketches sharded_sketches;
+    const auto sharded_idx = sharded_sketches.addSketch(simdb::StructFields::uint32_t);
+    auto shard1 = sharded_sketches.acquireShard();
+    auto shard2 = sharded_sketches.acquireShard();
+    EXPECT_NOTEQUAL(shard1, shard2);
+
+    std::vector<simdb::SketchSample> samples1, samples2;
+    for (uint64_t val = 1; val <= 10000; ++val)
+    {
+        auto& samples = val % 3 ? samples1 : samples2;
+        samples.push_back({sharded_idx, val % 10 < 7 ? 42 : val});
+    }
+    shard1->update(samples1);
+    shard2->update(samples2);
+
+    // Nothing is merged until the shards are released
+    EXPECT_EQUAL(sharded_sketches.getSummary(sharded_idx).num_values, 0);
+    sharded_sketches.releaseShard(shard1);
+    sharded_sketches.releaseShard(shard2);
+
+    const auto sharded_summary = sharded_sketches.getSummary(sharded_idx);
+    EXPECT_EQUAL(sharded_summary.num_values, 10000);
+    EXPECT_EQUAL(sharded_summary.min_val, 7);
+    EXPECT_EQUAL(sharded_summary.max_val, 9999);
+    EXPECT_TRUE(std::abs(sharded_summary.distinct_count - 3001) < 150);
+    EXPECT_TRUE(!sharded_summary.heavy_hitters.empty() && sharded_summary.heavy_hitters[0].first == 42);
+    EXPECT_TRUE(!sharded_summary.heavy_hitters.empty() && sharded_summary.heavy_hitters[0].second >= 7000);
+    for (const auto& [quantile, value] : sharded_summary.quantiles)
+    {
+        // 70% of the values are 42, the rest are spread out up to 10000
+        const double expected = quantile <= 0.7 ? 42 : (quantile - 0.7) / 0.3 * 10000;
+        EXPECT_TRUE(quantile == 0 || quantile == 1 || std::abs(value - expected) < 500);
+    }
+
+    // Released shards are reused, and merged again when released
+    auto shard3 = sharded_sketches.acquireShard();
+    EXPECT_TRUE(shard3 == shard1 || shard3 == shard2);
+    shard3->update({{sharded_idx, 20000}});
+    sharded_sketches.releaseShard(shard3);
+    EXPECT_EQUAL(sharded_sketches.getSummary(sharded_idx).num_values, 10001);
+    EXPECT_EQUAL(sharded_sketches.getSummary(sharded_idx).max_val, 20000);
+
+    // Region collectables: a few bytes of a 4KB region change most ticks.
+    // Replaying the (uncompressed) records must rebuild the region exactly.
+    simdb::CollectionConfig region_config;
+    region_config.num_compression_threads = 0;
+
+    simdb::DatabaseManager db_mgr8("test_regions.db", true);
+    db_mgr8.enableCollection(region_config);
+    auto region_mgr = db_mgr8.getCollectionMgr();
+    region_mgr->addClock("root", 10);
+
+    std::vector<char> region(4096 + 13, 0);
+    auto region_collectable = region_mgr->createRegionCollectable("core.regfile", "root", region.data(), region.size(), 64);
+    EXPECT_THROW(region_mgr->createRegionCollectable("core.empty", "root", region.data(), 0, 64));
+    db_mgr8.finalizeCollections();
+
+    std::map<int64_t, std::vector<char>> regions_by_tick;
+    uint32_t lcg = 12345;
+    for (int64_t region_tick = 1; region_tick <= 500; ++region_tick)
+    {
+        if (region_tick % 7)
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                lcg = lcg * 1664525 + 1013904223;
+                region[lcg % region.size()] = (char)(lcg >> 24);
+            }
+        }
+
+        region_collectable->activate();
+        region_mgr->sweep("root", region_tick);
+        regions_by_tick[region_tick] = region;
+    }
+    db_mgr8.postSim();
+
+    int64_t region_tick = 0;
+    std::vector<char> region_data;
+    auto region_query = db_mgr8.createQuery("CollectionRecords");
+    region_query->select("Tick", region_tick);
+    region_query->select("Data", region_data);
+    region_query->orderBy("Tick", simdb::QueryOrder::ASC);
+
+    simdb::RegionReplayer region_replayer(region.size(), 64);
+    size_t num_region_records = 0, total_region_bytes = 0;
+    bool regions_match = true;
+    auto region_results = region_query->getResultSet();
+    while (region_results.getNextRecord())
+    {
+        const auto num_read = region_replayer.replay(region_data.data() + sizeof(uint16_t), region_data.size() - sizeof(uint16_t));
+        regions_match &= num_read + sizeof(uint16_t) == region_data.size();
+        regions_match &= region_replayer.getBytes() == regions_by_tick[region_tick];
+        total_region_bytes += region_data.size();
+        ++num_region_records;
+    }
+    EXPECT_EQUAL(num_region_records, 500);
+    EXPECT_TRUE(regions_match);
+
+    // Keyframes every 10 sweeps (the heartbeat), small patches otherwise
+    EXPECT_TRUE(total_region_bytes < 500 * region.size() / 5);
+    db_mgr8.closeDatabase();
+
+    simdb::RegionReplayer patch_first_replayer(region.size(), 64);
+    const char patch_record[] = {(char)simdb::RegionCollectionPoint::Action::PATCH, 0, 0, 0, 0};
+    EXPECT_THROW(patch_first_replayer.replay(patch_record, sizeof(patch_record)));
+
+    // A region activated only once is still diffed on every sweep
+    {
+        simdb::DatabaseManager db_mgr("test_regions_activate_once.db", true);
+        db_mgr.enableCollection(region_config);
+        auto once_mgr = db_mgr.getCollectionMgr();
+        once_mgr->addClock("root", 10);
+
+        std::vector<char> once_region(1024, 0);
+        auto once_collectable = once_mgr->createRegionCollectable("core.regfile", "root", once_region.data(), once_region.size(), 64);
+        db_mgr.finalizeCollections();
+
+        once_collectable->activate();
+        std::map<int64_t, std::vector<char>> once_regions_by_tick;
+        for (int64_t once_tick = 1; once_tick <= 50; ++once_tick)
+        {
+            if (once_tick % 5)
+            {
+                once_region[(once_tick * 97) % once_region.size()] = (char)once_tick;
+            }
+            once_mgr->sweep("root", once_tick);
+            once_regions_by_tick[once_tick] = once_region;
+        }
+        db_mgr.postSim();
+
+        int64_t once_tick = 0;
+        std::vector<char> once_data;
+        auto once_query = db_mgr.createQuery("CollectionRecords");
+        once_query->select("Tick", once_tick);
+        once_query->select("Data", once_data);
+        once_query->orderBy("Tick", simdb::QueryOrder::ASC);
+
+        simdb::RegionReplayer once_replayer(once_region.size(), 64);
+        size_t num_once_records = 0;
+        bool once_regions_match = true;
+        auto once_results = once_query->getResultSet();
+        while (once_results.getNextRecord())
+        {
+            once_replayer.replay(once_data.data() + sizeof(uint16_t), once_data.size() - sizeof(uint16_t));
+            once_regions_match &= once_replayer.getBytes() == once_regions_by_tick[once_tick];
+            ++num_once_records;
+        }
+        EXPECT_EQUAL(num_once_records, 50);
+        EXPECT_TRUE(once_regions_match);
+        EXPECT_TRUE(once_replayer.getBytes() == once_region);
+        db_mgr.closeDatabase();
+    }
+
+    // Iterable collectables over other containers (see simdb::iterable_traits)
+    simdb::DatabaseManager db_mgr9("test_iterable_traits.db", true);
+    db_mgr9.enableCollection();
+    auto traits_mgr = db_mgr9.getCollectionMgr();
+    traits_mgr->addClock("root", 10);
+
+    std::array<DummyPacketPtr, 8> packet_array;
+    std::deque<DummyPacket> packet_deque;
+    std::list<DummyPacketPtr> packet_list;
+    auto array_collectable = traits_mgr->createIterableCollector<std::array<DummyPacketPtr, 8>, true>("traits.array", "root", 8);
+    auto deque_collectable = traits_mgr->createIterableCollector<std::deque<DummyPacket>, false>("traits.deque", "root", 16);
+    auto list_collectable = traits_mgr->createIterableCollector<std::list<DummyPacketPtr>, false>("traits.list", "root", 16);
+    db_mgr9.finalizeCollections();
+
+    for (uint64_t traits_tick = 1; traits_tick <= 100; ++traits_tick)
+    {
+        // At most 3 of the array slots are occupied
+        packet_array.fill(nullptr);
+        for (size_t slot = traits_tick % 3; slot < packet_array.size(); slot += 3)
+        {
+            packet_array[slot] = generateRandomDummyPacket();
+        }
+
+        if (packet_deque.size() < 12)
+        {
+            packet_deque.push_back(*generateRandomDummyPacket());
+        }
+
+        // Only the elements before the null one are collected, but the
+        // queue size (like std::list::size()) counts all of them
+        packet_list.assign(5, generateRandomDummyPacket());
+        packet_list.push_back(nullptr);
+        packet_list.push_back(generateRandomDummyPacket());
+
+        array_collectable->activate(packet_array);
+        deque_collectable->activate(packet_deque);
+        list_collectable->activate(packet_list);
+        traits_mgr->sweep("root", traits_tick);
+    }
+    db_mgr9.postSim();
+
+    auto get_queue_max_size = [&](uint16_t elem_id)
+    {
+        int32_t max_size = -1;
+        auto query = db_mgr9.createQuery("QueueMaxSizes");
+        query->addConstraintForInt("CollectableTreeNodeID", simdb::Constraints::EQUAL, elem_id);
+        query->select("MaxSize", max_size);
+        auto results = query->getResultSet();
+        results.getNextRecord();
+        return max_size;
+    };
+
+    EXPECT_EQUAL(get_queue_max_size(array_collectable->getElemId()), 3);
+    EXPECT_EQUAL(get_queue_max_size(deque_collectable->getElemId()), 12);
+    EXPECT_EQUAL(get_queue_max_size(list_collectable->getElemId()), 7);
+    db_mgr9.closeDatabase();
+
+    std::vector<size_t> visited_slots;
+    int c_array[] = {1, 2, 3, 4};
+    simdb::iterable_traits<int[4]>::forEachSlot(c_array,
+                                                3,
+                                                [&](size_t slot_idx, int val)
+                                                {
+                                                    visited_slots.push_back(slot_idx * 10 + val);
+                                                    return val < 2;
+                                                });
+    EXPECT_TRUE(visited_slots == std::vector<size_t>({1, 12}));
+    EXPECT_EQUAL(simdb::iterable_traits<std::list<int>>::size(std::list<int>(6)), 6);
+
+    // Column decode kernels: every field width, an odd stride, and a row
+    // count that leaves a tail after the 8-row gathers.
+    {
+        constexpr size_t stride = 23;
+        constexpr size_t num_rows = 1000 + 5;
+        std::vector<char> rows(stride * num_rows);
+        for (size_t idx = 0; idx < rows.size(); ++idx)
+        {
+            rows[idx] = (char)(idx * 131 + 7);
+        }
+
+        const std::vector<std::pair<size_t, size_t>> fields = {{0, 1}, {1, 2}, {3, 4}, {7, 8}, {15, 3}, {19, 4}};
+        std::vector<std::vector<char>> columns(fields.size());
+        std::vector<simdb::ColumnSlice> slices(fields.size());
+        for (size_t idx = 0; idx < fields.size(); ++idx)
+        {
+            columns[idx].resize(fields[idx].second * num_rows);
+            slices[idx].offset = fields[idx].first;
+            slices[idx].num_bytes = fields[idx].second;
+            slices[idx].out = columns[idx].data();
+        }
+        simdb::transposeRows(rows.data(), num_rows, stride, slices);
+
+        bool transposed = true;
+        for (size_t idx = 0; idx < fields.size(); ++idx)
+        {
+            for (size_t row = 0; row < num_rows; ++row)
+            {
+                const auto width = fields[idx].second;
+                transposed &= memcmp(columns[idx].data() + row * width, rows.data() + row * stride + fields[idx].first, width) == 0;
+            }
+        }
+        EXPECT_TRUE(transposed);
+
+        slices[0].offset = stride - 1;
+        slices[0].num_bytes = 2;
+        EXPECT_THROW(simdb::transposeRows(rows.data(), num_rows, stride, slices));
+    }
+
+    // Arrow export: decode records written with every filter (and then
+    // element-major) and check the rows against what was collected.
+    auto run_arrow_export = [&](const std::string& db_file, const simdb::CollectionConfig& config)
+    {
+        simdb::DatabaseManager db_mgr(db_file, true);
+        db_mgr.enableCollection(config);
+        auto collection_mgr = db_mgr.getCollectionMgr();
+        collection_mgr->addClock("root", 10);
+
+        auto tick_collectable = collection_mgr->createCollectable<uint32_t>("arrow.tick", "root");
+        auto packet_collectable = collection_mgr->createCollectable<DummyPacket>("arrow.packet", "root");
+        auto queue_collectable = collection_mgr->createIterableCollector<std::deque<DummyPacket>, false>("arrow.queue", "root", 16);
+        std::vector<char> arrow_region(256 + 7, 0);
+        auto region_collectable = collection_mgr->createRegionCollectable("arrow.regfile", "root", arrow_region.data(), arrow_region.size());
+        db_mgr.finalizeCollections();
+
+        DummyPacket packet = *generateRandomDummyPacket();
+        std::deque<DummyPacket> queue;
+        size_t num_queue_rows = 0;
+        for (uint32_t tick = 1; tick <= 300; ++tick)
+        {
+            packet.int32 = tick;
+            packet.b = tick % 2;
+            packet.str = "str" + std::to_string(tick % 3);
+            queue.push_back(packet);
+            if (queue.size() > 5)
+            {
+                queue.pop_front();
+            }
+            num_queue_rows += queue.size();
+            arrow_region[(tick * 37) % arrow_region.size()] = (char)tick;
+
+            tick_collectable->activate(tick);
+            packet_collectable->activate(packet);
+            queue_collectable->activate(queue);
+            region_collectable->activate();
+            collection_mgr->sweep("root", tick);
+        }
+        db_mgr.postSim();
+
+        // Decode 50 ticks at a time, so the replays carry over windows
+        simdb::ArrowExporter exporter(&db_mgr);
+        auto decoded = exporter.decodeAll(50);
+        EXPECT_EQUAL(decoded.size(), 4);
+        if (decoded.size() != 4)
+        {
+            return;
+        }
+
+        auto get_int32 = [](const simdb::DecodedCollectable& collectable, size_t row)
+        {
+            int32_t val = 0;
+            memcpy(&val, collectable.getValue(row), sizeof(val));
+            return val;
+        };
+
+        bool values_match = decoded[0].getNumRows() == 300 && decoded[1].getNumRows() == 300;
+        for (size_t row = 0; row < 300 && values_match; ++row)
+        {
+            values_match &= decoded[0].ticks[row] == row + 1 && get_int32(decoded[0], row) == (int32_t)row + 1;
+            values_match &= decoded[1].ticks[row] == row + 1 && get_int32(decoded[1], row) == (int32_t)row + 1;
+        }
+        EXPECT_TRUE(values_match);
+
+        // The queue holds the last 5 packets, oldest first
+        const auto& decoded_queue = decoded[2];
+        EXPECT_TRUE(decoded_queue.is_iterable);
+        EXPECT_EQUAL(decoded_queue.getNumRows(), num_queue_rows);
+        const auto last_row = decoded_queue.getNumRows() - 1;
+        EXPECT_EQUAL(decoded_queue.slots[last_row], 4);
+        EXPECT_EQUAL(get_int32(decoded_queue, last_row - 4), 296);
+        EXPECT_EQUAL(get_int32(decoded_queue, last_row), 300);
+
+        const auto& decoded_region = decoded[3];
+        EXPECT_EQUAL(decoded_region.getNumRows(), 300);
+        EXPECT_TRUE(std::equal(arrow_region.begin(), arrow_region.end(), decoded_region.getValue(decoded_region.getNumRows() - 1)));
+
+        // The packet columns are transposed out of the fixed-stride rows
+        auto packet_columns = exporter.makeColumns(decoded[1]);
+        bool columns_match = false;
+        bool strings_match = false;
+        for (const auto& column : packet_columns)
+        {
+            if (column.getName() == "str" && column.getNumRows() == 300)
+            {
+                // The StringMap is shared by both export databases, but each
+                // one has its own copy of the strings
+                const auto indices = reinterpret_cast<const int32_t*>(column.getValues().data());
+                strings_match = column.getValidity().empty();
+                for (size_t row = 0; row < 300 && strings_match; ++row)
+                {
+                    strings_match &= column.getDictionary()[indices[row]] == "str" + std::to_string((row + 1) % 3);
+                }
+            }
+
+            if (column.getName() == "int32" && column.getNumRows() == 300)
+            {
+                const auto vals = reinterpret_cast<const int32_t*>(column.getValues().data());
+                columns_match = true;
+                for (size_t row = 0; row < 300; ++row)
+                {
+                    columns_match &= vals[row] == (int32_t)row + 1;
+                }
+            }
+            else if (column.getName() == "b")
+            {
+                EXPECT_EQUAL(column.getValues()[0], 1);
+                EXPECT_EQUAL(column.getValues()[1], 0);
+            }
+        }
+        EXPECT_TRUE(columns_match);
+        EXPECT_TRUE(strings_match);
+
+        // Every file is an Arrow IPC file: magic at both ends
+        auto tables = exporter.exportTables(db_file.substr(0, db_file.rfind('.')), 128, 50);
+        EXPECT_EQUAL(tables.size(), 4);
+        for (const auto& table : tables)
+        {
+            std::ifstream fin(table.filename, std::ios::binary);
+            std::string bytes((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+            EXPECT_TRUE(bytes.size() > 16 && bytes.compare(0, 6, "ARROW1") == 0 && bytes.compare(bytes.size() - 6, 6, "ARROW1") == 0);
+        }
+        EXPECT_EQUAL(tables[2].num_rows, num_queue_rows);
+
+        // Strings missing from the StringMap table are nulls
+        db_mgr.removeAllRecordsFromTable("StringMap");
+        simdb::ArrowExporter no_strings_exporter(&db_mgr);
+        for (const auto& column : no_strings_exporter.makeColumns(no_strings_exporter.decodeAll()[1]))
+        {
+            if (column.getName() == "str")
+            {
+                const auto& validity = column.getValidity();
+                EXPECT_EQUAL(validity.size(), 300);
+                EXPECT_EQUAL(std::count(validity.begin(), validity.end(), 0), 300);
+            }
+        }
+        db_mgr.closeDatabase();
+    };
+
+    simdb::CollectionConfig arrow_config;
+    arrow_config.coalesce_max_ticks = 16;
+    arrow_config.filters.xor_delta = true;
+    arrow_config.filters.byte_shuffle = true;
+    arrow_config.dictionary_training_sweeps = 50;
+    run_arrow_export("test_arrow_export.db", arrow_config);
+
+    arrow_config.element_major = true;
+    run_arrow_export("test_arrow_export_transposed.db", arrow_config);
+
+    // Stats reports: sample every 10th tick through a tiny ring buffer (so
+    // the simulator has to wait on the writer) and check every row.
+    auto run_stats_report = [&](const std::string& filename, simdb::StatsReportFormat format)
+    {
+        uint64_t num_insts = 0;
+        double ipc = 0;
+        bool flushed = false;
+        int32_t credits = 0;
+
+        simdb::StatsReporter reporter(filename, format, 10, 4);
+        reporter.addStat("core0.num_insts", &num_insts);
+        reporter.addStat("core0.ipc", &ipc);
+        reporter.addStat("core0.flushed", &flushed);
+        reporter.addStat<int32_t>("lsu,credits", [&]() { return credits; });
+        EXPECT_THROW(reporter.addStat("core0.ipc", &ipc));
+        EXPECT_THROW(reporter.addStat("tick", &ipc));
+
+        for (uint64_t tick = 1; tick <= 1000; ++tick)
+        {
+            num_insts += 3;
+            ipc = tick / 4.0;
+            flushed = tick % 20 == 0;
+            credits = 5 - static_cast<int32_t>(tick);
+            reporter.sample(tick);
+        }
+
+        EXPECT_THROW(reporter.addStat("core0.late", &ipc));
+        reporter.close();
+        EXPECT_EQUAL(reporter.getNumRowsWritten(), 101);
+        EXPECT_THROW(reporter.sample(2000));
+
+        std::ifstream fin(filename);
+        std::vector<std::string> lines;
+        std::string line;
+        while (std::getline(fin, line))
+        {
+            lines.push_back(line);
+        }
+        return lines;
+    };
+
+    auto csv = run_stats_report("test_stats.csv", simdb::StatsReportFormat::CSV);
+    EXPECT_EQUAL(csv.size(), 102);
+    EXPECT_EQUAL(csv[0], "tick,core0.num_insts,core0.ipc,core0.flushed,\"lsu,credits\"");
+    EXPECT_EQUAL(csv[1], "1,3,0.25,0,4");
+    EXPECT_EQUAL(csv[2], "10,30,2.5,0,-5");
+    EXPECT_EQUAL(csv[101], "1000,3000,250,1,-995");
+
+    auto json = run_stats_report("test_stats.json", simdb::StatsReportFormat::JSON);
+    EXPECT_EQUAL(json.size(), 101);
+    EXPECT_EQUAL(json[0], "{\"tick\":1,\"core0.num_insts\":3,\"core0.ipc\":0.25,\"core0.flushed\":false,\"lsu,credits\":4}");
+    EXPECT_EQUAL(json[2], "{\"tick\":20,\"core0.num_insts\":60,\"core0.ipc\":5,\"core0.flushed\":true,\"lsu,credits\":-15}");
+
     // This MUST be put at the end of unit test files' main() function.
     ENSURE_ALL_REACHED(0);
     REPORT_ERROR;
@@ -3,10 +3,23 @@
  */
 
 #include "simdb/sqlite/DatabaseManager.hpp"
+#include "simdb/sqlite/TypedTable.hpp"
 #include "simdb/test/SimDBTester.hpp"
 
+#include <filesystem>
+
 TEST_INIT;
 
+/// Row struct for the TypedTable tests.
+struct TypedCustomer
+{
+    std::string name;
+    int32_t age = 0;
+    uint64_t account = 0;
+    double balance = 0;
+    std::vector<int> history;
+};
+
 static constexpr auto TEST_INT32 = std::numeric_limits<int32_t>::max();
 static constexpr auto TEST_INT64 = std::numeric_limits<int64_t>::max();
 static constexpr auto TEST_DOUBLE = std::numeric_limits<double>::max();
@@ -144,6 +157,36 @@ int main()
     EXPECT_NOTEQUAL(record8.get(), nullptr);
     EXPECT_EQUAL(record8->getId(), record6->getId());
 
+    // Verify the batched property APIs.
+    auto mix_record = db_mgr.INSERT(SQL_TABLE("MixAndMatch"), SQL_COLUMNS("SomeInt32", "SomeString"), SQL_VALUES(5, "bar"));
+    mix_record->setProperties(SQL_COLUMNS("SomeInt32", "SomeString", "SomeBlob"), SQL_VALUES(6, "baz", TEST_VECTOR));
+
+    auto mix_props = mix_record->getProperties<int32_t, std::string, std::vector<int>>(SQL_COLUMNS("SomeInt32", "SomeString", "SomeBlob"));
+    EXPECT_EQUAL(std::get<0>(mix_props), 6);
+    EXPECT_EQUAL(std::get<1>(mix_props), "baz");
+    EXPECT_EQUAL(std::get<2>(mix_props), TEST_VECTOR);
+    EXPECT_THROW(mix_record->getProperties<int32_t>(SQL_COLUMNS("SomeInt32", "SomeString")));
+    EXPECT_THROW(mix_record->setProperties(SQL_COLUMNS("SomeInt32", "SomeString"), SQL_VALUES(7)));
+
+    // Verify findRecords() with a mix of good and bad IDs.
+    auto records = db_mgr.findRecords("DefaultValues", {404, record6->getId(), 405});
+    EXPECT_EQUAL(records.size(), 1);
+    EXPECT_EQUAL(records[0]->getId(), record6->getId());
+    EXPECT_TRUE(db_mgr.findRecords("DefaultValues", {}).empty());
+
+    // Verify the column-reading findRecords() overload.
+    auto mix_record2 = db_mgr.INSERT(SQL_TABLE("MixAndMatch"), SQL_COLUMNS("SomeInt32", "SomeString"), SQL_VALUES(8, "qux"));
+    auto mix_rows = db_mgr.findRecords<int32_t, std::string>(
+        "MixAndMatch", SQL_COLUMNS("SomeInt32", "SomeString"), {mix_record2->getId(), 404, mix_record->getId()});
+    EXPECT_EQUAL(mix_rows.size(), 2);
+    EXPECT_EQUAL(mix_rows[0].first, mix_record2->getId());
+    EXPECT_EQUAL(std::get<0>(mix_rows[0].second), 8);
+    EXPECT_EQUAL(std::get<1>(mix_rows[0].second), "qux");
+    EXPECT_EQUAL(mix_rows[1].first, mix_record->getId());
+    EXPECT_EQUAL(std::get<0>(mix_rows[1].second), 6);
+    EXPECT_EQUAL(std::get<1>(mix_rows[1].second), "baz");
+    EXPECT_THROW(db_mgr.findRecords<int32_t>("MixAndMatch", SQL_COLUMNS("SomeInt32", "SomeString"), {mix_record->getId()}));
+
     // Verify record deletion.
     auto record9 = db_mgr.INSERT(SQL_TABLE("DefaultValues"));
     auto record10 = db_mgr.INSERT(SQL_TABLE("DefaultValues"));
@@ -795,12 +838,518 @@ int main()
         EXPECT_FALSE(result_set.getNextRecord());
     }
 
+    // Verify queries with joined tables, table aliases, and column aliases.
+    simdb::Schema schema4;
+    schema4.addTable("JoinParents").addColumn("Name", dt::string_t);
+    schema4.addTable("JoinChildren").addColumn("ParentID", dt::int32_t).addColumn("Name", dt::string_t);
+    db_mgr.appendSchema(schema4);
+
+    auto alpha = db_mgr.INSERT(SQL_TABLE("JoinParents"), SQL_COLUMNS("Name"), SQL_VALUES("alpha"));
+    auto beta = db_mgr.INSERT(SQL_TABLE("JoinParents"), SQL_COLUMNS("Name"), SQL_VALUES("beta"));
+    db_mgr.INSERT(SQL_TABLE("JoinParents"), SQL_COLUMNS("Name"), SQL_VALUES("gamma"));
+    db_mgr.INSERT(SQL_TABLE("JoinChildren"), SQL_COLUMNS("ParentID", "Name"), SQL_VALUES(alpha->getId(), "alpha1"));
+    db_mgr.INSERT(SQL_TABLE("JoinChildren"), SQL_COLUMNS("ParentID", "Name"), SQL_VALUES(alpha->getId(), "alpha2"));
+    db_mgr.INSERT(SQL_TABLE("JoinChildren"), SQL_COLUMNS("ParentID", "Name"), SQL_VALUES(beta->getId(), "beta1"));
+
+    auto query10 = db_mgr.createQuery("JoinParents");
+    query10->setTableAlias("p");
+    query10->join(simdb::JoinType::INNER, "JoinChildren", "c", {{"p.Id", "c.ParentID"}});
+    EXPECT_EQUAL(query10->count(), 3);
+
+    std::string parent_name, child_name;
+    query10->select("p.Name", parent_name);
+    query10->select("c.Name AS ChildName", child_name);
+    query10->addConstraintForString("p.Name", simdb::Constraints::EQUAL, "alpha");
+    query10->orderBy("ChildName", simdb::QueryOrder::DESC);
+    EXPECT_EQUAL(query10->count(), 2);
+
+    {
+        auto result_set = query10->getResultSet();
+        EXPECT_TRUE(result_set.getNextRecord());
+        EXPECT_EQUAL(parent_name, "alpha");
+        EXPECT_EQUAL(child_name, "alpha2");
+
+        EXPECT_TRUE(result_set.getNextRecord());
+        EXPECT_EQUAL(child_name, "alpha1");
+
+        EXPECT_FALSE(result_set.getNextRecord());
+    }
+
+    query10->resetJoins();
+    query10->resetConstraints();
+    query10->resetOrderBy();
+    query10->join(simdb::JoinType::LEFT, "JoinChildren", "c", {{"p.Id", "c.ParentID"}});
+    query10->addConstraintForString("p.Name", simdb::Constraints::EQUAL, "gamma");
+
+    {
+        auto result_set = query10->getResultSet();
+        EXPECT_TRUE(result_set.getNextRecord());
+        EXPECT_EQUAL(parent_name, "gamma");
+        EXPECT_EQUAL(child_name, "");
+        EXPECT_FALSE(result_set.getNextRecord());
+    }
+
+    EXPECT_THROW(query10->join(simdb::JoinType::INNER, "JoinChildren", "c2", {}));
+
+    // Verify the query plan introspection and index advice.
+    auto full_scan_steps = query10->explain();
+    EXPECT_TRUE(std::any_of(full_scan_steps.begin(), full_scan_steps.end(), [](const auto& step) { return step.isFullScan(); }));
+
+    auto query11 = db_mgr.createQuery("IndexedColumns");
+    query11->select("SomeString", str);
+    query11->addConstraintForInt("SomeInt32", simdb::Constraints::EQUAL, 5);
+    auto index_steps = query11->explain();
+    EXPECT_FALSE(index_steps.empty());
+    EXPECT_TRUE(std::none_of(index_steps.begin(), index_steps.end(), [](const auto& step) { return step.isFullScan(); }));
+
+    db_mgr.enableIndexAdvice();
+    EXPECT_TRUE(db_mgr.getIndexAdvice().empty());
+
+    auto query12 = db_mgr.createQuery("JoinChildren");
+    query12->addConstraintForInt("ParentID", simdb::Constraints::EQUAL, alpha->getId());
+    query12->addConstraintForString("Name", simdb::Constraints::EQUAL, "alpha1");
+    EXPECT_EQUAL(query12->count(), 1);
+
+    auto query13 = db_mgr.createQuery("IndexedColumns");
+    query13->addConstraintForInt("SomeInt32", simdb::Constraints::EQUAL, 5);
+    query13->count();
+
+    auto index_advice = db_mgr.getIndexAdvice();
+    EXPECT_EQUAL(index_advice.size(), 1);
+    if (!index_advice.empty())
+    {
+        EXPECT_EQUAL(index_advice[0], "JoinChildren: createCompoundIndexOn(SQL_COLUMNS(\"ParentID\", \"Name\"))");
+    }
+
+    // Verify that the prefetching result set returns the same records as the
+    // regular one, including when it is destroyed before the end.
+    simdb::Schema schema5;
+    schema5.addTable("PrefetchRows").addColumn("SomeInt32", dt::int32_t).addColumn("SomeDouble", dt::double_t).addColumn("SomeString", dt::string_t);
+    db_mgr.appendSchema(schema5);
+
+    db_mgr.safeTransaction(
+        [&]()
+        {
+            for (int idx = 0; idx < 5000; ++idx)
+            {
+                db_mgr.INSERT(SQL_TABLE("PrefetchRows"),
+                              SQL_COLUMNS("SomeInt32", "SomeDouble", "SomeString"),
+                              SQL_VALUES(idx, idx * 0.5, std::to_string(idx)));
+            }
+            return true;
+        });
+
+    auto query14 = db_mgr.createQuery("PrefetchRows");
+    query14->select("SomeInt32", i32);
+    query14->select("SomeDouble", dbl);
+    query14->select("SomeString", str);
+    query14->orderBy("Id", simdb::QueryOrder::ASC);
+
+    {
+        auto result_set = query14->getPrefetchingResultSet(64, 2);
+        int expected = 0;
+        bool all_match = true;
+        while (result_set->getNextRecord())
+        {
+            all_match &= (i32 == expected && dbl == expected * 0.5 && str == std::to_string(expected));
+            ++expected;
+        }
+        EXPECT_TRUE(all_match);
+        EXPECT_EQUAL(expected, 5000);
+        EXPECT_FALSE(result_set->getNextRecord());
+    }
+
+    {
+        auto result_set = query14->getPrefetchingResultSet(16, 1);
+        EXPECT_TRUE(result_set->getNextRecord());
+        EXPECT_EQUAL(i32, 0);
+    }
+
+    query14->addConstraintForDouble("SomeDouble", simdb::Constraints::EQUAL, 100.5, true);
+    {
+        auto result_set = query14->getPrefetchingResultSet();
+        EXPECT_TRUE(result_set->getNextRecord());
+        EXPECT_EQUAL(i32, 201);
+        EXPECT_FALSE(result_set->getNextRecord());
+    }
+
+    // Verify the query result cache. Identical queries are served from the
+    // cache until something is written to the database.
+    db_mgr.enableQueryCache(2);
+
+    auto run_cached_query = [&](int max_val)
+    {
+        auto query = db_mgr.createQuery("PrefetchRows");
+        query->select("SomeInt32", i32);
+        query->addConstraintForInt("SomeInt32", simdb::Constraints::LESS, max_val);
+
+        int num_rows = 0;
+        int64_t sum = 0;
+        auto result_set = query->getResultSet();
+        while (result_set.getNextRecord())
+        {
+            ++num_rows;
+            sum += i32;
+        }
+        EXPECT_EQUAL(query->count(), num_rows);
+        return sum;
+    };
+
+    EXPECT_EQUAL(run_cached_query(100), 4950);
+    EXPECT_EQUAL(db_mgr.getQueryCacheStats().hits, 0);
+    EXPECT_EQUAL(db_mgr.getQueryCacheStats().misses, 2);
+
+    EXPECT_EQUAL(run_cached_query(100), 4950);
+    EXPECT_EQUAL(db_mgr.getQueryCacheStats().hits, 2);
+    EXPECT_EQUAL(db_mgr.getQueryCacheStats().num_entries, 2);
+
+    db_mgr.INSERT(SQL_TABLE("PrefetchRows"), SQL_COLUMNS("SomeInt32"), SQL_VALUES(50));
+    EXPECT_EQUAL(run_cached_query(100), 5000);
+    EXPECT_EQUAL(db_mgr.getQueryCacheStats().hits, 2);
+    EXPECT_EQUAL(db_mgr.getQueryCacheStats().misses, 4);
+
+    // Only two entries fit in this cache.
+    EXPECT_EQUAL(run_cached_query(10), 45);
+    EXPECT_EQUAL(db_mgr.getQueryCacheStats().evictions, 2);
+    EXPECT_EQUAL(db_mgr.getQueryCacheStats().num_entries, 2);
+
+    // Read-only transactions leave the cache alone...
+    db_mgr.safeTransaction([&]() { return true; });
+    EXPECT_EQUAL(run_cached_query(10), 45);
+    EXPECT_EQUAL(db_mgr.getQueryCacheStats().hits, 4);
+
+    // ...but commits from other connections do not.
+    sqlite3* other_conn = nullptr;
+    EXPECT_EQUAL(sqlite3_open(db_mgr.getDatabaseFilePath().c_str(), &other_conn), SQLITE_OK);
+    EXPECT_EQUAL(sqlite3_exec(other_conn, "INSERT INTO PrefetchRows (SomeInt32) VALUES (5)", nullptr, nullptr, nullptr), SQLITE_OK);
+    sqlite3_close(other_conn);
+    EXPECT_EQUAL(run_cached_query(10), 50);
+    EXPECT_EQUAL(db_mgr.getQueryCacheStats().hits, 4);
+
+    // Verify that compressed_blob_t columns are compressed on the way in and
+    // decompressed on the way out.
+    simdb::Schema schema6;
+    schema6.addTable("CompressedBlobs").addColumn("SomeInt32", dt::int32_t).addColumn("SomeBlob", dt::compressed_blob_t);
+    db_mgr.appendSchema(schema6);
+
+    std::vector<double> compressible(10000);
+    for (size_t idx = 0; idx < compressible.size(); ++idx)
+    {
+        compressible[idx] = (double)(idx % 10);
+    }
+
+    auto compressed_record = db_mgr.INSERT(SQL_TABLE("CompressedBlobs"), SQL_COLUMNS("SomeInt32", "SomeBlob"), SQL_VALUES(1, compressible));
+    EXPECT_EQUAL(compressed_record->getPropertyBlob<double>("SomeBlob"), compressible);
+
+    auto stored_bytes_query = db_mgr.createQuery("CompressedBlobs");
+    int32_t stored_bytes = 0;
+    stored_bytes_query->select("length(SomeBlob)", stored_bytes);
+    {
+        auto result_set = stored_bytes_query->getResultSet();
+        EXPECT_TRUE(result_set.getNextRecord());
+        EXPECT_TRUE(stored_bytes > 0 && stored_bytes < (int32_t)(compressible.size() * sizeof(double) / 10));
+    }
+
+    compressed_record->setPropertyBlob("SomeBlob", TEST_VECTOR);
+    EXPECT_EQUAL(compressed_record->getPropertyBlob<int>("SomeBlob"), TEST_VECTOR);
+
+    compressed_record->setProperties(SQL_COLUMNS("SomeInt32", "SomeBlob"), SQL_VALUES(2, compressible));
+    auto compressed_query = db_mgr.createQuery("CompressedBlobs");
+    std::vector<double> decompressed;
+    compressed_query->select("SomeInt32", i32);
+    compressed_query->select("SomeBlob", decompressed);
+    {
+        auto result_set = compressed_query->getResultSet();
+        EXPECT_TRUE(result_set.getNextRecord());
+        EXPECT_EQUAL(i32, 2);
+        EXPECT_EQUAL(decompressed, compressible);
+    }
+    {
+        decompressed.clear();
+        auto result_set = compressed_query->getPrefetchingResultSet();
+        EXPECT_TRUE(result_set->getNextRecord());
+        EXPECT_EQUAL(decompressed, compressible);
+    }
+
+    // Empty blobs round-trip too.
+    compressed_record->setPropertyBlob("SomeBlob", std::vector<double>());
+    EXPECT_TRUE(compressed_record->getPropertyBlob<double>("SomeBlob").empty());
+
     // Verify that we cannot open a database connection for an invalid file
     EXPECT_THROW(simdb::DatabaseManager db_mgr3(__FILE__));
 
+    // The VFS cannot be changed once the database file is open
+    EXPECT_THROW(db_mgr.enableAsyncWrites());
+
     db_mgr.closeDatabase();
     db_mgr2.closeDatabase();
 
+    // Write a database through the asynchronous VFS (with and without fsync,
+    // and in WAL mode with the checkpointer's second connection) and make
+    // sure it reads back the same with the default VFS.
+    for (const auto& [durable, wal] : std::vector<std::pair<bool, bool>>{{true, false}, {false, false}, {false, true}})
+    {
+        const std::string async_db_file = wal ? "test_async_wal.db" : (durable ? "test_async.db" : "test_async_nosync.db");
+        simdb::DatabaseManager async_db_mgr(async_db_file, true);
+
+        simdb::AsyncVfsOptions vfs_options;
+        vfs_options.durable = durable;
+        async_db_mgr.enableAsyncWrites(vfs_options);
+
+        simdb::Schema async_schema;
+        async_schema.addTable("AsyncBlobs").addColumn("SomeInt32", dt::int32_t).addColumn("SomeBlob", dt::blob_t);
+        EXPECT_TRUE(async_db_mgr.createDatabaseFromSchema(async_schema));
+        if (wal)
+        {
+            async_db_mgr.enableWalCheckpointing();
+        }
+
+        std::vector<int> async_blob(250);
+        for (int txn = 0; txn < 10; ++txn)
+        {
+            async_db_mgr.safeTransaction(
+                [&]()
+                {
+                    for (int idx = 0; idx < 1000; ++idx)
+                    {
+                        std::fill(async_blob.begin(), async_blob.end(), txn * 1000 + idx);
+                        async_db_mgr.INSERT(
+                            SQL_TABLE("AsyncBlobs"), SQL_COLUMNS("SomeInt32", "SomeBlob"), SQL_VALUES(txn * 1000 + idx, async_blob));
+                    }
+                    return true;
+                });
+        }
+
+        // Reads must see the writes that have not reached the file yet
+        EXPECT_EQUAL(async_db_mgr.createQuery("AsyncBlobs")->count(), 10000);
+
+#ifdef __linux__
+        // The write-behind threads must not open file descriptors of their
+        // own: closing one drops the process's locks on the file. Only the
+        // connections' own descriptors may be open.
+        const auto async_db_path = std::filesystem::absolute(async_db_file).string();
+        size_t num_db_fds = 0;
+        for (const auto& fd : std::filesystem::directory_iterator("/proc/self/fd"))
+        {
+            std::error_code ec;
+            const auto target = std::filesystem::read_symlink(fd.path(), ec).string();
+            num_db_fds += !ec && target == async_db_path;
+        }
+        EXPECT_EQUAL(num_db_fds, wal ? 2 : 1);
+#endif
+
+        async_db_mgr.closeDatabase();
+
+        simdb::DatabaseManager reopened_db_mgr(async_db_file);
+        auto async_query = reopened_db_mgr.createQuery("AsyncBlobs");
+        EXPECT_EQUAL(async_query->count(), 10000);
+
+        int32_t some_int32;
+        std::vector<int> some_blob;
+        async_query->select("SomeInt32", some_int32);
+        async_query->select("SomeBlob", some_blob);
+
+        bool async_blobs_match = true;
+        auto async_results = async_query->getResultSet();
+        while (async_results.getNextRecord())
+        {
+            async_blobs_match &= some_blob.size() == 250 && some_blob.front() == some_int32 && some_blob.back() == some_int32;
+        }
+        EXPECT_TRUE(async_blobs_match);
+        reopened_db_mgr.closeDatabase();
+    }
+
+    // Compile-time typed tables: the schema, INSERT, and SELECT all come from
+    // the TypedCustomer members.
+    simdb::TypedTable customers("Customers",
+                                simdb::TypedColumn("Name", &TypedCustomer::name),
+                                simdb::TypedColumn("Age", &TypedCustomer::age),
+                                simdb::TypedColumn("Account", &TypedCustomer::account),
+                                simdb::TypedColumn("Balance", &TypedCustomer::balance),
+                                simdb::TypedColumn("History", &TypedCustomer::history));
+
+    simdb::Schema typed_schema;
+    customers.addToSchema(typed_schema).createIndexOn("Age");
+
+    simdb::DatabaseManager typed_db_mgr("test_typed.db", true);
+    EXPECT_TRUE(typed_db_mgr.createDatabaseFromSchema(typed_schema));
+
+    {
+        std::vector<TypedCustomer> typed_rows;
+        for (int32_t idx = 0; idx < 1000; ++idx)
+        {
+            typed_rows.push_back({"Customer" + std::to_string(idx), idx % 100, TEST_INT64 + (uint64_t)idx, idx * 1.5, {idx, idx + 1}});
+        }
+
+        auto inserter = customers.createInserter(typed_db_mgr);
+        EXPECT_EQUAL(inserter.insert(typed_rows[0]), 1);
+        typed_rows.erase(typed_rows.begin());
+        inserter.insertAll(typed_rows);
+
+        // The generic API sees the same columns
+        auto typed_record = typed_db_mgr.getRecord("Customers", 2);
+        EXPECT_EQUAL(typed_record->getPropertyString("Name"), "Customer1");
+        EXPECT_EQUAL(typed_record->getPropertyInt32("Age"), 1);
+
+        auto reader = customers.createReader(typed_db_mgr);
+        TypedCustomer customer;
+        int32_t num_rows = 0;
+        bool typed_rows_match = true;
+        while (reader.getNextRow(customer))
+        {
+            typed_rows_match &= reader.getCurrentId() == num_rows + 1;
+            typed_rows_match &= customer.name == "Customer" + std::to_string(num_rows);
+            typed_rows_match &= customer.age == num_rows % 100;
+            typed_rows_match &= customer.account == TEST_INT64 + (uint64_t)num_rows;
+            typed_rows_match &= customer.balance == num_rows * 1.5;
+            typed_rows_match &= customer.history == std::vector<int>{num_rows, num_rows + 1};
+            ++num_rows;
+        }
+        EXPECT_EQUAL(num_rows, 1000);
+        EXPECT_TRUE(typed_rows_match);
+
+        auto filtered_reader = customers.createReader(typed_db_mgr, "Age = 42");
+        num_rows = 0;
+        while (filtered_reader.getNextRow(customer))
+        {
+            EXPECT_EQUAL(customer.age, 42);
+            ++num_rows;
+        }
+        EXPECT_EQUAL(num_rows, 10);
+    }
+
+    // Typed tables with a compressed_blob_t column: values are compressed on
+    // the way in and decompressed on the way out, and the generic API agrees.
+    simdb::TypedTable compressed_customers("CompressedCustomers",
+                                           simdb::TypedColumn("Name", &TypedCustomer::name),
+                                           simdb::TypedColumn("History", &TypedCustomer::history, true));
+    EXPECT_THROW(simdb::TypedColumn("Age", &TypedCustomer::age, true));
+
+    simdb::Schema compressed_typed_schema;
+    compressed_customers.addToSchema(compressed_typed_schema);
+    EXPECT_TRUE(typed_db_mgr.appendSchema(compressed_typed_schema));
+
+    {
+        std::vector<TypedCustomer> typed_rows(10);
+        for (int32_t idx = 0; idx < 10; ++idx)
+        {
+            typed_rows[idx].name = "Customer" + std::to_string(idx);
+            typed_rows[idx].history.assign(10000, idx);
+        }
+        compressed_customers.createInserter(typed_db_mgr).insertAll(typed_rows);
+
+        auto reader = compressed_customers.createReader(typed_db_mgr);
+        TypedCustomer customer;
+        int32_t num_rows = 0;
+        bool typed_rows_match = true;
+        while (reader.getNextRow(customer))
+        {
+            typed_rows_match &= customer.history == typed_rows[num_rows++].history;
+        }
+        EXPECT_EQUAL(num_rows, 10);
+        EXPECT_TRUE(typed_rows_match);
+
+        auto compressed_typed_record = typed_db_mgr.getRecord("CompressedCustomers", 3);
+        EXPECT_EQUAL(compressed_typed_record->getPropertyBlob<int>("History"), typed_rows[2].history);
+
+        int32_t max_stored_bytes = 0;
+        auto stored_query = typed_db_mgr.createQuery("CompressedCustomers");
+        stored_query->select("length(History)", max_stored_bytes);
+        stored_query->orderBy("length(History)", simdb::QueryOrder::DESC);
+        stored_query->setLimit(1);
+        auto stored_results = stored_query->getResultSet();
+        EXPECT_TRUE(stored_results.getNextRecord());
+        EXPECT_TRUE(max_stored_bytes < 10000 * (int32_t)sizeof(int) / 10);
+    }
+
+    typed_db_mgr.closeDatabase();
+
+    // WAL journaling with checkpoints run from a background thread.
+    {
+        simdb::Schema wal_schema;
+        wal_schema.addTable("WalBlobs").addColumn("SomeInt32", dt::int32_t).addColumn("SomeBlob", dt::blob_t);
+
+        simdb::DatabaseManager wal_db_mgr("test_wal.db", true);
+        EXPECT_TRUE(wal_db_mgr.createDatabaseFromSchema(wal_schema));
+
+        simdb::WalCheckpointOptions wal_options;
+        wal_options.passive_wal_bytes = 64 * 1024;
+        wal_options.idle_ms = 50;
+        wal_options.poll_interval_ms = 10;
+        wal_db_mgr.enableWalCheckpointing(wal_options);
+
+        std::vector<int> wal_blob(250);
+        for (int txn = 0; txn < 10; ++txn)
+        {
+            wal_db_mgr.safeTransaction(
+                [&]()
+                {
+                    for (int idx = 0; idx < 100; ++idx)
+                    {
+                        std::fill(wal_blob.begin(), wal_blob.end(), txn * 100 + idx);
+                        wal_db_mgr.INSERT(SQL_TABLE("WalBlobs"), SQL_COLUMNS("SomeInt32", "SomeBlob"), SQL_VALUES(txn * 100 + idx, wal_blob));
+                    }
+                    return true;
+                });
+        }
+
+        // Give the idle checkpoint a chance to run
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+        const auto wal_stats = wal_db_mgr.getWalCheckpointStats();
+        EXPECT_TRUE(wal_stats.num_passive > 0);
+        EXPECT_TRUE(wal_stats.num_frames_checkpointed > 0);
+        EXPECT_TRUE(wal_stats.max_wal_bytes > 0);
+        EXPECT_EQUAL(wal_db_mgr.createQuery("WalBlobs")->count(), 1000);
+        wal_db_mgr.closeDatabase();
+
+        simdb::DatabaseManager reopened_db_mgr("test_wal.db");
+        EXPECT_EQUAL(reopened_db_mgr.createQuery("WalBlobs")->count(), 1000);
+        reopened_db_mgr.closeDatabase();
+    }
+
+    // PASSIVE checkpoints follow the committed frames, not the WAL file size.
+    // The file stops growing once checkpoints let writers reuse it, but every
+    // transaction below still commits more than passive_wal_bytes.
+    {
+        simdb::Schema wal_schema;
+        wal_schema.addTable("WalBlobs").addColumn("SomeInt32", dt::int32_t).addColumn("SomeBlob", dt::blob_t);
+
+        simdb::DatabaseManager wal_db_mgr("test_wal_frames.db", true);
+        EXPECT_TRUE(wal_db_mgr.createDatabaseFromSchema(wal_schema));
+
+        simdb::WalCheckpointOptions wal_options;
+        wal_options.passive_wal_bytes = 64 * 1024;
+        wal_options.idle_ms = 1000000;
+        wal_options.poll_interval_ms = 5;
+        wal_db_mgr.enableWalCheckpointing(wal_options);
+
+        std::vector<int> wal_blob(1000);
+        for (int txn = 0; txn < 10; ++txn)
+        {
+            wal_db_mgr.safeTransaction(
+                [&]()
+                {
+                    for (int idx = 0; idx < 100; ++idx)
+                    {
+                        std::fill(wal_blob.begin(), wal_blob.end(), txn * 100 + idx);
+                        wal_db_mgr.INSERT(SQL_TABLE("WalBlobs"), SQL_COLUMNS("SomeInt32", "SomeBlob"), SQL_VALUES(txn * 100 + idx, wal_blob));
+                    }
+                    return true;
+                });
+
+            // Read-only transactions are not activity
+            wal_db_mgr.safeTransaction([&]() { return wal_db_mgr.createQuery("WalBlobs")->count() > 0; });
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+
+        const auto wal_stats = wal_db_mgr.getWalCheckpointStats();
+        EXPECT_TRUE(wal_stats.num_frames_committed * 4096 >= 10 * wal_options.passive_wal_bytes);
+        EXPECT_TRUE(wal_stats.num_passive >= 9);
+        EXPECT_TRUE(wal_stats.max_wal_bytes < 10 * wal_options.passive_wal_bytes);
+        wal_db_mgr.closeDatabase();
+    }
+
     // This MUST be put at the end of unit test files' main() function.
     ENSURE_ALL_REACHED(0);
     REPORT_ERROR;